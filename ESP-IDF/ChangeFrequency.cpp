@@ -2,6 +2,7 @@
 // File ChangeFrequency.cpp
 // Author: Francesco Mecatti
 // FSM - Finite State Machine - to change blu led (LED 2) blink frequency with BOOT button (BUTTON 0)
+// The led is toggled by a periodic esp_timer (Blinker.h), so pauses shorter than a tick are honoured too
 //
 
 #include <stdio.h>
@@ -10,33 +11,43 @@
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "driver/gpio.h"
+#include "Blinker.h"
+#include "Console.h"
+#include "TimeFormat.h"
  
 #define BLUELED (gpio_num_t) 2
 #define BUTTON (gpio_num_t) 0
-#define PAUSE_MAX 4096
+#define PAUSE_MAX 4096  // ms, half blink period
 #define PAUSE_MIN 1
+#define US_PER_MS 1000
 #define NUM_STR_LEN 10
+#define CONSOLE_POLICY CONSOLE_COALESCE  // The value is redrawn in place: only the latest one matters
 
 typedef enum {PRESSED, RELEASED} State;
 
 int pause = 2;
 int direction = 1;
 State state = RELEASED;
+static const char BACKSPACES[] = "\b\b\b\b\b\b\b\b\b\b";  // NUM_STR_LEN of them
 
 void updateMonitor(int val){
     static bool firstRun = true;
-    char newString[NUM_STR_LEN];
-    itoa(val, newString, 10);
-    for (int i = 0; i < NUM_STR_LEN and not firstRun; i++) printf("\b");
-    printf(newString);
-    for (int i = 0; i < NUM_STR_LEN-(int)strlen(newString); i++) printf(" ");
+    char line[2*NUM_STR_LEN];
+    size_t n = firstRun ? 0 : NUM_STR_LEN;
+    memcpy(line, BACKSPACES, n);  // Back to the start of the value
+    size_t end = n + NUM_STR_LEN;
+    n += TimeFormat::formatUnsigned((uint32_t) val, line + n);
+    while (n < end) line[n++] = ' ';
+    Console::write(line, n);  // One message, never waits for the UART
     firstRun = false;
 }
 
 void buttonTask(void *pvParameter){
     gpio_pad_select_gpio(BUTTON);
     gpio_set_direction(BUTTON, GPIO_MODE_INPUT);
-    printf("Pause: ");
+    Blinker led(BLUELED, pause * US_PER_MS);  // The led blinks on an esp_timer, this task only polls the button
+    led.start();
+    Console::printf("Pause: ");
     while(1) {
         int button = gpio_get_level(BUTTON);
         switch (state) {
@@ -52,32 +63,21 @@ void buttonTask(void *pvParameter){
                         pause *= 2;
                     else
                         pause /= 2;
+                    led.setHalfPeriod(pause * US_PER_MS);
                     updateMonitor(pause);
                     state = RELEASED;
                 }
                 break;
         }
-        fflush(stdout);
         vTaskDelay(10 / portTICK_RATE_MS);
     }
 }
 
-void ledTask(void *pvParameter){
-    gpio_pad_select_gpio(BLUELED);
-    gpio_set_direction(BLUELED, GPIO_MODE_OUTPUT);
-    while(1) {
-        gpio_set_level(BLUELED, 0);
-        vTaskDelay(pause / portTICK_RATE_MS);
-        gpio_set_level(BLUELED, 1);
-        vTaskDelay(pause / portTICK_RATE_MS);
-  }
-}
- 
 extern "C" {
     void app_main(void);
 }
 
 void app_main(void){
+    Console::begin(CONSOLE_POLICY);
     xTaskCreate(&buttonTask, "buttonTask", 2048, NULL, 1, NULL);
-    xTaskCreate(&ledTask, "ledTask", 1024, NULL, 1, NULL );
 }
\ No newline at end of file
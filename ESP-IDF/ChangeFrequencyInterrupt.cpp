@@ -1,7 +1,9 @@
 //
 // File ChangeFrequencyInterrupt.cpp
 // Author: Francesco Mecatti
-// Button press is managed through an ISR triggered by a falling (negative = while pressing) edge
+// Button press is managed through the edge interrupt, filtered by a Debouncer: one step per press however much the
+// contact bounces
+// The led is toggled by a periodic esp_timer (Blinker.h), so pauses shorter than a tick are honoured too
 //
 
 #include <stdio.h>
@@ -12,40 +14,51 @@
 #include "esp_intr_alloc.h"
 #include "esp_system.h"
 #include "driver/gpio.h"
+#include "Blinker.h"
+#include "Console.h"
+#include "Debouncer.h"
+#include "TimeFormat.h"
  
 #define BLUELED (gpio_num_t) 2
 #define BUTTON (gpio_num_t) 0
-#define PAUSE_MAX 4096
+#define PAUSE_MAX 4096  // ms, half blink period
 #define PAUSE_MIN 1
+#define US_PER_MS 1000
 #define NUM_STR_LEN 10
+#define SETTLE_US 5000  // Contact bounce filter (see Debouncer.h)
+#define CONSOLE_POLICY CONSOLE_COALESCE  // The value is redrawn in place: only the latest one matters
 
 typedef enum {PRESSED, RELEASED} State;
 
 int pause = 2;
 int direction = 1;
 SemaphoreHandle_t xSemaphore = nullptr;
+static const char BACKSPACES[] = "\b\b\b\b\b\b\b\b\b\b";  // NUM_STR_LEN of them
 
 void updateMonitor(int val){
     static bool firstRun = true;
-    char newString[NUM_STR_LEN];
-    itoa(val, newString, 10);
-    for (int i = 0; i < NUM_STR_LEN and not firstRun; i++) printf("\b");
-    printf(newString);
-    for (int i = 0; i < NUM_STR_LEN-(int)strlen(newString); i++) printf(" ");
+    char line[2*NUM_STR_LEN];
+    size_t n = firstRun ? 0 : NUM_STR_LEN;
+    memcpy(line, BACKSPACES, n);  // Back to the start of the value
+    size_t end = n + NUM_STR_LEN;
+    n += TimeFormat::formatUnsigned((uint32_t) val, line + n);
+    while (n < end) line[n++] = ' ';
+    Console::write(line, n);  // One message, never waits for the UART
     firstRun = false;
 }
 
-void buttonIsrHandler (void *pvParameters) {  // Negative edge interrupt handler (triggered while pressing)
-    xSemaphoreGiveFromISR(xSemaphore, NULL);
+void buttonHandler(void *arg, int level, clock_us_t timestamp) {  // Settled transition: act on presses (low level) only
+    if (level == 0)
+        xSemaphoreGiveFromISR(xSemaphore, NULL);
 }
 
 void buttonTask(void *pvParameters){
+    Debouncer button;  // One step per settled press, not per bounce
     gpio_pad_select_gpio(BUTTON);
-    gpio_set_direction(BUTTON, GPIO_MODE_INPUT);
-    gpio_set_intr_type(BUTTON, GPIO_INTR_NEGEDGE);
-    gpio_install_isr_service(ESP_INTR_FLAG_LEVEL1);
-    gpio_isr_handler_add(BUTTON, buttonIsrHandler, NULL);
-    printf("Pause: "); fflush(stdout);
+    button.begin(BUTTON, SETTLE_US, &buttonHandler);
+    Blinker led(BLUELED, pause * US_PER_MS);  // The led blinks on an esp_timer, this task sleeps until a press
+    led.start();
+    Console::printf("Pause: ");
     while(1) {
         if (xSemaphoreTake(xSemaphore, portMAX_DELAY) == pdTRUE) {
             if (pause == PAUSE_MAX || pause == PAUSE_MIN)
@@ -54,29 +67,18 @@ void buttonTask(void *pvParameters){
                 pause *= 2;
             else
                 pause /= 2;
+            led.setHalfPeriod(pause * US_PER_MS);
             updateMonitor(pause);
-            fflush(stdout);
         }
     }
 }
 
-void ledTask(void *pvParameters){
-    gpio_pad_select_gpio(BLUELED);
-    gpio_set_direction(BLUELED, GPIO_MODE_OUTPUT);
-    while(1) {
-        gpio_set_level(BLUELED, 0);
-        vTaskDelay(pause / portTICK_RATE_MS);
-        gpio_set_level(BLUELED, 1);
-        vTaskDelay(pause / portTICK_RATE_MS);
-  }
-}
- 
 extern "C" {
     void app_main(void);
 }
 
 void app_main(void){
+    Console::begin(CONSOLE_POLICY);
     xSemaphore = xSemaphoreCreateBinary();
     xTaskCreate(&buttonTask, "buttonTask", 2048, NULL, 1, NULL);
-    xTaskCreate(&ledTask, "ledTask", 1024, NULL, 1, NULL );
 }
\ No newline at end of file
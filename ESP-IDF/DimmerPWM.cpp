@@ -2,71 +2,89 @@
 // File DimmerPWM.cpp
 // Author: Francesco Mecatti
 // Blue led (LED 2) dimmering through PWM - Pulse Width Modulation -. Use BUTTON 0 to control led brightness.
+// The PWM signal is generated by the LEDC peripheral: while the brightness is steady the CPU is never woken up
 //
 
 #include <stdio.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
+#include "esp_intr_alloc.h"
 #include "driver/gpio.h"
+#include "PwmOutput.h"
+#include "FadeEngine.h"
+#include "Console.h"
+#include "TimeFormat.h"
  
 #define BLUELED (gpio_num_t)    2
 #define BUTTON (gpio_num_t)     0
-#define PERIOD                  16  // ms
+#define STEP                    0.01  // Brightness change every STEP_PERIOD while the button is held
+#define STEP_PERIOD             10  // ms
+#define PWM_FREQUENCY           5000  // Hz
+#define PWM_RESOLUTION          LEDC_TIMER_13_BIT  // 8192 duty steps
+#define BRIGHTNESS_CURVE        GAMMA_CURVE  // LINEAR_CURVE: duty proportional to the value shown
 #define NUM_STR_LEN             10
+#define CONSOLE_POLICY          CONSOLE_COALESCE  // The value is redrawn in place: only the latest one matters
 
 typedef enum {PRESSED, RELEASED} State;
 
 double duty_cycle = 1;  // always between 0 and 1
 int direction = 1;
+SemaphoreHandle_t xButtonSemaphore = NULL;
+static const char BACKSPACES[] = "\b\b\b\b\b\b\b\b\b\b";  // NUM_STR_LEN of them
 
 void updateMonitor(double val){
     static bool firstRun = true;
-    char newString[NUM_STR_LEN];
-    itoa((int) ((float)val*100), newString, 10);
-    for (int i = 0; i < NUM_STR_LEN and not firstRun; i++) printf("\b");
-    printf(newString);
-    for (int i = 0; i < NUM_STR_LEN-(int)strlen(newString); i++) printf(" ");
+    char line[2*NUM_STR_LEN];
+    size_t n = firstRun ? 0 : NUM_STR_LEN;
+    memcpy(line, BACKSPACES, n);  // Back to the start of the value
+    size_t end = n + NUM_STR_LEN;
+    n += TimeFormat::formatUnsigned((uint32_t) ((float)val*100 + 0.5f), line + n);
+    while (n < end) line[n++] = ' ';
+    Console::write(line, n);  // One message, never waits for the UART
     firstRun = false;
 }
 
+// Any edge: wakes buttonTask up when the button is pressed
+void buttonIsrHandler(void *pvParameters){
+    xSemaphoreGiveFromISR(xButtonSemaphore, NULL);
+}
+
 void buttonTask(void *pvParameter){
+    PwmOutput led(BLUELED, LEDC_CHANNEL_0, LEDC_TIMER_0, PWM_FREQUENCY, PWM_RESOLUTION);
+    FadeEngine dimmer(led, BRIGHTNESS_CURVE);
+    dimmer.set(duty_cycle);
+
     gpio_pad_select_gpio(BUTTON);
     gpio_set_direction(BUTTON, GPIO_MODE_INPUT);
-    printf("Duty cycle [%%]: ");  // "%%" is an escaped "%"
+    gpio_set_intr_type(BUTTON, GPIO_INTR_ANYEDGE);
+    gpio_install_isr_service(ESP_INTR_FLAG_LEVEL1);
+    gpio_isr_handler_add(BUTTON, buttonIsrHandler, NULL);
+    Console::printf("Duty cycle [%%]: ");  // "%%" is an escaped "%"
+    updateMonitor(duty_cycle);
     while(1) {
         int button = gpio_get_level(BUTTON);
-        if (button == PRESSED) {
-            if (duty_cycle <= 0 || duty_cycle >= 1)
-                direction *= -1;
-            if (direction == 1)
-                duty_cycle += 0.01;
-            if (direction == -1)
-                duty_cycle -= 0.01;
-            updateMonitor(duty_cycle);
-            fflush(stdout);
+        if (button != PRESSED) {
+            xSemaphoreTake(xButtonSemaphore, portMAX_DELAY);  // Steady brightness: sleep until the button moves
+            continue;
         }
-        vTaskDelay(10 / portTICK_RATE_MS);
+        if (duty_cycle <= 0 || duty_cycle >= 1)
+            direction *= -1;
+        duty_cycle += direction * STEP;
+        duty_cycle = duty_cycle < 0 ? 0 : (duty_cycle > 1 ? 1 : duty_cycle);
+        dimmer.fadeTo(duty_cycle, STEP_PERIOD);  // The LEDC ramps to the new level while this task sleeps, one step period long
+        updateMonitor(duty_cycle);
     }
 }
-
-void ledTask(void *pvParameter){
-    gpio_pad_select_gpio(BLUELED);
-    gpio_set_direction(BLUELED, GPIO_MODE_OUTPUT);
-    while(1) {
-        gpio_set_level(BLUELED, 1);
-        vTaskDelay((double)duty_cycle*PERIOD / portTICK_RATE_MS);
-        gpio_set_level(BLUELED, 0);
-        vTaskDelay((1-(double)duty_cycle)*PERIOD / portTICK_RATE_MS);
-  }
-}
  
 extern "C" {
     void app_main(void);
 }
 
 void app_main(void){
+    Console::begin(CONSOLE_POLICY);
+    xButtonSemaphore = xSemaphoreCreateBinary();
     xTaskCreate(&buttonTask, "buttonTask", 2048, NULL, 1, NULL);
-    xTaskCreate(&ledTask, "ledTask", 1024, NULL, 1, NULL);
 }
\ No newline at end of file
@@ -16,6 +16,13 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_intr_alloc.h"
+#include "Time.h"
+#include "EventQueue.h"
+#include "InputRecorder.h"
+#include "InputSet.h"
+#include "PressFsm.h"
+#include "Profiler.h"
+#include "TaskPlacement.h"
 
 // Configuration section. Set to 1 if you want to enable that input device, 0 otherwise
 #define USE_BUTTON      (1)
@@ -23,160 +30,119 @@
 #define USE_HALLSENSOR  (0)
 
 // Touchpad configuration parameters
-#define TOUCHPAD_FILTER_PERIOD          (10)
-// #define TOUCHPAD_THRESH_NO_USE       (150)
-#define TOUCHPAD_THRESH_NO_USE_HIGH     (550)
-#define TOUCHPAD_THRESH_NO_USE_LOW      (150)
-
-// Hall-effect sensor config parameters
-#define HALL_MIN_THRESH_NO_USE (10)
-#define HALL_MAX_THRESH_NO_USE (40)
+#define TOUCHPAD_FILTER_PERIOD      (10)
+#define TOUCHPAD_PRESS_PERCENT      (50)  // Of the untouched reading, measured at start-up and tracked (see TouchPad)
+#define TOUCHPAD_RELEASE_PERCENT    (75)
+
+// Hall-effect sensor config parameters, relative to the idle reading measured at start-up (see HallSampler.h)
+#define HALL_PRESS_DELTA        (15)
+#define HALL_RELEASE_DELTA      (8)
+#define HALL_IDLE_RATE_HZ       (20)  // Sampling rate with no magnet around
+#define HALL_ACTIVE_RATE_HZ     (100)
+
+// Input event queues, one per producer as EventQueue wants: touches from the touch ISR, settled button transitions from
+// the debouncer. Drained in batches by buttonTask, a batch of each merged by timestamp
+#define EVENT_QUEUE_SIZE    (16)  // Power of 2
+#define EVENT_BATCH_SIZE    (8)
+
+// Button contact bounce filter: the pin is sampled this long after its first edge, one event per transition
+// (see Debouncer.h). 0 queues every edge, bounces included
+#define BUTTON_SETTLE_US    (5000)
+
+// Press classification (see PressFsm.h)
+#define LONG_PRESS_TIME_US      (500000)  // 0.5 secs: stop and reset
+#define DOUBLE_PRESS_TIME_US    (0)  // Not used by the stopwatch
+#define HOLD_REPEAT_TIME_US     (0)
+
+// Stopped with nothing pressed: stop every periodic job and sleep until the button or the touch pad wakes the chip.
+// The Hall sensor has no interrupt: with USE_HALLSENSOR it is still sampled at HALL_IDLE_RATE_HZ, so a magnet wakes it
+// too, at the cost of that many wakeups a second (see InputSet::suspend)
+#define LOW_POWER_IDLE          (1)
+
+// Display configuration
+#define DISPLAY_FPS             (1)  // Refresh rate while the counter runs
+#define DISPLAY_CENTISECONDS    (0)  // Set to 1 to show centiseconds as well (pair it with e.g. 25 fps)
+#define BINARY_TELEMETRY        (0)  // Set to 1 to send binary event frames instead of the screen (see Telemetry.h)
+#define CONSOLE_POLICY          CONSOLE_DROP_OLDEST  // What a full console buffer gives up (see Console.h)
+#define LAP_LOG                 (1)  // Keep sessions and laps in the "laplog" flash partition (see LapLog.h)
 
 // Pin definition
 #define BUTTON_PIN  (gpio_num_t)    (0)
 #define LED_PIN     (gpio_num_t)    (2)
 #define TOUCH_PIN   (touch_pad_t)   (4)  // Touch0
 
-// True if one of the input is true
-#define eval_input(button_query, touchpad_query, hallsensor_query)  (   (USE_BUTTON && buttonState == button_query) or \
-                                                                        (USE_TOUCHPAD && touchState == touchpad_query) or \
-                                                                        (USE_HALLSENSOR && (hall_sensor_read() < HALL_MIN_THRESH_NO_USE || hall_sensor_read() > HALL_MAX_THRESH_NO_USE) == hallsensor_query)    )
+// Enabled input sources; a press on any of them counts
+typedef InputSet<EnabledIf<USE_BUTTON, Button>, EnabledIf<USE_TOUCHPAD, TouchPad>, EnabledIf<USE_HALLSENSOR, HallSensor>> Inputs;
 
 using namespace std;
 
-typedef enum {PRESSED, RELEASED} InputState;
-typedef enum {  FIRST_PRESS,
-                WAITING_RELEASE
-                } FSMState;
 typedef enum {OFF, ON} LedState;
 
-typedef unsigned long int ctime_t;
-
 SemaphoreHandle_t xSemaphore = nullptr;
+EventQueue<InputEvent, EVENT_QUEUE_SIZE> touchEvents;  // touchIsrHandler
+EventQueue<InputEvent, EVENT_QUEUE_SIZE> buttonEvents;  // buttonHandler: the esp_timer task, on another core than the touch ISR
 
+typedef struct {
+    Time *t;  // Owned by app_main, static storage
+    SemaphoreHandle_t semaphore;
+} task_data_t;
 
-class Time {
-    public:
-        static const unsigned int CS_FACTOR = 100;
-        static const unsigned int SS_FACTOR = 60;
-        static const unsigned int MM_FACTOR = 60;
-        static inline ctime_t centiseconds = 0;
-        static inline unsigned int hh = 0, mm = 0, ss = 0, cs = 0;
-        TaskHandle_t xCounterTaskHandle = NULL;
-        pair<uint8_t, uint8_t> lastLapPosition {0, 10};  // Cursor position of last printed lap (row, col)
-        bool stopped = true;
-
-        // Instance constructor
-        Time() {
-            printf("\e[2J\e[H");  // ANSI Escape sequence to erase display and move the cursor to the home position
-        }
-
-        // Get centiseconds attribute
-        ctime_t getCentiseconds() {
-            return centiseconds;
-        }
-
-        // Print new time value over the old one
-        static void updateTime(void) {
-            for (int i = 0; i < 6+2; i++) printf("\b");
-            computeTime();
-            printf("\e[?25l\e[104m%02u:%02u:%02u\e[0m", hh, mm, ss);  // ANSI Escape characters hide cursor and change background color; after time print restore default graphics style
-            fflush(stdout);
-        }
-
-        // Prettify laps visualization
-        void addLap(void) {
-            printf("\e[s");  // Save cursor position
-            for (int i = 0; i < lastLapPosition.second; i++) printf("\e[1C");  // Move the cursor forward by 10 columns (keeping cursor hide)
-            for (int i = 0; i < lastLapPosition.first+1; i++) printf("\e[1B");  // Move the cursor down by N rows (keeping cursor hide)
-            computeTime();
-            printf("\e[?25l(%d)\t%02u:%02u:%02u.%02u", lastLapPosition.first+1, hh, mm, ss, cs);  // Hide cursor and print lap time
-            printf("\e[u");  // Restore cursor position
-            fflush(stdout);
-            lastLapPosition.first++;
-        }
-
-        // This method turns centiSeconds into hh, mm, ss and cs
-        static void computeTime(void) {
-            hh = centiseconds / (CS_FACTOR*SS_FACTOR*MM_FACTOR);
-            mm = (centiseconds - hh*(CS_FACTOR*SS_FACTOR*MM_FACTOR)) / (CS_FACTOR*SS_FACTOR);
-            ss = (centiseconds - hh*(CS_FACTOR*SS_FACTOR*MM_FACTOR) - mm*(CS_FACTOR*SS_FACTOR)) / (CS_FACTOR);
-            cs = (centiseconds - hh*(CS_FACTOR*SS_FACTOR*MM_FACTOR) - mm*(CS_FACTOR*SS_FACTOR) - ss*(CS_FACTOR));
-        }
-
-        // Task called every centisecond
-        static void counterTask(void *pvParameters) {
-            while (true) {
-                centiseconds++;
-                if (centiseconds % 100 == 0) {  // Print the time every 10 centiceconds
-                    updateTime();
-                }
-                vTaskDelay(10 / portTICK_PERIOD_MS);  // 10 ms, namely 1 cs
-            }
-        }
+// Stopwatch actions, bound to the press classifier at compile time
+struct StopwatchGestures : PressHandler {
+    Time &t;
 
-        // Run this method to start counter
-        void start(void) {
-            stopped = false;
-            xTaskCreate(&counterTask, "counterTask", 2048, NULL, 1, &xCounterTaskHandle);
-        }
+    StopwatchGestures(Time &t) : t(t) {}
 
-        void stop(void) {
-            vTaskDelete(xCounterTaskHandle);
-            stopped = true;
+    void onDown(clock_us_t timestamp) {  // Lap, or start if stopped
+        gpio_set_level(LED_PIN, (int) ON);
+        if (t.isStopped()) {
+            t.start(timestamp);
+            t.clearLaps();
         }
-
-        bool isStopped(void) {
-            return stopped;
-        }
-
-        void reset(void) {  // Reset counter and show update time (00:00:00)
-            centiseconds = 0;
-            computeTime();
-            updateTime();
+        else {
+            t.addLap(timestamp);
         }
+    }
 
-        void clearLaps(void) {
-            printf("\e[s");  // Save cursor position
-            for (int i = 0; i < lastLapPosition.second; i++) printf("\e[1C");  // Move the cursor forward by 10 columns (keeping cursor hide)
-            for (int i = 0; i < lastLapPosition.first+1; i++) {
-                printf("\e[1B");  // Move the cursor down by N rows (keeping cursor hide)
-                printf("\e[K");  // Erase line
-            }
-            printf("\e[u");  // Restore cursor position
-            fflush(stdout);
-            lastLapPosition.first = 0;
-        }
+    void onUp(clock_us_t timestamp) {
+        gpio_set_level(LED_PIN, (int) OFF);
+    }
 
-        // Destructor
-        ~ Time() {
-            printf("\e[0m");  // ANSI Escape sequence to set all graphics attributes off
-            stop();
-        }
+    void onLong(clock_us_t timestamp) {  // Stop and reset, at press + LONG_PRESS_TIME_US even if still held
+        t.stop(timestamp); t.reset();
+        if (BINARY_TELEMETRY)  // Task profile since the last one; built with -DPROFILING=1 only (see Profiler.h)
+            Profiler::emit<Telemetry>();
+        else
+            Time::printProfile();  // By displayTask, the console's writer
+    }
 };
 
-typedef struct {
-    Time t;
-    SemaphoreHandle_t semaphore;
-} task_data_t;
+// Ticks to wait for the classifier deadline, rounded up; portMAX_DELAY if there is none
+static TickType_t ticksUntil(clock_us_t deadline) {
+    if (deadline == PressFsm<StopwatchGestures>::NO_DEADLINE)
+        return portMAX_DELAY;
+    clock_us_t us = deadline - Time::clockSource();
+    clock_us_t tickUs = portTICK_PERIOD_MS * 1000;
+    return us > 0 ? (TickType_t) ((us + tickUs - 1) / tickUs) : 0;
+}
 
 #if USE_BUTTON
-InputState buttonState;
-
-// Negative and positive edge interrupt handler (triggered when pressed or released)
-void buttonIsrHandler(void *pvParameters) {
-    buttonState = (InputState) gpio_get_level(BUTTON_PIN);
+// Settled press or release, stamped at its first edge; runs in the esp_timer task (in the edge ISR with no settle time)
+void buttonHandler(void *arg, int level, clock_us_t timestamp) {
+    buttonEvents.push({BUTTON_INPUT, (uint8_t) level, timestamp});
+    Profiler::signal(BUTTON_INPUT);
     xSemaphoreGiveFromISR(xSemaphore, NULL);
 }
 #endif
 
 #if USE_TOUCHPAD
-InputState touchState;
-
-// Negative edge interrupt handler (triggered while pressing)
+// Touch interrupt handler (triggered while pressing). The interrupt is level-triggered and would fire again at every
+// measurement while the pad is held: it is masked here, and TouchPad enables it again once it has seen the release
 void touchIsrHandler(void *pvParameters) {
-    touchState = (InputState) ((touch_pad_get_status() & BIT4) >> 4);
+    touchEvents.push({TOUCH_INPUT, (uint8_t) ((touch_pad_get_status() & BIT(TOUCH_PIN)) == 0), Time::clockSource()});  // Pad triggered: PRESSED (0)
     touch_pad_clear_status();
+    touch_pad_intr_disable();
+    Profiler::signal(TOUCH_INPUT);
     xSemaphoreGiveFromISR(xSemaphore, NULL);
 }
 #endif
@@ -185,74 +151,66 @@ void touchIsrHandler(void *pvParameters) {
 void buttonTask(void *pvParameters) {
     gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
 
-#if USE_BUTTON  // Button configuration
-    gpio_set_direction(BUTTON_PIN, GPIO_MODE_INPUT);
-    gpio_set_intr_type(BUTTON_PIN, GPIO_INTR_ANYEDGE);
-    gpio_install_isr_service(ESP_INTR_FLAG_LEVEL1);
-    gpio_isr_handler_add(BUTTON_PIN, buttonIsrHandler, NULL);
+    Inputs inputs(  Button(BUTTON_PIN),
+                    TouchPad(TOUCH_PIN, TOUCHPAD_PRESS_PERCENT, TOUCHPAD_RELEASE_PERCENT, TOUCHPAD_FILTER_PERIOD),
+                    HallSensor(HALL_PRESS_DELTA, HALL_RELEASE_DELTA, HALL_IDLE_RATE_HZ, HALL_ACTIVE_RATE_HZ)    );
+    inputs.begin();
+#if USE_BUTTON
+    inputs.button.beginInterrupt(buttonHandler, BUTTON_SETTLE_US);
 #endif
-
-#if USE_TOUCHPAD  // Touchpad configuration
-    touch_pad_init();
-    touch_pad_config(TOUCH_PIN, TOUCHPAD_THRESH_NO_USE_LOW);
-    touch_pad_filter_start(TOUCHPAD_FILTER_PERIOD);
-    touch_pad_set_trigger_mode(TOUCH_TRIGGER_BELOW);
-    touch_pad_isr_register(touchIsrHandler, NULL);
-    touch_pad_intr_enable();
+#if USE_TOUCHPAD  // Touches raise the interrupt, releases come from the pad tracking timer, see TouchPad
+    inputs.touchPad.beginInterrupt(touchIsrHandler, xSemaphore);
+#endif
+#if USE_HALLSENSOR
+    inputs.hallSensor.beginInterrupt(xSemaphore);  // Transitions come from the sampling task instead of an ISR
 #endif
 
-    FSMState state = FIRST_PRESS;
-    ctime_t startCentiseconds;
+    bool pressed, wasPressed = false;
+    InputEvent events[3 * EVENT_BATCH_SIZE];  // A batch from each queue
+    size_t n;
     task_data_t *data = (task_data_t *) pvParameters;
-    Time t = data->t;
+    Time &t = *data->t;
     SemaphoreHandle_t xSemaphore = data->semaphore;
+    StopwatchGestures gestures(t);
+    PressFsm<StopwatchGestures> fsm(gestures, {LONG_PRESS_TIME_US, DOUBLE_PRESS_TIME_US, HOLD_REPEAT_TIME_US});
 
     gpio_set_level(LED_PIN, (int) OFF);
 
     // puts("Entered buttonTask");
     while (true) {
-        if (xSemaphoreTake(xSemaphore, portMAX_DELAY) == pdTRUE) {
-            switch (state) {
-                case FIRST_PRESS:
-                    if (eval_input(PRESSED, 1, 1)) {
-                        gpio_set_level(LED_PIN, (int) ON);
-                        if (t.isStopped()) {
-                            t.start();
-                            t.clearLaps();
-                        }
-                        else {
-                            t.addLap();
-                        }
-                        startCentiseconds = t.getCentiseconds();
-                        state = WAITING_RELEASE;
-#if USE_TOUCHPAD
-                        touch_pad_config(TOUCH_PIN, TOUCHPAD_THRESH_NO_USE_HIGH);
-                        touch_pad_set_trigger_mode(TOUCH_TRIGGER_ABOVE);
+        TickType_t wait = ticksUntil(fsm.deadline());
+#if LOW_POWER_IDLE
+        bool idle = t.isStopped() && !wasPressed && wait == portMAX_DELAY;  // Nothing to time or to classify
+        if (idle)
+            inputs.suspend(xSemaphore);
 #endif
-                    }
-                    else {
-                        ;;  // Do nothing
-                    }
-                    break;
-                case WAITING_RELEASE:
-                    if (eval_input(RELEASED, 0, 0)) {
-                        gpio_set_level(LED_PIN, (int) OFF);
-                        // Long press branch
-                        if ((t.getCentiseconds() - startCentiseconds) >= 0.5*100) {  // 0.5 secs; comparison in centisecs
-                            t.stop(); t.reset();
-                        }
-                        state = FIRST_PRESS;
-#if USE_TOUCHPAD
-                        touch_pad_config(TOUCH_PIN, TOUCHPAD_THRESH_NO_USE_LOW);
-                        touch_pad_set_trigger_mode(TOUCH_TRIGGER_BELOW);
+        BaseType_t taken = xSemaphoreTake(xSemaphore, wait);  // Edges, or the next long press deadline
+        Profiler::wake();
+#if LOW_POWER_IDLE
+        if (idle)
+            inputs.resume();
 #endif
-                    }
-                    else {
-                        ;;  // Do nothing
-                    }
+        if (taken == pdTRUE) {
+            Profiler::received();
+            while (true) {  // Every edge since the last wakeup
+                n = touchEvents.pop(events, EVENT_BATCH_SIZE);
+                n += buttonEvents.pop(events + n, EVENT_BATCH_SIZE);
+                n += inputs.popTaskEvents(events + n, EVENT_BATCH_SIZE);
+                if (n == 0)
                     break;
+                sortByTimestamp(events, n);  // A settled button edge comes in late, after touches it preceded
+                for (size_t i = 0; i < n; i++) {
+                    const InputEvent &event = events[i];
+                    pressed = inputs.update(event);  // Sources without interrupt are read here, once per event
+                    Telemetry::input(event);  // Nothing happens without telemetry
+                    InputRecorder::record(event);  // Nor without recording
+                    if (pressed != wasPressed)
+                        fsm.handle(pressed, event.timestamp);  // Classified on the ISR timestamps, not at task time
+                    wasPressed = pressed;
+                }
             }
         }
+        fsm.tick(Time::clockSource());
     }
 }
 
@@ -262,8 +220,16 @@ extern "C" {
 }
 
 void app_main(void) {
-    Time t = Time();
+#if LOW_POWER_IDLE
+    LightSleep::begin();  // Held off until the inputs are suspended
+#endif
+    Console::begin(CONSOLE_POLICY);  // displayTask hands its frames over to consoleTask, never waiting for the UART
+    Time::screen.setOutput(Console::stream());
+    InputRecorder::begin(INPUT_TRACE_PATH, BUTTON_PIN, USE_TOUCHPAD ? TOUCH_PIN : TOUCH_PAD_MAX);  // Built with -DRECORD_INPUTS=1 only (see InputRecorder.h)
+    if (LAP_LOG)
+        LapLog::begin();  // Nothing is kept if the partition table has no laplog partition
+    static Time t(DISPLAY_FPS, DISPLAY_CENTISECONDS, BINARY_TELEMETRY ? Time::TELEMETRY : Time::SCREEN);  // app_main returns right after creating the task: nothing it passes may live on its stack
     xSemaphore = xSemaphoreCreateBinary();
-    task_data_t data = {t, xSemaphore};
-    xTaskCreate(&buttonTask, "buttonTask", 2048, (void *) &data, 1, NULL);
+    static task_data_t data = {&t, xSemaphore};
+    TaskPlacement::create(TIMING_TASK, &buttonTask, "buttonTask", 2048, (void *) &data, 1);  // Core and priority: see TaskPlacement.h
 }
\ No newline at end of file
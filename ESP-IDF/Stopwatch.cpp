@@ -14,6 +14,12 @@
 #include "driver/adc.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "Time.h"
+#include "InputRecorder.h"
+#include "InputSet.h"
+#include "PressFsm.h"
+#include "Profiler.h"
+#include "TaskPlacement.h"
 
 // Configuration section. Set to 1 if you want to enable that input device, 0 otherwise
 #define USE_BUTTON      (1)
@@ -21,227 +27,118 @@
 #define USE_HALLSENSOR  (1)
 
 // Touchpad configuration parameters
-#define TOUCHPAD_FILTER_PERIOD  (10)
-#define TOUCHPAD_THRESH_NO_USE  (200)
-
-// Hall-effect sensor config parameters
-#define HALL_MIN_THRESH_NO_USE (-45)
-#define HALL_MAX_THRESH_NO_USE (-25)
+#define TOUCHPAD_FILTER_PERIOD      (10)
+#define TOUCHPAD_PRESS_PERCENT      (50)  // Of the untouched reading, measured at start-up and tracked (see TouchPad)
+#define TOUCHPAD_RELEASE_PERCENT    (75)
+
+// Hall-effect sensor config parameters, relative to the idle reading measured at start-up (see HallSampler.h)
+#define HALL_PRESS_DELTA        (15)
+#define HALL_RELEASE_DELTA      (8)
+#define HALL_IDLE_RATE_HZ       (20)  // Sampling rate with no magnet around
+#define HALL_ACTIVE_RATE_HZ     (100)
+
+// Press classification (see PressFsm.h)
+#define LONG_PRESS_TIME_US      (500000)  // 0.5 secs: stop and reset
+#define DOUBLE_PRESS_TIME_US    (0)  // Not used by the stopwatch
+#define HOLD_REPEAT_TIME_US     (0)
+
+// Stopped with nothing pressed: stop every periodic job and sleep until the button or the touch pad wakes the chip.
+// The Hall sensor has no interrupt: with USE_HALLSENSOR it is still sampled at HALL_IDLE_RATE_HZ, so a magnet wakes it
+// too, at the cost of that many wakeups a second (see InputSet::suspend)
+#define LOW_POWER_IDLE          (1)
+
+// Display configuration
+#define DISPLAY_FPS             (1)  // Refresh rate while the counter runs
+#define DISPLAY_CENTISECONDS    (0)  // Set to 1 to show centiseconds as well (pair it with e.g. 25 fps)
+#define BINARY_TELEMETRY        (0)  // Set to 1 to send binary event frames instead of the screen (see Telemetry.h)
+#define CONSOLE_POLICY          CONSOLE_DROP_OLDEST  // What a full console buffer gives up (see Console.h)
+#define LAP_LOG                 (1)  // Keep sessions and laps in the "laplog" flash partition (see LapLog.h)
 
 // Pin definition
 #define BUTTON_PIN  (gpio_num_t)    (0)
 #define LED_PIN     (gpio_num_t)    (2)
 #define TOUCH_PIN   (touch_pad_t)   (4)  // Touch0
 
-// True if one of the input is true
-#define eval_input(button_query, touchpad_query, hallsensor_query)  (   (USE_BUTTON && buttonState == button_query) or \
-                                                                        (USE_TOUCHPAD && (((touch_pad_get_status() & BIT4) >> 4) == touchpad_query) && !touch_pad_clear_status()) or \
-                                                                        (USE_HALLSENSOR && (hall_sensor_read() < HALL_MIN_THRESH_NO_USE || hall_sensor_read() > HALL_MAX_THRESH_NO_USE) == hallsensor_query)    )
+// Enabled input sources; a press on any of them counts
+typedef InputSet<EnabledIf<USE_BUTTON, Button>, EnabledIf<USE_TOUCHPAD, TouchPad>, EnabledIf<USE_HALLSENSOR, HallSensor>> Inputs;
 
 using namespace std;
 
-typedef enum {PRESSED, RELEASED} ButtonState;
-typedef enum {  IDLE,           // Entry point; do nothing
-                LAP,            // Split time
-                SHORT_PRESS,    // If button pressed and dt < 0.5 sec
-                STOP_AND_RESET, // Stop counting and reset counter
-                LONG_PRESS      // If button pressed and dt >= 0.5 sec; wait the button is released
-                } FSMState;
 typedef enum {OFF, ON} LedState;
 
-typedef unsigned long int ctime_t;
-
-class Time {
-    public:
-        static const unsigned int CS_FACTOR = 100;
-        static const unsigned int SS_FACTOR = 60;
-        static const unsigned int MM_FACTOR = 60;
-        static inline ctime_t centiseconds = 0;
-        static inline unsigned int hh = 0, mm = 0, ss = 0, cs = 0;
-        TaskHandle_t xCounterTaskHandle = NULL;
-        pair<uint8_t, uint8_t> lastLapPosition {0, 10};  // Cursor position of last printed lap (row, col)
-        bool stopped = true;
-
-        // Instance constructor
-        Time() {
-            printf("\e[2J\e[H");  // ANSI Escape sequence to erase display and move the cursor to the home position
-        }
-
-        // Get centiseconds attribute
-        ctime_t getCentiseconds() {
-            return centiseconds;
-        }
-
-        // Print new time value over the old one
-        static void updateTime(void) {
-            for (int i = 0; i < 6+2; i++) printf("\b");
-            computeTime();
-            printf("\e[?25l\e[104m%02u:%02u:%02u\e[0m", hh, mm, ss);  // ANSI Escape characters hide cursor and change background color; after time print restore default graphics style
-            fflush(stdout);
-        }
-
-        // Prettify laps visualization
-        void addLap(void) {
-            printf("\e[s");  // Save cursor position
-            for (int i = 0; i < lastLapPosition.second; i++) printf("\e[1C");  // Move the cursor forward by 10 columns (keeping cursor hide)
-            for (int i = 0; i < lastLapPosition.first+1; i++) printf("\e[1B");  // Move the cursor down by N rows (keeping cursor hide)
-            computeTime();
-            printf("\e[?25l(%d)\t%02u:%02u:%02u.%02u", lastLapPosition.first+1, hh, mm, ss, cs);  // Hide cursor and print lap time
-            printf("\e[u");  // Restore cursor position
-            fflush(stdout);
-            lastLapPosition.first++;
-        }
-
-        // This method turns centiSeconds into hh, mm, ss and cs
-        static void computeTime(void) {
-            hh = centiseconds / (CS_FACTOR*SS_FACTOR*MM_FACTOR);
-            mm = (centiseconds - hh*(CS_FACTOR*SS_FACTOR*MM_FACTOR)) / (CS_FACTOR*SS_FACTOR);
-            ss = (centiseconds - hh*(CS_FACTOR*SS_FACTOR*MM_FACTOR) - mm*(CS_FACTOR*SS_FACTOR)) / (CS_FACTOR);
-            cs = (centiseconds - hh*(CS_FACTOR*SS_FACTOR*MM_FACTOR) - mm*(CS_FACTOR*SS_FACTOR) - ss*(CS_FACTOR));
-        }
-
-        // Task called every centisecond
-        static void counterTask(void *pvParameter) {
-            while (true) {
-                centiseconds++;
-                if (centiseconds % 100 == 0) {  // Print the time every 10 centiceconds
-                    updateTime();
-                }
-                vTaskDelay(10 / portTICK_PERIOD_MS);  // 10 ms, namely 1 cs
-            }
-        }
-
-        // Run this method to start counter
-        void start(void) {
-            stopped = false;
-            xTaskCreate(&counterTask, "counterTask", 2048, NULL, 1, &xCounterTaskHandle);
-        }
-
-        void stop(void) {
-            vTaskDelete(xCounterTaskHandle);
-            stopped = true;
-        }
+// Stopwatch actions, bound to the press classifier at compile time
+struct StopwatchGestures : PressHandler {
+    Time &t;
 
-        bool isStopped(void) {
-            return stopped;
-        }
+    StopwatchGestures(Time &t) : t(t) {}
 
-        void reset(void) {  // Reset counter and show update time (00:00:00)
-            centiseconds = 0;
-            computeTime();
-            updateTime();
+    void onDown(clock_us_t timestamp) {  // Lap, or start if stopped
+        gpio_set_level(LED_PIN, (int) ON);
+        if (t.isStopped()) {
+            t.start(timestamp);
+            t.clearLaps();
         }
+        else
+            t.addLap(timestamp);
+    }
 
-        void clearLaps(void) {
-            printf("\e[s");  // Save cursor position
-            for (int i = 0; i < lastLapPosition.second; i++) printf("\e[1C");  // Move the cursor forward by 10 columns (keeping cursor hide)
-            for (int i = 0; i < lastLapPosition.first+1; i++) {
-                printf("\e[1B");  // Move the cursor down by N rows (keeping cursor hide)
-                printf("\e[K");  // Erase line
-            }
-            printf("\e[u");  // Restore cursor position
-            fflush(stdout);
-            lastLapPosition.first = 0;
-        }
+    void onUp(clock_us_t timestamp) {
+        gpio_set_level(LED_PIN, (int) OFF);
+    }
 
-        // Destructor
-        ~ Time() {
-            printf("\e[0m");  // ANSI Escape sequence to set all graphics attributes off
-            stop();
-        }
+    void onLong(clock_us_t timestamp) {  // Stop and reset
+        gpio_set_level(LED_PIN, (int) OFF);  // Quick blink to confirm reset
+        vTaskDelay(50 / portTICK_PERIOD_MS);
+        gpio_set_level(LED_PIN, (int) ON);
+        t.stop(timestamp); t.reset();
+        if (BINARY_TELEMETRY)  // Task profile since the last one; built with -DPROFILING=1 only (see Profiler.h)
+            Profiler::emit<Telemetry>();
+        else
+            Time::printProfile();  // By displayTask, the console's writer
+    }
 };
 
-// FSM to detect long and short press
+// Polls the inputs and feeds their edges to the press classifier
 void buttonTask(void *pvParameter) {
-#if USE_BUTTON  // Button configuration
-    gpio_set_direction(BUTTON_PIN, GPIO_MODE_INPUT);
     gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
-    ButtonState buttonState;
-#endif
-
-#if USE_TOUCHPAD  // Touchpad configuration
-    touch_pad_init();
-    touch_pad_config(TOUCH_PIN, TOUCHPAD_THRESH_NO_USE);
-    touch_pad_filter_start(TOUCHPAD_FILTER_PERIOD);
+    gpio_set_level(LED_PIN, (int) OFF);
+    Inputs inputs(  Button(BUTTON_PIN),
+                    TouchPad(TOUCH_PIN, TOUCHPAD_PRESS_PERCENT, TOUCHPAD_RELEASE_PERCENT, TOUCHPAD_FILTER_PERIOD),
+                    HallSensor(HALL_PRESS_DELTA, HALL_RELEASE_DELTA, HALL_IDLE_RATE_HZ, HALL_ACTIVE_RATE_HZ)    );
+    inputs.begin();
+    bool pressed, wasPressed = false;
+#if LOW_POWER_IDLE
+    SemaphoreHandle_t xWake = xSemaphoreCreateBinary();  // Given by an input wakeup while suspended
 #endif
 
-    FSMState state = IDLE;
-    ctime_t startCentiseconds;
-    Time t = *((Time *) pvParameter);
+    Time &t = *((Time *) pvParameter);
+    StopwatchGestures gestures(t);
+    PressFsm<StopwatchGestures> fsm(gestures, {LONG_PRESS_TIME_US, DOUBLE_PRESS_TIME_US, HOLD_REPEAT_TIME_US});
 
     // puts("Entered buttonTask");
     while (true) {
-#if USE_BUTTON
-        buttonState = (ButtonState) gpio_get_level(BUTTON_PIN);
-#endif
-        switch (state) {
-            case IDLE:
-                // puts("stateIdle");
-                gpio_set_level(LED_PIN, (int) OFF);
-                if (eval_input(PRESSED, 1, 1)) {
-                    startCentiseconds = t.getCentiseconds();
-                    state = LAP;
-                }
-                else if (eval_input(RELEASED, 0, 0)) {
-                    ;;  // Do nothing
-                }
-            break;
-            case LAP:
-                // puts("Lap");
-                gpio_set_level(LED_PIN, (int) ON);
-                if (t.isStopped()) {
-                    t.start();
-                    t.clearLaps();
-                }
-                else
-                    t.addLap();
-                if (eval_input(PRESSED, 1, 1)) {
-                    state = SHORT_PRESS;
-                }
-                else if (eval_input(RELEASED, 0, 0)) {
-                    state = IDLE;
-                }
-            break;
-            case SHORT_PRESS:
-                // puts("Short press");
-                gpio_set_level(LED_PIN, (int) ON);
-                if (eval_input(PRESSED, 1, 1)) {
-                    if ((t.getCentiseconds() - startCentiseconds) < 0.5*100) {  // 0.5 secs; comparison in centisecs
-                        ;; // Do nothing
-                    }
-                    else if ((t.getCentiseconds() - startCentiseconds) >= 0.5*100) {  // 0.5 secs; comparison in centisecs
-                        state = STOP_AND_RESET;
-                    }
-                }
-                else if (eval_input(RELEASED, 0, 0)) {
-                    state = IDLE;
-                }
-            break;
-            case STOP_AND_RESET:
-                // puts("Stop and reset");
-                gpio_set_level(LED_PIN, (int) OFF);  // Quick blink to confirm reset
-                vTaskDelay(50 / portTICK_PERIOD_MS);
-                gpio_set_level(LED_PIN, (int) ON);
-                t.stop(); t.reset();
-                if (eval_input(PRESSED, 1, 1)) {
-                    state = LONG_PRESS;
-                }
-                else if (eval_input(RELEASED, 0, 1)) {
-                    state = IDLE;
-                }
-            break;
-            case LONG_PRESS:
-                // puts("Long press");
-                gpio_set_level(LED_PIN, (int) ON);
-                if (eval_input(PRESSED, 1, 1)) {
-                    ;; // Do nothing
-                }
-                else if (eval_input(RELEASED, 0, 1)) {
-                    state = IDLE;
-                }
-            break;
+        pressed = inputs.sample();  // Every enabled source read once per period
+        if (pressed != wasPressed) {
+            clock_us_t now = Time::clockSource();
+            InputEvent event = {ANY_INPUT, (uint8_t) !pressed, now};
+            Telemetry::input(event);  // Nothing happens without telemetry
+            InputRecorder::record(event);  // Nor without recording
+            fsm.handle(pressed, now);
         }
+        else
+            fsm.tick(Time::clockSource());  // Long press while held
+        wasPressed = pressed;
+#if LOW_POWER_IDLE
+        if (t.isStopped() && !pressed && fsm.deadline() == fsm.NO_DEADLINE) {  // Nothing to time or to classify
+            inputs.suspend(xWake);
+            xSemaphoreTake(xWake, portMAX_DELAY);
+            Profiler::wake();
+            inputs.resume();
+            continue;  // Sample the input that woke us at once
+        }
+#endif
         vTaskDelay(100 / portTICK_PERIOD_MS);
+        Profiler::wake();
     }
 }
 
@@ -251,6 +148,14 @@ extern "C" {
 }
 
 void app_main(void) {
-    Time t = Time();
-    xTaskCreate(&buttonTask, "buttonTask", 2048, (void *) &t, 1, NULL);
+#if LOW_POWER_IDLE
+    LightSleep::begin();  // Held off until the inputs are suspended
+#endif
+    Console::begin(CONSOLE_POLICY);  // displayTask hands its frames over to consoleTask, never waiting for the UART
+    Time::screen.setOutput(Console::stream());
+    InputRecorder::begin(INPUT_TRACE_PATH, BUTTON_PIN, USE_TOUCHPAD ? TOUCH_PIN : TOUCH_PAD_MAX);  // Built with -DRECORD_INPUTS=1 only (see InputRecorder.h)
+    if (LAP_LOG)
+        LapLog::begin();  // Nothing is kept if the partition table has no laplog partition
+    static Time t(DISPLAY_FPS, DISPLAY_CENTISECONDS, BINARY_TELEMETRY ? Time::TELEMETRY : Time::SCREEN);  // app_main returns right after creating the task: t may not live on its stack
+    TaskPlacement::create(TIMING_TASK, &buttonTask, "buttonTask", 2048, (void *) &t, 1);  // Core and priority: see TaskPlacement.h
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+//
+// bank_bench.cpp
+// Author: Francesco Mecatti
+// Host benchmark: cost of one StopwatchBank refresh with 1 to 256 lanes, all running and lapping now and then, one
+// refresh per second for an hour. Per lane the cost stays flat: a lane costs the same whatever the size of the bank.
+// Then a 64 lane bank runs for a minute on its own refresh task, so the report shows a single task waking up
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim.h"
+#include "StopwatchBank.h"
+
+#define SESSION_S       (3600)
+#define LAP_PERIOD_S    (30)  // Each lane laps every LAP_PERIOD_S, lanes out of phase
+#define US_PER_S        (1000000)
+#define TASK_LANES      (64)
+#define TASK_RUN_MS     (60000)
+
+static unsigned long sinkBytes = 0;
+
+static ssize_t countingWrite(void *cookie, const char *buffer, size_t size) {
+    (void) cookie; (void) buffer;
+    sinkBytes += size;
+    return size;
+}
+
+static FILE *sink = NULL;
+
+template <size_t N>
+static void measure(void) {
+    static StopwatchBank<N> bank(FakeClock::now);  // Static storage, as on target: 256 lanes do not fit a task stack
+    FakeClock::reset();
+    bank.setOutput(sink);
+    for (size_t i = 0; i < N; i++)
+        bank.start(i, (clock_us_t) i * 7919);  // Lanes started out of phase
+    sinkBytes = 0;
+    unsigned long rows = 0;
+    std::chrono::duration<double> cpu(0);
+    for (int s = 1; s <= SESSION_S; s++) {
+        FakeClock::advance(US_PER_S);
+        for (size_t i = s % LAP_PERIOD_S; i < N; i += LAP_PERIOD_S)
+            bank.lap(i, FakeClock::us);
+        auto start = std::chrono::steady_clock::now();
+        rows += bank.refresh(FakeClock::us);
+        cpu += std::chrono::steady_clock::now() - start;
+    }
+    double ns = cpu.count() / SESSION_S * 1e9;
+    printf("%6zu %12.0f %14.1f %12.1f %12.0f\n", N, ns, ns / N, (double) rows / SESSION_S, (double) sinkBytes / SESSION_S);
+}
+
+static void benchTask(void *pvParameters) {
+    printf("%d refreshes, all lanes running, a lap every %d s per lane\n", SESSION_S, LAP_PERIOD_S);
+    printf("%6s %12s %14s %12s %12s\n", "lanes", "ns/refresh", "ns/lane", "rows/refresh", "B/refresh");
+    measure<1>();
+    measure<2>();
+    measure<4>();
+    measure<8>();
+    measure<16>();
+    measure<32>();
+    measure<64>();
+    measure<128>();
+    measure<256>();
+
+    static StopwatchBank<TASK_LANES> bank;
+    bank.setOutput(sink);
+    bank.begin(1);
+    for (size_t i = 0; i < TASK_LANES; i++)
+        bank.start(i);
+    vTaskDelay(pdMS_TO_TICKS(TASK_RUN_MS));
+    printf("%d lanes for %d s: %lu frames from one refresh task\n", TASK_LANES, TASK_RUN_MS / 1000, bank.getFrames());
+    fflush(stdout);
+    simStop();
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xTaskCreate(&benchTask, "benchTask", 4096, NULL, 1, NULL);
+}
+
+int main(void) {
+    cookie_io_functions_t functions = {NULL, countingWrite, NULL, NULL};
+    sink = fopencookie(NULL, "w", functions);
+    setvbuf(sink, NULL, _IOFBF, 4096);
+    setenv("SIM_DURATION_MS", "1000000", 1);  // Upper bound, the bench stops the simulation when done
+    int status = simMain();
+    fclose(sink);
+    return status;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# bench.sh
+# Author: Francesco Mecatti
+# Replays the same input traces into the three stopwatch variants (polled, GPIO interrupt, GPIO + touch interrupt)
+# and compares press-to-lap latency, missed presses, CPU wakeups, time in light sleep and stack headroom.
+# Usage: host/bench.sh [build directory] [trace...]
+#
+
+BUILD=${1:-build}
+[ $# -gt 0 ] && shift
+TRACES=${*:-"$(dirname "$0")/traces/presses.trace $(dirname "$0")/traces/double_taps.trace $(dirname "$0")/traces/touch_drift.trace $(dirname "$0")/traces/idle.trace $(dirname "$0")/traces/bounces.trace $(dirname "$0")/traces/overlap.trace"}  # hall_noise.trace is for HallBench
+SKETCHES="Stopwatch ButtonInterruptStopwatch InputInterruptStopwatch"
+
+printf "%-20s %-26s %7s %6s %9s %9s %9s %10s %9s %10s\n" trace sketch presses missed "p50 [ms]" "p99 [ms]" "max [ms]" wakeups/s "sleep [%]" "stack free"
+for trace in $TRACES; do
+    for sketch in $SKETCHES; do
+        SIM_TRACE=$trace "$BUILD/$sketch" 2>&1 >/dev/null | awk -v trace="$(basename "$trace" .trace)" -v sketch="$sketch" '
+            /^--- sim:/ { seconds = $3 }
+            /^cpu:/     { wakeups = $2; stack = $7 }
+            /^light sleep:/ { sleep = sprintf("%.1f", seconds > 0 ? 100 * $3 / seconds : 0) }
+            /^latency:/ { presses = $2; missed = $4; p50 = $7; p99 = $10; max = $13 }
+            END         { printf "%-20s %-26s %7s %6s %9s %9s %9s %10s %9s %10s\n", trace, sketch, presses, missed, p50, p99, max, wakeups, sleep, stack }'
+    done
+done
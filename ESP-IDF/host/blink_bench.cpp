@@ -0,0 +1,89 @@
+//
+// blink_bench.cpp
+// Author: Francesco Mecatti
+// Host check of Blinker: for every pause the ChangeFrequency examples step through (PAUSE_MIN..PAUSE_MAX, doubling),
+// the blinker is retuned while running and the measured toggle intervals are compared with the requested half period.
+// The esp_timer callbacks run late by a random 0 to TIMER_JITTER_US (SIM_TIMER_JITTER_US, unless set already), as the
+// esp_timer task does on the device: each interval may be off by that much, but the toggles must not drift, so the
+// last one must still come within TIMER_JITTER_US of where whole half periods put it.
+// Exits with 1 if an interval or the drift is off by more than that
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim.h"
+#include "Blinker.h"
+
+#define LED_PIN         (gpio_num_t) (2)
+#define PAUSE_MIN       (1)  // ms, as in ChangeFrequency.cpp
+#define PAUSE_MAX       (4096)
+#define US_PER_MS       (1000)
+#define TOGGLES         (20)  // Measured per pause
+#define TIMER_JITTER_US (50)  // Default esp_timer dispatch latency, from the alarm to the callback
+
+static std::vector<int64_t> edges;
+static int failures = 0;
+static int64_t toleranceUs = 0;
+
+static void recordEdge(gpio_num_t gpio_num, int level, int64_t time) {
+    if (gpio_num == LED_PIN)
+        edges.push_back(time);
+}
+
+static void measure(Blinker &led, int pause) {
+    int64_t requested = (int64_t) pause * US_PER_MS;
+    led.setHalfPeriod(requested);
+    edges.clear();
+    vTaskDelay(pdMS_TO_TICKS((TOGGLES + 1) * pause) + 1);  // The first edge comes one new half period after the retune
+    int64_t minUs = INT64_MAX, maxUs = 0, sumUs = 0, worstError = 0;
+    size_t intervals = edges.size() - 1;
+    int64_t drift = llabs(edges.back() - edges.front() - (int64_t) intervals * requested);
+    for (size_t i = 1; i < edges.size(); i++) {
+        int64_t interval = edges[i] - edges[i - 1];
+        minUs = interval < minUs ? interval : minUs;
+        maxUs = interval > maxUs ? interval : maxUs;
+        sumUs += interval;
+        int64_t error = llabs(interval - requested);
+        worstError = error > worstError ? error : worstError;
+    }
+    bool ok = intervals >= TOGGLES - 1 && worstError <= toleranceUs && drift <= toleranceUs;
+    failures += !ok;
+    printf("%9d %14lld %9zu %12.1f %10lld %10lld %14lld %10lld  %s\n", pause, (long long) requested, intervals,
+           intervals > 0 ? (double) sumUs / intervals : 0.0, (long long) minUs, (long long) maxUs, (long long) worstError,
+           (long long) drift, ok ? "ok" : "FAIL");
+}
+
+static void benchTask(void *pvParameters) {
+    Blinker led(LED_PIN, PAUSE_MIN * US_PER_MS);
+    simSetGpioObserver(recordEdge);
+    led.start();
+    printf("timer callbacks up to %lld us late\n", (long long) toleranceUs);
+    printf("%9s %14s %9s %12s %10s %10s %14s %10s\n", "pause[ms]", "requested[us]", "intervals", "mean[us]", "min[us]", "max[us]",
+           "max error[us]", "drift[us]");
+    for (int pause = PAUSE_MIN; pause <= PAUSE_MAX; pause *= 2)
+        measure(led, pause);
+    for (int pause = PAUSE_MAX / 2; pause >= PAUSE_MIN; pause /= 2)  // Back down, as the examples do
+        measure(led, pause);
+    led.stop();
+    printf("%s\n", failures == 0 ? "all periods within the timer latency, no drift" : "some periods out of tolerance");
+    fflush(stdout);
+    simStop(failures != 0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xTaskCreate(&benchTask, "benchTask", 4096, NULL, 1, NULL);
+}
+
+int main(void) {
+    setenv("SIM_DURATION_MS", "1000000", 1);  // Upper bound, the bench stops the simulation when done
+    char jitter[24];
+    snprintf(jitter, sizeof(jitter), "%d", TIMER_JITTER_US);
+    setenv("SIM_TIMER_JITTER_US", jitter, 0);
+    toleranceUs = std::max(atoll(getenv("SIM_TIMER_JITTER_US")), 0LL);
+    return simMain();
+}
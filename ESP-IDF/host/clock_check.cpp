@@ -0,0 +1,114 @@
+//
+// clock_check.cpp
+// Author: Francesco Mecatti
+// Host check of the clock-derived stopwatch (include/Time.h) against the tick-counting counterTask it replaced, with a
+// higher priority task stealing LOAD_US of CPU every LOAD_PERIOD_MS. The old loop adds a centisecond per 10 ms
+// vTaskDelay, so every scheduling delay is lost for good; Time reads FakeClock (include/ClockSource.h), kept in step
+// with the virtual clock by this check, and must show no drift at any step. Running at DISPLAY_FPS, displayTask must
+// wake once per frame and nothing else may; once stopped, nothing may read the clock at all.
+// Exits with 1 on a failed check
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim.h"
+#include "Time.h"
+
+#define RUN_S           (60)
+#define STOPPED_S       (10)
+#define STEP_MS         (100)  // Drift checked this often
+#define DISPLAY_FPS     (1)
+#define LOAD_PERIOD_MS  (37)
+#define LOAD_US         (12000)
+
+static int failures = 0;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line) {
+    if (condition)
+        return;
+    printf("line %d: %s failed\n", line, text);
+    failures++;
+}
+
+static volatile unsigned long legacyCentiseconds = 0, legacyWakeups = 0;
+
+// Time::counterTask as it was: one centisecond per wakeup
+static void legacyCounterTask(void *pvParameter) {
+    while (true) {
+        legacyCentiseconds++;
+        legacyWakeups++;
+        vTaskDelay(10 / portTICK_PERIOD_MS);  // 10 ms, namely 1 cs
+    }
+}
+
+static void loadTask(void *pvParameter) {
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(LOAD_PERIOD_MS));
+        simCompute(LOAD_US);
+    }
+}
+
+static void syncClock(void) {  // FakeClock follows the virtual clock, by hand
+    FakeClock::advance(simNow() - FakeClock::us);
+}
+
+static void checkTask(void *pvParameters) {
+    Time::screen.setOutput(fopen("/dev/null", "w"));  // Only the results on stdout
+    FakeClock::reset();
+    syncClock();
+    Time::clockSource = FakeClock::now;
+    static Time t(DISPLAY_FPS);
+    xTaskCreate(&loadTask, "loadTask", 2048, NULL, 2, NULL);
+
+    vTaskDelay(pdMS_TO_TICKS(STEP_MS));  // displayTask drew its first frame and sleeps
+    syncClock();
+    clock_us_t started = FakeClock::us;
+    unsigned long frames = Time::getDisplayStats().frames;
+    t.start(started);
+    xTaskCreate(&legacyCounterTask, "counterTask", 2048, NULL, 1, NULL);
+    clock_us_t maxDrift = 0;
+    for (int step = 0; step < RUN_S * 1000 / STEP_MS; step++) {
+        vTaskDelay(pdMS_TO_TICKS(STEP_MS));
+        syncClock();
+        clock_us_t drift = (FakeClock::us - started) / Time::US_PER_CS - (clock_us_t) Time::getCentiseconds();
+        maxDrift = drift > maxDrift ? drift : -drift > maxDrift ? -drift : maxDrift;
+    }
+    long runFrames = (long) (Time::getDisplayStats().frames - frames);
+    clock_us_t trueCs = (FakeClock::us - started) / Time::US_PER_CS;
+    unsigned long legacy = legacyCentiseconds, wakeups = legacyWakeups;
+    long legacyDrift = (long) trueCs - (long) legacy;
+
+    t.stop(FakeClock::us);
+    vTaskDelay(pdMS_TO_TICKS(STEP_MS));  // The frame showing the stop
+    unsigned long reads = FakeClock::reads;
+    frames = Time::getDisplayStats().frames;
+    vTaskDelay(pdMS_TO_TICKS(STOPPED_S * 1000));
+    unsigned long stoppedReads = FakeClock::reads - reads, stoppedFrames = Time::getDisplayStats().frames - frames;
+
+    printf("%d s running with %d us of higher priority work every %d ms:\n"
+           "counterTask: %lu wakeups, %ld cs behind (%.2f%%)\n"
+           "clock-derived: %ld frames at %d fps, max drift %lld cs; stopped %d s: %lu frames, %lu clock reads\n",
+           RUN_S, LOAD_US, LOAD_PERIOD_MS, wakeups, legacyDrift, 100.0 * legacyDrift / trueCs, runFrames, DISPLAY_FPS,
+           (long long) maxDrift, STOPPED_S, stoppedFrames, stoppedReads);
+    CHECK(maxDrift == 0);
+    CHECK(runFrames >= RUN_S * DISPLAY_FPS && runFrames <= RUN_S * DISPLAY_FPS + 1);  // Plus the frame of the start
+    CHECK(stoppedFrames == 0 && stoppedReads == 0);
+    CHECK(legacyDrift > 0 && wakeups == legacy);  // The load delays the old loop, which loses the time
+    printf("%s\n", failures == 0 ? "all clock checks passed" : "some clock checks failed");
+    fflush(stdout);
+    simStop(failures != 0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xTaskCreate(&checkTask, "checkTask", 4096, NULL, 3, NULL);
+}
+
+int main(void) {
+    setenv("SIM_DURATION_MS", "1000000", 1);  // Upper bound, the check stops the simulation when done
+    return simMain();
+}
@@ -0,0 +1,320 @@
+//
+// console_bench.cpp
+// Author: Francesco Mecatti
+// Host check of the buffered console writer (include/Console.h) against a throttled serial monitor: the sink runs at
+// 115200 baud, stalls for 4 s (monitor not reading), runs at 2400 baud, then recovers. Two programs are run, writing
+// straight to the sink as before and through the Console with each policy:
+// - status: a 10 ms polling loop that redraws a counter in place every 50 ms, as ChangeFrequency does
+// - screen: the stopwatch at 25 fps with centiseconds, a lap every 250 ms taken by a 10 ms polling loop
+// The loop must wake up on time whatever the sink does (no iteration more than a tick late) and the terminal, replayed
+// from the bytes the sink received, must end up showing the same as the program. Exits with 1 on a failed check
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sim.h"
+#include "Time.h"
+
+#define LOOP_PERIOD_MS  (10)
+#define STATUS_EVERY    (5)  // Loop iterations per status update
+#define LAP_EVERY       (25)  // Loop iterations per lap
+#define LATE_US         (1000)  // An iteration woken later than this (one tick) is late
+#define RUN_MS          (16000)
+#define SETTLE_MS       (3000)  // After the run, for the console to drain
+#define STATUS_PREFIX   "Value: "
+#define STATUS_WIDTH    (10)
+
+typedef struct {
+    clock_us_t until;  // Phase end, from the start of the run
+    unsigned int bytesPerSecond;  // 0: stalled
+} SinkPhase;
+
+static const SinkPhase PHASES[] = {{4000000, 11520}, {8000000, 0}, {12000000, 240}, {RUN_MS * 1000LL, 11520}};
+static const char BACKSPACES[] = "\b\b\b\b\b\b\b\b\b\b";
+
+// Just enough of a VT100 to replay what Renderer and the status line send
+struct Terminal {
+    static const unsigned int ROWS = Time::SCREEN_ROWS, COLS = 80;
+    char text[ROWS][COLS];
+    CellStyle style[ROWS][COLS];
+    unsigned int row, col;
+    CellStyle current;
+    char escape[16];
+    size_t escapeLength;
+
+    void reset(void) {
+        memset(text, ' ', sizeof(text));
+        for (unsigned int r = 0; r < ROWS; r++)
+            for (unsigned int c = 0; c < COLS; c++)
+                style[r][c] = PLAIN;
+        row = col = 0;
+        current = PLAIN;
+        escapeLength = 0;
+    }
+
+    void control(void) {
+        char final = escape[escapeLength - 1];
+        escape[escapeLength - 1] = '\0';
+        const char *params = escape + 2;  // After "\e["
+        if (final == 'H') {
+            unsigned int r = 1, c = 1;
+            sscanf(params, "%u;%u", &r, &c);
+            row = r - 1;
+            col = c - 1;
+        }
+        else if (final == 'J' && strcmp(params, "2") == 0) {
+            memset(text, ' ', sizeof(text));
+            for (unsigned int r = 0; r < ROWS; r++)
+                for (unsigned int c = 0; c < COLS; c++)
+                    style[r][c] = PLAIN;
+        }
+        else if (final == 'm') {
+            current = strcmp(params, "104") == 0 ? HIGHLIGHT : PLAIN;
+        }
+        escapeLength = 0;  // Anything else (cursor shown or hidden) changes nothing here
+    }
+
+    void feed(const char *data, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            char c = data[i];
+            if (escapeLength > 0) {
+                escape[escapeLength++] = c;
+                if ((escapeLength > 2 && ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))) || escapeLength == sizeof(escape))
+                    control();
+            }
+            else if (c == '\e') {
+                escape[escapeLength++] = c;
+            }
+            else if (c == '\b') {
+                if (col > 0)
+                    col--;
+            }
+            else if (row < ROWS && col < COLS) {
+                text[row][col] = c;
+                style[row][col++] = current;
+            }
+        }
+    }
+};
+
+typedef enum {DIRECT, THROUGH_CONSOLE} Path;
+
+typedef struct {
+    const char *name;
+    Path path;
+    ConsolePolicy policy;
+} Output;
+
+static const Output OUTPUTS[] = {
+    {"direct", DIRECT, CONSOLE_DROP_OLDEST},
+    {"drop oldest", THROUGH_CONSOLE, CONSOLE_DROP_OLDEST},
+    {"drop newest", THROUGH_CONSOLE, CONSOLE_DROP_NEWEST},
+    {"coalesce", THROUGH_CONSOLE, CONSOLE_COALESCE},
+};
+
+typedef struct {
+    bool screen;  // Stopwatch, otherwise status line
+    Output output;
+    Time *stopwatch;
+    unsigned long late;
+    clock_us_t maxLateUs;
+    unsigned long value;  // Last status value written
+} Run;
+
+static Terminal terminal;
+static FILE *sink = NULL;
+static clock_us_t runStart = 0;
+static unsigned long sinkBytes = 0;
+static int failures = 0;
+static SemaphoreHandle_t xLoopDone = NULL;
+
+// Time the sink takes to take size bytes from now, going through the phases
+static ssize_t throttledWrite(void *cookie, const char *buffer, size_t size) {
+    (void) cookie;
+    clock_us_t t = simNow() - runStart;
+    double remaining = size;
+    for (const SinkPhase &phase : PHASES) {
+        if (t >= phase.until || remaining <= 0)
+            continue;
+        if (phase.bytesPerSecond == 0) {
+            t = phase.until;
+            continue;
+        }
+        double fits = (double) (phase.until - t) * phase.bytesPerSecond / 1e6;
+        if (remaining <= fits) {
+            t += (clock_us_t) (remaining * 1e6 / phase.bytesPerSecond);
+            remaining = 0;
+        }
+        else {
+            remaining -= fits;
+            t = phase.until;
+        }
+    }
+    if (remaining > 0)
+        t += (clock_us_t) (remaining * 1e6 / PHASES[0].bytesPerSecond);
+    clock_us_t wait = runStart + t - simNow();
+    if (wait > 0)
+        vTaskDelay((TickType_t) ((wait + 999) / 1000));
+    terminal.feed(buffer, size);
+    sinkBytes += size;
+    return size;
+}
+
+static void check(bool condition, const Run &run, const char *text) {
+    if (!condition) {
+        printf("check failed (%s, %s): %s\n", run.screen ? "screen" : "status", run.output.name, text);
+        failures++;
+    }
+}
+
+static void updateStatus(Run &run, bool first) {
+    run.value++;
+    if (run.output.path == DIRECT) {
+        fprintf(sink, "%.*s%-*lu", first ? 0 : STATUS_WIDTH, BACKSPACES, STATUS_WIDTH, run.value);
+        fflush(sink);
+    }
+    else {
+        Console::printf("%.*s%-*lu", first ? 0 : STATUS_WIDTH, BACKSPACES, STATUS_WIDTH, run.value);
+    }
+}
+
+// The timing-sensitive task: polls every LOOP_PERIOD_MS, writes a status update or takes a lap now and then
+static void loopTask(void *pvParameters) {
+    Run &run = *(Run *) pvParameters;
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    clock_us_t expected = simNow();
+    for (unsigned long i = 0; (i + 1) * LOOP_PERIOD_MS <= RUN_MS; i++) {
+        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(LOOP_PERIOD_MS));
+        expected += LOOP_PERIOD_MS * 1000;
+        clock_us_t late = simNow() - expected;
+        if (late > LATE_US)
+            run.late++;
+        if (late > run.maxLateUs)
+            run.maxLateUs = late;
+        if (run.screen && i % LAP_EVERY == 0)
+            run.stopwatch->addLap();
+        else if (!run.screen && i % STATUS_EVERY == 0)
+            updateStatus(run, false);
+    }
+    xSemaphoreGive(xLoopDone);
+    vTaskDelete(NULL);
+}
+
+static bool screenMatches(void) {
+    for (unsigned int r = 0; r < Time::SCREEN_ROWS; r++)
+        for (unsigned int c = 0; c < Time::SCREEN_COLS; c++)
+            if (terminal.text[r][c] != Time::screen.getText(r, c) || terminal.style[r][c] != Time::screen.getStyle(r, c))
+                return false;
+    return true;
+}
+
+static bool statusMatches(unsigned long value) {
+    char expected[STATUS_WIDTH + sizeof(STATUS_PREFIX)];
+    snprintf(expected, sizeof(expected), STATUS_PREFIX "%-*lu", STATUS_WIDTH, value);
+    return strncmp(terminal.text[0], expected, strlen(expected)) == 0;
+}
+
+static void runOnce(Run &run) {
+    terminal.reset();
+    sinkBytes = 0;
+    runStart = simNow();
+    FILE *out = sink;
+    if (run.output.path == THROUGH_CONSOLE) {
+        Console::setOutput(sink);
+        Console::begin(run.output.policy);
+        out = Console::stream();
+    }
+    DisplayStats displayBefore = Time::getDisplayStats();
+    unsigned long deferredBefore = Time::screen.getDeferred();
+    bool shown;
+    {
+        Time::screen.setOutput(out);
+        if (run.screen) {
+            run.stopwatch = new Time(25, true);
+            run.stopwatch->start();
+        }
+        else if (run.output.path == DIRECT) {
+            fprintf(sink, STATUS_PREFIX);
+            updateStatus(run, true);
+        }
+        else {
+            Console::printf(STATUS_PREFIX);
+            updateStatus(run, true);
+        }
+        xTaskCreate(&loopTask, "loopTask", 2048, &run, 1, NULL);
+        xSemaphoreTake(xLoopDone, portMAX_DELAY);
+        if (run.screen) {
+            run.stopwatch->stop();
+            vTaskDelay(pdMS_TO_TICKS(SETTLE_MS));
+            Time::updateTime();  // One more frame, with all the room it needs
+        }
+        vTaskDelay(pdMS_TO_TICKS(SETTLE_MS));
+        shown = run.screen ? screenMatches() : statusMatches(run.value);
+        if (run.screen) {
+            Time::screen.setOutput(fopen("/dev/null", "w"));  // No closing sequences on the replayed terminal
+            delete run.stopwatch;
+        }
+    }
+    DisplayStats display = Time::getDisplayStats();
+    ConsoleStats console = Console::getStats();
+    if (run.output.path == THROUGH_CONSOLE) {
+        check(Console::isIdle(), run, "console drained");
+        Console::end();
+    }
+    else {
+        console = {};
+    }
+
+    char skipped[16] = "-", deferred[16] = "-";
+    if (run.screen) {
+        snprintf(skipped, sizeof(skipped), "%lu", display.dropped - displayBefore.dropped);
+        snprintf(deferred, sizeof(deferred), "%lu", Time::screen.getDeferred() - deferredBefore);
+    }
+    printf("%-8s %-12s %6lu %14.1f %8s %9s %10lu %8lu %10lu %9zu  %s\n", run.screen ? "screen" : "status", run.output.name,
+           run.late, run.maxLateUs / 1000.0, skipped, deferred, sinkBytes, console.dropped, console.coalesced,
+           console.maxFill, shown ? "ok" : "MISMATCH");
+
+    check(shown, run, "the terminal shows what the program drew");
+    if (run.output.path == THROUGH_CONSOLE) {
+        check(run.late == 0, run, "the loop wakes up on time");
+        if (run.screen)
+            check(console.dropped == 0, run, "the screen holds back what does not fit instead of losing it");
+        else
+            check(console.dropped > 0, run, "the throttled sink made the policy drop updates");
+    }
+}
+
+static void benchTask(void *pvParameters) {
+    printf("sink: %u B/s for %d s, stalled for %d s, %u B/s for %d s, then %u B/s; loop every %d ms\n",
+           PHASES[0].bytesPerSecond, (int) (PHASES[0].until / 1000000), (int) ((PHASES[1].until - PHASES[0].until) / 1000000),
+           PHASES[2].bytesPerSecond, (int) ((PHASES[2].until - PHASES[1].until) / 1000000), PHASES[3].bytesPerSecond, LOOP_PERIOD_MS);
+    printf("%-8s %-12s %6s %14s %8s %9s %10s %8s %10s %9s  %s\n", "program", "output", "late", "max late [ms]", "skipped",
+           "deferred", "bytes out", "dropped", "coalesced", "max fill", "terminal");
+    for (int screen = 0; screen < 2; screen++) {
+        for (const Output &output : OUTPUTS) {
+            Run run = {screen == 1, output, NULL, 0, 0, 0};
+            runOnce(run);
+        }
+    }
+    printf("%s\n", failures == 0 ? "all console checks passed" : "some console checks failed");
+    fflush(stdout);
+    simStop(failures != 0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    cookie_io_functions_t functions = {NULL, throttledWrite, NULL, NULL};
+    sink = fopencookie(NULL, "w", functions);
+    setvbuf(sink, NULL, _IOFBF, 4096);
+    xLoopDone = xSemaphoreCreateBinary();
+    xTaskCreate(&benchTask, "benchTask", 4096, NULL, 2, NULL);
+}
+
+int main(void) {
+    setenv("SIM_DURATION_MS", "10000000", 1);  // Upper bound, the bench stops the simulation when done
+    return simMain();
+}
@@ -0,0 +1,198 @@
+//
+// debounce_bench.cpp
+// Author: Francesco Mecatti
+// Host check and benchmark of Debouncer on synthetic contact bounce. A seeded stimulus drives the button pin from a
+// one-shot esp_timer chain: presses and releases held for HOLD_MIN_US..HOLD_MAX_US, each starting with a burst of
+// bounces (toggles every BOUNCE_STEP_MIN_US..BOUNCE_STEP_MAX_US for up to BOUNCE_MAX_US), and glitches of
+// GLITCH_MIN_US..GLITCH_MAX_US on the steady level in between. The same stimulus goes through every settle time,
+// 0 being the unfiltered ANYEDGE path of the interrupt sketches, and a consumer task drains the events as buttonTask does.
+// Reported: edges at the pin, ISR invocations, timer callbacks, events delivered, consumer wakeups, events that are not
+// the true transition at their position (wrong level, or not stamped at its first edge) and delivery latency.
+// Exits with 1 unless DEFAULT_SETTLE_US delivers exactly the true transitions
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sim.h"
+#include "Debouncer.h"
+#include "EventQueue.h"
+
+#define BUTTON_PIN          (gpio_num_t) (0)
+#define TRANSITIONS         (400)  // Presses and releases
+#define HOLD_MIN_US         (40000)
+#define HOLD_MAX_US         (400000)
+#define BOUNCE_MAX_US       (2500)  // Bursts end within this plus one step
+#define BOUNCE_STEP_MIN_US  (20)
+#define BOUNCE_STEP_MAX_US  (500)
+#define GLITCH_MIN_US       (5)
+#define GLITCH_MAX_US       (100)
+#define DEFAULT_SETTLE_US   (5000)  // BUTTON_SETTLE_US of the interrupt sketches
+#define SEED                (21)
+
+typedef struct {
+    int64_t at;  // From the start of the stimulus
+    int level;
+} Step;
+
+typedef struct {
+    int level;
+    int64_t firstEdge;
+} Transition;
+
+static const uint32_t SETTLES_US[] = {0, 500, 1000, 2000, DEFAULT_SETTLE_US};
+
+static std::vector<Step> steps;
+static std::vector<Transition> truth;
+static unsigned long glitchesInjected = 0;
+static size_t nextStep = 0;
+static int64_t stimulusStart = 0;
+static esp_timer_handle_t stimulus = NULL;
+
+static EventQueue<InputEvent, 1024> events;
+static SemaphoreHandle_t xEvents = NULL;
+static std::vector<InputEvent> received;
+static std::vector<int64_t> latencies;
+static unsigned long wakeups = 0;
+static Debouncer debouncer;
+
+static int64_t uniform(std::mt19937 &rng, int64_t min, int64_t max) {
+    return min + (int64_t) (rng() % (uint32_t) (max - min + 1));
+}
+
+static void schedule(std::mt19937 &rng) {
+    steps.clear();
+    truth.clear();
+    glitchesInjected = 0;
+    int64_t t = 0;
+    int level = 1;
+    for (int i = 0; i < TRANSITIONS; i++) {
+        int64_t hold = uniform(rng, HOLD_MIN_US, HOLD_MAX_US);
+        if (rng() % 2 == 0) {  // Well after the last burst has settled, and well before the next one
+            int64_t at = t + uniform(rng, hold / 4, hold / 2);
+            steps.push_back({at, !level});
+            steps.push_back({at + uniform(rng, GLITCH_MIN_US, GLITCH_MAX_US), level});
+            glitchesInjected++;
+        }
+        t += hold;
+        level = !level;
+        truth.push_back({level, t});
+        steps.push_back({t, level});
+        int64_t end = t + uniform(rng, 0, BOUNCE_MAX_US), at = t;
+        int bounced = level;
+        while ((at += uniform(rng, BOUNCE_STEP_MIN_US, BOUNCE_STEP_MAX_US)) < end) {
+            bounced = !bounced;
+            steps.push_back({at, bounced});
+        }
+        if (bounced != level)
+            steps.push_back({at, level});
+    }
+}
+
+// Apply the steps due, then wait for the next one
+static void stimulate(void *arg) {
+    int64_t now = simNow() - stimulusStart;
+    while (nextStep < steps.size() && steps[nextStep].at <= now)
+        simSetGpioInput(BUTTON_PIN, steps[nextStep++].level);
+    if (nextStep < steps.size())
+        esp_timer_start_once(stimulus, (uint64_t) (steps[nextStep].at - now));
+}
+
+// As buttonHandler in the interrupt sketches
+static void handler(void *arg, int level, clock_us_t timestamp) {
+    events.push({BUTTON_INPUT, (uint8_t) level, timestamp});
+    xSemaphoreGiveFromISR(xEvents, NULL);
+}
+
+static void consumerTask(void *pvParameters) {
+    InputEvent batch[8];
+    while (true) {
+        xSemaphoreTake(xEvents, portMAX_DELAY);
+        wakeups++;
+        size_t n;
+        while ((n = events.pop(batch, 8)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                received.push_back(batch[i]);
+                latencies.push_back(simNow() - batch[i].timestamp);
+            }
+        }
+    }
+}
+
+// Events that are not the true transition at their position, plus the transitions never delivered
+static size_t countWrong(void) {
+    size_t wrong = 0;
+    for (size_t i = 0; i < received.size(); i++) {
+        if (i >= truth.size() || received[i].level != truth[i].level || received[i].timestamp != stimulusStart + truth[i].firstEdge)
+            wrong++;
+    }
+    return wrong + (truth.size() > received.size() ? truth.size() - received.size() : 0);
+}
+
+static bool run(uint32_t settleUs) {
+    std::mt19937 rng(SEED);  // Same stimulus for every settle time
+    schedule(rng);
+    received.clear();
+    latencies.clear();
+    wakeups = 0;
+    nextStep = 0;
+    unsigned long overflows = events.getOverflows();
+    simSetGpioInput(BUTTON_PIN, 1);
+    debouncer.begin(BUTTON_PIN, settleUs, &handler);
+    stimulusStart = simNow() + 1000;
+    esp_timer_start_once(stimulus, 1000 + steps[0].at);
+    vTaskDelay(pdMS_TO_TICKS((steps.back().at + 1000) / 1000 + 50));
+    DebounceStats stats = debouncer.getStats();
+    debouncer.end();
+
+    size_t wrong = countWrong();
+    int64_t maxLatency = 0, sumLatency = 0;
+    for (int64_t latency : latencies) {
+        maxLatency = latency > maxLatency ? latency : maxLatency;
+        sumLatency += latency;
+    }
+    printf("%11u %10lu %10lu %10zu %8lu %8zu %9lu %10.3f %10.3f\n", (unsigned int) settleUs, stats.interrupts, stats.settles,
+           received.size(), wakeups, wrong, stats.glitches, latencies.empty() ? 0.0 : sumLatency / 1000.0 / latencies.size(),
+           maxLatency / 1000.0);
+    return received.size() == truth.size() && wrong == 0 && events.getOverflows() == overflows;
+}
+
+static void benchTask(void *pvParameters) {
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &stimulate;
+    timerArgs.dispatch_method = ESP_TIMER_TASK;
+    timerArgs.name = "stimulus";
+    esp_timer_create(&timerArgs, &stimulus);
+    xEvents = xSemaphoreCreateBinary();
+    xTaskCreate(&consumerTask, "consumerTask", 2048, NULL, 2, NULL);
+
+    std::mt19937 rng(SEED);
+    schedule(rng);
+    printf("%d transitions, %zu edges at the pin, %lu glitches of %d-%d us, bounce bursts up to %d us\n", TRANSITIONS,
+           steps.size(), glitchesInjected, GLITCH_MIN_US, GLITCH_MAX_US, BOUNCE_MAX_US + BOUNCE_STEP_MAX_US);
+    printf("%11s %10s %10s %10s %8s %8s %9s %10s %10s\n", "settle [us]", "interrupts", "timer cbs", "events", "wakeups",
+           "wrong", "glitches", "mean [ms]", "max [ms]");
+    bool passed = false;
+    for (uint32_t settleUs : SETTLES_US) {
+        bool exact = run(settleUs);
+        if (settleUs == DEFAULT_SETTLE_US)
+            passed = exact;
+    }
+    printf("%s\n", passed ? "default settle time delivers every transition once" : "default settle time is wrong");
+    fflush(stdout);
+    simStop(passed ? 0 : 1);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xTaskCreate(&benchTask, "benchTask", 4096, NULL, 1, NULL);
+}
+
+int main(void) {
+    setenv("SIM_DURATION_MS", "1000000", 1);  // Upper bound; the bench stops the simulation when done
+    return simMain();
+}
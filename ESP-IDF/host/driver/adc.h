@@ -0,0 +1,19 @@
+//
+// driver/adc.h
+// Author: Francesco Mecatti
+// Host simulator: subset of ESP-IDF ADC driver. The hall sensor value is driven by the simulator trace
+//
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hall_sensor_read(void);
+
+#ifdef __cplusplus
+}
+#endif
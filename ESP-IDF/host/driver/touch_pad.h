@@ -0,0 +1,45 @@
+//
+// driver/touch_pad.h
+// Author: Francesco Mecatti
+// Host simulator: subset of ESP-IDF touch pad driver. Pad readings are driven by the simulator trace
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_bit_defs.h"
+#include "esp_intr_alloc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    TOUCH_PAD_NUM0 = 0, TOUCH_PAD_NUM1, TOUCH_PAD_NUM2, TOUCH_PAD_NUM3, TOUCH_PAD_NUM4,
+    TOUCH_PAD_NUM5, TOUCH_PAD_NUM6, TOUCH_PAD_NUM7, TOUCH_PAD_NUM8, TOUCH_PAD_NUM9,
+    TOUCH_PAD_MAX
+} touch_pad_t;
+
+typedef enum {
+    TOUCH_TRIGGER_BELOW = 0,  // Interrupt when the reading drops below the threshold (pad touched)
+    TOUCH_TRIGGER_ABOVE = 1,  // Interrupt when the reading rises above the threshold (pad released)
+    TOUCH_TRIGGER_MAX
+} touch_trigger_mode_t;
+
+esp_err_t touch_pad_init(void);
+esp_err_t touch_pad_config(touch_pad_t touch_num, uint16_t threshold);
+esp_err_t touch_pad_read(touch_pad_t touch_num, uint16_t *touch_value);
+esp_err_t touch_pad_read_raw_data(touch_pad_t touch_num, uint16_t *touch_value);
+esp_err_t touch_pad_read_filtered(touch_pad_t touch_num, uint16_t *touch_value);
+esp_err_t touch_pad_filter_start(uint32_t filter_period_ms);
+esp_err_t touch_pad_set_trigger_mode(touch_trigger_mode_t mode);
+esp_err_t touch_pad_isr_register(intr_handler_t fn, void *arg);
+esp_err_t touch_pad_intr_enable(void);
+esp_err_t touch_pad_intr_disable(void);
+uint32_t touch_pad_get_status(void);
+esp_err_t touch_pad_clear_status(void);
+
+#ifdef __cplusplus
+}
+#endif
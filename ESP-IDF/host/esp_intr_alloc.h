@@ -0,0 +1,12 @@
+//
+// esp_intr_alloc.h
+// Author: Francesco Mecatti
+// Host simulator: subset of ESP-IDF esp_intr_alloc.h
+//
+
+#pragma once
+
+#define ESP_INTR_FLAG_LEVEL1    (1<<1)
+#define ESP_INTR_FLAG_IRAM      (1<<10)
+
+typedef void (*intr_handler_t)(void *arg);
@@ -0,0 +1,52 @@
+//
+// esp_partition.h
+// Author: Francesco Mecatti
+// Host simulator: subset of ESP-IDF esp_partition.h. One data partition of NOR flash, in memory or in the file given
+// in SIM_FLASH (see README.md)
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define ESP_ERR_INVALID_SIZE    (0x104)
+#define SPI_FLASH_SEC_SIZE      (4096)  // Erase unit; esp_spi_flash.h on the device
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+    ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    void *flash_chip;
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+// NOR flash: programming only clears bits, so writing over data already written ANDs the two
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+// offset and size: multiples of SPI_FLASH_SEC_SIZE
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
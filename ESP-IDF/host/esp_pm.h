@@ -0,0 +1,38 @@
+//
+// esp_pm.h
+// Author: Francesco Mecatti
+// Host simulator: subset of ESP-IDF esp_pm.h. With light_sleep_enable the simulator counts every idle stretch of at
+// least SIM_SLEEP_MIN_IDLE_TICKS as light sleep, unless an ESP_PM_NO_LIGHT_SLEEP lock is held
+//
+
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int max_freq_mhz;
+    int min_freq_mhz;
+    bool light_sleep_enable;
+} esp_pm_config_esp32_t;
+
+typedef enum {
+    ESP_PM_CPU_FREQ_MAX,
+    ESP_PM_APB_FREQ_MAX,
+    ESP_PM_NO_LIGHT_SLEEP
+} esp_pm_lock_type_t;
+
+typedef struct esp_pm_lock *esp_pm_lock_handle_t;
+
+esp_err_t esp_pm_configure(const void *config);
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char *name, esp_pm_lock_handle_t *out_handle);
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle);
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
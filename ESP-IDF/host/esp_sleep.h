@@ -0,0 +1,21 @@
+//
+// esp_sleep.h
+// Author: Francesco Mecatti
+// Host simulator: subset of ESP-IDF esp_sleep.h. Wakeup sources only matter for the report: an interrupt raised during
+// light sleep by a source that is not one of them is counted as lost, as it would be on the device
+//
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void);  // Pins chosen with gpio_wakeup_enable
+esp_err_t esp_sleep_enable_touchpad_wakeup(void);
+
+#ifdef __cplusplus
+}
+#endif
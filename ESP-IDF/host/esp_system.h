@@ -0,0 +1,20 @@
+//
+// esp_system.h
+// Author: Francesco Mecatti
+// Host simulator: subset of ESP-IDF esp_system.h
+//
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// newlib extension used by the examples, missing from glibc
+char *itoa(int value, char *str, int base);
+
+#ifdef __cplusplus
+}
+#endif
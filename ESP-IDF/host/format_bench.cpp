@@ -0,0 +1,196 @@
+//
+// format_bench.cpp
+// Author: Francesco Mecatti
+// Host check and microbenchmark of include/TimeFormat.h against the code it replaced: computeTime plus snprintf for
+// the stopwatch time and laps, itoa plus per-character printf for the status value of the blink and dimmer examples.
+// The text must be the same as snprintf's for every value tried (with a day count from 24 h, 32 and 64-bit values), and
+// TimeText, driven by random microsecond steps (frames, jumps, day changes, going back), must always hold the whole
+// conversion of its value with nothing changed before the index it returns.
+// Exits with 1 on a mismatch
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include "esp_system.h"
+#include "TimeFormat.h"
+
+#define SEQUENTIAL      (1000000)  // Every value from 0: 2 h 46 min of centiseconds
+#define RANDOM          (500000)  // 32-bit values, and as many 64-bit ones
+#define WALK_STEPS      (2000000)
+#define BENCH_CALLS     (5000000)
+#define NUM_STR_LEN     (10)
+#define SESSION_S       (300000)  // 83 h: 1 fps values start again from 0 after this many calls
+#define US_PER_CS       (10000)
+#define DAY_US          ((uint64_t) 86400 * 1000000)
+
+static int failures = 0;
+static volatile unsigned long sink = 0;  // Keeps the benchmarked results alive
+
+// The whole text must be stored, even if the benchmark only reads one character
+static inline void keep(const void *buffer) {
+    asm volatile("" : : "r"(buffer) : "memory");
+}
+
+// Former Time::computeTime and drawTime/drawLap formatting
+namespace legacy {
+    unsigned int hh = 0, mm = 0, ss = 0, cs = 0;
+
+    void computeTime(unsigned long centiseconds) {
+        hh = centiseconds / (100*60*60);
+        mm = (centiseconds - hh*(100*60*60)) / (100*60);
+        ss = (centiseconds - hh*(100*60*60) - mm*(100*60)) / (100);
+        cs = (centiseconds - hh*(100*60*60) - mm*(100*60) - ss*(100));
+    }
+
+    void time(uint32_t centiseconds, char *buffer, size_t size) {
+        computeTime(centiseconds);
+        snprintf(buffer, size, "%02u:%02u:%02u.%02u", hh, mm, ss, cs);
+    }
+
+    void lap(uint32_t number, uint32_t centiseconds, char *buffer, size_t size) {
+        char text[16];
+        computeTime(centiseconds);
+        snprintf(text, sizeof(text), "(%u)", (unsigned int) number);
+        snprintf(buffer, size, "%-7s %02u:%02u:%02u.%02u", text, hh, mm, ss, cs);
+    }
+
+    void status(int val, FILE *out) {
+        char newString[NUM_STR_LEN];
+        itoa(val, newString, 10);
+        for (int i = 0; i < NUM_STR_LEN; i++) fprintf(out, "\b");
+        fprintf(out, newString);
+        for (int i = 0; i < NUM_STR_LEN-(int)strlen(newString); i++) fprintf(out, " ");
+    }
+}
+
+// As Time::drawLap builds its row
+static size_t lapLine(uint32_t number, uint32_t centiseconds, char *buffer) {
+    size_t n = 0;
+    buffer[n++] = '(';
+    n += TimeFormat::formatUnsigned(number, buffer + n);
+    buffer[n++] = ')';
+    while (n < 7)
+        buffer[n++] = ' ';
+    buffer[n++] = ' ';
+    return n + TimeFormat::format(centiseconds, buffer + n);
+}
+
+// As updateMonitor builds its message
+static size_t statusLine(uint32_t value, char *line) {
+    static const char BACKSPACES[] = "\b\b\b\b\b\b\b\b\b\b";
+    memcpy(line, BACKSPACES, NUM_STR_LEN);
+    size_t n = NUM_STR_LEN + TimeFormat::formatUnsigned(value, line + NUM_STR_LEN);
+    while (n < 2 * NUM_STR_LEN)
+        line[n++] = ' ';
+    return n;
+}
+
+static void compare(const char *what, uint64_t value, const char *got, const char *expected) {
+    if (strcmp(got, expected) != 0 && failures++ < 10)
+        printf("%s %" PRIu64 ": \"%s\", expected \"%s\"\n", what, value, got, expected);
+}
+
+// "[Nd ]hh:mm:ss", as snprintf writes it
+static int reference(uint64_t seconds, char *out, size_t size) {
+    uint64_t days = seconds / 86400;
+    unsigned int rest = (unsigned int) (seconds % 86400);
+    int n = days > 0 ? snprintf(out, size, "%" PRIu64 "d ", days) : 0;
+    return n + snprintf(out + n, size - n, "%02u:%02u:%02u", rest / 3600, rest / 60 % 60, rest % 60);
+}
+
+static void checkValue(uint64_t value) {
+    char got[64], expected[64];
+    int n = reference(value / 100, expected, sizeof(expected));
+    snprintf(expected + n, sizeof(expected) - n, ".%02u", (unsigned int) (value % 100));
+    TimeFormat::format(value, got);
+    compare("format", value, got, expected);
+    reference(value / 100, expected, sizeof(expected));
+    TimeFormat::format(value, got, false);
+    compare("format without centiseconds", value, got, expected);
+    if (value > UINT32_MAX)
+        return;
+    TimeFormat::formatSeconds(value, got);
+    reference(value, expected, sizeof(expected));
+    compare("formatSeconds", value, got, expected);
+    TimeFormat::formatUnsigned((uint32_t) value, got);
+    snprintf(expected, sizeof(expected), "%" PRIu64, value);
+    compare("formatUnsigned", value, got, expected);
+    if (value >= 100 * 86400)
+        return;  // The former code has no day count
+    lapLine((uint32_t) value % 100000 + 1, (uint32_t) value, got);
+    legacy::lap((uint32_t) value % 100000 + 1, (uint32_t) value, expected, sizeof(expected));
+    compare("lap", value, got, expected);
+}
+
+static void walk(std::mt19937_64 &rng, bool withCentiseconds) {
+    TimeText text(withCentiseconds);
+    char previous[TimeFormat::MAX_LENGTH + 1] = "", expected[TimeFormat::MAX_LENGTH + 1];
+    uint64_t value = 0;
+    for (unsigned long i = 0; i < WALK_STEPS; i++) {
+        switch (rng() % 8) {
+            case 0: value -= value < 10000000 ? value : rng() % 10000000; break;  // Reset or clock skew: back
+            case 1: value += rng() % 100000000; break;  // Up to 100 s
+            case 2:  // Anywhere in 2^40 us (12 days), or just before a day, or 9, 99 and 999 days, change
+                value = rng() % 2 == 0 ? rng() % ((uint64_t) 1 << 40) : DAY_US * (1 + rng() % 1000) - rng() % 2000000;
+                break;
+            case 3: value += 1000000; break;  // 1 fps
+            default: value += rng() % 50000; break;  // 25 fps and jitter
+        }
+        size_t first = text.set(value);
+        TimeFormat::format(value / US_PER_CS, expected, withCentiseconds);
+        compare("TimeText", value, text.c_str(), expected);
+        if (strncmp(previous, text.c_str(), first) != 0 && failures++ < 10)
+            printf("TimeText %" PRIu64 ": changed before index %zu (\"%s\" -> \"%s\")\n", value, first, previous, text.c_str());
+        strcpy(previous, text.c_str());
+    }
+}
+
+template <typename F>
+static double nsPerCall(F call) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BENCH_CALLS; i++)
+        call(i);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / BENCH_CALLS * 1e9;
+}
+
+int main(void) {
+    std::mt19937_64 rng(19);
+    for (uint32_t value = 0; value < SEQUENTIAL; value++)
+        checkValue(value);
+    for (int i = 0; i < RANDOM; i++) {
+        checkValue((uint32_t) rng());
+        checkValue(rng() >> 10);  // Days still fit 32 bits
+    }
+    checkValue(UINT32_MAX);
+    checkValue((uint64_t) INT64_MAX / US_PER_CS);  // Largest clock_us_t
+    walk(rng, true);
+    walk(rng, false);
+
+    FILE *null = fopen("/dev/null", "w");
+    char buffer[64];
+    TimeText text25, text1;
+    double legacyTime = nsPerCall([&](uint32_t i) { legacy::time(i * 4, buffer, sizeof(buffer)); keep(buffer); });
+    double fullTime = nsPerCall([&](uint32_t i) { TimeFormat::format(i * 4, buffer); keep(buffer); });
+    double frames25 = nsPerCall([&](uint32_t i) { sink += text25.set((uint64_t) i * 40000); keep(text25.c_str()); });
+    double legacySeconds = nsPerCall([&](uint32_t i) { legacy::time(i % SESSION_S * 100, buffer, sizeof(buffer)); keep(buffer); });
+    double frames1 = nsPerCall([&](uint32_t i) { sink += text1.set((uint64_t) (i % SESSION_S) * 1000000); keep(text1.c_str()); });
+    double legacyLap = nsPerCall([&](uint32_t i) { legacy::lap(i, i * 37, buffer, sizeof(buffer)); keep(buffer); });
+    double lap = nsPerCall([&](uint32_t i) { sink += lapLine(i, i * 37, buffer); keep(buffer); });
+    double legacyStatus = nsPerCall([&](uint32_t i) { legacy::status((int) (i & 4095), null); });
+    double status = nsPerCall([&](uint32_t i) { sink += fwrite(buffer, 1, statusLine(i & 4095, buffer), null); });
+    fclose(null);
+
+    printf("%-34s %10s %10s\n", "ns per call", "before", "after");
+    printf("%-34s %10.1f %10.1f\n", "hh:mm:ss.cs, whole conversion", legacyTime, fullTime);
+    printf("%-34s %10.1f %10.1f\n", "hh:mm:ss.cs, 25 fps refresh", legacyTime, frames25);
+    printf("%-34s %10.1f %10.1f\n", "hh:mm:ss.cs, 1 fps refresh", legacySeconds, frames1);
+    printf("%-34s %10.1f %10.1f\n", "lap row", legacyLap, lap);
+    printf("%-34s %10.1f %10.1f\n", "status value, written to a FILE", legacyStatus, status);
+    printf("%s\n", failures == 0 ? "all formatting checks passed" : "some formatting checks failed");
+    return failures == 0 ? 0 : 1;
+}
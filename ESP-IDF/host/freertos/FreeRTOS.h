@@ -0,0 +1,39 @@
+//
+// freertos/FreeRTOS.h
+// Author: Francesco Mecatti
+// Host simulator: FreeRTOS types and configuration used by the examples
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#ifndef configTICK_RATE_HZ
+#define configTICK_RATE_HZ  (1000)  // CONFIG_FREERTOS_HZ, see README.md
+#endif
+
+#define portTICK_PERIOD_MS  ((TickType_t) 1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS    portTICK_PERIOD_MS
+#define portMAX_DELAY       (TickType_t) 0xffffffffUL
+#define portNUM_PROCESSORS  (2)  // ESP32; the simulation runs SIM_CORES of them (see README.md)
+#define pdMS_TO_TICKS(xTimeInMs)    ((TickType_t) (((uint64_t) (xTimeInMs) * configTICK_RATE_HZ) / 1000))
+
+#define pdFALSE     ((BaseType_t) 0)
+#define pdTRUE      ((BaseType_t) 1)
+#define pdPASS      (pdTRUE)
+#define pdFAIL      (pdFALSE)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BaseType_t xPortGetCoreID(void);  // Core running the caller
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,26 @@
+//
+// freertos/semphr.h
+// Author: Francesco Mecatti
+// Host simulator: FreeRTOS binary semaphores and mutexes
+//
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sim_semaphore *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);  // No priority inheritance in the simulator
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t xSemaphore, BaseType_t *pxHigherPriorityTaskWoken);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,54 @@
+//
+// freertos/task.h
+// Author: Francesco Mecatti
+// Host simulator: FreeRTOS task API. Tasks are Linux threads scheduled one at a time on the virtual clock
+//
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*TaskFunction_t)(void *);
+typedef struct sim_task *TaskHandle_t;
+
+#define tskIDLE_PRIORITY    ((UBaseType_t) 0)
+#define tskNO_AFFINITY      ((BaseType_t) 0x7fffffff)  // Runs on either core
+
+typedef enum {eRunning = 0, eReady, eBlocked, eSuspended, eDeleted, eInvalid} eTaskState;
+
+// As in ESP-IDF (configUSE_TRACE_FACILITY, configGENERATE_RUN_TIME_STATS). The run time counter is the host CPU time
+// of the task thread in us, the total run time the virtual clock: only the share of each task is meaningful
+typedef struct {
+    TaskHandle_t xHandle;
+    const char *pcTaskName;
+    UBaseType_t xTaskNumber;
+    eTaskState eCurrentState;
+    UBaseType_t uxCurrentPriority;
+    UBaseType_t uxBasePriority;
+    uint32_t ulRunTimeCounter;
+    uint8_t *pxStackBase;
+    uint32_t usStackHighWaterMark;  // Bytes, as uxTaskGetStackHighWaterMark
+    BaseType_t xCoreID;
+} TaskStatus_t;
+
+// As in ESP-IDF, usStackDepth is expressed in bytes. xTaskCreate tasks have no core affinity
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask, BaseType_t xCoreID);
+void vTaskDelete(TaskHandle_t xTaskToDelete);
+void vTaskDelay(TickType_t xTicksToDelay);
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime, TickType_t xTimeIncrement);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask);
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *pxTaskStatusArray, const UBaseType_t uxArraySize, uint32_t *pulTotalRunTime);
+
+#define taskYIELD() vTaskDelay(0)
+
+#ifdef __cplusplus
+}
+#endif
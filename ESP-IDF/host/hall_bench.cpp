@@ -0,0 +1,142 @@
+//
+// hall_bench.cpp
+// Author: Francesco Mecatti
+// Host benchmark: Hall sensor press detection on a recorded (or generated) noise trace. The previous fixed-band check,
+// polled every 100 ms as Stopwatch.cpp did, runs next to HallSampler on the same readings; for both the ADC conversions
+// per second, detected, missed and false presses and the detection latency are printed.
+// Usage: HallBench <trace>, e.g. HallBench host/traces/hall_noise.trace
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "sim.h"
+#include "HallSampler.h"
+
+#define LEGACY_MIN          (-45)  // HALL_MIN_THRESH_NO_USE / HALL_MAX_THRESH_NO_USE of Stopwatch.cpp
+#define LEGACY_MAX          (-25)
+#define LEGACY_PERIOD_MS    (100)
+#define MATCH_WINDOW_US     (500000)  // A detection up to this long after a magnet onset belongs to it
+#define TAIL_MS             (1000)
+#define LED_PIN             (gpio_num_t) (2)  // Follows HallSampler, so the simulator report shows its latency too
+
+typedef struct {
+    const char *name;
+    std::vector<int64_t> detections;
+    unsigned long conversions;
+} Detector;
+
+static std::vector<int64_t> onsets;  // Trace readings tagged "press"
+static int64_t traceEnd = 0;
+static Detector legacy = {"fixed band, 100 ms poll", {}, 0};
+static Detector filtered = {"HallSampler", {}, 0};
+static SemaphoreHandle_t xHallEvents = NULL;
+
+static void loadOnsets(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "HallBench: cannot open %s\n", path);
+        exit(1);
+    }
+    char line[256], source[32], tag[32];
+    double ms;
+    int value;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#')
+            continue;
+        int fields = sscanf(line, "%lf %31s %d %31s", &ms, source, &value, tag);
+        if (fields < 3)
+            continue;
+        traceEnd = std::max(traceEnd, (int64_t) (ms * 1000));
+        if (fields == 4 && strcmp(source, "hall") == 0 && strcmp(tag, "press") == 0)
+            onsets.push_back((int64_t) (ms * 1000));
+    }
+    fclose(f);
+}
+
+// Previous detection, as eval_input did it: out of a fixed band, sampled by the polling loop
+static void legacyTask(void *pvParameters) {
+    bool pressed = false;
+    while (true) {
+        legacy.conversions++;
+        bool outOfBand = hall_sensor_read() < LEGACY_MIN;
+        if (!outOfBand) {
+            legacy.conversions++;  // Second conversion of the same expression
+            outOfBand = hall_sensor_read() > LEGACY_MAX;
+        }
+        if (outOfBand && !pressed)
+            legacy.detections.push_back(simNow());
+        pressed = outOfBand;
+        vTaskDelay(pdMS_TO_TICKS(LEGACY_PERIOD_MS));
+    }
+}
+
+static void print(const Detector &d) {
+    std::vector<bool> matched(onsets.size(), false);
+    std::vector<int64_t> latencies;
+    unsigned long falseTriggers = 0;
+    for (int64_t detection : d.detections) {
+        bool hit = false;
+        for (size_t i = 0; i < onsets.size() && !hit; i++) {
+            if (!matched[i] && detection >= onsets[i] && detection - onsets[i] <= MATCH_WINDOW_US) {
+                matched[i] = hit = true;
+                latencies.push_back(detection - onsets[i]);
+            }
+        }
+        falseTriggers += !hit;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double seconds = simNow() / 1e6;
+    printf("%-24s %14.1f %8zu %8zu %7zu %7lu %10.1f %10.1f\n", d.name, d.conversions / seconds, onsets.size(), latencies.size(),
+           onsets.size() - latencies.size(), falseTriggers, latencies.empty() ? 0.0 : latencies[latencies.size() / 2] / 1000.0,
+           latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+}
+
+static void benchTask(void *pvParameters) {
+    HallConfig config = {15, 8, 20, 100, 2, 0.02f};  // As configured by the stopwatch examples
+    HallSampler::start(config, xHallEvents);
+    InputEvent events[HallSampler::EVENT_QUEUE_SIZE];
+    int64_t end = traceEnd + (int64_t) TAIL_MS * 1000;
+    gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
+    gpio_set_level(LED_PIN, 0);
+    while (simNow() < end) {
+        xSemaphoreTake(xHallEvents, pdMS_TO_TICKS(TAIL_MS));
+        size_t n = HallSampler::events.pop(events, HallSampler::EVENT_QUEUE_SIZE);
+        for (size_t i = 0; i < n; i++) {
+            if (events[i].level == 0)
+                filtered.detections.push_back(events[i].timestamp);
+            gpio_set_level(LED_PIN, events[i].level == 0);
+        }
+    }
+    filtered.conversions = HallSampler::getConversions();
+    printf("%-24s %14s %8s %8s %7s %7s %10s %10s\n", "detector", "conversions/s", "presses", "detected", "missed", "false",
+           "p50 [ms]", "max [ms]");
+    print(legacy);
+    print(filtered);
+    fflush(stdout);
+    simStop();
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xHallEvents = xSemaphoreCreateBinary();
+    xTaskCreate(&legacyTask, "legacyTask", 2048, NULL, 1, NULL);
+    xTaskCreate(&benchTask, "benchTask", 4096, NULL, 1, NULL);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace>\n", argv[0]);
+        return 1;
+    }
+    loadOnsets(argv[1]);
+    setenv("SIM_TRACE", argv[1], 1);
+    setenv("SIM_DURATION_MS", "100000000", 1);  // Upper bound, the bench stops the simulation when done
+    return simMain();
+}
@@ -0,0 +1,273 @@
+//
+// jitter_bench.cpp
+// Author: Francesco Mecatti
+// Host benchmark of task placement (include/TaskPlacement.h): press-to-lap latency of a stopwatch whose output tasks
+// take CPU time. The input side is the one of the interrupt examples: the button through a Debouncer, an EventQueue and
+// an input task that starts the stopwatch or takes a lap at every press. The output side is a 25 fps screen with
+// centiseconds, whose frames cost FRAME_CPU_US to draw, sent by the Console, and a telemetry stream of every edge and
+// lap; both go to a UART written as the ESP-IDF console does without a driver, busy waiting UART_US_PER_BYTE per byte.
+// The heaviest load adds two background output tasks, such as a radio stack and a flash writer, each busy LOAD_BUSY_US
+// of every LOAD_PERIOD_US: together they fit on one core, yet at times they take both, and an unpinned input task then
+// waits for a time slice.
+// The same seeded presses run once per placement, each in a child process with its own simulation: one core or both
+// (SIM_CORES), tasks unpinned at their own priorities or split by role. Latency is counted from the press edge to the
+// lap, so BUTTON_SETTLE_US is its floor; what lies above it is the wait for a core.
+// Exits with 1 if a placement loses a lap, or if the split waits longer than the unpinned placements
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sim.h"
+#include "Console.h"
+#include "Debouncer.h"
+#include "EventQueue.h"
+#include "TaskPlacement.h"
+#include "Telemetry.h"
+#include "Time.h"
+
+#define BUTTON_PIN          (gpio_num_t) (0)
+#define BUTTON_SETTLE_US    (5000)
+#define PRESSES             (400)
+#define HOLD_MIN_US         (30000)
+#define HOLD_MAX_US         (200000)
+#define GAP_MIN_US          (30000)
+#define GAP_MAX_US          (400000)
+#define DISPLAY_FPS         (25)
+#define UART_US_PER_BYTE    (87)  // 10 bits at 115200 baud
+#define EVENT_BATCH_SIZE    (8)
+#define SEED                (23)
+#define LOAD_BUSY_US        (4000)
+#define LOAD_PERIOD_US      (10000)
+
+typedef struct {
+    const char *name;
+    int cores;
+    bool split;
+} Placement;
+
+typedef struct {
+    int64_t frameCpuUs;  // Assumed cost of a frame: the terminal diff; a redraw on an SPI display
+    int backgroundTasks;
+} Load;
+
+typedef struct {
+    unsigned long laps;
+    double p50, p99, max, stddev;  // us above BUTTON_SETTLE_US
+    double uart;  // Share of the time the UART was written, %
+} Result;
+
+static const Placement PLACEMENTS[] = {
+    {"1 core, unpinned", 1, false},
+    {"1 core, timing priority", 1, true},
+    {"2 cores, unpinned", 2, false},
+    {"2 cores, split", 2, true},
+};
+static const size_t PLACEMENT_COUNT = sizeof(PLACEMENTS) / sizeof(PLACEMENTS[0]);
+static const Load LOADS[] = {
+    {300, 0},
+    {3000, 0},
+    {3000, 2},
+};
+static const size_t LOAD_COUNT = sizeof(LOADS) / sizeof(LOADS[0]);
+
+static Result *results = NULL;  // Shared with the child processes, one per load and placement
+static size_t current = 0;
+static Load load = {};
+
+static std::vector<int64_t> pressAt;  // From the start of the stimulus, every press then its release
+static size_t nextEdge = 0;
+static int64_t stimulusStart = 0;
+static esp_timer_handle_t stimulus = NULL;
+static std::vector<int64_t> latencies;
+
+static EventQueue<InputEvent, 64> inputEvents;
+static SemaphoreHandle_t xInput = NULL;
+static Debouncer button;
+static int64_t uartUs = 0;
+
+static int64_t uniform(std::mt19937 &rng, int64_t min, int64_t max) {
+    return min + (int64_t) (rng() % (uint32_t) (max - min + 1));
+}
+
+// Presses and releases, clean edges: bounce is DebounceBench's business
+static void stimulate(void *arg) {
+    simSetGpioInput(BUTTON_PIN, nextEdge % 2);
+    nextEdge++;
+    if (nextEdge < pressAt.size())
+        esp_timer_start_once(stimulus, (uint64_t) (stimulusStart + pressAt[nextEdge] - simNow()));
+}
+
+// UART written with no driver: the caller spins until the last byte is out
+static ssize_t uartWrite(void *cookie, const char *buffer, size_t size) {
+    (void) cookie;
+    (void) buffer;
+    simCompute((int64_t) size * UART_US_PER_BYTE);
+    uartUs += (int64_t) size * UART_US_PER_BYTE;
+    return size;
+}
+
+// The screen of displayTask: the frame costs its drawing time, then goes to the Console
+static ssize_t frameWrite(void *cookie, const char *buffer, size_t size) {
+    (void) cookie;
+    simCompute(load.frameCpuUs);
+    Console::write(buffer, size);
+    return size;
+}
+
+static FILE *openStream(ssize_t (*write)(void *, const char *, size_t)) {
+    cookie_io_functions_t functions = {NULL, write, NULL, NULL};
+    FILE *file = fopencookie(NULL, "w", functions);
+    setvbuf(file, NULL, _IOFBF, 1024);
+    return file;
+}
+
+// Output work that is neither the screen nor the UART, each task out of phase with the others
+static void backgroundTask(void *pvParameters) {
+    vTaskDelay(pdMS_TO_TICKS((intptr_t) pvParameters * LOAD_PERIOD_US / 1000 / load.backgroundTasks));
+    TickType_t lastWake = xTaskGetTickCount();
+    while (true) {
+        simCompute(LOAD_BUSY_US);
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(LOAD_PERIOD_US / 1000));
+    }
+}
+
+static void buttonHandler(void *arg, int level, clock_us_t timestamp) {
+    inputEvents.push({BUTTON_INPUT, (uint8_t) level, timestamp});
+    xSemaphoreGiveFromISR(xInput, NULL);
+}
+
+// As buttonTask in the interrupt examples, less the press classification: every press is a lap
+static void inputTask(void *pvParameters) {
+    Time &t = *(Time *) pvParameters;
+    button.begin(BUTTON_PIN, BUTTON_SETTLE_US, &buttonHandler);
+    InputEvent events[EVENT_BATCH_SIZE];
+    size_t n;
+    while (true) {
+        xSemaphoreTake(xInput, portMAX_DELAY);
+        while ((n = inputEvents.pop(events, EVENT_BATCH_SIZE)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                Telemetry::input(events[i]);
+                if (events[i].level != 0)
+                    continue;
+                if (t.isStopped())
+                    t.start(events[i].timestamp);
+                else
+                    t.addLap(events[i].timestamp);
+                latencies.push_back(simNow() - events[i].timestamp - BUTTON_SETTLE_US);
+            }
+        }
+    }
+}
+
+static double percentile(const std::vector<int64_t> &sorted, double p) {  // Nearest rank
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t) (p / 100 * sorted.size() + 0.999999);
+    return (double) sorted[std::min(std::max(rank, (size_t) 1), sorted.size()) - 1];
+}
+
+static void benchTask(void *pvParameters) {
+    std::mt19937 rng(SEED);
+    int64_t at = 0;
+    for (int i = 0; i < PRESSES; i++) {
+        at += uniform(rng, GAP_MIN_US, GAP_MAX_US);
+        pressAt.push_back(at);
+        at += uniform(rng, HOLD_MIN_US, HOLD_MAX_US);
+        pressAt.push_back(at);
+    }
+
+    Console::begin(CONSOLE_DROP_OLDEST);
+    Console::setOutput(openStream(&uartWrite));
+    Telemetry::setOutput(openStream(&uartWrite));  // The same UART, as with BINARY_TELEMETRY
+    Telemetry::begin();
+    Time::screen.setOutput(openStream(&frameWrite));
+    static Time t(DISPLAY_FPS, true, Time::SCREEN);
+    xInput = xSemaphoreCreateBinary();
+    TaskPlacement::create(TIMING_TASK, &inputTask, "inputTask", 2048, &t, 1);
+    for (intptr_t i = 0; i < load.backgroundTasks; i++)
+        TaskPlacement::create(RENDER_TASK, &backgroundTask, "backgroundTask", 2048, (void *) i, 1);
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &stimulate;
+    timerArgs.dispatch_method = ESP_TIMER_TASK;
+    timerArgs.name = "stimulus";
+    esp_timer_create(&timerArgs, &stimulus);
+    stimulusStart = simNow() + 100000;
+    esp_timer_start_once(stimulus, (uint64_t) (stimulusStart + pressAt[0] - simNow()));
+    vTaskDelay(pdMS_TO_TICKS((stimulusStart + pressAt.back() - simNow()) / 1000 + 100));
+
+    Result &result = results[current];
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0, squares = 0;
+    for (int64_t latency : latencies) {
+        sum += latency;
+        squares += (double) latency * latency;
+    }
+    double mean = latencies.empty() ? 0 : sum / latencies.size();
+    result.laps = t.getLaps().count() + 1;  // The first press starts the stopwatch
+    result.p50 = percentile(latencies, 50);
+    result.p99 = percentile(latencies, 99);
+    result.max = percentile(latencies, 100);
+    result.stddev = latencies.empty() ? 0 : sqrt(std::max(squares / latencies.size() - mean * mean, 0.0));
+    result.uart = 100.0 * uartUs / simNow();
+    fflush(stdout);
+    simStop(0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xTaskCreate(&benchTask, "benchTask", 4096, NULL, 1, NULL);
+}
+
+int main(void) {
+    results = (Result *) mmap(NULL, sizeof(Result) * LOAD_COUNT * PLACEMENT_COUNT, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    printf("%d presses, every one a lap; screen at %d fps with centiseconds; console and telemetry on a UART at %d us per byte.\n"
+           "Latency: us from the press edge to the lap, above the %d us settle time\n", PRESSES, DISPLAY_FPS, UART_US_PER_BYTE,
+           BUTTON_SETTLE_US);
+    bool passed = true;
+    for (size_t l = 0; l < LOAD_COUNT; l++) {
+        printf("\nframe %lld us, %d background tasks\n%-26s %6s %10s %10s %10s %12s %9s\n", (long long) LOADS[l].frameCpuUs,
+               LOADS[l].backgroundTasks, "placement", "laps", "p50 [us]", "p99 [us]", "max [us]", "stddev [us]", "uart [%]");
+        for (size_t i = 0; i < PLACEMENT_COUNT; i++) {
+            const Placement &placement = PLACEMENTS[i];
+            current = l * PLACEMENT_COUNT + i;
+            results[current] = {};
+            fflush(stdout);
+            pid_t child = fork();
+            if (child == 0) {  // One simulation per process: the simulator cannot start over
+                char cores[8];
+                snprintf(cores, sizeof(cores), "%d", placement.cores);
+                setenv("SIM_CORES", cores, 1);
+                setenv("SIM_DURATION_MS", "10000000", 1);  // Upper bound; the bench stops the simulation when done
+                freopen("/dev/null", "w", stderr);  // The simulator report, once per run
+                load = LOADS[l];
+                TaskPlacement::setSplit(placement.split);
+                return simMain();
+            }
+            int status = 0;
+            waitpid(child, &status, 0);
+            const Result &result = results[current];
+            printf("%-26s %6lu %10.0f %10.0f %10.0f %12.1f %9.1f\n", placement.name, result.laps, result.p50, result.p99,
+                   result.max, result.stddev, result.uart);
+            passed &= WIFEXITED(status) && WEXITSTATUS(status) == 0 && result.laps == PRESSES;
+        }
+        const Result &split = results[l * PLACEMENT_COUNT + PLACEMENT_COUNT - 1];
+        for (size_t i = 0; i + 1 < PLACEMENT_COUNT; i++) {
+            const Result &other = results[l * PLACEMENT_COUNT + i];
+            passed &= PLACEMENTS[i].split || (split.max <= other.max && split.p99 <= other.p99);
+        }
+    }
+    printf("\n%s\n", passed ? "no lap lost; the split never waits longer than the unpinned placements" : "placement check failed");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+//
+// laplog_bench.cpp
+// Author: Francesco Mecatti
+// Host benchmark and check of the flash lap log (include/LapLog.h) on the simulated 64 KB partition, whose page programs
+// and sector erases take the time of the ESP32 SPI flash (see SIM_FLASH in README.md).
+// Throughput: laps at a sustained rate for SIM_SECONDS of virtual time, queued by LapLog::append from a timer as the
+// input task would, once with every record written on its own and once in batches. Write amplification is the bytes
+// programmed (records, their length and CRC, sector headers) per byte of lap payload; busy is the share of the time the
+// writer task waited for the flash, which on the device also stalls the other core; life is the time until the sectors
+// reach ENDURANCE erase cycles at that rate. Every lap must be read back, in order, unless reported lost. The log is
+// then opened again, as after a reboot: the session must follow the last one, even when that one was long enough to push
+// its own TELEMETRY_HELLO out of the partition.
+// Power loss: POWER_CUTS times, a random number of laps is appended and the power is cut after a random number of bytes
+// more (simFlashCut), halfway through a write. The log is then mounted again: every lap whose write completed must be
+// there, nothing else may, and laps appended afterwards must follow them.
+// Upgrade: a version 1 log (8-byte sector headers, "LLOG", no session number) of UPGRADE_SECTORS sessions is written by
+// hand and opened by LapLog, as after a firmware update: every old lap must be read back, the new session must follow
+// the last old one, and laps appended afterwards must follow the old ones.
+// One child process per simulation. Exits with 1 if a check fails
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <random>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sim.h"
+#include "LapLog.h"
+
+#define SIM_SECONDS         (60)
+#define POWER_CUTS          (300)
+#define MAX_LAPS_PER_CUT    (8000)  // About 1.4 times the partition: some cuts come after the log wrapped around
+#define MAX_CUT_BYTES       (300)
+#define RESUME_LAPS         (50)
+#define ENDURANCE           (100000)  // Erase cycles per sector, typical of SPI NOR flash
+#define SEED                (25)
+#define UPGRADE_SECTORS     (3)
+#define UPGRADE_LAPS        (100)  // Per sector
+
+typedef struct {
+    unsigned int rate;  // Laps per second
+    size_t batch;  // Bytes per write
+} Config;
+
+typedef struct {
+    unsigned long offered, lost, readBack;
+    bool ordered;
+    bool helloKept, nextSession;  // The session's HELLO is still in the log; the one after it got the next number
+    LapLogStats log;
+    SimFlashStats flash;
+    size_t partitionSize;
+} Result;
+
+typedef struct {
+    unsigned long cuts, durable, recovered, inFlight, torn, resumed;
+    unsigned long missing, invented, badResume;
+} PowerResult;
+
+static const Config CONFIGS[] = {
+    {1, 1}, {1, LapLogStore::BATCH_SIZE},
+    {10, 1}, {10, LapLogStore::BATCH_SIZE},
+    {100, 1}, {100, LapLogStore::BATCH_SIZE},
+    {1000, 1}, {1000, LapLogStore::BATCH_SIZE},
+};
+static const size_t CONFIG_COUNT = sizeof(CONFIGS) / sizeof(CONFIGS[0]);
+
+typedef struct {
+    unsigned long legacy, laps;
+    bool nextSession, ordered;
+} UpgradeResult;
+
+static Result *results = NULL;  // Shared with the child processes
+static PowerResult *power = NULL;
+static UpgradeResult *upgrade = NULL;
+static size_t current = 0;
+
+static unsigned long laps = 0;
+static clock_us_t startedAt = 0;
+
+// The input task's side: one lap per tick, split since the start
+static void takeLap(void *arg) {
+    laps++;
+    clock_us_t now = simNow();
+    LapLog::append(TELEMETRY_LAP, now, laps, (uint64_t) (now - startedAt));
+}
+
+static void throughputTask(void *pvParameters) {
+    const Config &config = CONFIGS[current];
+    Result &result = results[current];
+    LapLog::begin(LAP_LOG_PARTITION, config.batch);
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &takeLap;
+    timerArgs.dispatch_method = ESP_TIMER_TASK;
+    timerArgs.name = "laps";
+    esp_timer_handle_t timer;
+    esp_timer_create(&timerArgs, &timer);
+    startedAt = simNow();
+    esp_timer_start_periodic(timer, 1000000 / config.rate);
+    vTaskDelay(pdMS_TO_TICKS(SIM_SECONDS * 1000));
+    esp_timer_stop(timer);
+    LapLog::end();
+
+    result.offered = laps;
+    result.log = LapLog::getStats();
+    result.flash = simFlashStats();
+    result.partitionSize = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, LAP_LOG_PARTITION)->size;
+    result.lost = result.log.lost;
+    uint64_t first = 0, last = 0;
+    bool ordered = true;
+    LapLog::read([&](const TelemetryEvent &event) {
+        result.helloKept |= event.type == TELEMETRY_HELLO;
+        if (event.type != TELEMETRY_LAP)
+            return;
+        ordered &= event.args[0] > last && event.args[0] <= laps;
+        first = first == 0 ? event.args[0] : first;
+        last = event.args[0];
+        result.readBack++;
+    });
+    // The oldest laps may have been pushed out by the newest ones: from the first lap read back on, every lap is
+    // there but the lost ones, up to the last one taken
+    result.ordered = ordered && (last == laps || result.lost > 0) && last - first + 1 - result.readBack <= result.lost;
+    uint64_t session = LapLog::getSession();
+    LapLog::begin(LAP_LOG_PARTITION, config.batch);  // Reboot
+    result.nextSession = LapLog::getSession() == session + 1;
+    LapLog::end();
+    fflush(stdout);
+    simStop(0);
+    vTaskDelete(NULL);
+}
+
+static std::vector<uint64_t> readLaps(void) {
+    LapLogStore store;
+    store.mount(LAP_LOG_PARTITION);
+    std::vector<uint64_t> numbers;
+    store.read([&](const TelemetryEvent &event) {
+        numbers.push_back(event.args[0]);
+    });
+    return numbers;
+}
+
+static bool isRun(const std::vector<uint64_t> &numbers, size_t from, size_t to) {  // Consecutive lap numbers
+    for (size_t i = from + 1; i < to; i++)
+        if (numbers[i] != numbers[i - 1] + 1)
+            return false;
+    return true;
+}
+
+static void powerTask(void *pvParameters) {
+    PowerResult &result = *power;
+    std::mt19937 rng(SEED);
+    static const size_t BATCHES[] = {1, 64, LapLogStore::BATCH_SIZE};
+    for (int cut = 0; cut < POWER_CUTS; cut++) {
+        LapLogStore store;
+        store.mount(LAP_LOG_PARTITION);
+        store.format();
+        store.mount(LAP_LOG_PARTITION, BATCHES[rng() % 3]);
+        unsigned long count = rng() % MAX_LAPS_PER_CUT + 1, cutAt = rng() % count, appended = 0, durable = 0;
+        clock_us_t at = 0;
+        for (; appended < count && simFlashCutLeft() != 0; ) {
+            if (appended == cutAt)
+                simFlashCut(rng() % MAX_CUT_BYTES);
+            at += rng() % 2000000;
+            unsigned long flushes = store.getStats().flushes;
+            store.append({TELEMETRY_LAP, at, {++appended, (uint64_t) at}});
+            if (rng() % 8 == 0)
+                store.flush();  // As after a stop
+            if (simFlashCutLeft() != 0 && (!store.isPending() || store.getStats().flushes != flushes))
+                durable = appended - store.isPending();  // Every write so far completed
+        }
+        simFlashRestore();
+
+        std::vector<uint64_t> numbers = readLaps();  // Power back: mount again
+        result.cuts++;
+        result.durable += durable;
+        uint64_t last = numbers.empty() ? 0 : numbers.back();
+        result.missing += last < durable || !isRun(numbers, 0, numbers.size());
+        result.invented += last > appended;
+        result.recovered += numbers.size();
+        result.inFlight += last > durable;  // Its write was cut, yet complete: the cut fell after its last byte
+        LapLogStore resumed;
+        resumed.mount(LAP_LOG_PARTITION);
+        result.torn += resumed.getStats().torn;
+        for (uint64_t i = 1; i <= RESUME_LAPS; i++)
+            resumed.append({TELEMETRY_LAP, at + (clock_us_t) i, {last + i, 0}});
+        resumed.flush();
+        std::vector<uint64_t> after = readLaps();
+        bool kept = after.size() >= RESUME_LAPS && after.back() == last + RESUME_LAPS && isRun(after, 0, after.size()) &&
+                    (numbers.empty() || (after.size() > RESUME_LAPS && after[after.size() - RESUME_LAPS - 1] == last));
+        result.resumed += kept;
+        result.badResume += !kept;
+    }
+    fflush(stdout);
+    simStop(0);
+    vTaskDelete(NULL);
+}
+
+// One record as LapLogStore writes it: length byte, payload, CRC-16
+static void putRecord(std::vector<uint8_t> &sector, const TelemetryEvent &event) {
+    uint8_t record[LapLogStore::MAX_RECORD];
+    size_t payload = TelemetryCodec::encodePayload(event, record + 1);
+    record[0] = (uint8_t) payload;
+    uint16_t crc = TelemetryCodec::crc16(record, 1 + payload);
+    record[1 + payload] = (uint8_t) (crc >> 8);
+    record[2 + payload] = (uint8_t) crc;
+    sector.insert(sector.end(), record, record + payload + 3);
+}
+
+static void upgradeTask(void *pvParameters) {
+    UpgradeResult &result = *upgrade;
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, LAP_LOG_PARTITION);
+    esp_partition_erase_range(partition, 0, partition->size);
+    uint64_t lap = 0;
+    for (uint32_t i = 0; i < UPGRADE_SECTORS; i++) {
+        std::vector<uint8_t> sector;
+        for (uint32_t value : {i + 1, LapLogStore::MAGIC_V1})  // Sequence number, magic
+            for (int b = 0; b < 4; b++)
+                sector.push_back((uint8_t) (value >> 8 * b));
+        putRecord(sector, {TELEMETRY_HELLO, (clock_us_t) i * 1000000, {(i + 1) << 8 | 1}});
+        for (int l = 0; l < UPGRADE_LAPS; l++) {
+            lap++;
+            putRecord(sector, {TELEMETRY_LAP, (clock_us_t) (i * 1000000 + lap), {lap, lap}});
+        }
+        esp_partition_write(partition, i * LapLogStore::SECTOR_SIZE, sector.data(), sector.size());
+    }
+
+    LapLog::begin(LAP_LOG_PARTITION, 1);
+    result.legacy = LapLog::getStats().legacy;
+    result.nextSession = LapLog::getSession() == UPGRADE_SECTORS + 1;
+    for (uint64_t i = 1; i <= RESUME_LAPS; i++)
+        LapLog::append(TELEMETRY_LAP, simNow(), lap + i, 0);
+    LapLog::end();
+    uint64_t last = 0;
+    bool ordered = true;
+    LapLog::read([&](const TelemetryEvent &event) {
+        if (event.type != TELEMETRY_LAP)
+            return;
+        ordered &= event.args[0] == last + 1;
+        last = event.args[0];
+        result.laps++;
+    });
+    result.ordered = ordered && last == lap + RESUME_LAPS;
+    fflush(stdout);
+    simStop(0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    TaskFunction_t task = upgrade != NULL ? &upgradeTask : power != NULL ? &powerTask : &throughputTask;
+    xTaskCreate(task, "benchTask", 8192, NULL, 1, NULL);
+}
+
+static int runChild(void) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {  // One simulation per process: the simulator cannot start over
+        setenv("SIM_DURATION_MS", "100000000", 1);  // Upper bound; the bench stops the simulation when done
+        unsetenv("SIM_FLASH");  // In memory: every simulation starts from an erased partition
+        freopen("/dev/null", "w", stderr);  // The simulator report, once per run
+        exit(simMain());
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int main(void) {
+    results = (Result *) mmap(NULL, sizeof(Result) * CONFIG_COUNT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    printf("Laps for %d s at a sustained rate, writing each record on its own or in %zu-byte batches (flush after %u ms at most)\n"
+           "WA: bytes programmed per payload byte; busy: share of the time spent waiting for the flash; life: to %d erases per sector\n\n",
+           SIM_SECONDS, LapLogStore::BATCH_SIZE, LapLog::FLUSH_MS, ENDURANCE);
+    printf("%8s %6s %7s %6s %8s %8s %7s %6s %8s %8s %8s %10s %8s\n", "laps/s", "batch", "laps", "lost", "writes", "B/write",
+           "rec [B]", "WA", "pages/lap", "erases", "spread", "busy [%]", "life [d]");
+    bool passed = true;
+    unsigned long wrapped = 0, numbered = 0;
+    for (current = 0; current < CONFIG_COUNT; current++) {
+        const Config &config = CONFIGS[current];
+        results[current] = {};
+        int status = runChild();
+        const Result &r = results[current];
+        double payload = (double) std::max(r.log.payloadBytes, 1ULL);
+        double bytesPerDay = (double) r.flash.bytesWritten / SIM_SECONDS * 86400;
+        char spread[24];
+        snprintf(spread, sizeof(spread), "%lu-%lu", r.flash.minSectorErases, r.flash.maxSectorErases);
+        printf("%8u %6zu %7lu %6lu %8lu %8.1f %7.2f %6.2f %8.3f %8lu %8s %10.2f %8.0f\n", config.rate, config.batch, r.offered,
+               r.lost, r.flash.writes, (double) r.flash.bytesWritten / std::max(r.flash.writes, 1UL),
+               (double) r.log.recordBytes / std::max(r.log.records, 1UL), (double) r.flash.bytesWritten / payload,
+               (double) r.flash.pagePrograms / std::max(r.offered, 1UL), r.flash.erases, spread,
+               100.0 * r.flash.busyUs / (SIM_SECONDS * 1000000.0), bytesPerDay > 0 ? ENDURANCE * (double) r.partitionSize / bytesPerDay : 0);
+        bool ok = status == 0 && r.ordered && r.nextSession && r.offered > 0 && r.flash.maxSectorErases - r.flash.minSectorErases <= 1;
+        if (!ok)
+            printf("  FAILED: %lu read back, %s, %s\n", r.readBack, r.ordered ? "in order" : "out of order or missing",
+                   r.nextSession ? "next session numbered on" : "session number went back");
+        passed &= ok;
+        wrapped += !r.helloKept;
+        numbered += r.nextSession;
+    }
+    printf("\nsessions: %lu of %zu runs pushed their own HELLO out of the log; after %lu of %zu the next session was numbered on\n",
+           wrapped, CONFIG_COUNT, numbered, CONFIG_COUNT);
+    passed &= wrapped > 0;  // Or the check above proved nothing
+
+    power = (PowerResult *) mmap(NULL, sizeof(PowerResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    *power = {};
+    int status = runChild();
+    const PowerResult &p = *power;
+    printf("\npower loss: %lu cuts, up to %d laps each; %lu laps written before the cut, %lu read back, less the oldest once the\n"
+           "log wrapped around; %lu cuts fell after the last byte of a write, %lu sectors ended in a torn record\n"
+           "%lu cuts lost a written lap, %lu read back a lap never written; appending resumed after %lu of %lu cuts\n",
+           p.cuts, MAX_LAPS_PER_CUT, p.durable, p.recovered, p.inFlight, p.torn, p.missing, p.invented, p.resumed, p.cuts);
+    passed &= status == 0 && p.cuts == POWER_CUTS && p.missing == 0 && p.invented == 0 && p.badResume == 0;
+
+    upgrade = (UpgradeResult *) mmap(NULL, sizeof(UpgradeResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    *upgrade = {};
+    status = runChild();
+    const UpgradeResult &u = *upgrade;
+    printf("\nversion 1 log: %lu of %d sectors read as such; %lu of %d laps read back, %s; %s\n", u.legacy, UPGRADE_SECTORS,
+           u.laps, UPGRADE_SECTORS * UPGRADE_LAPS + RESUME_LAPS, u.ordered ? "in order" : "out of order or missing",
+           u.nextSession ? "next session numbered on" : "session number went back");
+    passed &= status == 0 && u.legacy == UPGRADE_SECTORS && u.ordered && u.nextSession;
+    printf("\n%s\n", passed ? "every lap written is read back, wear is even, the log survives power loss and reads a version 1 log" : "lap log check failed");
+    return passed ? 0 : 1;
+}
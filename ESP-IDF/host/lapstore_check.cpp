@@ -0,0 +1,84 @@
+//
+// lapstore_check.cpp
+// Author: Francesco Mecatti
+// Host check of LapStore (include/LapStore.h): size, numbering, best(), worst(), average() and iteration on an empty
+// store, on a single lap, across the wraparound of a full ring (the overwritten laps must no longer count, the
+// shortest and the longest among them included) and after a clear.
+// Exits with 1 on a failed check
+//
+
+#include <stdio.h>
+#include "LapStore.h"
+
+#define CAPACITY    (4)
+
+static int failures = 0;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line) {
+    if (condition)
+        return;
+    printf("line %d: %s failed\n", line, text);
+    failures++;
+}
+
+static size_t iterated(const LapStore<CAPACITY> &store) {
+    size_t n = 0;
+    for (const Lap &lap : store)
+        n += lap.number != 0;
+    return n;
+}
+
+static void emptyStore(void) {
+    LapStore<CAPACITY> store;
+    CHECK(store.isEmpty() && store.size() == 0 && store.count() == 0);
+    CHECK(store.best() == NULL && store.worst() == NULL);
+    CHECK(store.average() == 0);
+    CHECK(!(store.begin() != store.end()) && iterated(store) == 0);
+}
+
+static void singleLap(void) {
+    LapStore<CAPACITY> store;
+    store.add(7000, 2500);
+    CHECK(store.size() == 1 && store.count() == 1);
+    CHECK(store.best() == &store[0] && store.worst() == &store[0] && &store.last() == &store[0]);
+    CHECK(store[0].number == 1 && store[0].timestamp == 7000 && store[0].split == 2500 && store[0].delta == 2500);
+    CHECK(store.average() == 2500);
+    CHECK(iterated(store) == 1);
+    CHECK(store.begin()->delta == 2500);
+}
+
+// Ten laps in a ring of four: laps 7 to 10 remain, while the shortest (4) and the longest (3) are gone
+static void wraparound(void) {
+    static const clock_us_t DELTAS[] = {5000, 3000, 9000, 1000, 7000, 2000, 8000, 6000, 4000, 8500};
+    LapStore<CAPACITY> store;
+    clock_us_t split = 0;
+    for (size_t i = 0; i < sizeof(DELTAS) / sizeof(DELTAS[0]); i++) {
+        split += DELTAS[i];
+        store.add(1000000 + split, split);
+        CHECK(store.size() == (i < CAPACITY ? i + 1 : CAPACITY) && store.count() == i + 1);
+    }
+    CHECK(iterated(store) == CAPACITY);
+    uint32_t numbers[CAPACITY] = {}, i = 0;
+    for (LapStore<CAPACITY>::Iterator lap = store.begin(); lap != store.end(); ++lap)
+        numbers[i++] = lap->number;
+    CHECK(i == CAPACITY && numbers[0] == 7 && numbers[1] == 8 && numbers[2] == 9 && numbers[3] == 10);
+    CHECK(store[0].delta == 8000 && store.last().delta == 8500 && store.last().split == split);
+    CHECK(store.best() != NULL && store.best()->number == 9 && store.best()->delta == 4000);
+    CHECK(store.worst() != NULL && store.worst()->number == 10 && store.worst()->delta == 8500);
+    CHECK(store.average() == (8000 + 6000 + 4000 + 8500) / 4);
+
+    store.clear();
+    CHECK(store.isEmpty() && store.count() == 0 && store.best() == NULL && store.average() == 0);
+    store.add(2000000, 3000);  // Deltas start over from 0 after a clear
+    CHECK(store.size() == 1 && store[0].number == 1 && store[0].delta == 3000 && store.average() == 3000);
+}
+
+int main(void) {
+    emptyStore();
+    singleLap();
+    wraparound();
+    printf("%s\n", failures == 0 ? "all lap store checks passed" : "some lap store checks failed");
+    return failures != 0;
+}
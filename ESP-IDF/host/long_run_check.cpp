@@ -0,0 +1,200 @@
+//
+// long_run_check.cpp
+// Author: Francesco Mecatti
+// Host check of multi-day sessions. A 25 fps stopwatch with centiseconds and a StopwatchBank lane run from boot, and the
+// virtual clock is fast-forwarded (simAdvance) to a few seconds before each boundary where a 32-bit count wraps or
+// a field gets wider: 2^31 and 2^32 us, ticks and centiseconds, 1, 10, 100 and 1000 days. Around each one the screen
+// must show the elapsed time written by snprintf (days included), never going back and at most two frames late, laps
+// must keep exact splits and deltas, and a vTaskDelayUntil loop must keep its period as the tick count wraps.
+// Exits with 1 on a failed check
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sim.h"
+#include "Time.h"
+#include "StopwatchBank.h"
+
+#define WINDOW_MS       (2000)  // Checked on each side of a boundary
+#define CHECK_MS        (40)  // Screen read period: one frame at 25 fps
+#define LAP_MS          (500)
+#define PERIOD_MS       (10)  // vTaskDelayUntil loop
+#define MAX_SKIP_US     ((int64_t) 86400 * 1000000)  // One day: tick differences stay well within 31 bits
+#define MAX_LAG_CS      (2 * 100 / 25)  // Two frames
+#define TICK_US         ((int64_t) portTICK_PERIOD_MS * 1000)
+#define DAY_US          ((int64_t) 86400 * 1000000)
+
+typedef struct {
+    const char *name;
+    int64_t us;  // Clock value: the stopwatch starts at 0, so elapsed time too
+} Boundary;
+
+static const Boundary BOUNDARIES[] = {
+    {"2^31 us", (int64_t) 1 << 31},
+    {"2^32 us", (int64_t) 1 << 32},
+    {"1 day", DAY_US},
+    {"10 days", 10 * DAY_US},
+    {"2^31 ticks", ((int64_t) 1 << 31) * TICK_US},
+    {"2^32 ticks", ((int64_t) 1 << 32) * TICK_US},
+    {"100 days", 100 * DAY_US},
+    {"2^31 cs", ((int64_t) 1 << 31) * Time::US_PER_CS},
+    {"2^32 cs", ((int64_t) 1 << 32) * Time::US_PER_CS},
+    {"1000 days", 1000 * DAY_US},
+};
+
+static int failures = 0;
+static volatile bool measuring = false;
+static SemaphoreHandle_t xWindow = NULL;
+static unsigned long periods = 0;
+static bool tickWrapped = false;
+
+#define CHECK(condition, ...) check(condition, #condition, __LINE__, __VA_ARGS__)
+
+static void check(bool condition, const char *text, int line, const char *boundary) {
+    if (condition)
+        return;
+    if (failures++ < 20)
+        printf("line %d, %s: %s failed\n", line, boundary, text);
+}
+
+// What %u and snprintf would write: "[Nd ]hh:mm:ss[.cs]"
+static void reference(uint64_t centiseconds, bool withCentiseconds, char *out, size_t size) {
+    uint64_t seconds = centiseconds / 100, days = seconds / 86400;
+    unsigned int rest = (unsigned int) (seconds % 86400);
+    int n = days > 0 ? snprintf(out, size, "%" PRIu64 "d ", days) : 0;
+    n += snprintf(out + n, size - n, "%02u:%02u:%02u", rest / 3600, rest / 60 % 60, rest % 60);
+    if (withCentiseconds)
+        snprintf(out + n, size - n, ".%02u", (unsigned int) (centiseconds % 100));
+}
+
+// Row text from col, trailing blanks removed
+template <unsigned int ROWS, unsigned int COLS>
+static void rowText(const Renderer<ROWS, COLS> &screen, unsigned int row, unsigned int col, char *out) {
+    size_t n = 0;
+    for (; col < COLS; col++)
+        out[n++] = screen.getText(row, col);
+    while (n > 0 && out[n - 1] == ' ')
+        n--;
+    out[n] = '\0';
+}
+
+// Centiseconds shown in text, if it reads as a time
+static bool parse(const char *text, uint64_t &centiseconds) {
+    uint64_t days = 0;
+    unsigned int hours, minutes, seconds, cs;
+    if (strchr(text, 'd') != NULL) {
+        if (sscanf(text, "%" SCNu64 "d %u:%u:%u.%u", &days, &hours, &minutes, &seconds, &cs) != 5)
+            return false;
+    }
+    else if (sscanf(text, "%u:%u:%u.%u", &hours, &minutes, &seconds, &cs) != 4) {
+        return false;
+    }
+    centiseconds = ((days * 24 + hours) * 3600 + minutes * 60 + seconds) * 100 + cs;
+    return true;
+}
+
+// Fixed rate loop, counting its period in ticks
+static void periodTask(void *pvParameters) {
+    while (true) {
+        xSemaphoreTake(xWindow, portMAX_DELAY);  // One window at a time: no catch-up over a skip
+        TickType_t xLastWakeTime = xTaskGetTickCount(), last = xLastWakeTime;
+        while (measuring) {
+            vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(PERIOD_MS));
+            TickType_t tick = xTaskGetTickCount();
+            check((TickType_t) (tick - last) == pdMS_TO_TICKS(PERIOD_MS), "period kept", __LINE__, "tick wrap");
+            tickWrapped |= tick < last;
+            last = tick;
+            periods++;
+        }
+    }
+}
+
+static void checkWindow(Time &t, StopwatchBank<1> &bank, const char *name) {
+    char shown[64], expected[64];
+    uint64_t lastShown = 0;
+    unsigned long frames = Time::getDisplayStats().frames;
+    measuring = true;
+    xSemaphoreGive(xWindow);
+    for (int ms = 0; ms < 2 * WINDOW_MS; ms += CHECK_MS) {
+        vTaskDelay(pdMS_TO_TICKS(CHECK_MS));
+        clock_us_t now = simNow();
+        uint64_t nowCs = (uint64_t) now / Time::US_PER_CS;
+        CHECK(Time::getCentiseconds() == nowCs, name);
+
+        uint64_t cs = 0;
+        rowText(Time::screen, 0, 0, shown);
+        bool valid = parse(shown, cs);
+        CHECK(valid, name);
+        reference(cs, true, expected, sizeof(expected));
+        CHECK(strcmp(shown, expected) == 0, name);
+        CHECK(cs >= lastShown && cs <= nowCs && nowCs - cs <= MAX_LAG_CS, name);
+        if (!valid || strcmp(shown, expected) != 0 || cs > nowCs || nowCs - cs > MAX_LAG_CS)
+            printf("  %s: shown \"%s\" at %" PRIu64 " cs\n", name, shown, nowCs);
+        lastShown = cs;
+
+        bank.refresh(now);
+        rowText(bank.getScreen(), 0, 4, shown);
+        reference(nowCs / 100 * 100, false, expected, sizeof(expected));
+        CHECK(strncmp(shown, expected, strlen(expected)) == 0, name);
+
+        if ((ms + CHECK_MS) % LAP_MS == 0) {
+            clock_us_t previous = t.getLaps().isEmpty() ? 0 : t.getLaps().last().split;
+            t.addLap(now);
+            const Lap &lap = t.getLaps().last();
+            CHECK(lap.split == now && lap.timestamp == now, name);
+            CHECK(previous == 0 || lap.delta == now - previous, name);
+        }
+    }
+    measuring = false;
+    vTaskDelay(pdMS_TO_TICKS(2 * PERIOD_MS));  // periodTask leaves its loop
+    CHECK(Time::getDisplayStats().frames - frames >= 2 * WINDOW_MS / CHECK_MS - 2, name);
+
+    const Lap &lap = t.getLaps().last();  // Drawn by the frames since
+    char lapText[64];
+    rowText(Time::screen, 1 + (lap.number - 1) % Time::LAP_ROWS, Time::LAP_COLUMN + 8, lapText);
+    reference((uint64_t) lap.split / Time::US_PER_CS, true, expected, sizeof(expected));
+    CHECK(strcmp(lapText, expected) == 0, name);
+    rowText(Time::screen, 0, 0, shown);
+    printf("%-12s %-24s lap %u %s\n", name, shown, (unsigned int) lap.number, lapText);
+}
+
+static void checkTask(void *pvParameters) {
+    Time::screen.setOutput(fopen("/dev/null", "w"));  // Only the results on stdout
+    static Time t(25, true);
+    static StopwatchBank<1> bank(espTimerClock);
+    bank.setOutput(fopen("/dev/null", "w"));
+    xWindow = xSemaphoreCreateBinary();
+    xTaskCreate(&periodTask, "periodTask", 2048, NULL, 1, NULL);
+    t.start(0);
+    bank.start(0, 0);
+
+    for (const Boundary &boundary : BOUNDARIES) {
+        while (simNow() < boundary.us - WINDOW_MS * 1000) {
+            int64_t skip = boundary.us - WINDOW_MS * 1000 - simNow();
+            simAdvance(skip < MAX_SKIP_US ? skip : MAX_SKIP_US);
+            vTaskDelay(1);  // displayTask catches up, once
+        }
+        checkWindow(t, bank, boundary.name);
+    }
+    check(tickWrapped && periods > 0, "tick count wrapped", __LINE__, "tick wrap");
+
+    printf("%lu periods of %d ms, tick count %s\n", periods, PERIOD_MS, tickWrapped ? "wrapped" : "did not wrap");
+    printf("%s\n", failures == 0 ? "all long run checks passed" : "some long run checks failed");
+    fflush(stdout);
+    simStop(failures != 0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xTaskCreate(&checkTask, "checkTask", 4096, NULL, 1, NULL);
+}
+
+int main(void) {
+    setenv("SIM_DURATION_MS", "1000000", 1);  // Upper bound, skips not included; the check stops the simulation when done
+    return simMain();
+}
@@ -0,0 +1,178 @@
+//
+// press_fsm_check.cpp
+// Author: Francesco Mecatti
+// Host check of PressFsm: random edge traces (durations and gaps around the thresholds, repeated edges, random timing
+// parameters) go through the state machine, driven with ticks at every deadline plus spurious ones, and the gestures
+// are compared with a reference model computed from the whole trace at once. Also times the machine per edge.
+// Usage: PressFsmCheck [traces], default 2000000. Exits with 1 on the first mismatch
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "PressFsm.h"
+
+#define DEFAULT_TRACES  (2000000)
+#define MAX_EDGES       (24)
+#define MAX_GESTURES    (4096)
+
+typedef enum {G_DOWN, G_UP, G_SHORT, G_DOUBLE, G_LONG, G_REPEAT} GestureKind;
+static const char *const GESTURE_NAMES[] = {"down", "up", "short", "double", "long", "repeat"};
+
+typedef struct {
+    GestureKind kind;
+    clock_us_t timestamp;
+} Record;
+
+typedef struct {
+    bool pressed;
+    clock_us_t timestamp;
+} Edge;
+
+// Fixed array: the handler must not allocate either
+struct Recorder : PressHandler {
+    Record records[MAX_GESTURES];
+    size_t count = 0;
+
+    void add(GestureKind kind, clock_us_t timestamp) {
+        if (count < MAX_GESTURES)
+            records[count++] = {kind, timestamp};
+    }
+    void onDown(clock_us_t timestamp) { add(G_DOWN, timestamp); }
+    void onUp(clock_us_t timestamp) { add(G_UP, timestamp); }
+    void onShort(clock_us_t timestamp) { add(G_SHORT, timestamp); }
+    void onDouble(clock_us_t timestamp) { add(G_DOUBLE, timestamp); }
+    void onLong(clock_us_t timestamp) { add(G_LONG, timestamp); }
+    void onRepeat(clock_us_t timestamp) { add(G_REPEAT, timestamp); }
+};
+
+// Straight from the definitions, looking at whole presses: no states, no timers
+static std::vector<Record> reference(const std::vector<Edge> &edges, const PressTiming &timing, clock_us_t end) {
+    std::vector<std::pair<clock_us_t, clock_us_t>> presses;  // (down, up); up = end + 1 if still held at the end
+    bool down = false;
+    for (const Edge &edge : edges) {
+        if (edge.pressed == down)
+            continue;  // Repeated edge
+        down = edge.pressed;
+        if (down)
+            presses.push_back({edge.timestamp, end + 1});
+        else
+            presses.back().second = edge.timestamp;
+    }
+    std::vector<Record> out;
+    bool second = false;  // This press is the second of a double
+    for (size_t i = 0; i < presses.size(); i++) {
+        clock_us_t pressAt = presses[i].first, releaseAt = presses[i].second;
+        out.push_back({G_DOWN, pressAt});
+        if (second)
+            out.push_back({G_DOUBLE, pressAt});
+        bool isLong = pressAt + timing.longUs <= releaseAt && pressAt + timing.longUs <= end;
+        if (pressAt + timing.longUs <= releaseAt) {
+            if (pressAt + timing.longUs <= end)
+                out.push_back({G_LONG, pressAt + timing.longUs});
+            if (timing.repeatUs > 0)
+                for (clock_us_t t = pressAt + timing.longUs + timing.repeatUs; t <= releaseAt && t <= end; t += timing.repeatUs)
+                    out.push_back({G_REPEAT, t});
+        }
+        if (releaseAt > end)
+            break;
+        out.push_back({G_UP, releaseAt});
+        bool wasSecond = second;
+        second = false;
+        if (isLong || wasSecond)
+            continue;
+        if (i + 1 < presses.size() && presses[i + 1].first - releaseAt < timing.doubleUs)
+            second = true;
+        else if (releaseAt + timing.doubleUs <= end)
+            out.push_back({G_SHORT, releaseAt + timing.doubleUs});
+    }
+    return out;
+}
+
+// Edge gaps clustered around the thresholds, in whole ms so that exact ties happen too
+static clock_us_t gap(std::mt19937_64 &rng, const PressTiming &timing) {
+    clock_us_t around[] = {timing.longUs, timing.doubleUs, timing.repeatUs, 0};
+    clock_us_t base = around[rng() % 4];
+    clock_us_t ms = (clock_us_t) (rng() % 41) - 20;
+    clock_us_t us = base + ms * 1000;
+    if (rng() % 8 == 0)
+        us = (clock_us_t) (rng() % 3000) * 1000;  // Anything
+    return us > 0 ? us : 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long traces = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_TRACES;
+    std::mt19937_64 rng(15);
+    unsigned long edgesTotal = 0, gesturesTotal = 0;
+    std::chrono::duration<double> cpu(0);
+    static Recorder recorder;
+    for (unsigned long n = 0; n < traces; n++) {
+        PressTiming timing;
+        timing.longUs = (clock_us_t) (rng() % 1000 + 1) * 1000;
+        timing.doubleUs = rng() % 3 == 0 ? 0 : (clock_us_t) (rng() % 400) * 1000;
+        timing.repeatUs = rng() % 3 == 0 ? 0 : (clock_us_t) (rng() % 280 + 20) * 1000;
+        std::vector<Edge> edges;
+        clock_us_t t = (clock_us_t) (rng() % 1000) * 1000;
+        bool level = false;
+        size_t count = rng() % MAX_EDGES + 1;
+        for (size_t i = 0; i < count; i++) {
+            if (rng() % 10 != 0)
+                level = !level;  // Otherwise a repeated edge
+            edges.push_back({level, t});
+            t += gap(rng, timing);
+        }
+        clock_us_t end = t;
+
+        recorder.count = 0;
+        PressFsm<Recorder> fsm(recorder, timing);
+        auto start = std::chrono::steady_clock::now();
+        for (const Edge &edge : edges) {
+            while (fsm.deadline() <= edge.timestamp)  // As the examples do: wake up at every deadline
+                fsm.tick(fsm.deadline());
+            if (rng() % 4 == 0)
+                fsm.tick(edge.timestamp - (clock_us_t) (rng() % 1000));  // Spurious, possibly before the deadline
+            fsm.handle(edge.pressed, edge.timestamp);
+        }
+        while (fsm.deadline() <= end)
+            fsm.tick(fsm.deadline());
+        cpu += std::chrono::steady_clock::now() - start;
+        edgesTotal += edges.size();
+        gesturesTotal += recorder.count;
+
+        std::vector<Record> expected = reference(edges, timing, end);
+        bool same = expected.size() == recorder.count;
+        for (size_t i = 0; same && i < expected.size(); i++)
+            same = expected[i].kind == recorder.records[i].kind && expected[i].timestamp == recorder.records[i].timestamp;
+        if (!same) {
+            printf("trace %lu: mismatch (long %" PRId64 " us, double %" PRId64 " us, repeat %" PRId64 " us)\nedges:", n,
+                   timing.longUs, timing.doubleUs, timing.repeatUs);
+            for (const Edge &edge : edges)
+                printf(" %s@%" PRId64, edge.pressed ? "P" : "R", edge.timestamp);
+            printf("\nexpected:");
+            for (const Record &r : expected)
+                printf(" %s@%" PRId64, GESTURE_NAMES[r.kind], r.timestamp);
+            printf("\ngot:     ");
+            for (size_t i = 0; i < recorder.count; i++)
+                printf(" %s@%" PRId64, GESTURE_NAMES[recorder.records[i].kind], recorder.records[i].timestamp);
+            printf("\n");
+            return 1;
+        }
+    }
+
+    // A late tick takes the long press and one repeat, skipping the missed ones: constant work whatever the delay
+    recorder.count = 0;
+    PressFsm<Recorder> fsm(recorder, {500000, 0, 1000});
+    fsm.handle(true, 0);
+    fsm.tick(3600000000LL);
+    if (recorder.count != 3 || fsm.deadline() <= 3600000000LL) {
+        printf("late tick: %zu gestures, next deadline %" PRId64 "\n", recorder.count, fsm.deadline());
+        return 1;
+    }
+
+    printf("%lu traces, %lu edges, %lu gestures: all match the reference\n", traces, edgesTotal, gesturesTotal);
+    printf("%.1f ns per edge, ticks included\n", cpu.count() / edgesTotal * 1e9);
+    return 0;
+}
@@ -0,0 +1,263 @@
+//
+// profile_bench.cpp
+// Author: Francesco Mecatti
+// Host check and benchmark of include/Profiler.h, built with PROFILING=1. A known workload runs for RUN_MS: a periodic
+// esp_timer stands for the button ISR, signalling and waking an event task; a higher priority task woken at the same
+// time keeps the CPU for a random time first, spreading the latencies, which the simulator clock gives exactly; a work task loops on vTaskDelayUntil and
+// burns host CPU. The dump must list every task with its priority, the exact wakeups of the interval, a stack
+// high-water mark within the stack, the latencies in the right buckets, and the same values in its telemetry frames.
+// With more tasks than the profiler has room for, the dump must say so rather than come out empty.
+// Then the cost of the instrumentation is timed and put against the wakeup rate of the workload.
+// Exits with 1 on a failed check
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <type_traits>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sim.h"
+#include "Profiler.h"
+
+#define RUN_MS          (10000)
+#define SECOND_RUN_MS   (2000)
+#define SIGNAL_MS       (20)  // Button ISR period
+#define WORK_MS         (10)  // Work task period
+#define WORK_LOOPS      (20000)  // Host CPU burnt per work period
+#define MAX_HOG_US      (3000)
+#define STACK_SIZE      (2048)
+#define COST_CALLS      (1000000)
+
+static_assert(std::is_empty<TaskProfiler<false>>::value, "a profiler built without PROFILING must hold nothing");
+
+static int failures = 0;
+static SemaphoreHandle_t xEvent = NULL, xHog = NULL;
+static esp_timer_handle_t isrTimer = NULL;
+static std::mt19937 rng(22);
+static std::vector<uint32_t> latencies;  // Of every signal, from the simulator clock
+static int64_t signalledAt = 0;
+static unsigned long signals = 0;
+static volatile unsigned long sink = 0;
+
+static void check(bool condition, const char *text) {
+    if (!condition && failures++ < 20)
+        printf("check failed: %s\n", text);
+}
+
+// Out for Profiler::print
+struct Stdout {
+    static bool printf(const char *format, ...) {
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        return true;
+    }
+};
+
+// Out for Profiler::emit: frames encoded and decoded again, as a collector would see them
+struct Capture {
+    static inline std::vector<TelemetryEvent> events;
+
+    static bool emit(TelemetryType type, clock_us_t timestamp, uint64_t arg0 = 0, uint64_t arg1 = 0, uint64_t arg2 = 0) {
+        uint8_t frame[TelemetryCodec::MAX_FRAME];
+        size_t length = TelemetryCodec::encode({type, timestamp, {arg0, arg1, arg2}}, frame);
+        TelemetryEvent event;
+        if (TelemetryCodec::decode(frame, length - 1, event))
+            events.push_back(event);
+        return true;
+    }
+};
+
+static void isr(void *arg) {
+    signals++;
+    signalledAt = simNow();
+    Profiler::signal(BUTTON_INPUT);
+    xSemaphoreGiveFromISR(xHog, NULL);  // Runs first and delays the event task
+    xSemaphoreGiveFromISR(xEvent, NULL);
+}
+
+static void hogTask(void *pvParameters) {
+    while (true) {
+        xSemaphoreTake(xHog, portMAX_DELAY);
+        Profiler::wake();
+        uint32_t us = rng() % MAX_HOG_US;
+        if (us > 0)
+            simAdvance(us);
+    }
+}
+
+static void eventTask(void *pvParameters) {
+    while (true) {
+        xSemaphoreTake(xEvent, portMAX_DELAY);
+        Profiler::wake();
+        Profiler::received();
+        latencies.push_back((uint32_t) (simNow() - signalledAt));
+    }
+}
+
+static void workTask(void *pvParameters) {
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    while (true) {
+        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(WORK_MS));
+        Profiler::wake();
+        for (unsigned long i = 0; i < WORK_LOOPS; i++)
+            sink += i;
+    }
+}
+
+static const TaskProfile *findTask(size_t n, const char *name) {
+    for (size_t i = 0; i < n; i++)
+        if (strcmp(Profiler::getTask(i).name, name) == 0)
+            return &Profiler::getTask(i);
+    return NULL;
+}
+
+// Rows of the last sample, an interval of about ms with expectedSignals signals
+static void checkInterval(size_t n, uint32_t ms, unsigned long expectedSignals) {
+    const TaskProfile *work = findTask(n, "workTask");
+    const TaskProfile *event = findTask(n, "eventTask");
+    const TaskProfile *hog = findTask(n, "hogTask");
+    check(work != NULL && event != NULL && hog != NULL, "every task listed");
+    if (work == NULL || event == NULL || hog == NULL)
+        return;
+    check(work->priority == 1 && event->priority == 2 && hog->priority == 3, "priorities");
+    check(work->wakeups + 1 >= ms / WORK_MS && work->wakeups <= ms / WORK_MS + 1, "work task wakeups");
+    check(event->wakeups == expectedSignals && hog->wakeups == expectedSignals, "event and hog task wakeups");
+    check(work->cpuUs > event->cpuUs, "the work task takes the most CPU");
+    for (const TaskProfile *task : {work, event, hog})
+        check(task->stackFree > 0 && task->stackFree < STACK_SIZE, "stack high-water mark within the stack");
+    int64_t error = (int64_t) Profiler::getInterval() - (int64_t) ms * 1000;  // Sampled late when a hog holds the CPU
+    check(error > -MAX_HOG_US && error < MAX_HOG_US, "interval length");
+}
+
+static void checkLatencies(void) {
+    uint32_t expected[Profiler::LATENCY_BUCKETS] = {};
+    for (uint32_t us : latencies) {
+        size_t b = 0;
+        while (b < Profiler::LATENCY_BUCKETS - 1 && us >= (2u << b))
+            b++;
+        expected[b]++;
+    }
+    for (size_t b = 0; b < Profiler::LATENCY_BUCKETS; b++)
+        check(Profiler::getLatencyCount(BUTTON_INPUT, b) == expected[b], "latency histogram");
+    for (size_t b = 0; b < Profiler::LATENCY_BUCKETS; b++)
+        check(Profiler::getLatencyCount(TOUCH_INPUT, b) == 0, "no latency for a source never signalled");
+}
+
+// Frames of the last dump against the rows it sampled
+static void checkFrames(void) {
+    const std::vector<TelemetryEvent> &events = Capture::events;
+    check(!events.empty() && events[0].type == TELEMETRY_PROFILE && events[0].args[0] == Profiler::getInterval(), "profile frame first");
+    size_t n = events.empty() ? 0 : (size_t) events[0].args[1];
+    if (events.size() < n + 1)
+        return;
+    for (size_t i = 0; i < n; i++) {
+        const TelemetryEvent &event = events[1 + i];
+        const TaskProfile &task = Profiler::getTask(i);
+        char name[9] = {};
+        for (int c = 0; c < 8; c++)
+            name[c] = (char) (event.args[0] >> (8 * c));
+        check(event.type == TELEMETRY_TASK && strncmp(name, task.name, 8) == 0, "task frame name");
+        check(event.args[1] == task.cpuUs && event.args[2] >> 32 == task.wakeups && (event.args[2] & 0xffffffff) == task.stackFree,
+              "task frame values");
+    }
+    unsigned long latencies = 0;
+    for (size_t i = n + 1; i < events.size(); i++) {
+        check(events[i].type == TELEMETRY_LATENCY && events[i].args[0] == BUTTON_INPUT, "latency frames");
+        check(events[i].args[2] == Profiler::getLatencyCount(BUTTON_INPUT, events[i].args[1]), "latency frame count");
+        latencies += events[i].args[2];
+    }
+    check(latencies == signals, "one latency per signal");
+}
+
+static void sleepTask(void *pvParameters) {
+    while (true)
+        vTaskDelay(portMAX_DELAY);
+}
+
+// More tasks than MAX_TASKS: FreeRTOS lists none, and the profiler reports them all as left out until they are gone
+static void checkTooManyTasks(void) {
+    std::vector<TaskHandle_t> extra;
+    while (uxTaskGetNumberOfTasks() <= Profiler::MAX_TASKS) {
+        TaskHandle_t task = NULL;
+        xTaskCreate(&sleepTask, "sleepTask", STACK_SIZE, NULL, 1, &task);
+        extra.push_back(task);
+    }
+    check(Profiler::sample() == 0 && Profiler::getLeftOut() == uxTaskGetNumberOfTasks(), "every task left out, and said so");
+    Profiler::print<Stdout>();
+    for (TaskHandle_t task : extra)
+        vTaskDelete(task);
+    check(Profiler::sample() > 0 && Profiler::getLeftOut() == 0, "sampled again once the tasks are gone");
+}
+
+template <typename F>
+static double nsPerCall(F call) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < COST_CALLS; i++)
+        call();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / COST_CALLS * 1e9;
+}
+
+static void benchTask(void *pvParameters) {
+    xEvent = xSemaphoreCreateBinary();
+    xHog = xSemaphoreCreateBinary();
+    xTaskCreate(&workTask, "workTask", STACK_SIZE, NULL, 1, NULL);
+    xTaskCreate(&eventTask, "eventTask", STACK_SIZE, NULL, 2, NULL);
+    xTaskCreate(&hogTask, "hogTask", STACK_SIZE, NULL, 3, NULL);
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &isr;
+    timerArgs.dispatch_method = ESP_TIMER_TASK;
+    timerArgs.name = "isr";
+    esp_timer_create(&timerArgs, &isrTimer);
+
+    Profiler::sample();  // Opens the first interval
+    esp_timer_start_periodic(isrTimer, SIGNAL_MS * 1000);
+    vTaskDelay(pdMS_TO_TICKS(RUN_MS));
+    Profiler::print<Stdout>();
+
+    unsigned long before = signals;  // Each sample closes an interval: the next one is checked on its own
+    vTaskDelay(pdMS_TO_TICKS(SECOND_RUN_MS));
+    size_t n = Profiler::sample();
+    checkInterval(n, SECOND_RUN_MS, signals - before);
+    esp_timer_stop(isrTimer);
+    vTaskDelay(pdMS_TO_TICKS(MAX_HOG_US / 1000 + 2));  // Last signal taken
+    checkLatencies();
+    Profiler::emit<Capture>();
+    checkFrames();
+    checkTooManyTasks();
+
+    double wake = nsPerCall([] { Profiler::wake(); });
+    double signalled = nsPerCall([] { Profiler::signal(BUTTON_INPUT); Profiler::received(); });
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; i++)
+        sink += Profiler::sample();
+    std::chrono::duration<double> sampled = std::chrono::steady_clock::now() - start;
+    double rate = 1000.0 / WORK_MS + 2 * 1000.0 / SIGNAL_MS;  // Wakeups per second of the workload
+    double share = (rate * wake + 1000.0 / SIGNAL_MS * signalled) / 1e9 * 100;
+    printf("cost: wake %.1f ns, signal + received %.1f ns, sample %.2f us (%zu tasks)\n", wake, signalled,
+           sampled.count() / 1000 * 1e6, n);
+    printf("instrumentation at %.0f wakeups/s: %.5f%% of the CPU\n", rate, share);
+    check(share < 1.0, "instrumentation under 1% of the CPU");
+
+    printf("%s\n", failures == 0 ? "all profiler checks passed" : "some profiler checks failed");
+    fflush(stdout);
+    simStop(failures != 0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xTaskCreate(&benchTask, "benchTask", 4096, NULL, tskIDLE_PRIORITY, NULL);  // Samples once the workload is done
+}
+
+int main(void) {
+    setenv("SIM_DURATION_MS", "1000000", 1);  // Upper bound; the bench stops the simulation when done
+    return simMain();
+}
@@ -0,0 +1,132 @@
+//
+// render_bench.cpp
+// Author: Francesco Mecatti
+// Host benchmark: bytes sent to the console and CPU time per refresh, for the original per-character printf output
+// of Time and for the dirty-region Renderer. Session: one refresh per second for an hour, a lap every 30 s, then a clear
+//
+
+#include <stdio.h>
+#include <chrono>
+#include "Time.h"
+
+#define SESSION_S       (3600)
+#define LAP_PERIOD_S    (30)
+#define UART_BAUD       (115200)  // 10 bits per byte on the wire (8N1)
+#define REPEAT          (20)
+
+static unsigned long sinkBytes = 0, sinkWrites = 0;
+
+static ssize_t countingWrite(void *cookie, const char *buffer, size_t size) {
+    (void) cookie; (void) buffer;
+    sinkBytes += size;
+    sinkWrites++;
+    return size;
+}
+
+// Previous Time output code, kept as reference
+namespace legacy {
+    unsigned int row = 0;
+    unsigned int hh = 0, mm = 0, ss = 0, cs = 0;
+
+    // Former Time::computeTime
+    void computeTime(ctime_t centiseconds) {
+        hh = centiseconds / (100*60*60);
+        mm = (centiseconds - hh*(100*60*60)) / (100*60);
+        ss = (centiseconds - hh*(100*60*60) - mm*(100*60)) / (100);
+        cs = (centiseconds - hh*(100*60*60) - mm*(100*60) - ss*(100));
+    }
+
+    void updateTime(FILE *out) {
+        for (int i = 0; i < 6+2; i++) fprintf(out, "\b");
+        computeTime(Time::getCentiseconds());
+        fprintf(out, "\e[?25l\e[104m%02u:%02u:%02u\e[0m", hh, mm, ss);
+        fflush(out);
+    }
+
+    void addLap(FILE *out) {
+        fprintf(out, "\e[s");
+        for (int i = 0; i < 10; i++) fprintf(out, "\e[1C");
+        for (unsigned int i = 0; i < row+1; i++) fprintf(out, "\e[1B");
+        computeTime(Time::getCentiseconds());
+        fprintf(out, "\e[?25l(%d)\t%02u:%02u:%02u.%02u", row+1, hh, mm, ss, cs);
+        fprintf(out, "\e[u");
+        fflush(out);
+        row++;
+    }
+
+    void clearLaps(FILE *out) {
+        fprintf(out, "\e[s");
+        for (int i = 0; i < 10; i++) fprintf(out, "\e[1C");
+        for (unsigned int i = 0; i < row+1; i++) {
+            fprintf(out, "\e[1B");
+            fprintf(out, "\e[K");
+        }
+        fprintf(out, "\e[u");
+        fflush(out);
+        row = 0;
+    }
+}
+
+typedef void (*session_step_t)(FILE *out, bool lap, bool clear);
+
+static void legacyStep(FILE *out, bool lap, bool clear) {
+    if (clear)
+        legacy::clearLaps(out);
+    else if (lap)
+        legacy::addLap(out);
+    else
+        legacy::updateTime(out);
+}
+
+static void rendererStep(FILE *out, bool lap, bool clear) {
+    (void) out;
+    if (clear) {
+        Time::laps.clear();
+        Time::clearLapRows();
+    }
+    else if (lap) {
+        Time::laps.add(FakeClock::us, Time::elapsedAt(FakeClock::us));
+        Time::drawLap(Time::laps.last());
+    }
+    else {
+        Time::drawTime();
+    }
+    Time::screen.flush();
+}
+
+static void runSession(const char *name, session_step_t step, FILE *out) {
+    unsigned long refreshes = 0;
+    std::chrono::duration<double> cpu(0);
+    sinkBytes = sinkWrites = 0;
+    for (int r = 0; r < REPEAT; r++) {
+        FakeClock::reset();
+        Time::startTimestamp = 0;
+        Time::elapsedUs = 0;
+        Time::stopped = false;
+        for (int s = 1; s <= SESSION_S + 1; s++) {
+            FakeClock::advance(1000000);
+            auto start = std::chrono::steady_clock::now();
+            step(out, s % LAP_PERIOD_S == 0, s == SESSION_S + 1);
+            cpu += std::chrono::steady_clock::now() - start;
+            refreshes++;
+        }
+    }
+    double bytes = (double) sinkBytes / REPEAT;
+    printf("%-10s %12.0f %10.1f %12lu %14.2f %12.1f\n", name, bytes, bytes / refreshes * REPEAT, sinkWrites / REPEAT,
+           bytes * 10 / UART_BAUD, cpu.count() / refreshes * 1e9);
+}
+
+int main(void) {
+    cookie_io_functions_t functions = {NULL, countingWrite, NULL, NULL};
+    FILE *sink = fopencookie(NULL, "w", functions);
+    setvbuf(sink, NULL, _IOFBF, 4096);
+    Time::clockSource = FakeClock::now;
+    Time::screen.setOutput(sink);
+
+    printf("%d s session, lap every %d s, %d refreshes\n", SESSION_S, LAP_PERIOD_S, SESSION_S + 1);
+    printf("%-10s %12s %10s %12s %14s %12s\n", "output", "bytes", "B/refresh", "writes", "UART time [s]", "ns/refresh");
+    runSession("printf", legacyStep, sink);
+    runSession("renderer", rendererStep, sink);
+    fclose(sink);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# replay.sh
+# Author: Francesco Mecatti
+# Input trace replay (see InputTrace.h and SIM_REPLAY in README.md).
+# With no trace, a record and replay round trip: each stopwatch, built with RECORD_INPUTS, records its events on the
+# text traces of host/traces; the recording is then replayed into the same build, which must record exactly the same
+# trace again and draw exactly the same screen. Exits with 1 otherwise.
+# With traces, a regression run: every session of every trace is replayed into each stopwatch, one line per session,
+# then the replay rate. Exits with 1 if a replay fails.
+# Usage: host/replay.sh [build directory] [recorded trace...]
+#
+
+BUILD=$(cd "${1:-build}" && pwd)
+[ $# -gt 0 ] && shift
+TRACES=$*
+SKETCHES="Stopwatch ButtonInterruptStopwatch InputInterruptStopwatch"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+STATUS=0
+
+if [ -z "$TRACES" ]; then
+    printf "%-20s %-26s %7s %7s %11s %7s %7s\n" trace sketch events bytes bytes/event trace screen
+    for trace in "$(dirname "$0")"/traces/*.trace; do
+        case $trace in *hall_noise*) continue ;; esac  # For HallBench: no sketch samples the Hall sensor fast enough
+        trace=$(cd "$(dirname "$trace")" && pwd)/$(basename "$trace")
+        for sketch in $SKETCHES; do
+            rm -f "$WORK"/*
+            (cd "$WORK" && SIM_TRACE=$trace "$BUILD/${sketch}Recorder" > recorded.screen 2> record.log && mv inputs.trace recorded.trace &&
+             SIM_REPLAY=recorded.trace SIM_DURATION_MS=$(awk '/^--- sim:/ { print $3 * 1000 }' record.log) \
+             "$BUILD/${sketch}Recorder" > replayed.screen 2> replay.log)  # As long as the recording: the last frames match too
+            events=$(awk '/^replay:/ { print $6 }' "$WORK/replay.log")
+            bytes=$(wc -c < "$WORK/recorded.trace")
+            same=same; cmp -s "$WORK/recorded.trace" "$WORK/inputs.trace" || { same=DIFFERS; STATUS=1; }
+            screen=same; cmp -s "$WORK/recorded.screen" "$WORK/replayed.screen" || { screen=DIFFERS; STATUS=1; }
+            printf "%-20s %-26s %7s %7s %11s %7s %7s\n" "$(basename "$trace" .trace)" "$sketch" "${events:-0}" "$bytes" \
+                "$(awk -v b="$bytes" -v e="${events:-0}" 'BEGIN { printf "%.2f", (e > 0 ? b / e : 0) }')" "$same" "$screen"
+        done
+    done
+    exit $STATUS
+fi
+
+runs=0
+start=$(date +%s.%N)
+printf "%-24s %7s %-26s %7s %6s %9s %9s\n" trace session sketch events missed "p50 [ms]" "max [ms]"
+for trace in $TRACES; do
+    sessions=$(SIM_REPLAY=$trace SIM_REPLAY_SESSION=0 SIM_DURATION_MS=0 "$BUILD/Stopwatch" 2>&1 >/dev/null | awk '/^replay:/ { print $5 }' | tr -d ,)
+    [ -z "$sessions" ] && { echo "$trace: no session"; STATUS=1; continue; }
+    session=0
+    while [ "$session" -lt "$sessions" ]; do
+        for sketch in $SKETCHES; do
+            SIM_REPLAY=$trace SIM_REPLAY_SESSION=$session "$BUILD/$sketch" > /dev/null 2> "$WORK/replay.log" || STATUS=1
+            awk -v trace="$(basename "$trace")" -v session="$session" -v sketch="$sketch" '
+                /^replay:/  { events = $6 }
+                /^latency:/ { missed = $4; p50 = $7; max = $13 }
+                END         { printf "%-24s %7s %-26s %7s %6s %9s %9s\n", trace, session, sketch, events, missed, p50, max }' "$WORK/replay.log"
+            runs=$((runs + 1))
+        done
+        session=$((session + 1))
+    done
+done
+awk -v runs="$runs" -v start="$start" -v end="$(date +%s.%N)" \
+    'BEGIN { printf "%d replays in %.2f s: %.0f per minute\n", runs, end - start, (end > start ? runs * 60 / (end - start) : 0) }'
+exit $STATUS
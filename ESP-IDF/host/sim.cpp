@@ -0,0 +1,1627 @@
+//
+// sim.cpp
+// Author: Francesco Mecatti
+// Host simulator backing the ESP-IDF/FreeRTOS subset found in host/.
+// Every task is a Linux thread, but only one of them holds the CPU at a time, handed over by the scheduler loop in main().
+// Tasks run in zero virtual time until they block (vTaskDelay, xSemaphoreTake); when no task is ready the virtual clock
+// jumps to the next deadline or trace event. Runs are therefore deterministic and much faster than real time.
+// SIM_CORES=2 simulates both ESP32 cores: each runs its own highest priority task, within the task core affinity.
+// Work that takes CPU time is declared with simCompute(), which keeps the core busy while the rest of the system goes on
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "driver/touch_pad.h"
+#include "driver/adc.h"
+#include "driver/ledc.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_partition.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "sim.h"
+#include "InputTrace.h"
+
+extern "C" void app_main(void) __attribute__((weak));  // Defined by the sketch
+
+#define SIM_TICK_US             ((int64_t) 1000000 / configTICK_RATE_HZ)
+#define SIM_DISPATCH_COST_US    (1)  // Virtual time charged for every context switch, so that yield loops still see the clock move
+#define SIM_STACK_SCALE         (32)  // Host frames (and glibc printf) are much larger than Xtensa ones
+#define SIM_STACK_RESERVED      (16384)  // Thread descriptor and TLS, placed by glibc at the top of the stack
+#define SIM_STACK_PAINT         (0xa5)
+#define SIM_DEAD_ZONE           (8192)
+#define SIM_MAIN_TASK_STACK     (3584)  // CONFIG_ESP_MAIN_TASK_STACK_SIZE
+#define SIM_MAIN_TASK_PRIO      (1)
+#define SIM_DEFAULT_DURATION_MS (10000)
+#define SIM_TRACE_TAIL_MS       (1000)  // Keep running after the last trace event
+#define SIM_TOUCH_IDLE_VALUE    (700)  // Untouched pad reading
+#define SIM_REPLAY_TOUCH_VALUE  (SIM_TOUCH_IDLE_VALUE / 4)  // Replayed touch: well below any press threshold
+#define SIM_TOUCH_MEASURE_US    (30000)  // Touch FSM cycle, default sleep plus measurement time: a level interrupt fires again at each one
+#define SIM_REPLAY_HALL_VALUE   (-40)  // Replayed Hall press: a magnet, well past any press delta
+#define SIM_PROBE_GPIO          (2)  // Output whose rising edge answers a "press" trace event (the LED)
+#define SIM_LEDC_SOURCE_HZ      (80000000)  // APB clock: frequency * 2^resolution must not exceed it
+#define SIM_SLEEP_MIN_IDLE_TICKS (3)  // CONFIG_FREERTOS_IDLE_TIME_BEFORE_SLEEP: shorter idle stretches are not worth a light sleep
+#define SIM_MAX_CORES           (portNUM_PROCESSORS)
+#define SIM_FLASH_LABEL         "laplog"  // Label of the simulated data partition
+#define SIM_TIMER_JITTER_SEED   (9)
+#define SIM_FLASH_SIZE_KB       (64)
+#define SIM_FLASH_PAGE          (256)  // Program unit
+#define SIM_FLASH_PROGRAM_US    (600)  // Per page programmed, typical of the ESP32 SPI flash
+#define SIM_FLASH_ERASE_US      (45000)  // Per sector
+#define SIM_NEVER               INT64_MAX
+
+typedef enum {READY, DELAYED, BLOCKED, COMPUTING, DELETED} TaskState;
+typedef enum {TRACE_GPIO, TRACE_TOUCH, TRACE_HALL} InputKind;
+
+struct sim_semaphore {
+    bool available = false;
+};
+
+struct sim_task {
+    TaskFunction_t function;
+    void *parameters;
+    std::string name;
+    UBaseType_t priority;
+    uint32_t stackDepth;  // Requested by the sketch, bytes
+    uint8_t *stack;
+    size_t stackSize;
+    size_t stackBaseline = 0;  // Used by the thread start-up code, before the task function runs
+    pthread_t thread;
+    std::condition_variable cpu;
+    TaskState state = READY;
+    int64_t wakeTime = SIM_NEVER;
+    sim_semaphore *waitingOn = nullptr;
+    bool timedOut = false;
+    unsigned long blockOrder = 0;
+    unsigned long lastDispatch = 0;
+    unsigned long wakeups = 0;
+    BaseType_t affinity = tskNO_AFFINITY;
+    int core = 0;  // Where it runs, or ran last
+    int64_t computeLeft = 0;  // COMPUTING: CPU time still to spend, us
+    bool computed = false;  // Ready again after simCompute: its next dispatch is not a wakeup
+    unsigned long lastSlice = 0;
+};
+
+// A computing task keeps its core until it is done, a higher priority task needs the core, or its time slice ends at a
+// tick and another task of the same priority takes its turn (configUSE_TIME_SLICING)
+struct sim_core {
+    sim_task *owner = nullptr;  // COMPUTING task spending its time here
+    int64_t sliceEnd = 0;
+    int64_t busyUs = 0;
+};
+
+struct sim_ledc_channel {
+    bool configured = false;
+    int gpio = -1;
+    ledc_timer_t timer = LEDC_TIMER_0;
+    uint32_t duty = 0;  // Output duty, or the target of the fade in progress
+    uint32_t pendingDuty = 0;  // Set by ledc_set_duty, latched by ledc_update_duty
+    uint32_t fadeFrom = 0, fadeTarget = 0;
+    int fadeTimeMs = -1;  // Set by ledc_set_fade_with_time, started by ledc_fade_start
+    int64_t fadeStart = 0, fadeEnd = 0;
+    unsigned long updates = 0, fades = 0;
+};
+
+struct esp_pm_lock {
+    esp_pm_lock_type_t type;
+    int count = 0;
+};
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    std::string name;
+    int64_t expiry = SIM_NEVER;  // Alarm
+    int64_t latency = 0;  // From the alarm to the callback, drawn for each alarm (SIM_TIMER_JITTER_US)
+    uint64_t period = 0;  // 0 for one-shot timers
+};
+
+typedef struct {
+    int64_t time;
+    int mode, channel;
+    uint32_t duty;
+    bool fade;  // Reached linearly from the previous sample of the channel
+} LedcSample;
+
+typedef struct {
+    int64_t time;
+    InputKind kind;
+    int index;
+    int value;
+    bool press;  // Latency stimulus, answered by the next rising edge of the probe output
+} TraceEvent;
+
+static int64_t now = 0;
+static int64_t endTime = 0;
+static int exitStatus = 0;
+static std::vector<sim_task *> tasks;
+static std::vector<TraceEvent> trace;
+static size_t nextEvent = 0;
+static unsigned long dispatchCount = 0, blockCount = 0, sliceCount = 0;
+static int coreCount = 1;
+static sim_core cores[SIM_MAX_CORES];
+
+// CPU hand-over between the scheduler and the task threads
+static std::mutex cpuMutex;
+static std::condition_variable schedulerCpu;
+static sim_task *running = nullptr;
+static thread_local sim_task *currentTask = nullptr;
+
+// Peripherals
+static int gpioLevel[GPIO_NUM_MAX];
+static gpio_mode_t gpioMode[GPIO_NUM_MAX];
+static gpio_int_type_t gpioIntrType[GPIO_NUM_MAX];
+static bool gpioIntrEnabled[GPIO_NUM_MAX];
+static gpio_isr_t gpioHandler[GPIO_NUM_MAX];
+static void *gpioHandlerArg[GPIO_NUM_MAX];
+static bool gpioIsrService = false;
+static bool gpioIsrPending[GPIO_NUM_MAX];  // Level interrupt enabled while the level is already there
+static bool gpioWakeup[GPIO_NUM_MAX];
+static sim_gpio_observer_t gpioObserver = nullptr;
+static unsigned long gpioIsrCount = 0, gpioOutputChanges[GPIO_NUM_MAX];
+
+static uint16_t touchValue[TOUCH_PAD_MAX], touchThreshold[TOUCH_PAD_MAX];  // Raw reading, compared with the threshold
+static uint16_t touchFiltered[TOUCH_PAD_MAX];  // Follows the raw one, unless a check holds it back (simSetTouchRawValue)
+static bool touchTriggered[TOUCH_PAD_MAX];
+static touch_trigger_mode_t touchTriggerMode = TOUCH_TRIGGER_BELOW;
+static uint32_t touchStatus = 0;
+static bool touchIntrEnabled = false, touchIsrPending = false, touchReconfigured = false;
+static int64_t touchMeasureAt = 0;  // Next measurement cycle after the last touch interrupt
+static intr_handler_t touchHandler = nullptr;
+static void *touchHandlerArg = nullptr;
+static unsigned long touchIsrCount = 0, touchConfigCount = 0;
+
+static ledc_timer_config_t ledcTimer[LEDC_SPEED_MODE_MAX][LEDC_TIMER_MAX];
+static bool ledcTimerConfigured[LEDC_SPEED_MODE_MAX][LEDC_TIMER_MAX];
+static sim_ledc_channel ledcChannel[LEDC_SPEED_MODE_MAX][LEDC_CHANNEL_MAX];
+static bool ledcFadeInstalled = false;
+static std::vector<LedcSample> ledcTimeline;
+
+static std::vector<esp_timer *> timers;
+static unsigned long timerCallbacks = 0;
+static bool inTimerCallback = false;
+
+// Power management: idle time, wakeups and automatic light sleep
+static bool pmLightSleep = false;
+static int pmNoSleepLocks = 0;  // ESP_PM_NO_LIGHT_SLEEP locks held
+static bool sleepGpioWakeup = false, sleepTouchWakeup = false;
+static int64_t idleSince = -1;  // Start of the current idle stretch, -1 while a task runs
+static bool sleeping = false;  // The current idle stretch is spent in light sleep
+static unsigned long idleInterrupts = 0, idleTimerCallbacks = 0;  // Counts when the idle stretch began
+static int64_t idleUs = 0, sleepUs = 0;
+static unsigned long timerWakeups = 0, inputWakeups = 0, sleepPeriods = 0, sleepLostInterrupts = 0;
+
+static int hallValue = 0;
+static unsigned long hallReads = 0;
+
+// Press-to-response latency
+static int probeGpio = SIM_PROBE_GPIO;
+static int64_t timerJitterUs = 0;
+static std::mt19937 timerRng(SIM_TIMER_JITTER_SEED);
+static bool pressPending = false;
+static int64_t pressTime = 0;
+static unsigned long presses = 0, missedPresses = 0;
+static std::string replayNote;  // Session replayed from SIM_REPLAY, for the report
+static std::vector<int64_t> latencies;
+
+// Flash partition
+static esp_partition_t flashPartition = {};
+static std::vector<uint8_t> flash;  // Empty until the partition is first looked up
+static std::vector<unsigned long> flashSectorErases;
+static FILE *flashFile = NULL;
+static SimFlashStats flashStats = {};
+static int64_t flashCutBudget = -1;  // Bytes still programmed before the simulated power cut; -1: none
+
+
+static void fatal(const char *message) {
+    fprintf(stderr, "sim: %s\n", message);
+    fflush(stdout);
+    _exit(1);
+}
+
+static sim_task *self(void) {
+    if (currentTask == nullptr)
+        fatal("FreeRTOS call outside of a task");
+    return currentTask;
+}
+
+// An interrupt from a source that cannot wake the chip is lost if it comes during light sleep
+static void noteInterrupt(bool wakeupSource) {
+    if (sleeping && !wakeupSource)
+        sleepLostInterrupts++;
+}
+
+static int64_t nextTickTime(TickType_t ticks) {  // FreeRTOS wakes tasks on tick boundaries
+    return (now / SIM_TICK_US + ticks) * SIM_TICK_US;
+}
+
+// Scheduler side: give the CPU to a task and wait until it blocks
+static void dispatch(sim_task *t) {
+    std::unique_lock<std::mutex> lock(cpuMutex);
+    running = t;
+    if (!t->computed)
+        t->wakeups++;
+    t->computed = false;
+    t->lastDispatch = ++dispatchCount;
+    t->cpu.notify_one();
+    schedulerCpu.wait(lock, [] { return running == nullptr; });
+}
+
+// Task side: hand the CPU back and sleep until the scheduler picks this task again
+static void releaseCpu(sim_task *t) {
+    std::unique_lock<std::mutex> lock(cpuMutex);
+    running = nullptr;
+    schedulerCpu.notify_one();
+    t->cpu.wait(lock, [t] { return running == t; });
+}
+
+static void block(sim_task *t, TaskState state, int64_t wakeTime) {
+    t->state = state;
+    t->wakeTime = wakeTime;
+    t->blockOrder = ++blockCount;
+    releaseCpu(t);
+}
+
+static size_t unusedStack(sim_task *t) {
+    size_t unused = 0;
+    while (unused < t->stackSize && t->stack[unused] == SIM_STACK_PAINT)
+        unused++;
+    return unused;
+}
+
+// Keep the frames of a returned task untouched: FreeRTOS frees a deleted task stack lazily, and the examples
+// hand pointers to app_main locals to their tasks
+static void __attribute__((noinline)) runTaskFunction(sim_task *t) {
+    [[maybe_unused]] volatile uint8_t deadZone[SIM_DEAD_ZONE];
+    deadZone[0] = 0;
+    t->function(t->parameters);
+    deadZone[0] = 1;  // Keeps the frame alive across the call (no tail call)
+}
+
+static void *taskEntry(void *pvParameters) {
+    sim_task *t = (sim_task *) pvParameters;
+    currentTask = t;
+    t->stackBaseline = t->stackSize - unusedStack(t);
+    {
+        std::unique_lock<std::mutex> lock(cpuMutex);
+        t->cpu.wait(lock, [t] { return running == t; });
+    }
+    runTaskFunction(t);
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+static bool runsOn(sim_task *t, int core) {
+    return t->affinity == tskNO_AFFINITY || t->affinity == core;
+}
+
+// Whether t can take core now: free, computing at a lower priority, or at the same one with its time slice over
+static bool canTake(sim_task *t, int core) {
+    sim_task *owner = cores[core].owner;
+    return owner == nullptr || t->priority > owner->priority || (t->priority == owner->priority && now >= cores[core].sliceEnd);
+}
+
+// For t, core a over core b: a free core first, then the one computing at the lowest priority, then the one t ran on last
+static bool betterCore(sim_task *t, int a, int b) {
+    int rankA = cores[a].owner != nullptr ? (int) cores[a].owner->priority : -1;
+    int rankB = cores[b].owner != nullptr ? (int) cores[b].owner->priority : -1;
+    return rankA != rankB ? rankA < rankB : a == t->core;
+}
+
+// Highest priority ready task that some core can run now, and the core to run it on
+static sim_task *pickReadyTask(int *core) {
+    sim_task *next = nullptr;
+    for (sim_task *t : tasks) {
+        if (t->state != READY)
+            continue;
+        if (next != nullptr && (t->priority < next->priority || (t->priority == next->priority && t->lastDispatch >= next->lastDispatch)))
+            continue;
+        int best = -1;
+        for (int c = 0; c < coreCount; c++)
+            if (runsOn(t, c) && canTake(t, c) && (best < 0 || betterCore(t, c, best)))
+                best = c;
+        if (best >= 0) {
+            next = t;
+            *core = best;
+        }
+    }
+    return next;
+}
+
+// Give every core to its computing task: the highest priority one, equal priorities taking turns at each tick
+static void assignCores(void) {
+    for (int c = 0; c < coreCount; c++) {
+        sim_core &core = cores[c];
+        sim_task *best = nullptr;
+        for (sim_task *t : tasks)
+            if (t->state == COMPUTING && t->core == c && (best == nullptr || t->priority > best->priority || (t->priority == best->priority && t->lastSlice < best->lastSlice)))
+                best = t;
+        sim_task *owner = core.owner != nullptr && core.owner->state == COMPUTING && core.owner->core == c ? core.owner : nullptr;
+        if (owner != nullptr && best != nullptr && owner->priority == best->priority && now < core.sliceEnd)
+            best = owner;  // Keeps its slice
+        if (best != nullptr && (best != owner || now >= core.sliceEnd)) {
+            best->lastSlice = ++sliceCount;
+            core.sliceEnd = nextTickTime(1);
+        }
+        core.owner = best;
+    }
+}
+
+static bool anyCoreBusy(void) {
+    for (int c = 0; c < coreCount; c++)
+        if (cores[c].owner != nullptr)
+            return true;
+    return false;
+}
+
+// Next time a computing task is done, or a tick when a time slice may pass to another task
+static int64_t nextComputeEvent(void) {
+    int64_t next = SIM_NEVER;
+    bool waiting = std::any_of(tasks.begin(), tasks.end(), [](sim_task *t) { return t->state == READY || t->state == COMPUTING; });
+    for (int c = 0; c < coreCount; c++) {
+        if (cores[c].owner == nullptr)
+            continue;
+        next = std::min(next, now + cores[c].owner->computeLeft);
+        if (waiting)
+            next = std::min(next, std::max(cores[c].sliceEnd, now));
+    }
+    return next;
+}
+
+// Move the clock forward; the task computing on each core spends the time
+static void advanceTo(int64_t time) {
+    for (int c = 0; c < coreCount; c++) {
+        sim_task *owner = cores[c].owner;
+        if (owner == nullptr || owner->state != COMPUTING)
+            continue;
+        int64_t spent = std::min(time - now, owner->computeLeft);
+        owner->computeLeft -= spent;
+        cores[c].busyUs += spent;
+        if (owner->computeLeft == 0) {
+            owner->state = READY;  // Carries on from simCompute
+            owner->computed = true;
+            cores[c].owner = nullptr;
+        }
+    }
+    now = time;
+}
+
+static void makeReady(sim_task *t) {
+    t->state = READY;
+    t->wakeTime = SIM_NEVER;
+    t->waitingOn = nullptr;
+}
+
+
+// ----- FreeRTOS tasks -----
+
+// A core the simulation does not have runs the task on core 0, as a CONFIG_FREERTOS_UNICORE build does
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask, BaseType_t xCoreID) {
+    if (xCoreID != tskNO_AFFINITY && (xCoreID < 0 || xCoreID >= SIM_MAX_CORES))
+        return pdFAIL;
+    sim_task *t = new sim_task;
+    t->affinity = coreCount > 1 ? xCoreID : 0;
+    t->core = t->affinity != tskNO_AFFINITY ? t->affinity : 0;
+    t->function = pvTaskCode;
+    t->parameters = pvParameters;
+    t->name = pcName;
+    t->priority = uxPriority;
+    t->stackDepth = usStackDepth;
+    t->stackSize = (size_t) usStackDepth * SIM_STACK_SCALE + SIM_STACK_RESERVED;
+    size_t page = sysconf(_SC_PAGESIZE);
+    t->stackSize = (t->stackSize + page - 1) / page * page;
+    uint8_t *mapping = (uint8_t *) mmap(NULL, t->stackSize + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (mapping == MAP_FAILED)
+        return pdFAIL;
+    mprotect(mapping, page, PROT_NONE);  // Guard page: a stack overflow crashes instead of corrupting memory
+    t->stack = mapping + page;
+    memset(t->stack, SIM_STACK_PAINT, t->stackSize);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, t->stack, t->stackSize);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    tasks.push_back(t);
+    if (pthread_create(&t->thread, &attr, taskEntry, t) != 0)
+        fatal("cannot create task thread");
+    pthread_attr_destroy(&attr);
+    if (pxCreatedTask != NULL)
+        *pxCreatedTask = t;
+    if (currentTask != nullptr && uxPriority > currentTask->priority)
+        vTaskDelay(0);  // Preempted by the new task
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask) {
+    return xTaskCreatePinnedToCore(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {
+    sim_task *t = xTaskToDelete != NULL ? xTaskToDelete : self();
+    t->state = DELETED;
+    t->wakeTime = SIM_NEVER;
+    t->waitingOn = nullptr;
+    if (t == currentTask)
+        releaseCpu(t);  // Never picked again
+}
+
+void vTaskDelay(TickType_t xTicksToDelay) {
+    sim_task *t = self();
+    if (xTicksToDelay == 0)
+        block(t, READY, SIM_NEVER);  // Plain yield
+    else
+        block(t, DELAYED, nextTickTime(xTicksToDelay));
+}
+
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime, TickType_t xTimeIncrement) {
+    sim_task *t = self();
+    *pxPreviousWakeTime += xTimeIncrement;
+    int32_t ahead = (int32_t) (*pxPreviousWakeTime - xTaskGetTickCount());  // Right across the tick count wrap too
+    if (ahead > 0)
+        block(t, DELAYED, nextTickTime((TickType_t) ahead));
+    else
+        block(t, READY, SIM_NEVER);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t) (now / SIM_TICK_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return currentTask;
+}
+
+BaseType_t xPortGetCoreID(void) {
+    return currentTask != nullptr ? currentTask->core : 0;
+}
+
+// Scaled back to device bytes, so it can be compared with usStackDepth; only an estimate of the Xtensa usage
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask) {
+    sim_task *t = xTask != NULL ? xTask : self();
+    size_t used = t->stackSize - unusedStack(t) - t->stackBaseline;
+    size_t usedDevice = used / SIM_STACK_SCALE;
+    return usedDevice < t->stackDepth ? t->stackDepth - usedDevice : 0;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void) {
+    return (UBaseType_t) std::count_if(tasks.begin(), tasks.end(), [](sim_task *t) { return t->state != DELETED; });
+}
+
+// Deleted tasks are left out, as FreeRTOS does once their memory is freed (their threads may be gone as well)
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *pxTaskStatusArray, const UBaseType_t uxArraySize, uint32_t *pulTotalRunTime) {
+    UBaseType_t n = 0;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        sim_task *t = tasks[i];
+        if (t->state == DELETED)
+            continue;
+        if (n == uxArraySize)
+            return 0;  // As FreeRTOS: the array must hold every task
+        clockid_t clock;
+        struct timespec cpu = {};
+        if (pthread_getcpuclockid(t->thread, &clock) == 0)
+            clock_gettime(clock, &cpu);
+        TaskStatus_t &status = pxTaskStatusArray[n++];
+        status.xHandle = t;
+        status.pcTaskName = t->name.c_str();
+        status.xTaskNumber = (UBaseType_t) i + 1;
+        status.eCurrentState = t == currentTask ? eRunning : t->state == READY ? eReady : eBlocked;
+        status.uxCurrentPriority = status.uxBasePriority = t->priority;
+        status.ulRunTimeCounter = (uint32_t) ((int64_t) cpu.tv_sec * 1000000 + cpu.tv_nsec / 1000);
+        status.pxStackBase = t->stack;
+        status.usStackHighWaterMark = uxTaskGetStackHighWaterMark(t);
+        status.xCoreID = t->affinity;
+    }
+    if (pulTotalRunTime != NULL)
+        *pulTotalRunTime = (uint32_t) now;
+    return n;
+}
+
+
+// ----- FreeRTOS semaphores -----
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return new sim_semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    sim_semaphore *mutex = new sim_semaphore;
+    mutex->available = true;
+    return mutex;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore) {
+    delete xSemaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime) {
+    sim_task *t = self();
+    if (xSemaphore->available) {
+        xSemaphore->available = false;
+        return pdTRUE;
+    }
+    if (xBlockTime == 0)
+        return pdFALSE;
+    t->waitingOn = xSemaphore;
+    t->timedOut = false;
+    block(t, BLOCKED, xBlockTime == portMAX_DELAY ? SIM_NEVER : nextTickTime(xBlockTime));
+    return t->timedOut ? pdFALSE : pdTRUE;
+}
+
+// Hand the semaphore straight to the highest priority waiter, if any
+static sim_task *give(SemaphoreHandle_t xSemaphore) {
+    sim_task *waiter = nullptr;
+    for (sim_task *t : tasks) {
+        if (t->state != BLOCKED || t->waitingOn != xSemaphore)
+            continue;
+        if (waiter == nullptr || t->priority > waiter->priority || (t->priority == waiter->priority && t->blockOrder < waiter->blockOrder))
+            waiter = t;
+    }
+    if (waiter != nullptr)
+        makeReady(waiter);
+    else
+        xSemaphore->available = true;
+    return waiter;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore) {
+    if (xSemaphore->available)
+        return pdFALSE;
+    sim_task *woken = give(xSemaphore);
+    if (inTimerCallback)
+        return pdTRUE;  // The esp_timer task outranks the woken task
+    sim_task *t = self();
+    if (woken != nullptr && woken->priority > t->priority)
+        block(t, READY, SIM_NEVER);  // Preempted by the woken task
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t xSemaphore, BaseType_t *pxHigherPriorityTaskWoken) {
+    if (xSemaphore->available)
+        return pdFALSE;
+    sim_task *woken = give(xSemaphore);
+    if (pxHigherPriorityTaskWoken != NULL && woken != nullptr)
+        *pxHigherPriorityTaskWoken = pdTRUE;
+    return pdTRUE;
+}
+
+
+// ----- GPIO -----
+
+void gpio_pad_select_gpio(uint8_t gpio_num) {
+    (void) gpio_num;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    gpioMode[gpio_num] = mode;
+    return ESP_OK;
+}
+
+void simSetGpioObserver(sim_gpio_observer_t observer) {
+    gpioObserver = observer;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    if (gpioMode[gpio_num] == GPIO_MODE_OUTPUT || gpioMode[gpio_num] == GPIO_MODE_INPUT_OUTPUT) {
+        if (gpioLevel[gpio_num] != (int) !!level) {
+            gpioOutputChanges[gpio_num]++;
+            if (gpioObserver != nullptr)
+                gpioObserver(gpio_num, !!level, now);
+            if (gpio_num == probeGpio && level && pressPending) {
+                latencies.push_back(now - pressTime);
+                pressPending = false;
+            }
+        }
+        gpioLevel[gpio_num] = !!level;
+    }
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return 0;
+    return gpioLevel[gpio_num];
+}
+
+static bool gpioLevelActive(int gpio_num) {
+    return (gpioIntrType[gpio_num] == GPIO_INTR_LOW_LEVEL && gpioLevel[gpio_num] == 0) ||
+           (gpioIntrType[gpio_num] == GPIO_INTR_HIGH_LEVEL && gpioLevel[gpio_num] == 1);
+}
+
+// A level interrupt armed while its level is already there fires at once, delivered by the scheduler
+static void gpioCheckLevel(int gpio_num) {
+    if (gpioHandler[gpio_num] != nullptr && gpioIntrEnabled[gpio_num] && gpioLevelActive(gpio_num))
+        gpioIsrPending[gpio_num] = true;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    gpioIntrType[gpio_num] = intr_type;
+    gpioCheckLevel(gpio_num);
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    gpioIntrEnabled[gpio_num] = true;
+    gpioCheckLevel(gpio_num);
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    gpioIntrEnabled[gpio_num] = false;
+    gpioIsrPending[gpio_num] = false;
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX || (intr_type != GPIO_INTR_LOW_LEVEL && intr_type != GPIO_INTR_HIGH_LEVEL))
+        return ESP_ERR_INVALID_ARG;
+    gpioWakeup[gpio_num] = true;
+    return gpio_set_intr_type(gpio_num, intr_type);
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    gpioWakeup[gpio_num] = false;
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags) {
+    (void) intr_alloc_flags;
+    if (gpioIsrService)
+        return ESP_ERR_INVALID_STATE;
+    gpioIsrService = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args) {
+    if (!gpioIsrService)
+        return ESP_ERR_INVALID_STATE;
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    gpioHandler[gpio_num] = isr_handler;
+    gpioHandlerArg[gpio_num] = args;
+    gpioIntrEnabled[gpio_num] = true;
+    gpioCheckLevel(gpio_num);
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    gpioHandler[gpio_num] = nullptr;
+    gpioIsrPending[gpio_num] = false;
+    return ESP_OK;
+}
+
+static bool gpioIntrFires(gpio_int_type_t type, int oldLevel, int newLevel) {
+    switch (type) {
+        case GPIO_INTR_POSEDGE:     return oldLevel == 0 && newLevel == 1;
+        case GPIO_INTR_NEGEDGE:     return oldLevel == 1 && newLevel == 0;
+        case GPIO_INTR_ANYEDGE:     return oldLevel != newLevel;
+        case GPIO_INTR_LOW_LEVEL:   return newLevel == 0 && oldLevel != newLevel;
+        case GPIO_INTR_HIGH_LEVEL:  return newLevel == 1 && oldLevel != newLevel;
+        default:                    return false;
+    }
+}
+
+void simSetGpioInput(gpio_num_t gpio_num, int level) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return;
+    int oldLevel = gpioLevel[gpio_num];
+    gpioLevel[gpio_num] = !!level;
+    if (gpioHandler[gpio_num] != nullptr && gpioIntrEnabled[gpio_num] && gpioIntrFires(gpioIntrType[gpio_num], oldLevel, gpioLevel[gpio_num])) {
+        gpioIsrCount++;
+        noteInterrupt(sleepGpioWakeup && gpioWakeup[gpio_num]);
+        gpioHandler[gpio_num](gpioHandlerArg[gpio_num]);
+    }
+}
+
+
+// ----- Touch pad -----
+
+// Latch the pad status bit when the reading crosses the threshold in the configured direction
+static void touchEvaluate(int pad) {
+    bool triggered = touchThreshold[pad] != 0 && (touchTriggerMode == TOUCH_TRIGGER_BELOW ? touchValue[pad] < touchThreshold[pad] : touchValue[pad] > touchThreshold[pad]);
+    if (triggered && !touchTriggered[pad]) {
+        touchStatus |= BIT(pad);
+        if (touchIntrEnabled && touchHandler != nullptr)
+            touchIsrPending = true;  // Delivered by the scheduler, never inside the caller
+    }
+    touchTriggered[pad] = triggered;
+}
+
+// The touch interrupt is level-triggered: while a pad stays beyond its threshold and the interrupt is enabled, every
+// measurement cycle raises it again. SIM_NEVER if none will
+static int64_t touchNextLevelFire(void) {
+    if (!touchIntrEnabled || touchHandler == nullptr)
+        return SIM_NEVER;
+    for (int pad = 0; pad < TOUCH_PAD_MAX; pad++)
+        if (touchTriggered[pad])
+            return touchMeasureAt;
+    return SIM_NEVER;
+}
+
+esp_err_t touch_pad_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t touch_pad_config(touch_pad_t touch_num, uint16_t threshold) {
+    if (touch_num < 0 || touch_num >= TOUCH_PAD_MAX)
+        return ESP_ERR_INVALID_ARG;
+    touchThreshold[touch_num] = threshold;
+    touchTriggered[touch_num] = false;
+    touchConfigCount++;
+    touchReconfigured = true;  // Applied at the next measurement, as the hardware does
+    return ESP_OK;
+}
+
+esp_err_t touch_pad_read(touch_pad_t touch_num, uint16_t *touch_value) {
+    if (touch_num < 0 || touch_num >= TOUCH_PAD_MAX || touch_value == NULL)
+        return ESP_ERR_INVALID_ARG;
+    *touch_value = touchValue[touch_num];
+    return ESP_OK;
+}
+
+esp_err_t touch_pad_read_raw_data(touch_pad_t touch_num, uint16_t *touch_value) {
+    return touch_pad_read(touch_num, touch_value);
+}
+
+esp_err_t touch_pad_read_filtered(touch_pad_t touch_num, uint16_t *touch_value) {
+    if (touch_num < 0 || touch_num >= TOUCH_PAD_MAX || touch_value == NULL)
+        return ESP_ERR_INVALID_ARG;
+    *touch_value = touchFiltered[touch_num];
+    return ESP_OK;
+}
+
+esp_err_t touch_pad_filter_start(uint32_t filter_period_ms) {
+    (void) filter_period_ms;
+    return ESP_OK;
+}
+
+esp_err_t touch_pad_set_trigger_mode(touch_trigger_mode_t mode) {
+    touchTriggerMode = mode;
+    for (int pad = 0; pad < TOUCH_PAD_MAX; pad++)
+        touchTriggered[pad] = false;
+    touchReconfigured = true;
+    return ESP_OK;
+}
+
+esp_err_t touch_pad_isr_register(intr_handler_t fn, void *arg) {
+    touchHandler = fn;
+    touchHandlerArg = arg;
+    return ESP_OK;
+}
+
+esp_err_t touch_pad_intr_enable(void) {
+    if (!touchIntrEnabled)
+        touchMeasureAt = now + SIM_TOUCH_MEASURE_US;  // A pad already triggered interrupts at the next measurement
+    touchIntrEnabled = true;
+    return ESP_OK;
+}
+
+esp_err_t touch_pad_intr_disable(void) {
+    touchIntrEnabled = false;
+    touchIsrPending = false;
+    return ESP_OK;
+}
+
+// As on the hardware, a pad still beyond the threshold is reported again after a clear
+uint32_t touch_pad_get_status(void) {
+    uint32_t status = touchStatus;
+    for (int pad = 0; pad < TOUCH_PAD_MAX; pad++)
+        if (touchTriggered[pad])
+            status |= BIT(pad);
+    return status;
+}
+
+esp_err_t touch_pad_clear_status(void) {
+    touchStatus = 0;
+    return ESP_OK;
+}
+
+void simSetTouchValue(touch_pad_t touch_num, uint16_t value) {
+    if (touch_num < 0 || touch_num >= TOUCH_PAD_MAX)
+        return;
+    touchValue[touch_num] = value;
+    touchFiltered[touch_num] = value;
+    touchEvaluate(touch_num);
+}
+
+void simSetTouchRawValue(touch_pad_t touch_num, uint16_t value) {
+    if (touch_num < 0 || touch_num >= TOUCH_PAD_MAX)
+        return;
+    touchValue[touch_num] = value;
+    touchEvaluate(touch_num);
+}
+
+// ----- LEDC -----
+
+static sim_ledc_channel *ledcGetChannel(ledc_mode_t speed_mode, ledc_channel_t channel) {
+    if (speed_mode < 0 || speed_mode >= LEDC_SPEED_MODE_MAX || channel < 0 || channel >= LEDC_CHANNEL_MAX)
+        return nullptr;
+    sim_ledc_channel *c = &ledcChannel[speed_mode][channel];
+    return c->configured ? c : nullptr;
+}
+
+// Output duty now; hardware fades are modelled as a linear ramp
+static uint32_t ledcDutyNow(const sim_ledc_channel *c) {
+    if (now >= c->fadeEnd)
+        return c->duty;
+    double progress = (double) (now - c->fadeStart) / (c->fadeEnd - c->fadeStart);
+    return (uint32_t) (c->fadeFrom + ((double) c->duty - c->fadeFrom) * progress + 0.5);
+}
+
+// A fade overridden before its end stops where the output is now
+static void ledcCutFade(sim_ledc_channel *c, int mode, int channel) {
+    if (now >= c->fadeEnd)
+        return;
+    for (auto sample = ledcTimeline.rbegin(); sample != ledcTimeline.rend(); ++sample) {
+        if (sample->mode == mode && sample->channel == channel && sample->fade) {
+            sample->time = now;
+            sample->duty = ledcDutyNow(c);
+            break;
+        }
+    }
+    c->duty = ledcDutyNow(c);
+    c->fadeEnd = now;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf) {
+    if (timer_conf == NULL || timer_conf->speed_mode >= LEDC_SPEED_MODE_MAX || timer_conf->timer_num >= LEDC_TIMER_MAX ||
+        timer_conf->duty_resolution < LEDC_TIMER_1_BIT || timer_conf->duty_resolution >= LEDC_TIMER_BIT_MAX || timer_conf->freq_hz == 0)
+        return ESP_ERR_INVALID_ARG;
+    if ((uint64_t) timer_conf->freq_hz << timer_conf->duty_resolution > SIM_LEDC_SOURCE_HZ)
+        return ESP_FAIL;  // No clock divider can give this frequency at this resolution
+    ledcTimer[timer_conf->speed_mode][timer_conf->timer_num] = *timer_conf;
+    ledcTimerConfigured[timer_conf->speed_mode][timer_conf->timer_num] = true;
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf) {
+    if (ledc_conf == NULL || ledc_conf->speed_mode >= LEDC_SPEED_MODE_MAX || ledc_conf->channel >= LEDC_CHANNEL_MAX ||
+        ledc_conf->timer_sel >= LEDC_TIMER_MAX || ledc_conf->gpio_num < 0 || ledc_conf->gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    if (!ledcTimerConfigured[ledc_conf->speed_mode][ledc_conf->timer_sel])
+        return ESP_ERR_INVALID_STATE;
+    sim_ledc_channel &c = ledcChannel[ledc_conf->speed_mode][ledc_conf->channel];
+    c.configured = true;
+    c.gpio = ledc_conf->gpio_num;
+    c.timer = ledc_conf->timer_sel;
+    c.duty = c.pendingDuty = ledc_conf->duty;
+    c.fadeEnd = now;
+    gpioMode[c.gpio] = GPIO_MODE_OUTPUT;
+    ledcTimeline.push_back({now, ledc_conf->speed_mode, ledc_conf->channel, c.duty, false});
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty) {
+    sim_ledc_channel *c = ledcGetChannel(speed_mode, channel);
+    if (c == nullptr)
+        return ESP_ERR_INVALID_STATE;
+    c->pendingDuty = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel) {
+    sim_ledc_channel *c = ledcGetChannel(speed_mode, channel);
+    if (c == nullptr)
+        return ESP_ERR_INVALID_STATE;
+    ledcCutFade(c, speed_mode, channel);
+    c->duty = c->pendingDuty;
+    c->updates++;
+    ledcTimeline.push_back({now, speed_mode, channel, c->duty, false});
+    return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel) {
+    sim_ledc_channel *c = ledcGetChannel(speed_mode, channel);
+    return c != nullptr ? ledcDutyNow(c) : 0;
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags) {
+    if (ledcFadeInstalled)
+        return ESP_ERR_INVALID_STATE;
+    ledcFadeInstalled = true;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t target_duty, int max_fade_time_ms) {
+    sim_ledc_channel *c = ledcGetChannel(speed_mode, channel);
+    if (c == nullptr || !ledcFadeInstalled)
+        return ESP_ERR_INVALID_STATE;
+    if (max_fade_time_ms < 0)
+        return ESP_ERR_INVALID_ARG;
+    c->fadeTarget = target_duty;
+    c->fadeTimeMs = max_fade_time_ms;
+    return ESP_OK;
+}
+
+// The duty ramp is run by the peripheral: no CPU time is charged, a waiting task sleeps until the end of the fade
+esp_err_t ledc_fade_start(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode) {
+    sim_ledc_channel *c = ledcGetChannel(speed_mode, channel);
+    if (c == nullptr || !ledcFadeInstalled || c->fadeTimeMs < 0)
+        return ESP_ERR_INVALID_STATE;
+    ledcCutFade(c, speed_mode, channel);
+    c->fadeFrom = c->duty;
+    c->duty = c->fadeTarget;
+    c->fadeStart = now;
+    c->fadeEnd = now + (int64_t) c->fadeTimeMs * 1000;
+    c->fadeTimeMs = -1;
+    c->fades++;
+    const LedcSample &last = ledcTimeline.back();  // The configuration sample guarantees there is one
+    if (last.time != now || last.mode != speed_mode || last.channel != channel || last.duty != c->fadeFrom)
+        ledcTimeline.push_back({now, speed_mode, channel, c->fadeFrom, false});
+    ledcTimeline.push_back({c->fadeEnd, speed_mode, channel, c->duty, true});
+    if (fade_mode == LEDC_FADE_WAIT_DONE && c->fadeEnd > now)
+        block(self(), DELAYED, c->fadeEnd);
+    return ESP_OK;
+}
+
+
+// ----- ADC, timer, libc -----
+
+int hall_sensor_read(void) {
+    hallReads++;
+    return hallValue;
+}
+
+void simSetHallValue(int value) {
+    hallValue = value;
+}
+
+int64_t esp_timer_get_time(void) {
+    return now;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle) {
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+        return ESP_ERR_INVALID_ARG;
+    esp_timer *timer = new esp_timer;
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->name = create_args->name != NULL ? create_args->name : "";
+    timers.push_back(timer);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+// Set the alarm of timer, and the dispatch latency its callback will see: up to SIM_TIMER_JITTER_US, as the esp_timer
+// task takes its time to wake up and may be behind other callbacks
+static void armTimer(esp_timer *timer, int64_t expiry) {
+    timer->expiry = expiry;
+    timer->latency = timerJitterUs > 0 ? (int64_t) (timerRng() % (uint64_t) (timerJitterUs + 1)) : 0;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    if (timer == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (timer->expiry != SIM_NEVER)
+        return ESP_ERR_INVALID_STATE;
+    armTimer(timer, now + (int64_t) timeout_us);
+    timer->period = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    if (timer == NULL || period == 0)
+        return ESP_ERR_INVALID_ARG;
+    if (timer->expiry != SIM_NEVER)
+        return ESP_ERR_INVALID_STATE;
+    armTimer(timer, now + (int64_t) period);
+    timer->period = period;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (timer == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (timer->expiry == SIM_NEVER)
+        return ESP_ERR_INVALID_STATE;
+    timer->expiry = SIM_NEVER;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (timer == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (timer->expiry != SIM_NEVER)
+        return ESP_ERR_INVALID_STATE;
+    timers.erase(std::find(timers.begin(), timers.end(), timer));
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    return timer != NULL && timer->expiry != SIM_NEVER;
+}
+
+esp_err_t esp_pm_configure(const void *config) {
+    if (config == NULL)
+        return ESP_ERR_INVALID_ARG;
+    pmLightSleep = ((const esp_pm_config_esp32_t *) config)->light_sleep_enable;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char *name, esp_pm_lock_handle_t *out_handle) {
+    (void) arg; (void) name;
+    if (out_handle == NULL)
+        return ESP_ERR_INVALID_ARG;
+    esp_pm_lock *lock = new esp_pm_lock;
+    lock->type = lock_type;
+    *out_handle = lock;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle) {
+    if (handle->count++ == 0 && handle->type == ESP_PM_NO_LIGHT_SLEEP)
+        pmNoSleepLocks++;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle) {
+    if (handle->count == 0)
+        return ESP_ERR_INVALID_STATE;
+    if (--handle->count == 0 && handle->type == ESP_PM_NO_LIGHT_SLEEP)
+        pmNoSleepLocks--;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void) {
+    sleepGpioWakeup = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_touchpad_wakeup(void) {
+    sleepTouchWakeup = true;
+    return ESP_OK;
+}
+
+int64_t simNow(void) {
+    return now;
+}
+
+void simAdvance(int64_t us) {
+    self();
+    advanceTo(now + us);
+    endTime += us;
+}
+
+void simCompute(int64_t us) {
+    sim_task *t = self();
+    if (us <= 0)
+        return;
+    t->computeLeft = us;
+    block(t, COMPUTING, SIM_NEVER);
+}
+
+void simStop(int status) {
+    endTime = now;
+    exitStatus = status;
+}
+
+// ----- Flash partition -----
+
+static void flashSpend(int64_t us) {
+    flashStats.busyUs += us;
+    if (currentTask != nullptr)
+        simCompute(us);  // The caller waits for the flash; on the device the cache of both cores is off meanwhile
+}
+
+static void flashSave(size_t offset, size_t size) {
+    if (flashFile == NULL)
+        return;
+    fseek(flashFile, (long) offset, SEEK_SET);
+    fwrite(flash.data() + offset, 1, size, flashFile);
+    fflush(flashFile);
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    if (type != ESP_PARTITION_TYPE_DATA || (label != NULL && strcmp(label, SIM_FLASH_LABEL) != 0))
+        return NULL;
+    if (flash.empty()) {
+        const char *sizeValue = getenv("SIM_FLASH_SIZE_KB");
+        size_t size = (size_t) (sizeValue != NULL ? atoi(sizeValue) : SIM_FLASH_SIZE_KB) * 1024;
+        size = std::max(size / SPI_FLASH_SEC_SIZE, (size_t) 1) * SPI_FLASH_SEC_SIZE;
+        flash.assign(size, 0xff);  // Erased
+        flashSectorErases.assign(size / SPI_FLASH_SEC_SIZE, 0);
+        const char *path = getenv("SIM_FLASH");
+        if (path != NULL) {
+            flashFile = fopen(path, "r+b");
+            if (flashFile == NULL)
+                flashFile = fopen(path, "w+b");
+            if (flashFile == NULL)
+                fatal("cannot open SIM_FLASH file");
+            size_t n = fread(flash.data(), 1, size, flashFile);
+            flashSave(n, size - n);  // A new or shorter image is extended with erased flash
+        }
+        flashPartition = {NULL, ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t) 0x40, 0x110000, (uint32_t) size, SIM_FLASH_LABEL, false};
+    }
+    return subtype == ESP_PARTITION_SUBTYPE_ANY || subtype == flashPartition.subtype ? &flashPartition : NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    if (partition != &flashPartition || dst == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (src_offset > flash.size() || size > flash.size() - src_offset)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, flash.data() + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    if (partition != &flashPartition || src == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (dst_offset > flash.size() || size > flash.size() - dst_offset)
+        return ESP_ERR_INVALID_SIZE;
+    if (size == 0)
+        return ESP_OK;
+    size_t written = size;
+    if (flashCutBudget >= 0) {  // Power cut: the write stops where the budget runs out
+        written = (size_t) std::min((int64_t) size, flashCutBudget);
+        flashCutBudget -= (int64_t) written;
+    }
+    for (size_t i = 0; i < written; i++)
+        flash[dst_offset + i] &= ((const uint8_t *) src)[i];
+    flashSave(dst_offset, written);
+    unsigned long pages = (unsigned long) ((dst_offset + size - 1) / SIM_FLASH_PAGE - dst_offset / SIM_FLASH_PAGE + 1);
+    flashStats.writes++;
+    flashStats.bytesWritten += written;
+    flashStats.pagePrograms += pages;
+    flashSpend((int64_t) pages * SIM_FLASH_PROGRAM_US);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (partition != &flashPartition)
+        return ESP_ERR_INVALID_ARG;
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0 || offset > flash.size() || size > flash.size() - offset)
+        return ESP_ERR_INVALID_SIZE;
+    size_t sectors = size / SPI_FLASH_SEC_SIZE;
+    if (flashCutBudget != 0) {  // After a power cut nothing is erased
+        memset(flash.data() + offset, 0xff, size);
+        flashSave(offset, size);
+        for (size_t i = 0; i < sectors; i++)
+            flashSectorErases[offset / SPI_FLASH_SEC_SIZE + i]++;
+        flashStats.erases += sectors;
+    }
+    flashSpend((int64_t) sectors * SIM_FLASH_ERASE_US);
+    return ESP_OK;
+}
+
+SimFlashStats simFlashStats(void) {
+    SimFlashStats stats = flashStats;
+    if (!flashSectorErases.empty()) {
+        stats.minSectorErases = *std::min_element(flashSectorErases.begin(), flashSectorErases.end());
+        stats.maxSectorErases = *std::max_element(flashSectorErases.begin(), flashSectorErases.end());
+    }
+    return stats;
+}
+
+void simFlashCut(int64_t bytes) {
+    flashCutBudget = bytes;
+}
+
+int64_t simFlashCutLeft(void) {
+    return flashCutBudget;
+}
+
+void simFlashRestore(void) {
+    flashCutBudget = -1;
+}
+
+char *itoa(int value, char *str, int base) {
+    if (base == 10)
+        sprintf(str, "%d", value);
+    else if (base == 16)
+        sprintf(str, "%x", (unsigned int) value);
+    else if (base == 8)
+        sprintf(str, "%o", (unsigned int) value);
+    else
+        str[0] = '\0';
+    return str;
+}
+
+
+// ----- Simulation driver -----
+
+static void serviceInterrupts(void) {
+    for (int pin = 0; pin < GPIO_NUM_MAX; pin++) {
+        if (!gpioIsrPending[pin])
+            continue;
+        gpioIsrPending[pin] = false;
+        if (gpioHandler[pin] == nullptr || !gpioIntrEnabled[pin] || !gpioLevelActive(pin))
+            continue;
+        gpioIsrCount++;
+        noteInterrupt(sleepGpioWakeup && gpioWakeup[pin]);
+        gpioHandler[pin](gpioHandlerArg[pin]);
+    }
+    if (touchReconfigured) {
+        touchReconfigured = false;
+        for (int pad = 0; pad < TOUCH_PAD_MAX; pad++)
+            touchEvaluate(pad);
+    }
+    if (touchNextLevelFire() <= now)
+        touchIsrPending = true;
+    if (touchIsrPending) {
+        touchIsrPending = false;
+        touchMeasureAt = now + SIM_TOUCH_MEASURE_US;
+        touchIsrCount++;
+        noteInterrupt(sleepTouchWakeup);
+        touchHandler(touchHandlerArg);
+    }
+}
+
+// When the callback of timer runs: its alarm plus its dispatch latency
+static int64_t timerDue(const esp_timer *timer) {
+    return timer->expiry != SIM_NEVER ? timer->expiry + timer->latency : SIM_NEVER;
+}
+
+// Run the due esp_timer callbacks, earliest first; periodic timers are rearmed from their alarm, not from the late
+// callback, so they do not drift
+static void serviceTimers(void) {
+    while (true) {
+        esp_timer *next = nullptr;
+        for (esp_timer *timer : timers)
+            if (timerDue(timer) <= now && (next == nullptr || timerDue(timer) < timerDue(next)))
+                next = timer;
+        if (next == nullptr)
+            break;
+        if (next->period != 0)
+            armTimer(next, next->expiry + (int64_t) next->period);
+        else
+            next->expiry = SIM_NEVER;
+        timerCallbacks++;
+        inTimerCallback = true;
+        next->callback(next->arg);
+        inTimerCallback = false;
+    }
+}
+
+static void applyTraceEvents(void) {
+    while (nextEvent < trace.size() && trace[nextEvent].time <= now) {
+        const TraceEvent &e = trace[nextEvent++];
+        if (e.press) {
+            presses++;
+            if (pressPending)
+                missedPresses++;  // Previous press never got an answer
+            pressPending = true;
+            pressTime = now;
+        }
+        switch (e.kind) {
+            case TRACE_GPIO:    simSetGpioInput((gpio_num_t) e.index, e.value); break;
+            case TRACE_TOUCH:   simSetTouchValue((touch_pad_t) e.index, (uint16_t) e.value); break;
+            case TRACE_HALL:    simSetHallValue(e.value); break;
+        }
+        serviceInterrupts();
+    }
+}
+
+static void wakeExpiredTasks(void) {
+    for (sim_task *t : tasks) {
+        if ((t->state == DELAYED || t->state == BLOCKED) && t->wakeTime <= now) {
+            t->timedOut = t->state == BLOCKED;
+            makeReady(t);
+        }
+    }
+}
+
+// Next wakeup the chip knows about: task timeouts and esp_timer expiries
+static int64_t nextTimeout(void) {
+    int64_t next = SIM_NEVER;
+    for (esp_timer *timer : timers)
+        next = std::min(next, timerDue(timer));
+    for (sim_task *t : tasks)
+        if (t->state == DELAYED || t->state == BLOCKED)
+            next = std::min(next, t->wakeTime);
+    return next;
+}
+
+static int64_t nextDeadline(void) {
+    int64_t next = std::min(std::min(endTime, nextTimeout()), touchNextLevelFire());
+    if (nextEvent < trace.size())
+        next = std::min(next, trace[nextEvent].time);
+    return std::max(next, now);
+}
+
+static unsigned long interruptCount(void) {
+    return gpioIsrCount + touchIsrCount;
+}
+
+// No task ready: the idle task runs, and with tickless idle the chip goes to light sleep if the next timeout is far enough
+static void beginIdle(void) {
+    idleSince = now;
+    idleInterrupts = interruptCount();
+    idleTimerCallbacks = timerCallbacks;
+    sleeping = pmLightSleep && pmNoSleepLocks == 0 && nextTimeout() - now >= (int64_t) SIM_SLEEP_MIN_IDLE_TICKS * SIM_TICK_US;
+}
+
+static void endIdle(bool woken) {
+    idleUs += now - idleSince;
+    if (sleeping) {
+        sleepUs += now - idleSince;
+        sleepPeriods++;
+    }
+    if (woken && interruptCount() != idleInterrupts)
+        inputWakeups++;
+    else if (woken)
+        timerWakeups++;
+    idleSince = -1;
+    sleeping = false;
+}
+
+static void runScheduler(void) {
+    while (true) {
+        applyTraceEvents();
+        serviceInterrupts();
+        serviceTimers();
+        wakeExpiredTasks();
+        if (now >= endTime)
+            break;
+        assignCores();
+        int core = 0;
+        sim_task *t = pickReadyTask(&core);
+        bool busy = anyCoreBusy();
+        if (idleSince >= 0 && (t != nullptr || busy || interruptCount() != idleInterrupts || timerCallbacks != idleTimerCallbacks))
+            endIdle(true);  // A task, an ISR or an esp_timer callback has to run
+        if (t != nullptr) {
+            sim_task *owner = cores[core].owner;
+            t->core = core;
+            dispatch(t);
+            if (owner != nullptr && owner->priority == t->priority)
+                cores[core].sliceEnd = nextTickTime(1);  // Back to the computing task until the next tick
+            advanceTo(now + SIM_DISPATCH_COST_US);
+        }
+        else {
+            if (!busy && idleSince < 0)
+                beginIdle();
+            advanceTo(std::max(std::min(nextDeadline(), nextComputeEvent()), now));
+        }
+    }
+    if (idleSince >= 0)
+        endIdle(false);  // Still idle at the end of the run
+}
+
+// Trace format, one event per line: <time ms> <gpioN|touchN|hall> <value> [press]; '#' starts a comment
+static void loadTrace(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        fatal("cannot open SIM_TRACE file");
+    char line[256];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+        double ms;
+        char source[32], tag[32];
+        int value;
+        int fields = sscanf(line, "%lf %31s %d %31s", &ms, source, &value, tag);
+        if (fields <= 0)
+            continue;  // Blank line
+        TraceEvent e = {(int64_t) (ms * 1000), TRACE_GPIO, 0, value, fields == 4 && strcmp(tag, "press") == 0};
+        bool valid = fields == 3 || (fields == 4 && e.press);
+        if (valid && sscanf(source, "gpio%d", &e.index) == 1 && e.index >= 0 && e.index < GPIO_NUM_MAX)
+            e.kind = TRACE_GPIO;
+        else if (valid && sscanf(source, "touch%d", &e.index) == 1 && e.index >= 0 && e.index < TOUCH_PAD_MAX)
+            e.kind = TRACE_TOUCH;
+        else if (valid && strcmp(source, "hall") == 0)
+            e.kind = TRACE_HALL;
+        else {
+            fprintf(stderr, "sim: %s:%d: malformed trace event\n", path, lineNumber);
+            _exit(1);
+        }
+        trace.push_back(e);
+    }
+    fclose(f);
+    std::stable_sort(trace.begin(), trace.end(), [](const TraceEvent &a, const TraceEvent &b) { return a.time < b.time; });
+}
+
+// Input trace recorded by InputRecorder.h (see InputTrace.h): the events of one session become button levels, pad
+// readings and Hall values at their timestamps, and every press a latency stimulus. The fused state of a polled
+// stopwatch (ANY_INPUT) drives the button. session counts from 0; negative values count back from the last one
+static void loadReplay(const char *path, int session) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        fatal("cannot open SIM_REPLAY file");
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        data.insert(data.end(), buffer, buffer + n);
+    fclose(f);
+    TraceSession header = {};
+    int sessions = 0;
+    for (InputTraceReader counter(data.data(), data.size()); counter.nextSession(header); )
+        sessions++;
+    if (session < 0)
+        session += sessions;
+    if (session < 0 || session >= sessions) {
+        fprintf(stderr, "sim: %s: no session %d, %d in the trace\n", path, session, sessions);
+        _exit(1);
+    }
+    InputTraceReader reader(data.data(), data.size());
+    for (int i = 0; i <= session; i++)
+        reader.nextSession(header);
+    if (header.version != INPUT_TRACE_VERSION)
+        fatal("SIM_REPLAY trace of another format version");
+    InputEvent event;
+    unsigned long events = 0;
+    while (reader.next(event)) {
+        TraceEvent e = {event.timestamp, TRACE_GPIO, header.buttonPin, event.level, event.level == 0};
+        if (event.source == TOUCH_INPUT) {
+            e.kind = TRACE_TOUCH;
+            e.index = header.touchPad;
+            e.value = event.level != 0 ? SIM_TOUCH_IDLE_VALUE : SIM_REPLAY_TOUCH_VALUE;
+        }
+        else if (event.source == HALL_INPUT) {
+            e.kind = TRACE_HALL;
+            e.value = event.level != 0 ? 0 : SIM_REPLAY_HALL_VALUE;
+        }
+        if ((e.kind == TRACE_GPIO && e.index >= GPIO_NUM_MAX) || (e.kind == TRACE_TOUCH && e.index >= TOUCH_PAD_MAX))
+            fatal("SIM_REPLAY event from a pin the session does not name");
+        trace.push_back(e);
+        events++;
+    }
+    std::stable_sort(trace.begin(), trace.end(), [](const TraceEvent &a, const TraceEvent &b) { return a.time < b.time; });
+    char note[160];
+    snprintf(note, sizeof(note), "replay: session %d of %d, %lu events, %lu lost while recording%s", session + 1, sessions, events,
+             (unsigned long) reader.getLost(), reader.isDamaged() ? "; damaged record, the rest of the trace ignored" : "");
+    replayNote = note;
+}
+
+static double percentileMs(std::vector<int64_t> &sorted, double p) {  // Nearest rank
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t) (p / 100 * sorted.size() + 0.999999);
+    return sorted[std::min(std::max(rank, (size_t) 1), sorted.size()) - 1] / 1000.0;
+}
+
+static void printReport(double hostSeconds) {
+    double seconds = now / 1e6;
+    unsigned long wakeups = 0;
+    sim_task *tightest = nullptr;
+    fflush(stdout);
+    fprintf(stderr, "\n--- sim: %.3f s virtual in %.3f s host ---\n", seconds, hostSeconds);
+    fprintf(stderr, "%-16s %4s %10s %10s %12s\n", "task", "prio", "wakeups", "wakeups/s", "stack free");
+    for (sim_task *t : tasks) {
+        fprintf(stderr, "%-16s %4u %10lu %10.1f %6u/%-5u\n", t->name.c_str(), t->priority, t->wakeups, seconds > 0 ? t->wakeups / seconds : 0.0,
+                uxTaskGetStackHighWaterMark(t), t->stackDepth);
+        if (t->name != "main") {  // app_main runs once at boot
+            wakeups += t->wakeups;
+            if (tightest == nullptr || uxTaskGetStackHighWaterMark(t) < uxTaskGetStackHighWaterMark(tightest))
+                tightest = t;
+        }
+    }
+    fprintf(stderr, "cpu: %.1f wakeups/s", seconds > 0 ? wakeups / seconds : 0.0);
+    if (tightest != nullptr)
+        fprintf(stderr, ", min stack free %u (%s)", uxTaskGetStackHighWaterMark(tightest), tightest->name.c_str());
+    fprintf(stderr, "\n");
+    if (coreCount > 1 || cores[0].busyUs > 0) {
+        fprintf(stderr, "cores: %d; busy in simCompute:", coreCount);
+        for (int c = 0; c < coreCount; c++)
+            fprintf(stderr, " core %d %.1f%%", c, now > 0 ? 100.0 * cores[c].busyUs / now : 0.0);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "isr: gpio %lu, touch %lu; touch pad configs %lu; hall reads %lu; esp_timer callbacks %lu\n", gpioIsrCount, touchIsrCount,
+            touchConfigCount, hallReads, timerCallbacks);
+    unsigned long idleWakeups = timerWakeups + inputWakeups;
+    fprintf(stderr, "idle: %.1f%% of the time, %lu wakeups (%.1f/min): %lu timer, %lu input\n", now > 0 ? 100.0 * idleUs / now : 0.0,
+            idleWakeups, seconds > 0 ? idleWakeups * 60 / seconds : 0.0, timerWakeups, inputWakeups);
+    if (pmLightSleep)
+        fprintf(stderr, "light sleep: %.3f s in %lu periods; %lu interrupts lost (no wakeup source)\n", sleepUs / 1e6, sleepPeriods, sleepLostInterrupts);
+    if (!replayNote.empty())
+        fprintf(stderr, "%s\n", replayNote.c_str());
+    if (presses != 0) {
+        if (pressPending)
+            missedPresses++;
+        std::sort(latencies.begin(), latencies.end());
+        fprintf(stderr, "latency: %lu presses, %lu missed, p50 %.3f ms, p99 %.3f ms, max %.3f ms (gpio%d)\n", presses, missedPresses,
+                percentileMs(latencies, 50), percentileMs(latencies, 99), percentileMs(latencies, 100), probeGpio);
+    }
+    if (flashStats.writes != 0 || flashStats.erases != 0) {
+        SimFlashStats stats = simFlashStats();
+        fprintf(stderr, "flash: %lu writes, %llu bytes, %lu page programs; %lu sector erases, %lu to %lu per sector\n", stats.writes,
+                (unsigned long long) stats.bytesWritten, stats.pagePrograms, stats.erases, stats.minSectorErases, stats.maxSectorErases);
+    }
+    for (int pin = 0; pin < GPIO_NUM_MAX; pin++)
+        if (gpioOutputChanges[pin] != 0)
+            fprintf(stderr, "gpio%d output changes: %lu\n", pin, gpioOutputChanges[pin]);
+    for (int mode = 0; mode < LEDC_SPEED_MODE_MAX; mode++) {
+        for (int channel = 0; channel < LEDC_CHANNEL_MAX; channel++) {
+            const sim_ledc_channel &c = ledcChannel[mode][channel];
+            if (!c.configured)
+                continue;
+            const ledc_timer_config_t &timer = ledcTimer[mode][c.timer];
+            std::vector<uint32_t> levels;
+            for (const LedcSample &sample : ledcTimeline)
+                if (sample.mode == mode && sample.channel == channel)
+                    levels.push_back(sample.duty);
+            std::sort(levels.begin(), levels.end());
+            size_t distinct = std::unique(levels.begin(), levels.end()) - levels.begin();
+            fprintf(stderr, "ledc%d: gpio%d, %u Hz, %d bit duty; %lu updates, %lu fades, %zu distinct duty levels\n",
+                    mode * LEDC_CHANNEL_MAX + channel, c.gpio, timer.freq_hz, (int) timer.duty_resolution, c.updates, c.fades, distinct);
+        }
+    }
+}
+
+// LEDC timeline format, one sample per line: <time ms> ledc<N> <duty> [fade]; "fade" marks a linear ramp from the previous sample
+static void writeLedcTimeline(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        fatal("cannot open SIM_LEDC_TIMELINE file");
+    std::stable_sort(ledcTimeline.begin(), ledcTimeline.end(), [](const LedcSample &a, const LedcSample &b) { return a.time < b.time; });
+    for (const LedcSample &sample : ledcTimeline)
+        fprintf(f, "%.3f ledc%d %u%s\n", sample.time / 1000.0, sample.mode * LEDC_CHANNEL_MAX + sample.channel, sample.duty, sample.fade ? " fade" : "");
+    fclose(f);
+}
+
+int simMain(void) {
+    if (app_main == NULL)
+        fatal("no app_main");
+    for (int pin = 0; pin < GPIO_NUM_MAX; pin++)
+        gpioLevel[pin] = 1;  // Inputs pulled up, as the BOOT button
+    for (int pad = 0; pad < TOUCH_PAD_MAX; pad++)
+        touchValue[pad] = touchFiltered[pad] = SIM_TOUCH_IDLE_VALUE;
+
+    const char *coresValue = getenv("SIM_CORES");
+    if (coresValue != NULL)
+        coreCount = std::min(std::max(atoi(coresValue), 1), SIM_MAX_CORES);
+    const char *probe = getenv("SIM_PROBE_GPIO");
+    if (probe != NULL)
+        probeGpio = atoi(probe);
+    const char *jitter = getenv("SIM_TIMER_JITTER_US");
+    if (jitter != NULL)
+        timerJitterUs = std::max(atoll(jitter), 0LL);
+    const char *tracePath = getenv("SIM_TRACE");
+    if (tracePath != NULL)
+        loadTrace(tracePath);
+    const char *replayPath = getenv("SIM_REPLAY");
+    if (replayPath != NULL) {
+        const char *session = getenv("SIM_REPLAY_SESSION");
+        loadReplay(replayPath, session != NULL ? atoi(session) : -1);
+    }
+    const char *duration = getenv("SIM_DURATION_MS");
+    endTime = (int64_t) SIM_DEFAULT_DURATION_MS * 1000;
+    if (duration != NULL)
+        endTime = (int64_t) (atof(duration) * 1000);
+    else if (!trace.empty())
+        endTime = trace.back().time + (int64_t) SIM_TRACE_TAIL_MS * 1000;
+
+    applyTraceEvents();  // Events at t = 0 set the initial input levels
+    auto hostStart = std::chrono::steady_clock::now();
+    xTaskCreate([](void *) { app_main(); }, "main", SIM_MAIN_TASK_STACK, NULL, SIM_MAIN_TASK_PRIO, NULL);
+    runScheduler();
+    std::chrono::duration<double> hostTime = std::chrono::steady_clock::now() - hostStart;
+    printReport(hostTime.count());
+    const char *timelinePath = getenv("SIM_LEDC_TIMELINE");
+    if (timelinePath != NULL)
+        writeLedcTimeline(timelinePath);
+    _exit(exitStatus);  // Task threads are parked forever
+}
@@ -0,0 +1,37 @@
+//
+// sim.h
+// Author: Francesco Mecatti
+// Host simulator control interface: virtual clock and input stimuli.
+// Inputs are normally driven by the trace file given in SIM_TRACE (see README.md), these calls do the same from code
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "driver/touch_pad.h"
+
+int simMain(void);  // Boot app_main and run the simulation; called by main() in sim_main.cpp
+int64_t simNow(void);  // Virtual time, us
+void simSetGpioInput(gpio_num_t gpio_num, int level);  // Drive an input pin; edge interrupts fire as on the device
+void simSetTouchValue(touch_pad_t touch_num, uint16_t value);  // Raw pad reading: lower when touched
+void simSetTouchRawValue(touch_pad_t touch_num, uint16_t value);  // The raw reading only: the filtered one lags behind
+void simSetHallValue(int value);
+
+typedef void (*sim_gpio_observer_t)(gpio_num_t gpio_num, int level, int64_t time);
+void simSetGpioObserver(sim_gpio_observer_t observer);  // Called on every output level change, e.g. to time a waveform
+void simCompute(int64_t us);  // From a task: spend us of CPU time. Its core stays busy meanwhile, while interrupts, timers and other cores go on; a higher priority task preempts it, one of equal priority shares the core tick by tick
+void simAdvance(int64_t us);  // From a task: let us pass at once, as if it kept the CPU; timeouts and timers due meanwhile fire late. Not counted in SIM_DURATION_MS
+typedef struct {
+    unsigned long writes;  // esp_partition_write calls
+    unsigned long long bytesWritten;
+    unsigned long pagePrograms;  // 256-byte pages touched by the writes, each a program operation
+    unsigned long erases;  // Sectors
+    unsigned long minSectorErases, maxSectorErases;  // Wear spread across the partition
+    int64_t busyUs;  // Spent by the callers waiting for programs and erases
+} SimFlashStats;
+SimFlashStats simFlashStats(void);  // Of the data partition (see esp_partition.h), since boot
+void simFlashCut(int64_t bytes);  // Power cut after bytes more bytes programmed: the write in progress stops there and later writes and erases are lost
+int64_t simFlashCutLeft(void);  // Bytes still programmed before the cut: 0 once it happened, -1 without one
+void simFlashRestore(void);  // Power back: flash is written again; the partition keeps what the cut left
+void simStop(int status = 0);  // End the simulation as soon as the calling task blocks, instead of at SIM_DURATION_MS; the process exits with status
@@ -0,0 +1,11 @@
+//
+// sim_main.cpp
+// Author: Francesco Mecatti
+// Entry point of the simulated sketches. Kept apart from sim.cpp so host tools can link the simulator with their own main()
+//
+
+#include "sim.h"
+
+int main(void) {
+    return simMain();
+}
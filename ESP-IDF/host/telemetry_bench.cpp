@@ -0,0 +1,198 @@
+//
+// telemetry_bench.cpp
+// Author: Francesco Mecatti
+// Host benchmark and check of the binary telemetry. The same session (start, laps every 1.5 s, stop, reset) is run with
+// the ANSI screen and with telemetry: console bytes per stopwatch event, and host time spent on the caller's side per
+// lap (addLap plus the frame drawn for it on SCREEN, addLap with the frame encoding on TELEMETRY). The binary stream is
+// then decoded and compared with the events sent, decoded again with corrupted bytes (no event may be invented), and a
+// burst larger than the queue must come out with its losses reported. Exits with 1 on a failed check
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim.h"
+#include "Time.h"
+
+#define SESSION_LAPS    (200)
+#define LAP_PERIOD_MS   (1500)
+#define COST_LAPS       (10000)  // Laps timed for the cost per lap
+#define CORRUPT_PERCENT (5)  // Frames with one byte changed
+#define BURST           (100)  // Frames emitted without yielding, more than Telemetry::QUEUE_SIZE
+
+static int failures = 0;
+static unsigned long sinkBytes = 0;
+
+static ssize_t countingWrite(void *cookie, const char *buffer, size_t size) {
+    (void) cookie; (void) buffer;
+    sinkBytes += size;
+    return size;
+}
+
+static void check(bool condition, const char *text) {
+    if (!condition) {
+        printf("check failed: %s\n", text);
+        failures++;
+    }
+}
+
+static std::vector<TelemetryEvent> decodeAll(const uint8_t *data, size_t length, TelemetryDecoder &decoder) {
+    std::vector<TelemetryEvent> events;
+    decoder.feed(data, length, [&events](const TelemetryEvent &event) { events.push_back(event); });
+    return events;
+}
+
+static bool sameEvent(const TelemetryEvent &a, const TelemetryEvent &b) {
+    return a.type == b.type && a.timestamp == b.timestamp && a.args[0] == b.args[0] && a.args[1] == b.args[1] &&
+           a.args[2] == b.args[2];
+}
+
+// Start, laps, stop, reset, clear: the events a collector needs. Returns the number of stopwatch events
+static unsigned long session(Time &t) {
+    unsigned long events = 0;
+    t.start();
+    events++;
+    for (int i = 0; i < SESSION_LAPS; i++) {
+        vTaskDelay(pdMS_TO_TICKS(LAP_PERIOD_MS));
+        t.addLap();
+        events++;
+    }
+    t.stop();
+    t.reset();
+    t.clearLaps();
+    vTaskDelay(pdMS_TO_TICKS(100));  // Let the writer finish
+    return events + 3;
+}
+
+static void benchTask(void *pvParameters) {
+    FILE *sink = (FILE *) pvParameters;
+    double screenBytes, telemetryBytes, screenNs, telemetryNs;
+
+    {
+        Time::screen.setOutput(sink);
+        Time t(1, false, Time::SCREEN);
+        sinkBytes = 0;
+        unsigned long events = session(t);
+        fflush(sink);
+        screenBytes = (double) sinkBytes / events;
+        uint32_t generation = 0, shown = 0;
+        Time::renderFrame(generation, shown);
+        t.start();
+        std::chrono::duration<double> cpu(0);
+        for (int i = 0; i < COST_LAPS; i++) {
+            auto start = std::chrono::steady_clock::now();
+            t.addLap();
+            Time::renderFrame(generation, shown);  // What displayTask does for it
+            cpu += std::chrono::steady_clock::now() - start;
+        }
+        screenNs = cpu.count() / COST_LAPS * 1e9;
+        Time::screen.setOutput(fopen("/dev/null", "w"));  // No closing sequences in the results
+    }
+
+    char *stream = NULL;
+    size_t streamLength = 0;
+    FILE *memory = open_memstream(&stream, &streamLength);
+    std::vector<TelemetryEvent> sent;
+    {
+        Telemetry::setOutput(memory);
+        Time t(1, false, Time::TELEMETRY);
+        session(t);
+        fflush(memory);
+        TelemetryStats stats = Telemetry::getStats();
+        telemetryBytes = (double) stats.bytes / (stats.frames - 1);  // Hello not counted
+        check(stats.dropped == 0, "no frame dropped in a normal session");
+
+        TelemetryDecoder decoder;
+        sent = decodeAll((const uint8_t *) stream, streamLength, decoder);
+        check(decoder.getBadFrames() == 0 && sent.size() == stats.frames, "every frame decoded");
+        check(!sent.empty() && sent[0].type == TELEMETRY_HELLO && sent[0].args[0] == TELEMETRY_VERSION, "hello first");
+        unsigned long laps = 0;
+        clock_us_t started = 0;
+        for (const TelemetryEvent &event : sent) {
+            if (event.type == TELEMETRY_START)
+                started = event.timestamp;
+            if (event.type == TELEMETRY_LAP)
+                check(event.args[0] == ++laps && (clock_us_t) event.args[1] == event.timestamp - started, "lap number and split");
+        }
+        check(laps == SESSION_LAPS, "every lap sent");
+
+        std::chrono::duration<double> cpu(0);
+        t.start();
+        for (int i = 0; i < COST_LAPS; i++) {
+            auto start = std::chrono::steady_clock::now();
+            t.addLap();
+            cpu += std::chrono::steady_clock::now() - start;
+            if (i % (Telemetry::QUEUE_SIZE / 2) == 0)
+                vTaskDelay(1);  // Let the writer drain
+        }
+        telemetryNs = cpu.count() / COST_LAPS * 1e9;
+        vTaskDelay(pdMS_TO_TICKS(100));
+        unsigned long droppedBefore = Telemetry::getStats().dropped;
+
+        for (int i = 0; i < BURST; i++)
+            Telemetry::emit(TELEMETRY_INPUT, Time::clockSource(), BUTTON_INPUT << 1 | (i & 1));
+        vTaskDelay(pdMS_TO_TICKS(100));
+        TelemetryStats after = Telemetry::getStats();
+        unsigned long lost = after.dropped - droppedBefore;
+        check(lost == BURST - Telemetry::QUEUE_SIZE, "a burst keeps the first QUEUE_SIZE frames");
+        fflush(memory);
+        TelemetryDecoder tail;
+        std::vector<TelemetryEvent> all = decodeAll((const uint8_t *) stream, streamLength, tail);
+        check(!all.empty() && all.back().type != TELEMETRY_DROPPED, "burst written");
+        bool reported = false;
+        for (const TelemetryEvent &event : all)
+            reported |= event.type == TELEMETRY_DROPPED && event.args[0] == after.dropped;
+        check(reported, "losses reported in the stream");
+    }
+
+    // Change one byte in some frames: those frames go, the others come out intact, nothing is made up
+    std::vector<uint8_t> corrupted(stream, stream + streamLength);
+    std::mt19937 rng(17);
+    unsigned long frameStart = 0, changed = 0;
+    for (size_t i = 0; i < corrupted.size(); i++) {
+        if (corrupted[i] != 0)
+            continue;
+        if (i > frameStart && rng() % 100 < CORRUPT_PERCENT) {
+            corrupted[frameStart + rng() % (i - frameStart)] ^= (uint8_t) (1 + rng() % 255);
+            changed++;
+        }
+        frameStart = i + 1;
+    }
+    TelemetryDecoder noisy, clean;
+    std::vector<TelemetryEvent> original = decodeAll((const uint8_t *) stream, streamLength, clean);
+    std::vector<TelemetryEvent> survived = decodeAll(corrupted.data(), corrupted.size(), noisy);
+    size_t next = 0;
+    for (const TelemetryEvent &event : survived) {
+        while (next < original.size() && !sameEvent(original[next], event))
+            next++;
+        check(next < original.size(), "only events that were sent come out of a noisy stream");
+        next++;
+    }
+    check(noisy.getFrames() + changed >= original.size(), "one frame lost per corrupted frame at most");
+
+    printf("%-10s %16s %18s\n", "output", "bytes/event", "host ns/lap");
+    printf("%-10s %16.1f %18.0f\n", "screen", screenBytes, screenNs);
+    printf("%-10s %16.1f %18.0f\n", "telemetry", telemetryBytes, telemetryNs);
+    printf("noise: %lu of %zu frames corrupted, %lu decoded, %lu rejected\n", changed, original.size(), noisy.getFrames(),
+           noisy.getBadFrames());
+    printf("%s\n", failures == 0 ? "all telemetry checks passed" : "some telemetry checks failed");
+    fflush(stdout);
+    simStop(failures != 0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    cookie_io_functions_t functions = {NULL, countingWrite, NULL, NULL};
+    FILE *sink = fopencookie(NULL, "w", functions);
+    setvbuf(sink, NULL, _IOFBF, 4096);
+    xTaskCreate(&benchTask, "benchTask", 4096, sink, 1, NULL);
+}
+
+int main(void) {
+    setenv("SIM_DURATION_MS", "10000000", 1);  // Upper bound, the bench stops the simulation when done
+    return simMain();
+}
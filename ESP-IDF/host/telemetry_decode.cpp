@@ -0,0 +1,105 @@
+//
+// telemetry_decode.cpp
+// Author: Francesco Mecatti
+// Decoder for the binary telemetry stream (see include/TelemetryCodec.h): reads the raw console bytes from a file or
+// stdin and prints one event per line, "<seconds> <event> [arguments]". Frames failing the CRC are skipped and counted
+// on stderr. With --flash, prints the lap log kept in a flash image instead (see include/LapLog.h and SIM_FLASH in
+// README.md), oldest session first. Usage: TelemetryDecode [file] | TelemetryDecode --flash image
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "LapLog.h"
+#include "TelemetryCodec.h"
+
+static const char *const TYPE_NAMES[TELEMETRY_TYPE_COUNT] = {"hello", "start", "stop", "lap", "reset", "clear", "input", "dropped",
+                                                              "profile", "task", "latency"};
+static const char *const SOURCE_NAMES[] = {"button", "touch", "hall", "any"};
+static bool lapLog = false;  // Events read from a lap log: hello carries the session too
+
+static void printSeconds(clock_us_t us) {
+    printf("%" PRId64 ".%06" PRId64, us / 1000000, us % 1000000);
+}
+
+static void printEvent(const TelemetryEvent &event) {
+    printSeconds(event.timestamp);
+    printf(" %s", TYPE_NAMES[event.type]);
+    switch (event.type) {
+        case TELEMETRY_HELLO:
+            if (lapLog)
+                printf(" session %" PRIu64 " version %" PRIu64, event.args[0] >> 8, event.args[0] & 0xff);
+            else
+                printf(" version %" PRIu64, event.args[0]);
+            break;
+        case TELEMETRY_STOP:
+            printf(" elapsed ");
+            printSeconds((clock_us_t) event.args[0]);
+            break;
+        case TELEMETRY_LAP:
+            printf(" %" PRIu64 " split ", event.args[0]);
+            printSeconds((clock_us_t) event.args[1]);
+            break;
+        case TELEMETRY_INPUT: {
+            uint64_t source = event.args[0] >> 1;
+            printf(" %s %s", source < sizeof(SOURCE_NAMES) / sizeof(SOURCE_NAMES[0]) ? SOURCE_NAMES[source] : "?",
+                   (event.args[0] & 1) == 0 ? "pressed" : "released");
+            break;
+        }
+        case TELEMETRY_DROPPED:
+            printf(" %" PRIu64 " frames in total", event.args[0]);
+            break;
+        case TELEMETRY_PROFILE:
+            printf(" %" PRIu64 " tasks over ", event.args[1]);
+            printSeconds((clock_us_t) event.args[0]);
+            break;
+        case TELEMETRY_TASK: {
+            char name[9] = {};
+            for (int i = 0; i < 8; i++)
+                name[i] = (char) (event.args[0] >> (8 * i));
+            printf(" %-8s cpu %" PRIu64 " us, %" PRIu64 " wakeups, stack free %" PRIu64, name, event.args[1],
+                   event.args[2] >> 32, event.args[2] & 0xffffffff);
+            break;
+        }
+        case TELEMETRY_LATENCY:
+            printf(" %s < %" PRIu64 " us: %" PRIu64, event.args[0] < sizeof(SOURCE_NAMES) / sizeof(SOURCE_NAMES[0]) ?
+                   SOURCE_NAMES[event.args[0]] : "?", (uint64_t) 2 << event.args[1], event.args[2]);
+            break;
+        default:
+            break;
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2 && strcmp(argv[1], "--flash") == 0) {
+        if (access(argv[2], R_OK) != 0) {  // The simulated partition would create it
+            perror(argv[2]);
+            return 1;
+        }
+        setenv("SIM_FLASH", argv[2], 1);
+        LapLogStore store;
+        if (!store.mount(LAP_LOG_PARTITION)) {
+            fprintf(stderr, "%s: no lap log partition\n", argv[2]);
+            return 1;
+        }
+        lapLog = true;
+        store.read(printEvent);
+        fprintf(stderr, "%lu records, %lu sectors ending in a torn record\n", store.getStats().recovered, store.getStats().torn);
+        return 0;
+    }
+    FILE *in = argc > 1 ? fopen(argv[1], "rb") : stdin;
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    TelemetryDecoder decoder;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        decoder.feed(buffer, n, printEvent);
+    fprintf(stderr, "%lu frames, %lu bad\n", decoder.getFrames(), decoder.getBadFrames());
+    return 0;
+}
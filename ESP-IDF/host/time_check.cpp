@@ -0,0 +1,143 @@
+//
+// time_check.cpp
+// Author: Francesco Mecatti
+// Host check of Time ownership: start/stop/lap/reset sequences, moves, non-owning handles and repeated
+// create/destroy cycles, built with AddressSanitizer and UBSan (see CMakeLists.txt), and the time row after a reset from
+// days of elapsed time. Exits with 1 on a failed check
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim.h"
+#include "Time.h"
+
+#define CYCLES  (200)  // Create/use/destroy rounds
+
+static int failures = 0;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line) {
+    if (condition)
+        return;
+    printf("line %d: %s failed\n", line, text);
+    failures++;
+}
+
+static bool displayAlive(void) {
+    return Time::xDisplayTaskHandle != NULL && Time::xDisplayRequest != NULL && Time::xFrameMutex != NULL;
+}
+
+static void sequences(void) {
+    {
+        Time a;
+        CHECK(a.isOwner() && displayAlive());
+        CHECK(Time::isStopped() && Time::getCentiseconds() == 0);
+        clock_us_t started = Time::clockSource();
+        a.start(started);
+        vTaskDelay(pdMS_TO_TICKS(1500));
+        clock_us_t lapped = Time::clockSource();
+        a.addLap(lapped);
+        CHECK(Time::getLaps().count() == 1 && Time::getLaps().last().split == lapped - started);
+        clock_us_t stopped = Time::clockSource();
+        a.stop(stopped);
+        vTaskDelay(pdMS_TO_TICKS(500));
+        CHECK(Time::elapsedAt(Time::clockSource()) == stopped - started);  // Not counting while stopped
+        a.reset();
+        CHECK(Time::getCentiseconds() == 0);
+        a.clearLaps();
+        CHECK(Time::getLaps().isEmpty());
+
+        {
+            Time handle;  // Refers to a's stopwatch, owns nothing
+            CHECK(!handle.isOwner());
+            handle.start();
+        }
+        CHECK(!Time::isStopped() && displayAlive());  // Destroying the handle changed nothing
+
+        Time b(std::move(a));
+        CHECK(b.isOwner() && !a.isOwner() && displayAlive());
+        Time c;
+        c = std::move(b);
+        CHECK(c.isOwner() && !b.isOwner() && displayAlive());
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        CHECK(Time::getCentiseconds() >= 100);  // Still counting after two moves
+    }
+    CHECK(Time::isStopped() && !displayAlive());  // c was destroyed last and took displayTask with it
+
+    Time fresh;
+    CHECK(fresh.isOwner() && displayAlive());
+    CHECK(Time::isStopped() && Time::getCentiseconds() == 0 && Time::getLaps().isEmpty());  // A new owner starts from zero
+    unsigned long frames = Time::getDisplayStats().frames;
+    fresh.start();
+    vTaskDelay(pdMS_TO_TICKS(2000));
+    CHECK(Time::getDisplayStats().frames > frames);  // The new displayTask draws
+}
+
+// Ten days on a FakeClock, then a reset: "10d 00:00:00" becomes "00:00:00", and the cells it no longer covers are blank
+static void shorterTime(void) {
+    clock_source_t clockSource = Time::clockSource;
+    FakeClock::reset();
+    Time::clockSource = FakeClock::now;
+    {
+        Time t;
+        t.start(FakeClock::now());
+        FakeClock::advance((clock_us_t) 10 * 24 * 3600 * 1000000);
+        Time::updateTime();
+        vTaskDelay(pdMS_TO_TICKS(100));
+        CHECK(Time::screen.getText(0, 0) == '1' && Time::screen.getText(0, 2) == 'd');
+        size_t length = 0;  // Up to the last cell drawn
+        for (size_t col = 0; col < Time::SCREEN_COLS; col++)
+            if (Time::screen.getText(0, col) != ' ')
+                length = col + 1;
+        t.reset();
+        vTaskDelay(pdMS_TO_TICKS(100));
+        CHECK(Time::screen.getText(0, 0) == '0' && Time::screen.getText(0, 7) == '0');
+        bool blank = length > 8;
+        for (size_t col = 8; col < length; col++)
+            blank &= Time::screen.getText(0, col) == ' ' && Time::screen.getStyle(0, col) == PLAIN;
+        CHECK(blank);
+        t.stop();
+    }
+    Time::clockSource = clockSource;
+}
+
+static void cycles(void) {
+    for (int i = 0; i < CYCLES; i++) {
+        Time t(25, true);
+        t.start();
+        vTaskDelay(pdMS_TO_TICKS(40));
+        t.addLap();
+        if (i % 2 == 0)
+            t.stop();  // Destroyed both running and stopped
+        if (i % 3 == 0) {
+            Time moved(std::move(t));
+            moved.reset();
+        }
+    }
+    CHECK(!displayAlive());
+}
+
+static void checkTask(void *pvParameters) {
+    Time::screen.setOutput(fopen("/dev/null", "w"));  // Only the results on stdout
+    sequences();
+    CHECK(!displayAlive());  // fresh is gone too
+    shorterTime();
+    cycles();
+    printf("%s\n", failures == 0 ? "all Time checks passed" : "some Time checks failed");
+    fflush(stdout);
+    simStop(failures != 0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xTaskCreate(&checkTask, "checkTask", 4096, NULL, 1, NULL);
+}
+
+int main(void) {
+    setenv("SIM_DURATION_MS", "100000", 1);  // Upper bound, the check stops the simulation when done
+    return simMain();
+}
@@ -0,0 +1,159 @@
+//
+// touch_check.cpp
+// Author: Francesco Mecatti
+// Host check of the touch pad in interrupt mode (include/InputSet.h, TouchPad). The touch interrupt is level-triggered,
+// as on the ESP32: the simulator raises it again at every measurement cycle while the pad is held. TOUCHES long touches
+// are made twice, first with a handler that only clears the status, as the examples once did, then with one that masks
+// the interrupt until TouchPad has seen the release. The first must fire over and over; the second once per touch,
+// and every touch must still be read as one press and one release. Then, masking, the raw reading the interrupt compares
+// parts from the filtered one TouchPad decides on: touches the filter shows LAG_MS late, and light touches whose raw
+// reading dips below the press threshold every HOVER_STEP_MS while the filtered one stays in the hysteresis band. The
+// interrupt must stay masked until either the filter shows the press or the raw reading is back above the release
+// threshold: two interrupts per late touch, one per light touch, which is no press.
+// Exits with 1 on a failed check
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sim.h"
+#include "InputSet.h"
+
+#define TOUCH_PIN       (TOUCH_PAD_NUM4)
+#define PRESS_PERCENT   (80)
+#define RELEASE_PERCENT (90)
+#define FILTER_PERIOD   (10)
+#define TOUCHES         (20)
+#define HOLD_MS         (800)
+#define GAP_MS          (700)
+#define TOUCH_VALUE     (200)
+#define IDLE_VALUE      (700)
+#define LAG_MS          (300)
+#define HOVER_VALUE     (600)  // Between the press (80%) and release (90%) thresholds
+#define HOVER_STEP_MS   (40)
+#define HOVER_STEPS     (16)
+
+static int failures = 0;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line) {
+    if (condition)
+        return;
+    printf("line %d: %s failed\n", line, text);
+    failures++;
+}
+
+static SemaphoreHandle_t xSemaphore = NULL;
+static volatile bool masking = false;
+static volatile unsigned long isrs = 0;
+
+static void touchIsrHandler(void *pvParameters) {
+    isrs++;
+    touch_pad_clear_status();
+    if (masking)
+        touch_pad_intr_disable();
+    xSemaphoreGiveFromISR(xSemaphore, NULL);
+}
+
+typedef struct {
+    unsigned long isrs, presses, releases;
+} Round;
+
+static volatile unsigned long presses = 0, releases = 0;
+
+// The input task's side: read the pad on every interrupt or reported release
+static void inputTask(void *pvParameters) {
+    TouchPad &touchPad = *(TouchPad *) pvParameters;
+    bool wasPressed = false;
+    while (true) {
+        xSemaphoreTake(xSemaphore, portMAX_DELAY);
+        InputEvent event;
+        bool pressed = touchPad.popEvents(&event, 1) != 0 ? touchPad.update(event) : touchPad.update({TOUCH_INPUT, 0, 0});
+        presses += pressed && !wasPressed;
+        releases += !pressed && wasPressed;
+        wasPressed = pressed;
+    }
+}
+
+static Round touchRound(bool mask) {
+    masking = mask;
+    unsigned long fromIsrs = isrs, fromPresses = presses, fromReleases = releases;
+    for (int i = 0; i < TOUCHES; i++) {
+        simSetTouchValue(TOUCH_PIN, TOUCH_VALUE);
+        vTaskDelay(pdMS_TO_TICKS(HOLD_MS));
+        simSetTouchValue(TOUCH_PIN, IDLE_VALUE);
+        vTaskDelay(pdMS_TO_TICKS(GAP_MS));
+    }
+    return {isrs - fromIsrs, presses - fromPresses, releases - fromReleases};
+}
+
+// Each touch read by the filter LAG_MS after the hardware saw it
+static Round lagRound(void) {
+    masking = true;
+    unsigned long fromIsrs = isrs, fromPresses = presses, fromReleases = releases;
+    for (int i = 0; i < TOUCHES; i++) {
+        simSetTouchRawValue(TOUCH_PIN, TOUCH_VALUE);
+        vTaskDelay(pdMS_TO_TICKS(LAG_MS));
+        simSetTouchValue(TOUCH_PIN, TOUCH_VALUE);
+        vTaskDelay(pdMS_TO_TICKS(HOLD_MS));
+        simSetTouchValue(TOUCH_PIN, IDLE_VALUE);
+        vTaskDelay(pdMS_TO_TICKS(GAP_MS));
+    }
+    return {isrs - fromIsrs, presses - fromPresses, releases - fromReleases};
+}
+
+// Light touches: filtered in the hysteresis band, raw dipping below the press threshold on and off
+static Round hoverRound(void) {
+    masking = true;
+    unsigned long fromIsrs = isrs, fromPresses = presses, fromReleases = releases;
+    for (int i = 0; i < TOUCHES; i++) {
+        simSetTouchValue(TOUCH_PIN, HOVER_VALUE);
+        for (int step = 0; step < HOVER_STEPS; step++) {
+            simSetTouchRawValue(TOUCH_PIN, step % 2 == 0 ? TOUCH_VALUE : HOVER_VALUE);
+            vTaskDelay(pdMS_TO_TICKS(HOVER_STEP_MS));
+        }
+        simSetTouchValue(TOUCH_PIN, IDLE_VALUE);
+        vTaskDelay(pdMS_TO_TICKS(GAP_MS));
+    }
+    return {isrs - fromIsrs, presses - fromPresses, releases - fromReleases};
+}
+
+static void checkTask(void *pvParameters) {
+    xSemaphore = xSemaphoreCreateBinary();
+    static TouchPad touchPad(TOUCH_PIN, PRESS_PERCENT, RELEASE_PERCENT, FILTER_PERIOD);
+    touchPad.beginInterrupt(touchIsrHandler, xSemaphore);
+    xTaskCreate(&inputTask, "inputTask", 2048, &touchPad, 2, NULL);
+
+    Round level = touchRound(false);
+    Round masked = touchRound(true);
+    Round lag = lagRound();
+    Round hover = hoverRound();
+    printf("%d touches held %d ms: %lu interrupts unmasked, %lu masked until the release; %lu presses, %lu releases\n",
+           TOUCHES, HOLD_MS, level.isrs, masked.isrs, masked.presses, masked.releases);
+    printf("filter %d ms late: %lu interrupts, %lu presses, %lu releases; light touches: %lu interrupts, %lu presses\n",
+           LAG_MS, lag.isrs, lag.presses, lag.releases, hover.isrs, hover.presses);
+    CHECK(level.isrs > TOUCHES * 2);  // Level-triggered: the held pad keeps interrupting
+    CHECK(masked.isrs == TOUCHES);
+    CHECK(masked.presses == TOUCHES && masked.releases == TOUCHES);
+    CHECK(level.presses == TOUCHES && level.releases == TOUCHES);  // Wasted wakeups, still the right touches
+    CHECK(lag.isrs == TOUCHES * 2);  // Too early for the filter, then once it shows the press
+    CHECK(lag.presses == TOUCHES && lag.releases == TOUCHES);
+    CHECK(hover.isrs == TOUCHES);
+    CHECK(hover.presses == 0 && hover.releases == 0);
+    printf("%s\n", failures == 0 ? "all touch checks passed" : "some touch checks failed");
+    fflush(stdout);
+    simStop(failures != 0);
+    vTaskDelete(NULL);
+}
+
+extern "C" void app_main(void) {
+    xTaskCreate(&checkTask, "checkTask", 4096, NULL, 3, NULL);
+}
+
+int main(void) {
+    setenv("SIM_DURATION_MS", "1000000", 1);  // Upper bound, the check stops the simulation when done
+    return simMain();
+}
@@ -0,0 +1,182 @@
+"""
+Generates the button traces used by bench.sh (idle.trace: long stopped stretches, bounces.trace: contact bounce and glitches), the touch pad drift trace, the button and touch overlap trace and the Hall sensor noise trace used by HallBench.
+Press durations, gaps and noise are drawn from a seeded generator, so the traces are reproducible
+"""
+
+__author__ = "Francesco Mecatti"
+
+import math
+import random
+
+BUTTON = "gpio0"
+HALL_IDLE = -35  # Inside the "no use" band of every example
+
+
+def write_trace(path: str, header: str, presses: list) -> None:
+    with open(path, "w") as f:
+        f.write(f"# {header}\n")
+        f.write("# Generated by make_traces.py\n")
+        f.write(f"0\thall\t{HALL_IDLE}\n")
+        for down, up in presses:
+            f.write(f"{down:.1f}\t{BUTTON}\t0\tpress\n")
+            f.write(f"{up:.1f}\t{BUTTON}\t1\n")
+
+
+def mixed(rng: random.Random, count: int) -> list:
+    presses, t = [], 1000.0
+    for _ in range(count):
+        kind = rng.random()
+        if kind < 0.25:
+            duration = rng.uniform(20, 80)  # Quick tap
+        elif kind < 0.9:
+            duration = rng.uniform(100, 300)  # Normal lap press
+        else:
+            duration = rng.uniform(600, 1500)  # Long press: stop and reset
+        t += rng.uniform(0, 10)  # Not aligned to the polling period
+        presses.append((t, t + duration))
+        t += duration + rng.uniform(300, 2000)
+    return presses
+
+
+def double_taps(rng: random.Random, count: int) -> list:
+    presses, t = [], 1000.0
+    for _ in range(count):
+        for _ in range(2):
+            duration = rng.uniform(30, 60)
+            presses.append((t, t + duration))
+            t += duration + rng.uniform(40, 80)
+        t += rng.uniform(1000, 2000)
+    return presses
+
+
+def idle_sessions(rng: random.Random, count: int) -> list:
+    """Timing sessions (start, a lap every few seconds, long press to stop and reset) separated by minutes of idle"""
+    presses, t = [], 1000.0
+    for _ in range(count):
+        for _ in range(rng.randint(3, 8)):
+            duration = rng.uniform(80, 250)
+            presses.append((t, t + duration))
+            t += duration + rng.uniform(2000, 8000)
+        duration = rng.uniform(700, 1200)
+        presses.append((t, t + duration))
+        t += duration + rng.uniform(60000, 180000)
+    return presses
+
+
+def bounces(rng: random.Random, path: str, presses: list) -> None:
+    """presses with a burst of contact bounce after every edge (20-500 us toggles, up to 3 ms) and short glitches in between"""
+    def edge(f, t: float, level: int, tag: str = "") -> None:
+        f.write(f"{t:.3f}\t{BUTTON}\t{level}{tag}\n")
+        end, bounced = t + rng.uniform(0, 2.5), level
+        while True:
+            t += rng.uniform(0.02, 0.5)
+            if t >= end:
+                break
+            bounced = 1 - bounced
+            f.write(f"{t:.3f}\t{BUTTON}\t{bounced}\n")
+        if bounced != level:
+            f.write(f"{t:.3f}\t{BUTTON}\t{level}\n")
+
+    def glitch(f, start: float, end: float, level: int) -> None:
+        if rng.random() < 0.5:
+            t = rng.uniform(start + (end - start) / 4, start + (end - start) / 2)
+            f.write(f"{t:.3f}\t{BUTTON}\t{1 - level}\n")
+            f.write(f"{t + rng.uniform(0.005, 0.1):.3f}\t{BUTTON}\t{level}\n")
+
+    with open(path, "w") as f:
+        f.write(f"# {len(presses)} presses with contact bounce on every edge and glitches of 5-100 us\n")
+        f.write("# Generated by make_traces.py\n")
+        f.write(f"0\thall\t{HALL_IDLE}\n")
+        last = 0.0
+        for down, up in presses:
+            glitch(f, last, down, 1)
+            edge(f, down, 0, "\tpress")
+            glitch(f, down, up, 0)
+            edge(f, up, 1)
+            last = up
+
+
+def hall_noise(rng: random.Random, path: str, seconds: int, presses: int) -> None:
+    """Idle reading drifting by +-10 over 3 minutes, gaussian noise, rare spikes and magnet presses of either pole"""
+    step_ms = 20
+    magnets, t = [], 3000.0
+    for _ in range(presses):
+        duration = rng.uniform(300, 1500)
+        magnets.append((t, t + duration, rng.choice((-1, 1)) * rng.uniform(35, 60)))
+        t += duration + rng.uniform(3000, 6000)
+    with open(path, "w") as f:
+        f.write(f"# {seconds} s of Hall sensor readings with {presses} magnet presses\n")
+        f.write("# Generated by make_traces.py\n")
+        m = 0
+        for i in range(seconds * 1000 // step_ms):
+            t = i * step_ms
+            value = HALL_IDLE + 10 * math.sin(2 * math.pi * t / 180000) + rng.gauss(0, 3)
+            if rng.random() < 0.005:
+                value += rng.choice((-1, 1)) * 30  # Spike
+            tag = ""
+            while m < len(magnets) and magnets[m][1] <= t:
+                m += 1
+            if m < len(magnets) and magnets[m][0] <= t:
+                value += magnets[m][2]
+                if t - step_ms < magnets[m][0]:
+                    tag = "\tpress"  # First reading with the magnet
+            f.write(f"{t}\thall\t{round(value)}{tag}\n")
+
+
+def touch_drift(rng: random.Random, path: str, seconds: int, touches: int) -> None:
+    """Untouched reading sinking from 700 to 450 and back (humidity), noise, and touches down to ~15% of it"""
+    step_ms = 50
+    touched, t = [], 2000.0
+    for _ in range(touches):
+        duration = rng.uniform(100, 1200)
+        touched.append((t, t + duration))
+        t += duration + rng.uniform(1500, 4000)
+    with open(path, "w") as f:
+        f.write(f"# {seconds} s of touch pad readings with {touches} touches, untouched reading drifting by humidity\n")
+        f.write("# Generated by make_traces.py\n")
+        f.write(f"0\thall\t{HALL_IDLE}\n")
+        m = 0
+        for i in range(seconds * 1000 // step_ms):
+            t = i * step_ms
+            baseline = 575 + 125 * math.cos(2 * math.pi * t / (seconds * 1000))
+            value = baseline + rng.gauss(0, 5)
+            tag = ""
+            while m < len(touched) and touched[m][1] <= t:
+                m += 1
+            if m < len(touched) and touched[m][0] <= t:
+                value = baseline * rng.uniform(0.12, 0.18)
+                if t - step_ms < touched[m][0]:
+                    tag = "\tpress"  # First reading with the finger on the pad
+            f.write(f"{t}\ttouch4\t{round(value)}{tag}\n")
+
+
+def overlap(rng: random.Random, path: str, count: int) -> None:
+    """Start with a button tap, then a long press made of the button and the pad together: the finger lands on the pad
+    as the button press settles (5 ms, BUTTON_SETTLE_US), so both events reach the input task at once, touch first.
+    The press must be dated from the button edge: the lap at the button edge and the stop 500 ms after it"""
+    with open(path, "w") as f:
+        f.write(f"# {count} starts, each followed by a long press of the button and the touch pad together\n")
+        f.write("# Generated by make_traces.py\n")
+        f.write(f"0\thall\t{HALL_IDLE}\n")
+        t = 1000
+        for _ in range(count):
+            tap = rng.randint(80, 200)
+            f.write(f"{t}\t{BUTTON}\t0\tpress\n")
+            f.write(f"{t + tap}\t{BUTTON}\t1\n")
+            t += tap + rng.randint(1000, 3000)
+            f.write(f"{t}\t{BUTTON}\t0\tpress\n")
+            f.write(f"{t + 5}\ttouch4\t{rng.randint(85, 125)}\n")
+            f.write(f"{t + rng.randint(150, 350)}\ttouch4\t{rng.randint(690, 710)}\n")
+            f.write(f"{t + rng.randint(501, 504)}\t{BUTTON}\t1\n")
+            t += rng.randint(1500, 3000)
+
+
+if __name__ == "__main__":
+    rng = random.Random(32)
+    write_trace("presses.trace", "200 presses: quick taps, lap presses and long presses", mixed(rng, 200))
+    write_trace("double_taps.trace", "100 pairs of quick taps, 40-80 ms apart", double_taps(rng, 100))
+    hall_noise(rng, "hall_noise.trace", 240, 40)
+    touch_drift(rng, "touch_drift.trace", 240, 60)
+    write_trace("idle.trace", "10 timing sessions, each followed by 1 to 3 minutes stopped", idle_sessions(rng, 10))
+    bounces(rng, "bounces.trace", mixed(rng, 200))
+    overlap(rng, "overlap.trace", 30)
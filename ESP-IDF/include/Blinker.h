@@ -0,0 +1,85 @@
+//
+// Blinker.h
+// Author: Francesco Mecatti
+// Square wave on a GPIO driven by a periodic esp_timer: every half period the timer callback toggles the pin.
+// Unlike a vTaskDelay loop the period is not rounded to the FreeRTOS tick and no task wakes up to blink
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "esp_timer.h"
+
+class Blinker {
+    public:
+        Blinker(gpio_num_t pin, uint64_t halfPeriodUs) {
+            this->pin = pin;
+            this->halfPeriodUs = halfPeriodUs;
+            gpio_pad_select_gpio(pin);
+            gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+            esp_timer_create_args_t timerArgs = {};
+            timerArgs.callback = &toggle;
+            timerArgs.arg = this;
+            timerArgs.dispatch_method = ESP_TIMER_TASK;
+            timerArgs.name = "blinker";
+            esp_timer_create(&timerArgs, &timer);
+        }
+
+        Blinker(const Blinker &) = delete;  // The timer callback holds this
+        Blinker &operator=(const Blinker &) = delete;
+
+        void start(void) {
+            if (running)
+                return;
+            gpio_set_level(pin, level);
+            esp_timer_start_periodic(timer, halfPeriodUs);
+            running = true;
+        }
+
+        void stop(void) {
+            if (!running)
+                return;
+            esp_timer_stop(timer);
+            running = false;
+        }
+
+        // Retune while blinking: the timer is rearmed as a whole, so the callback sees either the old or the new period,
+        // and the next toggle comes one new half period after this call
+        void setHalfPeriod(uint64_t us) {
+            halfPeriodUs = us;
+            if (running) {
+                esp_timer_stop(timer);
+                esp_timer_start_periodic(timer, halfPeriodUs);
+            }
+        }
+
+        uint64_t getHalfPeriod(void) const {
+            return halfPeriodUs;
+        }
+
+        unsigned long getToggles(void) const {
+            return toggles;
+        }
+
+        ~Blinker() {
+            stop();
+            esp_timer_delete(timer);
+        }
+
+    private:
+        gpio_num_t pin;
+        esp_timer_handle_t timer = NULL;
+        uint64_t halfPeriodUs;
+        bool running = false;
+        volatile int level = 0;  // Toggled by the callback, read by start() from the owner's task
+        volatile unsigned long toggles = 0;
+
+        // esp_timer task context: keep it short and never block
+        static void toggle(void *arg) {
+            Blinker *blinker = (Blinker *) arg;
+            blinker->level = !blinker->level;
+            gpio_set_level(blinker->pin, blinker->level);
+            blinker->toggles++;
+        }
+};
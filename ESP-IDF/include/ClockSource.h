@@ -0,0 +1,40 @@
+//
+// ClockSource.h
+// Author: Francesco Mecatti
+// Monotonic microsecond clock sources used by Time.
+// On target the esp_timer high resolution counter is used; FakeClock is a host-side clock advanced by hand,
+// so drift and wakeup counts can be checked without real hardware
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_timer.h"
+
+typedef int64_t clock_us_t;  // Microseconds
+typedef clock_us_t (*clock_source_t)(void);
+
+// 64 bit, 1 us resolution counter started at boot; it does not depend on the FreeRTOS tick, so it does not drift with scheduling delays
+inline clock_us_t espTimerClock(void) {
+    return (clock_us_t) esp_timer_get_time();
+}
+
+class FakeClock {
+    public:
+        static inline clock_us_t us = 0;
+        static inline unsigned long reads = 0;  // Number of times the clock has been sampled
+
+        static clock_us_t now(void) {
+            reads++;
+            return us;
+        }
+
+        static void advance(clock_us_t dt) {
+            us += dt;
+        }
+
+        static void reset(void) {
+            us = 0;
+            reads = 0;
+        }
+};
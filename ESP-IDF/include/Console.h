@@ -0,0 +1,283 @@
+//
+// Console.h
+// Author: Francesco Mecatti
+// Non-blocking buffered console writer. write() copies the text into a lock-free ring of whole messages and returns:
+// a slow or disconnected serial monitor never stalls the caller. A drain task, at idle priority, moves the queued
+// messages to the console in chunks of up to CHUNK_SIZE bytes. When a message does not fit the policy decides:
+// drop the newest (the message written), drop the oldest (queued messages are evicted until it fits) or coalesce
+// (it goes to a one-message slot, replaced by the following ones until the ring drains: only the latest of a burst
+// is shown, right for status lines redrawn in place). Losses are counted, see getStats().
+// One producing task and one console per firmware image, so everything is static
+//
+
+#pragma once
+
+#include <atomic>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "Profiler.h"
+#include "TaskPlacement.h"
+
+typedef enum {CONSOLE_DROP_OLDEST, CONSOLE_DROP_NEWEST, CONSOLE_COALESCE} ConsolePolicy;
+
+typedef struct {
+    unsigned long writes;  // Messages accepted; a write longer than MAX_MESSAGE is split
+    unsigned long bytes;  // Accepted
+    unsigned long dropped;  // Messages lost to the policy: rejected, evicted, or replaced in the coalescing slot
+    unsigned long droppedBytes;
+    unsigned long coalesced;  // Messages that went through the coalescing slot
+    unsigned long chunks;  // Writes to the output
+    unsigned long written;  // Bytes written to the output
+    size_t maxFill;  // Most bytes ever waiting in the ring, headers included
+} ConsoleStats;
+
+class Console {
+    public:
+        static const size_t RING_SIZE = 2048;  // Bytes; power of 2
+        static const size_t MAX_MESSAGE = 256;
+        static const size_t CHUNK_SIZE = 512;  // Bytes per write to the output
+        static const size_t PRINTF_SIZE = 128;  // Longer printf output is cut
+        static const unsigned int STACK_SIZE = 2048;
+
+        // Start the drain task. stream() and write() can be used from then on
+        static void begin(ConsolePolicy policy = CONSOLE_DROP_OLDEST) {
+            if (xDrainTaskHandle != NULL)
+                return;
+            Console::policy = policy;
+            head.store(0);
+            tail.store(0);
+            middle.store(1);
+            back = 0;
+            front = 2;
+            coalescing = false;
+            stats = {};
+            if (file == NULL) {
+                cookie_io_functions_t functions = {NULL, &streamWrite, NULL, NULL};
+                file = fopencookie(NULL, "w", functions);
+                setvbuf(file, NULL, _IOFBF, MAX_MESSAGE);  // One fflush, one message
+            }
+            xPending = xSemaphoreCreateBinary();
+            xWriteMutex = xSemaphoreCreateMutex();
+            TaskPlacement::create(RENDER_TASK, &drainTask, "consoleTask", STACK_SIZE, NULL, tskIDLE_PRIORITY, &xDrainTaskHandle);
+        }
+
+        // Delete the drain task, once it is not halfway through a write. Messages still queued are discarded
+        static void end(void) {
+            if (xDrainTaskHandle == NULL)
+                return;
+            xSemaphoreTake(xWriteMutex, portMAX_DELAY);
+            vTaskDelete(xDrainTaskHandle);
+            xDrainTaskHandle = NULL;
+            xSemaphoreGive(xWriteMutex);
+            vSemaphoreDelete(xPending);
+            vSemaphoreDelete(xWriteMutex);
+            xPending = xWriteMutex = NULL;
+        }
+
+        static bool isEnabled(void) {
+            return xDrainTaskHandle != NULL;
+        }
+
+        // Queue length bytes; never blocks. False if the console is off or part of the text was dropped
+        static bool write(const char *data, size_t length) {
+            if (xDrainTaskHandle == NULL)
+                return false;
+            bool accepted = true;
+            while (length > 0) {
+                size_t n = length < MAX_MESSAGE ? length : MAX_MESSAGE;
+                accepted &= writeMessage(data, n);
+                data += n;
+                length -= n;
+            }
+            xSemaphoreGive(xPending);
+            return accepted;
+        }
+
+        static bool printf(const char *format, ...) __attribute__((format(printf, 1, 2))) {
+            char buffer[PRINTF_SIZE];
+            va_list args;
+            va_start(args, format);
+            int n = vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+            if (n < 0)
+                return false;
+            return write(buffer, (size_t) n < sizeof(buffer) ? (size_t) n : sizeof(buffer) - 1);
+        }
+
+        // A FILE writing through the ring, for code that takes a stream (e.g. Renderer). Every fflush is one message
+        static FILE *stream(void) {
+            return file;
+        }
+
+        // Bytes that can be written now without loss, as a few messages; a producer can hold back what does not fit
+        // and send it later, coalescing its updates itself. Unlimited while the console is off
+        static size_t room(void) {
+            if (xDrainTaskHandle == NULL)
+                return SIZE_MAX;
+            if (coalescing)
+                return 0;
+            size_t free = RING_SIZE - (size_t) (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+            size_t headers = HEADER * (free / (HEADER + MAX_MESSAGE) + 2);  // stdio may split a flush in two
+            return free > headers ? free - headers : 0;
+        }
+
+        // Nothing waiting to be written
+        static bool isIdle(void) {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire) &&
+                   (middle.load(std::memory_order_acquire) & FRESH) == 0 && !draining;
+        }
+
+        static void setOutput(FILE *out) {
+            Console::out = out;
+        }
+
+        static ConsoleStats getStats(void) {
+            return stats;
+        }
+
+    private:
+        static const size_t HEADER = 2;  // Message length, little endian
+        static const uint8_t FRESH = 4;  // In middle: the slot holds a message not taken yet
+
+        typedef struct {
+            size_t length;
+            char data[MAX_MESSAGE];
+        } Slot;
+
+        static inline char ring[RING_SIZE];
+        static inline std::atomic<uint32_t> head {0};  // Free running; written by the producer only
+        static inline std::atomic<uint32_t> tail {0};  // Advanced by the drain task, and by the producer to evict
+        static inline Slot slots[3];  // Triple buffer: the producer fills back, the drain task writes front
+        static inline std::atomic<uint8_t> middle {1};
+        static inline uint8_t back = 0, front = 2;
+        static inline bool coalescing = false;  // Producer side: messages go to the slot until the drain task takes it
+        static inline volatile bool draining = false;
+        static inline ConsolePolicy policy = CONSOLE_DROP_OLDEST;
+        static inline ConsoleStats stats = {};
+        static inline FILE *out = stdout;
+        static inline FILE *file = NULL;
+        static inline TaskHandle_t xDrainTaskHandle = NULL;
+        static inline SemaphoreHandle_t xPending = NULL;  // Given after every write; writes coalesce
+        static inline SemaphoreHandle_t xWriteMutex = NULL;  // Held by drainTask while it empties the ring: end() deletes the task only between two drains
+        static inline char chunk[CHUNK_SIZE];
+
+        static size_t peekLength(uint32_t at) {
+            return (uint8_t) ring[at & (RING_SIZE - 1)] | (size_t) (uint8_t) ring[(at + 1) & (RING_SIZE - 1)] << 8;
+        }
+
+        static bool writeMessage(const char *data, size_t length) {
+            if (coalescing) {
+                if (middle.load(std::memory_order_acquire) & FRESH)
+                    return coalesce(data, length);  // Not taken yet: a ring message now would overtake it
+                coalescing = false;
+            }
+            uint32_t h = head.load(std::memory_order_relaxed);
+            size_t size = HEADER + length;
+            uint32_t t;
+            while (h - (t = tail.load(std::memory_order_acquire)) + size > RING_SIZE) {
+                if (policy == CONSOLE_DROP_NEWEST) {
+                    stats.dropped++;
+                    stats.droppedBytes += length;
+                    return false;
+                }
+                if (policy == CONSOLE_COALESCE) {
+                    coalescing = true;
+                    return coalesce(data, length);
+                }
+                size_t evicted = peekLength(t);  // Still intact: only this task writes the ring
+                if (tail.compare_exchange_strong(t, t + HEADER + (uint32_t) evicted, std::memory_order_acq_rel)) {
+                    stats.dropped++;
+                    stats.droppedBytes += evicted;
+                }
+            }
+            ring[h & (RING_SIZE - 1)] = (char) length;
+            ring[(h + 1) & (RING_SIZE - 1)] = (char) (length >> 8);
+            for (size_t i = 0; i < length; i++)
+                ring[(h + HEADER + i) & (RING_SIZE - 1)] = data[i];
+            head.store(h + (uint32_t) size, std::memory_order_release);
+            stats.writes++;
+            stats.bytes += length;
+            if (h + size - t > stats.maxFill)
+                stats.maxFill = h + size - t;
+            return true;
+        }
+
+        static bool coalesce(const char *data, size_t length) {
+            memcpy(slots[back].data, data, length);
+            slots[back].length = length;
+            uint8_t previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+            back = previous & ~FRESH;
+            if (previous & FRESH) {
+                stats.dropped++;
+                stats.droppedBytes += slots[back].length;
+            }
+            stats.writes++;
+            stats.bytes += length;
+            stats.coalesced++;
+            return true;
+        }
+
+        // Whole messages from the ring into chunk. Returns the bytes copied, 0 if the ring is empty
+        static size_t drainRing(void) {
+            while (true) {
+                uint32_t t = tail.load(std::memory_order_acquire), h = head.load(std::memory_order_acquire);
+                uint32_t at = t;
+                size_t length = 0;
+                while (at != h) {
+                    size_t n = peekLength(at);
+                    if (n > MAX_MESSAGE || h - at < HEADER + n || length + n > CHUNK_SIZE)
+                        break;  // Chunk full, or a header torn by an eviction: the exchange below fails then
+                    for (size_t i = 0; i < n; i++)
+                        chunk[length + i] = ring[(at + HEADER + i) & (RING_SIZE - 1)];
+                    length += n;
+                    at += HEADER + (uint32_t) n;
+                }
+                if (at == t)
+                    return 0;
+                if (tail.compare_exchange_strong(t, at, std::memory_order_acq_rel))
+                    return length;
+                // The producer evicted messages while they were copied: start again from the new tail
+            }
+        }
+
+        static void output(const char *data, size_t length) {
+            fwrite(data, 1, length, out);
+            fflush(out);
+            stats.chunks++;
+            stats.written += length;
+        }
+
+        static void drainTask(void *pvParameter) {
+            while (true) {
+                xSemaphoreTake(xPending, portMAX_DELAY);
+                Profiler::wake();
+                xSemaphoreTake(xWriteMutex, portMAX_DELAY);
+                draining = true;
+                while (true) {
+                    size_t length = drainRing();
+                    if (length > 0) {
+                        output(chunk, length);
+                        continue;
+                    }
+                    if ((middle.load(std::memory_order_acquire) & FRESH) == 0)
+                        break;
+                    uint8_t previous = middle.exchange(front, std::memory_order_acq_rel);  // Ring empty: the slot is next
+                    front = previous & ~FRESH;
+                    output(slots[front].data, slots[front].length);
+                }
+                draining = false;
+                xSemaphoreGive(xWriteMutex);
+            }
+        }
+
+        static ssize_t streamWrite(void *cookie, const char *buffer, size_t size) {
+            (void) cookie;
+            write(buffer, size);
+            return size;  // Losses are counted, never reported to stdio: the stream would stay in error
+        }
+};
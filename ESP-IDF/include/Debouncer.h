@@ -0,0 +1,153 @@
+//
+// Debouncer.h
+// Author: Francesco Mecatti
+// Contact bounce and glitch filter for a GPIO input, driven by its edge interrupt. The first edge masks the pin
+// interrupt and arms a one-shot esp_timer; once the settle time is over the callback samples the pin and unmasks it.
+// A level different from the last one reported is a transition, delivered once and stamped at its first edge; the same
+// level means the edges were a glitch, and nothing is delivered. However much a contact bounces, each transition costs
+// one interrupt and one timer callback, and the task behind the handler wakes once
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "esp_intr_alloc.h"
+#include "esp_timer.h"
+#include "ClockSource.h"
+
+// Settled transition: level sampled at the end of the settle time, timestamp of the edge that started it.
+// Runs in the esp_timer task, or in the edge ISR when the settle time is 0: it must not block
+typedef void (*debounce_handler_t)(void *arg, int level, clock_us_t timestamp);
+
+typedef struct {
+    unsigned long interrupts;  // Edge ISR invocations
+    unsigned long settles;  // Settle times that ran out
+    unsigned long events;  // Transitions delivered
+    unsigned long glitches;  // Settle times ending on the level already reported
+} DebounceStats;
+
+class Debouncer {
+    public:
+        // Input pin, both edges. With settleUs == 0 every edge is delivered from the ISR, as without a filter.
+        // The ISR and the timer callback hold this: the object must not be copied or moved from here on
+        void begin(gpio_num_t pin, uint32_t settleUs, debounce_handler_t handler, void *arg = NULL) {
+            if (started)
+                return;
+            this->pin = pin;
+            this->settleUs = settleUs;
+            this->handler = handler;
+            this->arg = arg;
+            stats = {};
+            paused = false;
+            gpio_set_direction(pin, GPIO_MODE_INPUT);
+            level = gpio_get_level(pin);
+            if (settleUs > 0 && timer == NULL) {
+                esp_timer_create_args_t timerArgs = {};
+                timerArgs.callback = &settled;
+                timerArgs.arg = this;
+                timerArgs.dispatch_method = ESP_TIMER_TASK;
+                timerArgs.name = "debounce";
+                esp_timer_create(&timerArgs, &timer);
+            }
+            gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+            gpio_install_isr_service(ESP_INTR_FLAG_LEVEL1);  // Already installed: nothing happens
+            gpio_isr_handler_add(pin, &edgeIsr, this);
+            gpio_intr_enable(pin);
+            started = true;
+        }
+
+        void end(void) {
+            if (!started)
+                return;
+            gpio_intr_disable(pin);
+            gpio_isr_handler_remove(pin);
+            if (timer != NULL) {
+                esp_timer_stop(timer);
+                esp_timer_delete(timer);
+                timer = NULL;
+            }
+            started = false;
+        }
+
+        // The pin interrupt is about to serve something else (e.g. a wakeup): a settle time running meanwhile still
+        // delivers its transition and leaves the interrupt masked, for the owner to resume; after a glitch it unmasks it
+        void pause(void) {
+            paused = true;
+        }
+
+        // Edges come here again. A level that changed while paused is settled and delivered as usual
+        void resume(void) {
+            paused = false;
+            gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+            gpio_isr_handler_add(pin, &edgeIsr, this);
+            if (timer != NULL && esp_timer_is_active(timer))
+                gpio_intr_disable(pin);  // Settling: the callback unmasks it
+            else
+                gpio_intr_enable(pin);
+            if (gpio_get_level(pin) != level)
+                trigger();
+        }
+
+        // An edge seen by other means (e.g. a wakeup interrupt), ISR safe: start settling as the edge ISR would
+        void trigger(void) {
+            if (settleUs == 0) {
+                deliver(gpio_get_level(pin), espTimerClock());
+                return;
+            }
+            gpio_intr_disable(pin);
+            if (esp_timer_is_active(timer))
+                return;
+            edgeTimestamp = espTimerClock();
+            esp_timer_start_once(timer, settleUs);
+        }
+
+        // Last level delivered
+        int getLevel(void) const {
+            return level;
+        }
+
+        DebounceStats getStats(void) const {
+            return stats;
+        }
+
+    private:
+        gpio_num_t pin = GPIO_NUM_0;
+        uint32_t settleUs = 0;
+        debounce_handler_t handler = NULL;
+        void *arg = NULL;
+        esp_timer_handle_t timer = NULL;
+        volatile int level = 1;
+        volatile clock_us_t edgeTimestamp = 0;
+        volatile bool paused = false;
+        bool started = false;
+        DebounceStats stats = {};
+
+        bool deliver(int newLevel, clock_us_t timestamp) {
+            if (newLevel == level) {
+                stats.glitches++;
+                return false;
+            }
+            level = newLevel;
+            stats.events++;
+            handler(arg, newLevel, timestamp);
+            return true;
+        }
+
+        static void edgeIsr(void *arg) {
+            Debouncer *debouncer = (Debouncer *) arg;
+            debouncer->stats.interrupts++;
+            debouncer->trigger();
+        }
+
+        static void settled(void *arg) {
+            Debouncer *debouncer = (Debouncer *) arg;
+            debouncer->stats.settles++;
+            bool delivered = debouncer->deliver(gpio_get_level(debouncer->pin), debouncer->edgeTimestamp);
+            if (debouncer->paused && delivered)
+                return;  // The handler wakes the owner, which resumes
+            gpio_intr_enable(debouncer->pin);  // An edge latched while masked fires now: one more settle time
+            if (gpio_get_level(debouncer->pin) != debouncer->level)
+                debouncer->trigger();  // Moved since the sample with no edge seen: settle that too
+        }
+};
@@ -0,0 +1,78 @@
+//
+// EventQueue.h
+// Author: Francesco Mecatti
+// Lock-free single-producer/single-consumer ring buffer, used to pass timestamped input events from an ISR to a task.
+// Every edge is kept (up to the capacity) with the time it happened, instead of collapsing into the latest state
+//
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "ClockSource.h"
+
+typedef enum {BUTTON_INPUT, TOUCH_INPUT, HALL_INPUT, ANY_INPUT} InputSource;  // ANY_INPUT: the fused state, as a polling loop sees it
+
+typedef struct {
+    InputSource source;
+    uint8_t level;  // PRESSED (0) or RELEASED (1)
+    clock_us_t timestamp;  // Taken in the ISR
+} InputEvent;
+
+// Events popped from several queues, each in time order, into a single timeline: a stable insertion sort by timestamp,
+// cheap for the few events of a batch
+inline void sortByTimestamp(InputEvent *events, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        InputEvent event = events[i];
+        size_t j = i;
+        for (; j > 0 && events[j - 1].timestamp > event.timestamp; j--)
+            events[j] = events[j - 1];
+        events[j] = event;
+    }
+}
+
+// SIZE must be a power of 2; one producer (the ISR) and one consumer (the task) only
+template <typename T, size_t SIZE>
+class EventQueue {
+    static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "EventQueue size must be a power of 2");
+
+    public:
+        // Producer side, ISR safe. Returns false and counts an overflow if the queue is full
+        bool push(const T &item) {
+            uint32_t head = this->head.load(std::memory_order_relaxed);
+            if (head - tail.load(std::memory_order_acquire) == SIZE) {
+                overflows.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            buffer[head & (SIZE - 1)] = item;
+            this->head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side: move up to maxItems events into items, oldest first. Returns the number of events moved
+        size_t pop(T *items, size_t maxItems) {
+            uint32_t tail = this->tail.load(std::memory_order_relaxed);
+            uint32_t available = head.load(std::memory_order_acquire) - tail;
+            size_t n = available < maxItems ? available : maxItems;
+            for (size_t i = 0; i < n; i++)
+                items[i] = buffer[(tail + i) & (SIZE - 1)];
+            this->tail.store(tail + n, std::memory_order_release);
+            return n;
+        }
+
+        bool isEmpty(void) const {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+
+        // Events dropped because the consumer was too slow
+        unsigned long getOverflows(void) const {
+            return overflows.load(std::memory_order_relaxed);
+        }
+
+    private:
+        T buffer[SIZE];
+        std::atomic<uint32_t> head {0};  // Next slot to write; free running, wraps naturally
+        std::atomic<uint32_t> tail {0};  // Next slot to read
+        std::atomic<unsigned long> overflows {0};
+};
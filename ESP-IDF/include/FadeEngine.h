@@ -0,0 +1,76 @@
+//
+// FadeEngine.h
+// Author: Francesco Mecatti
+// Brightness control on top of a PwmOutput. Brightness goes from 0 to 1 and is mapped to a duty either linearly or
+// through a gamma curve, so that equal brightness steps look equal to the eye. Fades run on the LEDC hardware:
+// a gamma fade is split into a few linear hardware segments following the curve
+//
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include "PwmOutput.h"
+
+typedef enum {LINEAR_CURVE, GAMMA_CURVE} FadeCurve;
+
+class FadeEngine {
+    public:
+        static constexpr float GAMMA = 2.2f;  // sRGB-like perceived brightness
+        static const unsigned int GAMMA_SEGMENTS = 16;  // Linear segments for a full 0 to 1 gamma fade
+
+        FadeEngine(PwmOutput &output, FadeCurve curve = GAMMA_CURVE) : output(output) {
+            this->curve = curve;
+        }
+
+        uint32_t dutyFor(float level) const {
+            level = clamp(level);
+            float scaled = curve == GAMMA_CURVE ? powf(level, GAMMA) : level;
+            return (uint32_t) (scaled * output.getMaxDuty() + 0.5f);
+        }
+
+        float getLevel(void) const {
+            return level;
+        }
+
+        void setCurve(FadeCurve curve) {
+            this->curve = curve;
+            set(level);
+        }
+
+        // Jump to level at once
+        void set(float level) {
+            this->level = clamp(level);
+            output.setDuty(dutyFor(this->level));
+        }
+
+        // Fade from the current level to target in ms; the calling task sleeps while the hardware fades
+        void fadeTo(float target, uint32_t ms) {
+            target = clamp(target);
+            unsigned int segments = 1;
+            if (curve == GAMMA_CURVE)
+                segments = (unsigned int) ceilf(fabsf(target - level) * GAMMA_SEGMENTS);
+            if (segments == 0 || ms == 0) {
+                set(target);
+                return;
+            }
+            float start = level;
+            uint32_t elapsedMs = 0;
+            for (unsigned int i = 1; i <= segments; i++) {
+                level = start + (target - start) * i / segments;
+                uint32_t endMs = (uint32_t) ((uint64_t) ms * i / segments);  // No rounding drift over the segments
+                output.fadeTo(dutyFor(level), endMs - elapsedMs);
+                elapsedMs = endMs;
+            }
+            level = target;
+        }
+
+    private:
+        PwmOutput &output;
+        FadeCurve curve;
+        float level = 0;
+
+        static float clamp(float level) {
+            return level < 0 ? 0 : (level > 1 ? 1 : level);
+        }
+};
@@ -0,0 +1,153 @@
+//
+// HallSampler.h
+// Author: Francesco Mecatti
+// Sampling stage for the ESP32 Hall-effect sensor. A task reads the sensor at a low rate while nothing happens and at
+// a higher one when the reading moves; readings go through a ring buffer and a trimmed mean (a median/average hybrid
+// that drops spikes), are compared with a baseline measured at start-up and tracked while idle, and turn into
+// debounced press/release events with hysteresis. There is one Hall sensor per chip, so everything is static
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/adc.h"
+#include "ClockSource.h"
+#include "EventQueue.h"
+#include "Profiler.h"
+#include "TaskPlacement.h"
+
+typedef struct {
+    int pressDelta;  // |reading - baseline| above this: magnet near
+    int releaseDelta;  // Below this: magnet gone. Smaller than pressDelta, the gap is the hysteresis
+    uint32_t idleRateHz;  // Sampling rate while the reading sits on the baseline
+    uint32_t activeRateHz;  // While pressed or moving away from the baseline
+    unsigned int debounceSamples;  // Consecutive filtered samples needed to change state
+    float baselineAlpha;  // Weight of a new idle sample in the baseline IIR filter; 0 freezes the start-up baseline
+} HallConfig;
+
+class HallSampler {
+    public:
+        static const size_t WINDOW = 5;  // Filter length, in samples
+        static const size_t EVENT_QUEUE_SIZE = 8;
+        static const unsigned int STACK_SIZE = 2048;
+
+        // Transitions for the input task; filled only when start() got a semaphore to notify
+        static inline EventQueue<InputEvent, EVENT_QUEUE_SIZE> events;
+
+        // Start sampling. notify (optional) is given after every event queued in events
+        static void start(const HallConfig &config, SemaphoreHandle_t notify = NULL) {
+            if (xTaskHandle != NULL) {
+                if (notify != NULL)
+                    xNotify = notify;  // Polled first, then switched to events
+                return;
+            }
+            HallSampler::config = config;
+            xNotify = notify;
+            TaskPlacement::create(TIMING_TASK, &hallTask, "hallTask", STACK_SIZE, NULL, 1, &xTaskHandle);
+        }
+
+        // While idle (wake not NULL), e.g. around a light sleep: the sensor has no interrupt, so the sampling task goes on
+        // at the rate the readings call for and gives wake on every press. NULL when awake again
+        static void watch(SemaphoreHandle_t wake) {
+            xWake = wake;
+        }
+
+        static bool isPressed(void) {
+            return pressed;
+        }
+
+        static bool isCalibrated(void) {
+            return calibrated;
+        }
+
+        static float getBaseline(void) {
+            return baseline;
+        }
+
+        static unsigned long getConversions(void) {  // ADC reads since start
+            return conversions;
+        }
+
+        static unsigned long getTransitions(void) {
+            return transitions;
+        }
+
+        // One sample: filter, baseline, hysteresis and debounce. Returns the sampling period to use next, in ms
+        static uint32_t process(int raw, clock_us_t timestamp) {
+            window[next] = raw;
+            next = (next + 1) % WINDOW;
+            if (filled < WINDOW)
+                filled++;
+            int32_t sum = 0;
+            int low = window[0], high = window[0];
+            for (size_t i = 0; i < filled; i++) {
+                sum += window[i];
+                low = window[i] < low ? window[i] : low;
+                high = window[i] > high ? window[i] : high;
+            }
+            if (filled < WINDOW)
+                return 1000 / config.activeRateHz;  // Fill the window quickly at start-up
+            float filtered = (float) (sum - low - high) / (WINDOW - 2);  // Trimmed mean: one spike per window is dropped
+            if (!calibrated) {
+                baseline = filtered;
+                calibrated = true;
+            }
+
+            float deviation = filtered - baseline;
+            float magnitude = deviation < 0 ? -deviation : deviation;
+            bool candidate = pressed ? magnitude > config.releaseDelta : magnitude > config.pressDelta;
+            if (candidate != pressed) {
+                if (run == 0)
+                    runStart = timestamp;  // The transition is dated from its first sample, not from the confirming one
+                if (++run >= config.debounceSamples) {
+                    pressed = candidate;
+                    run = 0;
+                    transitions++;
+                    if (xNotify != NULL) {
+                        events.push({HALL_INPUT, (uint8_t) (pressed ? 0 : 1), runStart});
+                        xSemaphoreGive(xNotify);
+                    }
+                    SemaphoreHandle_t wake = xWake;
+                    if (pressed && wake != NULL)
+                        xSemaphoreGive(wake);
+                }
+            }
+            else {
+                run = 0;
+            }
+            if (!pressed && magnitude < config.releaseDelta)
+                baseline += config.baselineAlpha * deviation;  // Slow drift (temperature, nearby metal) is followed, presses are not
+
+            float rawDeviation = raw - baseline;  // Unfiltered, so that the rate goes up on the first sample of a press
+            bool active = pressed || run != 0 || magnitude >= config.releaseDelta || rawDeviation > config.pressDelta || rawDeviation < -config.pressDelta;
+            return 1000 / (active ? config.activeRateHz : config.idleRateHz);
+        }
+
+    private:
+        static inline HallConfig config;
+        static inline TaskHandle_t xTaskHandle = NULL;
+        static inline SemaphoreHandle_t xNotify = NULL;
+        static inline SemaphoreHandle_t volatile xWake = NULL;  // Set by watch()
+        static inline int window[WINDOW];
+        static inline size_t next = 0, filled = 0;
+        static inline float baseline = 0;
+        static inline bool calibrated = false, pressed = false;
+        static inline unsigned int run = 0;  // Consecutive samples disagreeing with the current state
+        static inline clock_us_t runStart = 0;
+        static inline unsigned long conversions = 0, transitions = 0;
+
+        static void hallTask(void *pvParameter) {
+            TickType_t xLastWakeTime = xTaskGetTickCount();
+            while (true) {
+                int raw = hall_sensor_read();  // The only ADC conversion of the Hall sensor
+                conversions++;
+                uint32_t periodMs = process(raw, espTimerClock());
+                TickType_t period = pdMS_TO_TICKS(periodMs);
+                vTaskDelayUntil(&xLastWakeTime, period != 0 ? period : 1);
+                Profiler::wake();
+            }
+        }
+};
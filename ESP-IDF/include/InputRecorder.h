@@ -0,0 +1,172 @@
+//
+// InputRecorder.h
+// Author: Francesco Mecatti
+// Records every input event buttonTask takes, with its ISR timestamp, to a file in the format of InputTrace.h, so a
+// session from the field can be replayed on the host simulator (SIM_REPLAY, see README.md). record() queues the event
+// and returns; a writer task at idle priority encodes the queued events and appends them in one write per batch, never
+// from buttonTask. Each begin() appends a new session to the file, so the session before a reset is kept.
+// Built with -DRECORD_INPUTS=1 (see README.md); otherwise InputRecorder is an empty class and every call compiles to
+// nothing. On the device the file must be on a mounted filesystem (e.g. SPIFFS, see INPUT_TRACE_PATH)
+//
+
+#pragma once
+
+#include <stdio.h>
+#include "driver/gpio.h"
+#include "driver/touch_pad.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "EventQueue.h"
+#include "InputTrace.h"
+#include "Profiler.h"
+#include "TaskPlacement.h"
+
+#ifndef RECORD_INPUTS
+#define RECORD_INPUTS       (0)
+#endif
+
+#ifndef INPUT_TRACE_PATH
+#define INPUT_TRACE_PATH    "/spiffs/inputs.trace"  // After esp_vfs_spiffs_register() with base path /spiffs
+#endif
+
+typedef struct {
+    unsigned long events;  // Written to the file
+    unsigned long lost;  // Dropped because the queue was full
+    unsigned long bytes;
+    unsigned long writes;  // One per batch
+} RecorderStats;
+
+template <bool ENABLED>
+class TraceRecorder {
+    public:
+        static const size_t QUEUE_SIZE = 64;  // Events; power of 2
+        static const size_t BATCH_SIZE = 16;  // Events per write
+        static const unsigned int STACK_SIZE = 2048;
+
+        // Open path for appending, start a session with the pins the events come from and start the writer task.
+        // False if the file cannot be opened
+        static bool begin(const char *path, gpio_num_t buttonPin, touch_pad_t touchPad = TOUCH_PAD_MAX) {
+            if (xWriterTaskHandle != NULL)
+                return true;
+            out = fopen(path, "ab");
+            if (out == NULL)
+                return false;
+            TraceSession session = {INPUT_TRACE_VERSION, (uint8_t) buttonPin,
+                                    touchPad < TOUCH_PAD_MAX ? (uint8_t) touchPad : InputTraceCodec::TRACE_NO_PIN};
+            uint8_t record[InputTraceCodec::MAX_SESSION_RECORD];
+            size_t length = InputTraceCodec::encodeSession(session, record);
+            fwrite(record, 1, length, out);
+            fflush(out);
+            stats = {0, 0, length, 1};
+            previous = 0;
+            reportedLost = lostAtBegin = queue.getOverflows();
+            xPending = xSemaphoreCreateBinary();
+            xWriteMutex = xSemaphoreCreateMutex();
+            TaskPlacement::create(RENDER_TASK, &writerTask, "recorderTask", STACK_SIZE, NULL, 0, &xWriterTaskHandle);
+            return true;
+        }
+
+        // Delete the writer task, once it is not halfway through a write, and close the file. Events still queued are
+        // discarded
+        static void end(void) {
+            if (xWriterTaskHandle == NULL)
+                return;
+            xSemaphoreTake(xWriteMutex, portMAX_DELAY);
+            vTaskDelete(xWriterTaskHandle);
+            xWriterTaskHandle = NULL;
+            xSemaphoreGive(xWriteMutex);
+            vSemaphoreDelete(xPending);
+            vSemaphoreDelete(xWriteMutex);
+            xPending = xWriteMutex = NULL;
+            fclose(out);
+            out = NULL;
+            InputEvent event;
+            while (queue.pop(&event, 1) > 0)
+                ;
+        }
+
+        static bool isEnabled(void) {
+            return xWriterTaskHandle != NULL;
+        }
+
+        // Queue one event; never blocks. False if not recording or the queue is full
+        static bool record(const InputEvent &event) {
+            if (xWriterTaskHandle == NULL)
+                return false;
+            if (!queue.push(event))
+                return false;
+            xSemaphoreGive(xPending);
+            return true;
+        }
+
+        static RecorderStats getStats(void) {
+            RecorderStats stats = TraceRecorder::stats;
+            stats.lost = queue.getOverflows() - lostAtBegin;
+            return stats;
+        }
+
+    private:
+        static inline EventQueue<InputEvent, QUEUE_SIZE> queue;
+        static inline FILE *out = NULL;
+        static inline TaskHandle_t xWriterTaskHandle = NULL;
+        static inline SemaphoreHandle_t xPending = NULL;  // Given after every event queued; events coalesce
+        static inline SemaphoreHandle_t xWriteMutex = NULL;  // The writer task owns it while a record is on its way to the file; end() takes it before deleting the task
+        static inline RecorderStats stats = {};  // Of the current session; lost is taken from the queue
+        static inline clock_us_t previous = 0;  // Timestamp of the last event written
+        static inline unsigned long reportedLost = 0, lostAtBegin = 0;  // Queue overflows at the last TRACE_LOST record, at begin()
+
+        static void writerTask(void *pvParameter) {
+            InputEvent batch[BATCH_SIZE];
+            uint8_t buffer[(BATCH_SIZE + 1) * InputTraceCodec::MAX_RECORD];
+            size_t n;
+            while (true) {
+                xSemaphoreTake(xPending, portMAX_DELAY);
+                Profiler::wake();
+                xSemaphoreTake(xWriteMutex, portMAX_DELAY);
+                while ((n = queue.pop(batch, BATCH_SIZE)) > 0) {
+                    size_t length = 0;
+                    unsigned long overflows = queue.getOverflows();
+                    if (overflows != reportedLost) {  // Before the events queued after the loss
+                        length += InputTraceCodec::encodeLost(overflows - reportedLost, buffer);
+                        reportedLost = overflows;
+                    }
+                    for (size_t i = 0; i < n; i++) {
+                        length += InputTraceCodec::encode(batch[i], previous, buffer + length);
+                        previous = batch[i].timestamp;
+                    }
+                    fwrite(buffer, 1, length, out);
+                    fflush(out);
+                    stats.events += n;
+                    stats.bytes += length;
+                    stats.writes++;
+                }
+                xSemaphoreGive(xWriteMutex);
+            }
+        }
+};
+
+// Built without recording: nothing is stored and every call is empty
+template <>
+class TraceRecorder<false> {
+    public:
+        static bool begin(const char *, gpio_num_t, touch_pad_t = TOUCH_PAD_MAX) {
+            return false;
+        }
+
+        static void end(void) {}
+
+        static bool isEnabled(void) {
+            return false;
+        }
+
+        static bool record(const InputEvent &) {
+            return false;
+        }
+
+        static RecorderStats getStats(void) {
+            return {};
+        }
+};
+
+typedef TraceRecorder<RECORD_INPUTS> InputRecorder;
@@ -0,0 +1,446 @@
+//
+// InputSet.h
+// Author: Francesco Mecatti
+// Stopwatch input sources (BOOT button, touch pad, Hall-effect sensor) fused into a single logical press signal.
+// The set is fixed at compile time: a source disabled with EnabledIf<false, ...> becomes NoInput, which compiles to nothing.
+// Every evaluation reads each enabled source exactly once, with no side effect on the others
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <type_traits>
+#include "driver/gpio.h"
+#include "driver/touch_pad.h"
+#include "driver/adc.h"
+#include "esp_intr_alloc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "Debouncer.h"
+#include "EventQueue.h"
+#include "HallSampler.h"
+#include "LightSleep.h"
+
+// Active low push button, e.g. BOOT (GPIO 0)
+class Button {
+    public:
+        Button(gpio_num_t pin) {
+            this->pin = pin;
+        }
+
+        void begin(void) {
+            gpio_set_direction(pin, GPIO_MODE_INPUT);
+        }
+
+        // Both edges, through a Debouncer: handler gets each settled transition once, stamped at its first edge, and
+        // pushes an InputEvent with source BUTTON_INPUT. settleUs == 0 delivers every edge from the ISR
+        void beginInterrupt(debounce_handler_t handler, uint32_t settleUs) {
+            begin();
+            interrupt = true;
+            debouncer.begin(pin, settleUs, handler);
+        }
+
+        // Idle: a low level wakes the chip from light sleep (edges do not) and fires wakeIsr once. In interrupt mode it
+        // starts a settle time, so the press is queued as usual; otherwise it gives wake
+        void suspend(SemaphoreHandle_t wake) {
+            this->wake = wake;
+            if (interrupt)
+                debouncer.pause();
+            else
+                gpio_install_isr_service(ESP_INTR_FLAG_LEVEL1);  // Already installed: nothing happens
+            gpio_isr_handler_add(pin, &wakeIsr, this);
+            gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);  // Turns the interrupt into a level one, too
+            esp_sleep_enable_gpio_wakeup();
+            gpio_intr_enable(pin);  // Fires at once if the button is already down
+        }
+
+        void resume(void) {
+            gpio_intr_disable(pin);
+            gpio_wakeup_disable(pin);
+            if (!interrupt) {
+                gpio_isr_handler_remove(pin);
+                return;
+            }
+            debouncer.resume();  // Released before the edge interrupt was back: the release is settled and reported
+        }
+
+        bool sample(void) {
+            pressed = gpio_get_level(pin) == 0;
+            return pressed;
+        }
+
+        // Transition settled by the debouncer: the level sampled there is the state
+        bool update(const InputEvent &event) {
+            if (event.source == BUTTON_INPUT)
+                pressed = event.level == 0;
+            return pressed;
+        }
+
+        bool isPressed(void) const {
+            return pressed;
+        }
+
+    private:
+        gpio_num_t pin;
+        bool pressed = false;
+        bool interrupt = false;
+        Debouncer debouncer;
+        SemaphoreHandle_t wake = NULL;
+
+        static void wakeIsr(void *arg) {
+            Button *button = (Button *) arg;
+            gpio_intr_disable(button->pin);  // Level interrupt: once, or it fires for as long as the button is down
+            if (button->interrupt)
+                button->debouncer.trigger();
+            else
+                xSemaphoreGiveFromISR(button->wake, NULL);
+        }
+};
+
+// Capacitive pad with self-calibrating thresholds. The untouched reading (baseline) is measured at start-up and then
+// followed by an IIR filter while the pad is released, so that slow drift (humidity, temperature) does not move the
+// pad towards a threshold. Touched below pressPercent of the baseline, released above releasePercent (hysteresis).
+// A periodic esp_timer does the tracking: the hardware threshold is reprogrammed only when the baseline has moved
+// enough to shift it, never on a press
+class TouchPad {
+    public:
+        static const unsigned int CALIBRATION_SAMPLES = 8;  // Averaged at start-up, one per filter period
+        static const uint32_t TRACK_PERIOD_MS = 20;
+        static constexpr float BASELINE_ALPHA = 0.005f;  // Per tracking period: a time constant of about 4 s
+        static const unsigned int RETUNE_PERCENT = 2;  // Smallest threshold move, in % of the baseline, worth a reprogram
+
+        TouchPad(touch_pad_t pad, unsigned int pressPercent, unsigned int releasePercent, uint32_t filterPeriodMs) {
+            this->pad = pad;
+            this->pressPercent = pressPercent;
+            this->releasePercent = releasePercent;
+            this->filterPeriodMs = filterPeriodMs;
+        }
+
+        // Measures the baseline with the pad untouched; the object must not be copied afterwards (the timer holds this)
+        void begin(void) {
+            if (timer != NULL)
+                return;
+            touch_pad_init();
+            touch_pad_config(pad, 0);  // No interrupt until calibrated
+            touch_pad_filter_start(filterPeriodMs);
+            uint32_t sum = 0;
+            for (unsigned int i = 0; i < CALIBRATION_SAMPLES; i++) {
+                vTaskDelay(pdMS_TO_TICKS(filterPeriodMs) != 0 ? pdMS_TO_TICKS(filterPeriodMs) : 1);
+                uint16_t value;
+                touch_pad_read_filtered(pad, &value);
+                sum += value;
+            }
+            baseline = (float) sum / CALIBRATION_SAMPLES;
+            setThresholds();
+            esp_timer_create_args_t timerArgs = {};
+            timerArgs.callback = &track;
+            timerArgs.arg = this;
+            timerArgs.dispatch_method = ESP_TIMER_TASK;
+            timerArgs.name = "touchTrack";
+            esp_timer_create(&timerArgs, &timer);
+            esp_timer_start_periodic(timer, (uint64_t) TRACK_PERIOD_MS * 1000);
+        }
+
+        // The interrupt fires on touches only: releases are seen by the tracking timer, which gives notify. handler must
+        // call touch_pad_intr_disable(): the interrupt is level-triggered, and is enabled again once the raw reading, which
+        // the hardware compares, is back above the release threshold
+        void beginInterrupt(intr_handler_t handler, SemaphoreHandle_t notify) {
+            begin();
+            this->notify = notify;
+            programmedThreshold = pressThreshold;
+            touch_pad_config(pad, programmedThreshold);
+            retunes++;
+            touch_pad_set_trigger_mode(TOUCH_TRIGGER_BELOW);
+            touch_pad_isr_register(handler, NULL);
+            touch_pad_intr_enable();
+        }
+
+        // Idle: no tracking (the baseline is frozen), a touch wakes the chip from light sleep. In interrupt mode the
+        // touch interrupt is already armed; otherwise it is armed here, to give wake
+        void suspend(SemaphoreHandle_t wake) {
+            if (timer == NULL)
+                return;
+            esp_timer_stop(timer);
+            if (notify != NULL && rearmPending) {
+                rearmPending = false;
+                touch_pad_intr_enable();  // Nothing would enable it while asleep; still touched, it wakes the chip at once
+            }
+            if (notify == NULL) {
+                this->wake = wake;
+                touch_pad_config(pad, pressThreshold);
+                touch_pad_set_trigger_mode(TOUCH_TRIGGER_BELOW);
+                touch_pad_isr_register(&wakeIsr, this);
+                touch_pad_intr_enable();
+            }
+            esp_sleep_enable_touchpad_wakeup();
+        }
+
+        void resume(void) {
+            if (timer == NULL || esp_timer_is_active(timer))
+                return;
+            if (notify == NULL) {
+                touch_pad_intr_disable();
+                touch_pad_config(pad, 0);
+            }
+            esp_timer_start_periodic(timer, (uint64_t) TRACK_PERIOD_MS * 1000);
+        }
+
+        bool sample(void) {
+            uint16_t value;
+            touch_pad_read_filtered(pad, &value);
+            if (!pressed && value < pressThreshold)
+                pressed = true;
+            else if (pressed && value > releaseThreshold)
+                pressed = false;
+            return pressed;
+        }
+
+        // Touch interrupt or release seen by the tracker: read the pad once to know which
+        bool update(const InputEvent &event) {
+            if (event.source != TOUCH_INPUT)
+                return pressed;
+            sample();
+            if (notify == NULL)
+                return pressed;
+            if (pressed) {
+                releasePending = true;
+            }
+            else if (!releasePending) {
+                uint16_t raw;
+                touch_pad_read_raw_data(pad, &raw);
+                // Not a press. If the raw reading is still low (the filter lags, or it sits in the hysteresis band) the
+                // interrupt would fire at every measurement: the tracker enables it later
+                if (raw > releaseThreshold)
+                    touch_pad_intr_enable();  // The touch was over before it was read: nothing for the tracker to report
+                else
+                    rearmPending = true;
+            }
+            return pressed;
+        }
+
+        size_t popEvents(InputEvent *items, size_t max) {
+            if (!releaseReady || max == 0)
+                return 0;
+            items[0] = {TOUCH_INPUT, 1, releaseTimestamp};
+            releaseReady = false;
+            return 1;
+        }
+
+        bool isPressed(void) const {
+            return pressed;
+        }
+
+        float getBaseline(void) const {
+            return baseline;
+        }
+
+        unsigned long getRetunes(void) const {  // touch_pad_config calls made for the interrupt threshold
+            return retunes;
+        }
+
+    private:
+        touch_pad_t pad;
+        unsigned int pressPercent, releasePercent;
+        uint32_t filterPeriodMs;
+        bool pressed = false;
+        esp_timer_handle_t timer = NULL;
+        SemaphoreHandle_t notify = NULL;
+        SemaphoreHandle_t wake = NULL;  // Polled mode, while suspended
+        float baseline = 0;
+        volatile uint16_t pressThreshold = 0, releaseThreshold = 0;  // Written by the tracker, read by sample()
+        uint16_t programmedThreshold = 0;  // In the hardware, interrupt mode only
+        volatile bool releasePending = false;  // Touch seen by the input task, release not reported yet
+        volatile bool rearmPending = false;  // Interrupt masked on a low raw reading that was not a press, see update()
+        volatile bool releaseReady = false;
+        volatile clock_us_t releaseTimestamp = 0;
+        volatile unsigned long retunes = 0;
+
+        static void wakeIsr(void *arg) {
+            TouchPad *touchPad = (TouchPad *) arg;
+            touch_pad_clear_status();
+            touch_pad_intr_disable();
+            xSemaphoreGiveFromISR(touchPad->wake, NULL);
+        }
+
+        void setThresholds(void) {
+            pressThreshold = (uint16_t) (baseline * pressPercent / 100);
+            releaseThreshold = (uint16_t) (baseline * releasePercent / 100);
+        }
+
+        // esp_timer task context: follow the baseline while released, report releases, retune the hardware if needed
+        static void track(void *arg) {
+            TouchPad *touchPad = (TouchPad *) arg;
+            uint16_t value, raw;
+            touch_pad_read_filtered(touchPad->pad, &value);
+            touch_pad_read_raw_data(touchPad->pad, &raw);
+            if (touchPad->rearmPending && (raw > touchPad->releaseThreshold || value < touchPad->pressThreshold)) {
+                touchPad->rearmPending = false;
+                touch_pad_intr_enable();  // Let go; or a press the filter shows now, which raises the interrupt again at once
+            }
+            if (value <= touchPad->releaseThreshold)
+                return;  // Touched, or on its way: leave the baseline alone
+            if (touchPad->releasePending) {
+                if (raw <= touchPad->releaseThreshold)
+                    return;  // Released as filtered, not yet as measured: the interrupt would fire again
+                touchPad->releasePending = false;
+                touchPad->releaseTimestamp = espTimerClock();
+                touchPad->releaseReady = true;
+                touch_pad_intr_enable();  // Masked by the handler since the touch
+                xSemaphoreGive(touchPad->notify);
+                return;
+            }
+            touchPad->baseline += BASELINE_ALPHA * (value - touchPad->baseline);
+            touchPad->setThresholds();
+            if (touchPad->notify == NULL)
+                return;  // Polled: no hardware threshold to keep
+            int move = (int) touchPad->pressThreshold - touchPad->programmedThreshold;
+            if ((unsigned int) (move < 0 ? -move : move) * 100 >= RETUNE_PERCENT * touchPad->baseline) {
+                touchPad->programmedThreshold = touchPad->pressThreshold;
+                touch_pad_config(touchPad->pad, touchPad->programmedThreshold);
+                touchPad->retunes++;
+            }
+        }
+};
+
+// Magnet nearby, as decided by HallSampler (filtered, baseline-relative, debounced). The ADC is read by the sampling
+// task only: evaluating this source costs no conversion
+class HallSensor {
+    public:
+        HallSensor(int pressDelta, int releaseDelta, uint32_t idleRateHz, uint32_t activeRateHz) {
+            config = {pressDelta, releaseDelta, idleRateHz, activeRateHz, DEBOUNCE_SAMPLES, BASELINE_ALPHA};
+        }
+
+        void begin(void) {
+            HallSampler::start(config);
+        }
+
+        // Transitions are queued in HallSampler::events and notify is given, as an ISR would
+        void beginInterrupt(SemaphoreHandle_t notify) {
+            HallSampler::start(config, notify);
+        }
+
+        // Idle: the sensor has no interrupt, so sampling goes on, at idleRateHz while no magnet is near; a press gives wake
+        void suspend(SemaphoreHandle_t wake) {
+            HallSampler::watch(wake);
+        }
+
+        void resume(void) {
+            HallSampler::watch(NULL);
+        }
+
+        bool sample(void) {
+            pressed = HallSampler::isPressed();
+            return pressed;
+        }
+
+        bool update(const InputEvent &event) {
+            if (event.source == HALL_INPUT)
+                pressed = event.level == 0;
+            return pressed;
+        }
+
+        size_t popEvents(InputEvent *items, size_t max) {
+            return HallSampler::events.pop(items, max);
+        }
+
+        bool isPressed(void) const {
+            return pressed;
+        }
+
+    private:
+        static const unsigned int DEBOUNCE_SAMPLES = 2;
+        static constexpr float BASELINE_ALPHA = 0.02f;
+        HallConfig config;
+        bool pressed = false;
+};
+
+// Placeholder for a disabled source: accepts the same constructor arguments and is never pressed
+class NoInput {
+    public:
+        template <typename... Args>
+        NoInput(Args...) {}
+
+        template <typename... Args>
+        void beginInterrupt(Args...) {}
+
+        void begin(void) {}
+
+        void suspend(SemaphoreHandle_t) {}
+
+        void resume(void) {}
+
+        bool sample(void) {
+            return false;
+        }
+
+        bool update(const InputEvent &) {
+            return false;
+        }
+
+        size_t popEvents(InputEvent *, size_t) {
+            return 0;
+        }
+
+        bool isPressed(void) const {
+            return false;
+        }
+};
+
+template <bool ENABLED, typename Source>
+using EnabledIf = typename std::conditional<ENABLED, Source, NoInput>::type;
+
+template <typename ButtonInput, typename TouchInput, typename HallInput>
+class InputSet {
+    public:
+        ButtonInput button;
+        TouchInput touchPad;
+        HallInput hallSensor;
+
+        InputSet(ButtonInput button, TouchInput touchPad, HallInput hallSensor) : button(button), touchPad(touchPad), hallSensor(hallSensor) {}
+
+        // Polled configuration of every enabled source
+        void begin(void) {
+            button.begin();
+            touchPad.begin();
+            hallSensor.begin();
+        }
+
+        // Polling: read every enabled source once; pressed if any of them is. Bitwise or, so none is skipped
+        bool sample(void) {
+            return button.sample() | touchPad.sample() | hallSensor.sample();
+        }
+
+        // Interrupt driven: hand the event to its source and fuse with the state of the others
+        bool update(const InputEvent &event) {
+            return button.update(event) | touchPad.update(event) | hallSensor.update(event);
+        }
+
+        // Nothing to time and nothing pressed: stop the periodic work of every source that can wake the chip by itself
+        // (touch tracking), arm the button and touch wakeups and let the chip sleep. wake is given by an input without
+        // its own interrupt: the Hall sampler, which keeps sampling at its idle rate
+        void suspend(SemaphoreHandle_t wake) {
+            button.suspend(wake);
+            touchPad.suspend(wake);
+            hallSensor.suspend(wake);
+            LightSleep::allow();
+        }
+
+        void resume(void) {
+            LightSleep::forbid();
+            button.resume();
+            touchPad.resume();
+            hallSensor.resume();
+        }
+
+        // Events produced by tasks and timers rather than ISRs (touch releases, the Hall sampler), to be handled like the ISR ones
+        size_t popTaskEvents(InputEvent *items, size_t max) {
+            size_t n = touchPad.popEvents(items, max);
+            return n + hallSensor.popEvents(items + n, max - n);
+        }
+
+        bool isPressed(void) const {
+            return button.isPressed() || touchPad.isPressed() || hallSensor.isPressed();
+        }
+};
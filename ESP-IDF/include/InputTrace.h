@@ -0,0 +1,130 @@
+//
+// InputTrace.h
+// Author: Francesco Mecatti
+// Compact input trace format: the events buttonTask takes from its queue, as written by InputRecorder.h and replayed by
+// the host simulator (SIM_REPLAY, see README.md). Every record is one varint (see TelemetryCodec.h):
+// payload << 4 | mark << 3 | source << 1 | level. An event has mark 0 and its payload is the zigzag encoded difference
+// from the previous timestamp of the session (events of different sources are queued out of timestamp order), so a
+// press typically takes 3 bytes. A mark record has mark 1 and a kind in the source bits: a session starts with
+// TRACE_SESSION (payload: format version, then two raw bytes: button GPIO and touch pad, TRACE_NO_PIN if unused);
+// TRACE_LOST counts the events the recorder had to drop. A file holds the sessions of successive boots, one after
+// the other. A record cut short by a power loss is ignored, together with whatever follows it
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "EventQueue.h"
+#include "TelemetryCodec.h"
+
+#define INPUT_TRACE_VERSION (1)
+
+typedef enum {TRACE_SESSION = 0, TRACE_LOST} TraceMark;
+
+typedef struct {
+    uint8_t version;
+    uint8_t buttonPin;  // GPIO the button events come from, TRACE_NO_PIN if none
+    uint8_t touchPad;  // Touch pad of the touch events, TRACE_NO_PIN if none
+} TraceSession;
+
+class InputTraceCodec {
+    public:
+        static const uint8_t TRACE_NO_PIN = 0xff;
+        static const size_t MAX_RECORD = TelemetryCodec::MAX_VARINT;
+        static const size_t MAX_SESSION_RECORD = 1 + 2;  // Version fits in one varint byte
+
+        // Session start into out (at least MAX_SESSION_RECORD bytes). Returns its length
+        static size_t encodeSession(const TraceSession &session, uint8_t *out) {
+            size_t n = TelemetryCodec::putVarint((uint64_t) session.version << 4 | 1 << 3 | TRACE_SESSION << 1, out);
+            out[n++] = session.buttonPin;
+            out[n++] = session.touchPad;
+            return n;
+        }
+
+        static size_t encodeLost(uint64_t events, uint8_t *out) {
+            return TelemetryCodec::putVarint(events << 4 | 1 << 3 | TRACE_LOST << 1, out);
+        }
+
+        // One event after the one stamped previous (0 at the start of a session). Returns its length
+        static size_t encode(const InputEvent &event, clock_us_t previous, uint8_t *out) {
+            int64_t delta = event.timestamp - previous;
+            uint64_t zigzag = (uint64_t) delta << 1 ^ (uint64_t) (delta >> 63);
+            return TelemetryCodec::putVarint(zigzag << 4 | (uint64_t) event.source << 1 | (event.level & 1), out);
+        }
+
+        static clock_us_t unzigzag(uint64_t value) {
+            return (clock_us_t) (value >> 1) ^ -(clock_us_t) (value & 1);
+        }
+};
+
+// Walks a trace held in memory, session by session
+class InputTraceReader {
+    public:
+        InputTraceReader(const uint8_t *data, size_t length) : data(data), length(length) {}
+
+        // Skip to the start of the next session. False at the end of the trace, or on a damaged record
+        bool nextSession(TraceSession &session) {
+            InputEvent event;
+            while (next(event))
+                ;  // Rest of the current session
+            if (!pending)
+                return false;
+            pending = false;
+            session = this->session;
+            previous = 0;
+            lost = 0;
+            return true;
+        }
+
+        // Next event of the current session. False at its end
+        bool next(InputEvent &event) {
+            while (!pending && !damaged) {
+                uint64_t value;
+                size_t start = at;
+                if (!TelemetryCodec::getVarint(data, length, at, value)) {
+                    damaged = at > start;  // Cut short, or too long to be a varint
+                    at = length;
+                    return false;
+                }
+                if ((value & 1 << 3) == 0) {
+                    previous += InputTraceCodec::unzigzag(value >> 4);
+                    event = {(InputSource) (value >> 1 & 3), (uint8_t) (value & 1), previous};
+                    return true;
+                }
+                if ((value >> 1 & 3) == TRACE_LOST) {
+                    lost += value >> 4;
+                    continue;
+                }
+                if ((value >> 1 & 3) != TRACE_SESSION || length - at < 2) {
+                    damaged = true;
+                    at = length;
+                    return false;
+                }
+                session = {(uint8_t) (value >> 4), data[at], data[at + 1]};
+                at += 2;
+                pending = true;
+            }
+            return false;
+        }
+
+        // Events the recorder dropped in the current session
+        uint64_t getLost(void) const {
+            return lost;
+        }
+
+        // A record was cut short or malformed: what follows it is ignored
+        bool isDamaged(void) const {
+            return damaged;
+        }
+
+    private:
+        const uint8_t *data;
+        size_t length;
+        size_t at = 0;
+        TraceSession session = {};
+        bool pending = false;  // A session record was read, not handed out yet
+        bool damaged = false;
+        clock_us_t previous = 0;
+        uint64_t lost = 0;
+};
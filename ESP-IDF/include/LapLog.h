@@ -0,0 +1,405 @@
+//
+// LapLog.h
+// Author: Francesco Mecatti
+// Persistent session and lap log in a data partition of the SPI flash (LAP_LOG_PARTITION, see README.md for the
+// partition table line; on the host the simulated one, kept in the SIM_FLASH file). The partition is a circular log of
+// sectors, each headed by its sequence number and the last session number opened: records are only ever appended, and when a sector is full the one after
+// it, the oldest, is erased and takes the next sequence number. Every sector is erased in turn, so wear is even and the
+// newest sessions push out the oldest. A record is a length byte, the payload of a telemetry frame (type, timestamp and
+// arguments as varints, see TelemetryCodec.h) and a CRC-16 of both; a session starts with TELEMETRY_HELLO, whose
+// argument is session number << 8 | LAP_LOG_VERSION. The session number in the headers keeps the numbering going once
+// the HELLO of the last session has been pushed out, by a session longer than the partition. Sectors of a version 1
+// log (an 8-byte header: sequence number, then "LLOG") are still read, their session taken from their HELLO records, and
+// are replaced as the log wraps around. Records are gathered in RAM and programmed a batch at a time:
+// when BATCH_SIZE bytes are waiting, FLUSH_MS after the first of them, and at once after a stop or a reset.
+// After a power loss mount() takes the sector with the highest sequence number and walks it to the first erased or
+// failing record: appending resumes there, or in a fresh sector if a write was cut short, so a torn record is never
+// followed by good ones. Everything whose write completed is read back; the torn record and the batch in RAM are lost.
+// LapLogStore is the format; LapLog runs it in a writer task at idle priority fed by a lock-free queue, so the input
+// task never waits for the flash (on the device a write stalls the code running from flash on both cores: one more
+// reason to batch). One producing task (the input task, through Time.h), so LapLog is static like Telemetry
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "ClockSource.h"
+#include "EventQueue.h"
+#include "Profiler.h"
+#include "TaskPlacement.h"
+#include "TelemetryCodec.h"
+
+#ifndef LAP_LOG_PARTITION
+#define LAP_LOG_PARTITION   "laplog"
+#endif
+
+#define LAP_LOG_VERSION     (2)
+
+typedef struct {
+    unsigned long records;  // Appended since mount
+    unsigned long long payloadBytes;  // Of those records: type, timestamp and arguments
+    unsigned long long recordBytes;  // With length byte and CRC
+    unsigned long flushes;  // Flash writes of batches
+    unsigned long sectors;  // Sectors erased and opened since mount
+    unsigned long recovered;  // Records found by mount
+    unsigned long torn;  // Sectors found ending in a record cut short or corrupted
+    unsigned long legacy;  // Sectors found with a version 1 header
+    unsigned long lost;  // Events dropped because the queue was full (LapLog only)
+} LapLogStats;
+
+class LapLogStore {
+    public:
+        static const size_t SECTOR_SIZE = SPI_FLASH_SEC_SIZE;  // Erase unit
+        static const size_t HEADER_SIZE = 12;  // Sequence number, session number, then MAGIC: a header cut short has no magic
+        static const size_t HEADER_V1_SIZE = 8;  // Sequence number, then MAGIC_V1
+        static const size_t MAX_RECORD = 1 + TelemetryCodec::MAX_PAYLOAD;  // Length byte, payload, CRC
+        static const size_t BATCH_SIZE = 256;  // Bytes; one flash page
+        static const uint32_t MAGIC = 0x32474f4c;  // "LOG2"
+        static const uint32_t MAGIC_V1 = 0x474f4c4c;  // "LLOG"
+
+        // Find the partition and the end of the log in it. batchSize: bytes gathered per write, 1 to write every
+        // record at once. False if there is no such partition or it has less than two sectors
+        bool mount(const char *label, size_t batchSize = BATCH_SIZE) {
+            partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+            if (partition == NULL || partition->size / SECTOR_SIZE < 2) {
+                partition = NULL;
+                return false;
+            }
+            sectors = partition->size / SECTOR_SIZE;
+            batchLimit = batchSize == 0 ? 1 : batchSize < BATCH_SIZE ? batchSize : BATCH_SIZE;
+            batched = 0;
+            stats = {};
+            bool found = false;
+            uint32_t s, n;
+            session = 0;
+            for (size_t i = 0; i < sectors; i++)
+                if (readHeader(i, s, n) != 0 && (!found || (int32_t) (s - sequence) > 0)) {
+                    head = i;
+                    sequence = s;
+                    session = n;
+                    found = true;
+                }
+            offset = SECTOR_SIZE;  // Closed: the first write opens the next sector
+            if (!found) {
+                head = sectors - 1;  // Blank partition: start from sector 0
+                sequence = 0;
+                return true;
+            }
+            for (size_t i = 1; i <= sectors; i++) {
+                size_t sector = (head + i) % sectors;
+                bool torn = false;
+                size_t header = readHeader(sector, s, n);
+                if (header == 0)
+                    continue;
+                stats.legacy += header == HEADER_V1_SIZE;
+                size_t end = scan(sector, header, [this](const TelemetryEvent &event) { noteSession(event); }, stats.recovered, torn);
+                stats.torn += torn;
+                if (sector == head && !torn)
+                    offset = end;
+            }
+            return true;
+        }
+
+        bool isMounted(void) const {
+            return partition != NULL;
+        }
+
+        // Highest session number in the log, from the sector headers and the TELEMETRY_HELLO records; 0 if none
+        uint32_t getSession(void) const {
+            return session;
+        }
+
+        // Add one record to the batch, writing the batch first if the record does not fit. False if a flash write failed
+        bool append(const TelemetryEvent &event) {
+            if (partition == NULL)
+                return false;
+            noteSession(event);  // Before a sector is opened for it: its header already counts this session
+            uint8_t record[MAX_RECORD];
+            size_t payload = TelemetryCodec::encodePayload(event, record + 1);
+            record[0] = (uint8_t) payload;
+            uint16_t crc = TelemetryCodec::crc16(record, 1 + payload);
+            record[1 + payload] = (uint8_t) (crc >> 8);
+            record[2 + payload] = (uint8_t) crc;
+            size_t length = payload + 3;
+            bool written = true;
+            if (batched > 0 && batched + length > batchLimit)
+                written &= flush();
+            if (offset + batched + length > SECTOR_SIZE) {  // Records never span two sectors
+                written &= flush();
+                written &= openSector();
+            }
+            memcpy(batch + batched, record, length);
+            batched += length;
+            stats.records++;
+            stats.payloadBytes += payload;
+            stats.recordBytes += length;
+            if (batched >= batchLimit)
+                written &= flush();
+            return written;
+        }
+
+        // Write the batch, if any
+        bool flush(void) {
+            if (batched == 0)
+                return true;
+            esp_err_t err = esp_partition_write(partition, head * SECTOR_SIZE + offset, batch, batched);
+            offset += batched;
+            batched = 0;
+            stats.flushes++;
+            return err == ESP_OK;
+        }
+
+        bool isPending(void) const {
+            return batched > 0;
+        }
+
+        // Call visit(const TelemetryEvent &) on every record written, oldest first. Returns their count
+        template <typename F>
+        size_t read(F visit) const {
+            unsigned long count = 0;
+            uint32_t s, n;
+            bool torn;
+            for (size_t i = 1; partition != NULL && i <= sectors; i++) {
+                size_t sector = (head + i) % sectors;
+                size_t header = readHeader(sector, s, n);
+                if (header != 0)
+                    scan(sector, header, visit, count, torn);
+            }
+            return count;
+        }
+
+        // Erase the whole partition
+        bool format(void) {
+            if (partition == NULL)
+                return false;
+            esp_err_t err = esp_partition_erase_range(partition, 0, sectors * SECTOR_SIZE);
+            head = sectors - 1;
+            sequence = 0;
+            session = 0;
+            offset = SECTOR_SIZE;
+            batched = 0;
+            return err == ESP_OK;
+        }
+
+        const LapLogStats &getStats(void) const {
+            return stats;
+        }
+
+    private:
+        const esp_partition_t *partition = NULL;
+        size_t sectors = 0;
+        size_t head = 0;  // Sector written
+        uint32_t sequence = 0;  // Of head
+        uint32_t session = 0;  // Highest seen, written into every sector header
+        size_t offset = SECTOR_SIZE;  // Next byte of head to write; SECTOR_SIZE when head takes no more records
+        uint8_t batch[BATCH_SIZE];
+        size_t batched = 0, batchLimit = BATCH_SIZE;
+        LapLogStats stats = {};
+
+        // Sequence and session number of sector. Returns the length of its header, 0 if it has none (erased, or cut
+        // short). A version 1 header holds no session number: n is 0, the HELLO records of the sector tell it
+        size_t readHeader(size_t sector, uint32_t &s, uint32_t &n) const {
+            uint8_t header[HEADER_SIZE];
+            if (esp_partition_read(partition, sector * SECTOR_SIZE, header, HEADER_SIZE) != ESP_OK)
+                return 0;
+            s = getU32(header);
+            n = 0;
+            if (getU32(header + 4) == MAGIC_V1)
+                return HEADER_V1_SIZE;
+            n = getU32(header + 4);
+            return getU32(header + 8) == MAGIC ? HEADER_SIZE : 0;
+        }
+
+        void noteSession(const TelemetryEvent &event) {
+            if (event.type == TELEMETRY_HELLO && (uint32_t) (event.args[0] >> 8) > session)
+                session = (uint32_t) (event.args[0] >> 8);
+        }
+
+        // Erase the sector after head and make it head
+        bool openSector(void) {
+            size_t next = (head + 1) % sectors;
+            uint8_t header[HEADER_SIZE];
+            putU32(sequence + 1, header);
+            putU32(session, header + 4);
+            putU32(MAGIC, header + 8);
+            bool written = esp_partition_erase_range(partition, next * SECTOR_SIZE, SECTOR_SIZE) == ESP_OK &&
+                           esp_partition_write(partition, next * SECTOR_SIZE, header, HEADER_SIZE) == ESP_OK;
+            head = next;
+            sequence++;
+            offset = HEADER_SIZE;
+            stats.sectors++;
+            return written;
+        }
+
+        // Visit the records of sector, after its header, up to the first erased or bad one, counting them. Returns where
+        // it stopped; torn if at a bad record
+        template <typename F>
+        size_t scan(size_t sector, size_t header, F visit, unsigned long &count, bool &torn) const {
+            uint8_t record[MAX_RECORD];
+            TelemetryEvent event;
+            size_t at = header;
+            torn = false;
+            while (at < SECTOR_SIZE) {
+                size_t n = SECTOR_SIZE - at < MAX_RECORD ? SECTOR_SIZE - at : MAX_RECORD;
+                if (esp_partition_read(partition, sector * SECTOR_SIZE + at, record, n) != ESP_OK || record[0] == 0xff)
+                    break;  // Erased: the end of the sector's records
+                size_t payload = record[0];
+                if (payload + 3 > n || TelemetryCodec::crc16(record, 1 + payload) != (uint16_t) (record[1 + payload] << 8 | record[2 + payload]) ||
+                    !TelemetryCodec::decodePayload(record + 1, payload, event)) {
+                    torn = true;
+                    break;
+                }
+                visit(event);
+                count++;
+                at += payload + 3;
+            }
+            return at;
+        }
+
+        static void putU32(uint32_t value, uint8_t *out) {
+            for (int i = 0; i < 4; i++)
+                out[i] = (uint8_t) (value >> 8 * i);
+        }
+
+        static uint32_t getU32(const uint8_t *in) {
+            return (uint32_t) in[0] | (uint32_t) in[1] << 8 | (uint32_t) in[2] << 16 | (uint32_t) in[3] << 24;
+        }
+};
+
+class LapLog {
+    public:
+        static const size_t QUEUE_SIZE = 64;  // Events; power of 2. Holds the laps of a sector erase (about 45 ms) at 1000 per second
+        static const size_t POP_SIZE = 8;  // Events taken from the queue at a time
+        static const uint32_t FLUSH_MS = 2000;  // Longest a record waits in RAM, unless a stop or reset writes it first
+        static const unsigned int STACK_SIZE = 2048;
+
+        // Mount the log, open a session numbered after the last one it holds and start the writer task. False if the
+        // partition is missing
+        static bool begin(const char *label = LAP_LOG_PARTITION, size_t batchSize = LapLogStore::BATCH_SIZE) {
+            if (xWriterTaskHandle != NULL)
+                return true;
+            if (!store.mount(label, batchSize))
+                return false;
+            session = store.getSession() + 1;  // Never back: the headers keep it when the HELLO records are gone
+            store.append({TELEMETRY_HELLO, espTimerClock(), {session << 8 | LAP_LOG_VERSION}});
+            deadline = espTimerClock() + FLUSH_MS * 1000;
+            reportedLost = lostAtBegin = queue.getOverflows();
+            xPending = xSemaphoreCreateBinary();
+            xWriteMutex = xSemaphoreCreateMutex();
+            TaskPlacement::create(RENDER_TASK, &writerTask, "lapLogTask", STACK_SIZE, NULL, 0, &xWriterTaskHandle);
+            return true;
+        }
+
+        // Write everything queued, then delete the writer task
+        static void end(void) {
+            if (xWriterTaskHandle == NULL)
+                return;
+            xSemaphoreTake(xWriteMutex, portMAX_DELAY);
+            vTaskDelete(xWriterTaskHandle);
+            xWriterTaskHandle = NULL;
+            drain();
+            store.flush();
+            xSemaphoreGive(xWriteMutex);
+            vSemaphoreDelete(xPending);
+            vSemaphoreDelete(xWriteMutex);
+            xPending = xWriteMutex = NULL;
+        }
+
+        static bool isEnabled(void) {
+            return xWriterTaskHandle != NULL;
+        }
+
+        // Queue one event; never blocks. False if the log is off or the queue is full
+        static bool append(TelemetryType type, clock_us_t timestamp, uint64_t arg0 = 0, uint64_t arg1 = 0) {
+            if (xWriterTaskHandle == NULL)
+                return false;
+            if (!queue.push({type, timestamp, {arg0, arg1, 0}}))
+                return false;
+            xSemaphoreGive(xPending);
+            return true;
+        }
+
+        // Call visit(const TelemetryEvent &) on every record written, oldest first. Returns their count
+        template <typename F>
+        static size_t read(F visit) {
+            if (xWriteMutex != NULL)
+                xSemaphoreTake(xWriteMutex, portMAX_DELAY);
+            size_t count = store.read(visit);
+            if (xWriteMutex != NULL)
+                xSemaphoreGive(xWriteMutex);
+            return count;
+        }
+
+        // Number of the session begin() opened
+        static uint64_t getSession(void) {
+            return session;
+        }
+
+        static LapLogStats getStats(void) {
+            LapLogStats stats = store.getStats();
+            stats.lost = queue.getOverflows() - lostAtBegin;
+            return stats;
+        }
+
+    private:
+        static inline LapLogStore store;
+        static inline EventQueue<TelemetryEvent, QUEUE_SIZE> queue;
+        static inline TaskHandle_t xWriterTaskHandle = NULL;
+        static inline SemaphoreHandle_t xPending = NULL;  // Given after every event queued; events coalesce
+        static inline SemaphoreHandle_t xWriteMutex = NULL;  // Guards the store, for writerTask and read(): a program or erase in progress finishes before end() stops the writer
+        static inline uint64_t session = 0;
+        static inline clock_us_t deadline = 0;  // When the batch must be written at the latest
+        static inline bool urgent = false;  // A stop or reset is in the batch
+        static inline unsigned long reportedLost = 0, lostAtBegin = 0;  // Queue overflows at the last TELEMETRY_DROPPED record, at begin()
+
+        // Queued events into the batch, which the store writes whenever it fills up
+        static void drain(void) {
+            TelemetryEvent events[POP_SIZE];
+            size_t n;
+            while ((n = queue.pop(events, POP_SIZE)) > 0) {
+                unsigned long overflows = queue.getOverflows();
+                if (overflows != reportedLost) {  // Before the events queued after the loss
+                    add({TELEMETRY_DROPPED, espTimerClock(), {overflows - lostAtBegin}});
+                    reportedLost = overflows;
+                }
+                for (size_t i = 0; i < n; i++) {
+                    add(events[i]);
+                    urgent |= events[i].type == TELEMETRY_STOP || events[i].type == TELEMETRY_RESET;
+                }
+            }
+        }
+
+        static void add(const TelemetryEvent &event) {
+            unsigned long flushes = store.getStats().flushes;
+            bool pending = store.isPending();
+            store.append(event);
+            if (store.getStats().flushes != flushes)
+                urgent = false;  // What was urgent went with the batch
+            if (store.isPending() && (!pending || store.getStats().flushes != flushes))
+                deadline = event.timestamp + FLUSH_MS * 1000;  // First record of a new batch
+        }
+
+        static void writerTask(void *pvParameter) {
+            while (true) {
+                TickType_t wait = portMAX_DELAY;
+                if (store.isPending()) {
+                    clock_us_t left = deadline - espTimerClock();
+                    wait = left > 0 ? pdMS_TO_TICKS(left / 1000) + 1 : 0;
+                }
+                xSemaphoreTake(xPending, wait);
+                Profiler::wake();
+                xSemaphoreTake(xWriteMutex, portMAX_DELAY);
+                drain();
+                if (store.isPending() && (urgent || espTimerClock() >= deadline)) {
+                    store.flush();
+                    urgent = false;
+                }
+                xSemaphoreGive(xWriteMutex);
+            }
+        }
+};
@@ -0,0 +1,124 @@
+//
+// LapStore.h
+// Author: Francesco Mecatti
+// Lap history kept in a fixed-capacity ring, allocated once (static storage or inside its owner): no heap use at all.
+// When full, the oldest lap is overwritten; lap numbers keep counting
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ClockSource.h"
+
+typedef struct {
+    uint32_t number;  // 1 for the first lap since the last clear
+    clock_us_t timestamp;  // Clock value when the lap was taken
+    clock_us_t split;  // Elapsed stopwatch time at the lap
+    clock_us_t delta;  // Lap duration: split minus the previous split
+} Lap;
+
+template <size_t CAPACITY>
+class LapStore {
+    static_assert(CAPACITY > 0, "LapStore capacity must be positive");
+
+    public:
+        void add(clock_us_t timestamp, clock_us_t split) {
+            Lap &lap = laps[(first + stored) % CAPACITY];
+            if (stored == CAPACITY) {  // Overwrite the oldest lap
+                deltaSum -= laps[first].delta;
+                first = (first + 1) % CAPACITY;
+            }
+            else {
+                stored++;
+            }
+            lap.number = ++taken;
+            lap.timestamp = timestamp;
+            lap.split = split;
+            lap.delta = split - lastSplit;
+            lastSplit = split;
+            deltaSum += lap.delta;
+        }
+
+        void clear(void) {
+            first = stored = 0;
+            taken = 0;
+            lastSplit = 0;
+            deltaSum = 0;
+        }
+
+        // Laps currently held, at most CAPACITY
+        size_t size(void) const {
+            return stored;
+        }
+
+        // Laps taken since the last clear, including the overwritten ones
+        uint32_t count(void) const {
+            return taken;
+        }
+
+        bool isEmpty(void) const {
+            return stored == 0;
+        }
+
+        // i = 0 is the oldest lap held
+        const Lap &operator[](size_t i) const {
+            return laps[(first + i) % CAPACITY];
+        }
+
+        const Lap &last(void) const {
+            return (*this)[stored - 1];
+        }
+
+        // Shortest lap held; NULL if empty
+        const Lap *best(void) const {
+            const Lap *best = NULL;
+            for (size_t i = 0; i < stored; i++)
+                if (best == NULL || (*this)[i].delta < best->delta)
+                    best = &(*this)[i];
+            return best;
+        }
+
+        // Longest lap held; NULL if empty
+        const Lap *worst(void) const {
+            const Lap *worst = NULL;
+            for (size_t i = 0; i < stored; i++)
+                if (worst == NULL || (*this)[i].delta > worst->delta)
+                    worst = &(*this)[i];
+            return worst;
+        }
+
+        // Average duration of the laps held, us
+        clock_us_t average(void) const {
+            return stored != 0 ? deltaSum / (clock_us_t) stored : 0;
+        }
+
+        class Iterator {
+            public:
+                Iterator(const LapStore *store, size_t i) : store(store), i(i) {}
+                const Lap &operator*(void) const { return (*store)[i]; }
+                const Lap *operator->(void) const { return &(*store)[i]; }
+                Iterator &operator++(void) { i++; return *this; }
+                bool operator!=(const Iterator &other) const { return i != other.i; }
+            private:
+                const LapStore *store;
+                size_t i;
+        };
+
+        // Oldest to newest
+        Iterator begin(void) const {
+            return Iterator(this, 0);
+        }
+
+        Iterator end(void) const {
+            return Iterator(this, stored);
+        }
+
+    private:
+        Lap laps[CAPACITY];
+        size_t first = 0;  // Index of the oldest lap
+        size_t stored = 0;
+        uint32_t taken = 0;
+        clock_us_t lastSplit = 0;
+        clock_us_t deltaSum = 0;  // Sum of the deltas held, for average()
+};
@@ -0,0 +1,50 @@
+//
+// LightSleep.h
+// Author: Francesco Mecatti
+// Automatic light sleep for the stopwatch examples. With power management on, FreeRTOS stops its tick while every task
+// is blocked (tickless idle) and the chip sleeps until the next timeout or a wakeup source; esp_timer is corrected on
+// wakeup, so timestamps stay exact. Sleep is held off by a lock while the inputs are polled or the counter runs:
+// GPIO edges are lost in light sleep. Needs CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE (see README.md)
+//
+
+#pragma once
+
+#include "esp_pm.h"
+#include "esp_sleep.h"
+
+class LightSleep {
+    public:
+        static const int MAX_FREQ_MHZ = 240;
+        static const int MIN_FREQ_MHZ = 80;  // Between wakeups the CPU clock is lowered down to this
+
+        // Turn automatic light sleep on, held off until allow(). Returns false if the firmware has no power management
+        static bool begin(void) {
+            if (lock != NULL)
+                return true;
+            esp_pm_config_esp32_t config = {MAX_FREQ_MHZ, MIN_FREQ_MHZ, true};
+            if (esp_pm_configure(&config) != ESP_OK)
+                return false;
+            esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "inputs", &lock);
+            esp_pm_lock_acquire(lock);
+            return true;
+        }
+
+        // Only the armed wakeup sources can end the next idle stretch: call it after arming them
+        static void allow(void) {
+            if (lock != NULL && held) {
+                esp_pm_lock_release(lock);
+                held = false;
+            }
+        }
+
+        static void forbid(void) {
+            if (lock != NULL && !held) {
+                esp_pm_lock_acquire(lock);
+                held = true;
+            }
+        }
+
+    private:
+        static inline esp_pm_lock_handle_t lock = NULL;
+        static inline bool held = true;
+};
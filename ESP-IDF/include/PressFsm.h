@@ -0,0 +1,117 @@
+//
+// PressFsm.h
+// Author: Francesco Mecatti
+// Press classification shared by the stopwatch examples: a table-driven state machine turning timestamped press and
+// release edges into gestures (down, up, short, double, long press, hold repeat). The transition table is constexpr and
+// the gesture callbacks are methods of a Handler type resolved at compile time; every edge or timeout costs one table
+// lookup, with no allocation. Time based transitions are taken at their deadline, whatever the caller's timing
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "ClockSource.h"
+
+typedef struct {
+    clock_us_t longUs;  // Held this long: long press
+    clock_us_t doubleUs;  // Second press starting within this time from a short release: double press. 0: no double press
+    clock_us_t repeatUs;  // Period of the hold repeats after a long press, while still held. 0: no repeat
+} PressTiming;
+
+// Default gesture handler: derive from it and hide the methods you need (no virtual calls involved)
+struct PressHandler {
+    void onDown(clock_us_t timestamp) {}  // Every press edge, immediately
+    void onUp(clock_us_t timestamp) {}  // Every release edge
+    void onShort(clock_us_t timestamp) {}  // Press released before longUs and not followed by a second one; at the end of the double window
+    void onDouble(clock_us_t timestamp) {}  // At the second press edge
+    void onLong(clock_us_t timestamp) {}  // At press + longUs, while still held
+    void onRepeat(clock_us_t timestamp) {}  // Every repeatUs after the long press, while still held
+};
+
+template <typename Handler>
+class PressFsm {
+    public:
+        typedef enum {IDLE, PRESSED, WAIT_SECOND, SECOND_PRESSED, HELD, STATE_COUNT} State;
+        typedef enum {PRESS_EDGE, RELEASE_EDGE, TIMEOUT, INPUT_COUNT} Input;
+        static constexpr clock_us_t NO_DEADLINE = INT64_MAX;
+
+        PressFsm(Handler &handler, const PressTiming &timing) : handler(handler), timing(timing) {}
+
+        // One edge of the (fused) input, with the time it happened. Deadlines that expired before it are taken first
+        void handle(bool pressed, clock_us_t timestamp) {
+            expire(timestamp);
+            step(pressed ? PRESS_EDGE : RELEASE_EDGE, timestamp);
+            expire(timestamp);  // Zero length windows (doubleUs = 0) close at once
+        }
+
+        // No edge: take the deadline if it has passed. Call it at least at every deadline()
+        void tick(clock_us_t now) {
+            expire(now);
+        }
+
+        // Next time based transition, NO_DEADLINE if none is pending
+        clock_us_t deadline(void) const {
+            return nextDeadline;
+        }
+
+        State getState(void) const {
+            return state;
+        }
+
+    private:
+        typedef enum {NONE = 0, DOWN = 1, UP = 2, SHORT = 4, DOUBLE = 8, LONG = 16, REPEAT = 32} Gesture;
+        typedef enum {KEEP, CLEAR, ARM_LONG, ARM_DOUBLE, ARM_REPEAT} TimerAction;
+
+        typedef struct {
+            State next;
+            uint8_t gestures;  // Gesture bits, reported in declaration order
+            TimerAction timer;
+        } Transition;
+
+        // TABLE[state][input]. A press while pressed, or a release while released, changes nothing
+        static constexpr Transition TABLE[STATE_COUNT][INPUT_COUNT] = {
+            /* IDLE */              {{PRESSED, DOWN, ARM_LONG},             {IDLE, NONE, KEEP},             {IDLE, NONE, CLEAR}},
+            /* PRESSED */           {{PRESSED, NONE, KEEP},                 {WAIT_SECOND, UP, ARM_DOUBLE},  {HELD, LONG, ARM_REPEAT}},
+            /* WAIT_SECOND */       {{SECOND_PRESSED, DOWN | DOUBLE, ARM_LONG}, {WAIT_SECOND, NONE, KEEP},  {IDLE, SHORT, CLEAR}},
+            /* SECOND_PRESSED */    {{SECOND_PRESSED, NONE, KEEP},          {IDLE, UP, CLEAR},              {HELD, LONG, ARM_REPEAT}},
+            /* HELD */              {{HELD, NONE, KEEP},                    {IDLE, UP, CLEAR},              {HELD, REPEAT, ARM_REPEAT}},
+        };
+
+        Handler &handler;
+        PressTiming timing;
+        State state = IDLE;
+        clock_us_t nextDeadline = NO_DEADLINE;
+
+        // At most two timeouts in a row (long press, then one repeat), so this is constant time too
+        void expire(clock_us_t now) {
+            while (nextDeadline <= now)
+                step(TIMEOUT, nextDeadline, now);
+        }
+
+        void step(Input input, clock_us_t timestamp, clock_us_t now = 0) {
+            const Transition &transition = TABLE[state][input];
+            state = transition.next;
+            switch (transition.timer) {
+                case KEEP:          break;
+                case CLEAR:         nextDeadline = NO_DEADLINE; break;
+                case ARM_LONG:      nextDeadline = timestamp + timing.longUs; break;
+                case ARM_DOUBLE:    nextDeadline = timestamp + timing.doubleUs; break;
+                case ARM_REPEAT:
+                    if (timing.repeatUs <= 0) {
+                        nextDeadline = NO_DEADLINE;
+                        break;
+                    }
+                    nextDeadline = timestamp + timing.repeatUs;  // From the deadline just taken, so repeats do not drift
+                    if (transition.gestures == REPEAT && nextDeadline <= now)
+                        nextDeadline += ((now - nextDeadline) / timing.repeatUs + 1) * timing.repeatUs;  // Repeats missed by a late tick are skipped
+                break;
+            }
+            uint8_t gestures = transition.gestures;
+            if (gestures & DOWN)    handler.onDown(timestamp);
+            if (gestures & UP)      handler.onUp(timestamp);
+            if (gestures & SHORT)   handler.onShort(timestamp);
+            if (gestures & DOUBLE)  handler.onDouble(timestamp);
+            if (gestures & LONG)    handler.onLong(timestamp);
+            if (gestures & REPEAT)  handler.onRepeat(timestamp);
+        }
+};
@@ -0,0 +1,239 @@
+//
+// Profiler.h
+// Author: Francesco Mecatti
+// Per-task runtime profile: CPU time and stack high-water mark of every task, read from FreeRTOS when a dump is asked
+// for, wakeups counted by the tasks themselves (FreeRTOS keeps no per-task switch count: each instrumented task calls
+// wake() after the call it blocks in), and ISR-to-task latency histograms per input source (signal() in the ISR,
+// received() in the task). Between dumps the cost is a few loads and stores per wakeup; the FreeRTOS walk only happens
+// in sample(). A dump goes to the console as text (print) or to the telemetry stream as frames (emit). print formats
+// integers only, so that it fits the stack of displayTask, which calls it.
+// Built with -DPROFILING=1 (see README.md); otherwise Profiler is an empty class and every call compiles to nothing.
+// On the device, CPU time needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+//
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "ClockSource.h"
+#include "EventQueue.h"
+#include "TelemetryCodec.h"
+
+#ifndef PROFILING
+#define PROFILING   (0)
+#endif
+
+typedef struct {
+    char name[16];
+    UBaseType_t priority;
+    uint32_t cpuUs;  // Run time in the interval
+    uint32_t wakeups;  // In the interval; 0 for a task that does not call wake()
+    uint32_t stackFree;  // Least free stack ever, bytes
+} TaskProfile;
+
+template <bool ENABLED>
+class TaskProfiler {
+    public:
+        static const size_t MAX_TASKS = 32;  // Of the whole system: ESP-IDF runs about ten tasks of its own
+        static const size_t CHANNELS = ANY_INPUT + 1;  // One per InputSource
+        static const size_t LATENCY_BUCKETS = 24;  // Bucket b: latency < 2^(b+1) us; the last one takes the rest
+
+        // The calling task woke up: call it right after the call it blocks in
+        static void wake(void) {
+            Slot *slot = find(xTaskGetCurrentTaskHandle());
+            if (slot != NULL)
+                slot->wakeups++;  // Written by its own task only
+        }
+
+        // ISR safe: source is about to wake its task (e.g. before xSemaphoreGiveFromISR). Until the task takes it, later
+        // signals of the same source are not timed again
+        static void signal(InputSource source) {
+            uint32_t idle = 0;
+            pending[source].compare_exchange_strong(idle, stamp(), std::memory_order_release);
+        }
+
+        // In the woken task: close the pending signals, adding their latency to the histograms
+        static void received(void) {
+            uint32_t now = stamp();
+            for (size_t i = 0; i < CHANNELS; i++) {
+                uint32_t at = pending[i].exchange(0, std::memory_order_acquire);
+                if (at != 0)
+                    latency[i][bucket(now - at)]++;  // 32-bit stamps: right across their wrap
+            }
+        }
+
+        // Read every task from FreeRTOS and close the interval opened by the previous sample. Returns the number of
+        // tasks, see getTask()
+        static size_t sample(void) {
+            uint32_t total = 0;
+            UBaseType_t n = uxTaskGetSystemState(statuses, MAX_TASKS, &total);
+            tasks = 0;
+            if (n == 0) {  // More than MAX_TASKS tasks: FreeRTOS fills in none, and the interval stays open
+                leftOut = uxTaskGetNumberOfTasks();
+                return 0;
+            }
+            interval = total - lastTotal;
+            lastTotal = total;
+            leftOut = 0;
+            for (UBaseType_t i = 0; i < n; i++) {
+                Slot *slot = find(statuses[i].xHandle);
+                if (slot == NULL) {
+                    leftOut++;
+                    continue;
+                }
+                TaskProfile &task = profiles[tasks++];
+                strncpy(task.name, statuses[i].pcTaskName, sizeof(task.name) - 1);
+                task.name[sizeof(task.name) - 1] = '\0';
+                task.priority = statuses[i].uxCurrentPriority;
+                task.cpuUs = statuses[i].ulRunTimeCounter - slot->lastRunTime;
+                uint32_t wakeups = slot->wakeups;
+                task.wakeups = wakeups - slot->lastWakeups;
+                task.stackFree = (uint32_t) statuses[i].usStackHighWaterMark;
+                slot->lastRunTime = statuses[i].ulRunTimeCounter;
+                slot->lastWakeups = wakeups;
+            }
+            return tasks;
+        }
+
+        static const TaskProfile &getTask(size_t i) {
+            return profiles[i];
+        }
+
+        // Length of the last sampled interval, in run time counter units (us)
+        static uint32_t getInterval(void) {
+            return interval;
+        }
+
+        // Tasks the last sample could not profile for want of room (MAX_TASKS); every task when there were too many to
+        // sample at all
+        static size_t getLeftOut(void) {
+            return leftOut;
+        }
+
+        static uint32_t getLatencyCount(InputSource source, size_t bucket) {
+            return latency[source][bucket];
+        }
+
+        // Sample, then one text row per task and one per latency histogram through Out::printf (e.g. Console)
+        template <typename Out>
+        static void print(void) {
+            size_t n = sample();
+            Out::printf("%-16s %4s %8s %8s %10s\n", "task", "prio", "cpu [%]", "wakeups", "stack free");
+            for (size_t i = 0; i < n; i++) {
+                const TaskProfile &task = profiles[i];
+                uint32_t cpu = interval > 0 ? (uint32_t) ((uint64_t) task.cpuUs * 10000 / interval) : 0;  // 0.01 %
+                Out::printf("%-16s %4u %5u.%02u %8u %10u\n", task.name, (unsigned int) task.priority,
+                            (unsigned int) (cpu / 100), (unsigned int) (cpu % 100), (unsigned int) task.wakeups,
+                            (unsigned int) task.stackFree);
+            }
+            if (leftOut > 0)
+                Out::printf("%u tasks left out, the profiler has room for %u\n", (unsigned int) leftOut,
+                            (unsigned int) MAX_TASKS);
+            static const char *const SOURCES[CHANNELS] = {"button", "touch", "hall", "any"};
+            for (size_t i = 0; i < CHANNELS; i++) {
+                char line[128];
+                int length = snprintf(line, sizeof(line), "%s latency [us]:", SOURCES[i]);
+                bool any = false;
+                for (size_t b = 0; b < LATENCY_BUCKETS && length < (int) sizeof(line); b++) {
+                    if (latency[i][b] == 0)
+                        continue;
+                    length += snprintf(line + length, sizeof(line) - length, " <%lu %u", 2ul << b, (unsigned int) latency[i][b]);
+                    any = true;
+                }
+                if (any)
+                    Out::printf("%s\n", line);
+            }
+        }
+
+        // Sample, then a TELEMETRY_PROFILE frame, one TELEMETRY_TASK per task and one TELEMETRY_LATENCY per non-empty
+        // bucket through Out::emit (e.g. Telemetry)
+        template <typename Out>
+        static void emit(void) {
+            size_t n = sample();
+            clock_us_t now = espTimerClock();
+            Out::emit(TELEMETRY_PROFILE, now, interval, n);
+            for (size_t i = 0; i < n; i++) {
+                const TaskProfile &task = profiles[i];
+                uint64_t name = 0;
+                for (size_t c = 0; c < 8 && task.name[c] != '\0'; c++)
+                    name |= (uint64_t) (uint8_t) task.name[c] << (8 * c);
+                Out::emit(TELEMETRY_TASK, now, name, task.cpuUs, (uint64_t) task.wakeups << 32 | task.stackFree);
+            }
+            for (size_t i = 0; i < CHANNELS; i++)
+                for (size_t b = 0; b < LATENCY_BUCKETS; b++)
+                    if (latency[i][b] != 0)
+                        Out::emit(TELEMETRY_LATENCY, now, i, b, latency[i][b]);
+        }
+
+    private:
+        typedef struct {
+            std::atomic<TaskHandle_t> handle;
+            volatile uint32_t wakeups;
+            uint32_t lastWakeups, lastRunTime;  // At the previous sample
+        } Slot;
+
+        static inline Slot slots[MAX_TASKS] = {};
+        static inline std::atomic<uint32_t> pending[CHANNELS] = {};  // Stamp of the first signal not taken yet, 0 if none
+        static inline uint32_t latency[CHANNELS][LATENCY_BUCKETS] = {};
+        static inline TaskStatus_t statuses[MAX_TASKS];
+        static inline TaskProfile profiles[MAX_TASKS];
+        static inline size_t tasks = 0, leftOut = 0;
+        static inline uint32_t interval = 0, lastTotal = 0;
+
+        // Low 32 bits of the esp_timer clock, never 0 (0 means no signal): off by 1 us once every 71 minutes at most
+        static uint32_t stamp(void) {
+            uint32_t now = (uint32_t) esp_timer_get_time();
+            return now != 0 ? now : 1;
+        }
+
+        static size_t bucket(uint32_t us) {
+            size_t b = 0;
+            while (us >= 2 && b < LATENCY_BUCKETS - 1) {
+                us >>= 1;
+                b++;
+            }
+            return b;
+        }
+
+        // The slot of task, taken on its first use; NULL once MAX_TASKS tasks have one
+        static Slot *find(TaskHandle_t task) {
+            for (size_t i = 0; i < MAX_TASKS; i++) {
+                TaskHandle_t owner = slots[i].handle.load(std::memory_order_acquire);
+                if (owner == task)
+                    return &slots[i];
+                if (owner == NULL) {
+                    if (slots[i].handle.compare_exchange_strong(owner, task, std::memory_order_acq_rel) || owner == task)
+                        return &slots[i];
+                }
+            }
+            return NULL;
+        }
+};
+
+// Built without profiling: nothing is stored and every call is empty
+template <>
+class TaskProfiler<false> {
+    public:
+        static void wake(void) {}
+
+        static void signal(InputSource) {}
+
+        static void received(void) {}
+
+        static size_t sample(void) {
+            return 0;
+        }
+
+        template <typename Out>
+        static void print(void) {}
+
+        template <typename Out>
+        static void emit(void) {}
+};
+
+typedef TaskProfiler<PROFILING> Profiler;
@@ -0,0 +1,70 @@
+//
+// PwmOutput.h
+// Author: Francesco Mecatti
+// PWM output driven by the LEDC peripheral: the waveform and the fades are generated in hardware, so a steady duty
+// costs no CPU time at all. The host build runs on the LEDC driver of the simulator, which records the duty timeline
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "driver/ledc.h"
+
+class PwmOutput {
+    public:
+        static const uint32_t DEFAULT_FREQUENCY_HZ = 5000;  // Well above flicker fusion
+        static const ledc_timer_bit_t DEFAULT_RESOLUTION = LEDC_TIMER_13_BIT;  // Max for 5 kHz from the 80 MHz APB clock
+
+        PwmOutput(gpio_num_t pin, ledc_channel_t channel = LEDC_CHANNEL_0, ledc_timer_t timer = LEDC_TIMER_0,
+                  uint32_t frequency = DEFAULT_FREQUENCY_HZ, ledc_timer_bit_t resolution = DEFAULT_RESOLUTION) {
+            this->channel = channel;
+            this->resolution = resolution;
+            ledc_timer_config_t timerConfig = {};
+            timerConfig.speed_mode = SPEED_MODE;
+            timerConfig.duty_resolution = resolution;
+            timerConfig.timer_num = timer;
+            timerConfig.freq_hz = frequency;
+            timerConfig.clk_cfg = LEDC_AUTO_CLK;
+            ledc_timer_config(&timerConfig);
+
+            ledc_channel_config_t channelConfig = {};
+            channelConfig.gpio_num = pin;
+            channelConfig.speed_mode = SPEED_MODE;
+            channelConfig.channel = channel;
+            channelConfig.intr_type = LEDC_INTR_DISABLE;
+            channelConfig.timer_sel = timer;
+            channelConfig.duty = 0;
+            channelConfig.hpoint = 0;
+            ledc_channel_config(&channelConfig);
+            ledc_fade_func_install(0);  // Fails harmlessly if another output installed it already
+        }
+
+        // Duty for a 100% output: on the ESP32 the LEDC duty goes up to 2^resolution included
+        uint32_t getMaxDuty(void) const {
+            return (uint32_t) 1 << resolution;
+        }
+
+        unsigned int getResolutionBits(void) const {
+            return (unsigned int) resolution;
+        }
+
+        uint32_t getDuty(void) const {
+            return ledc_get_duty(SPEED_MODE, channel);
+        }
+
+        void setDuty(uint32_t duty) {
+            ledc_set_duty(SPEED_MODE, channel, duty);
+            ledc_update_duty(SPEED_MODE, channel);
+        }
+
+        // Linear hardware fade from the current duty. With wait the calling task sleeps until the end of the fade
+        void fadeTo(uint32_t duty, uint32_t ms, bool wait = true) {
+            ledc_set_fade_with_time(SPEED_MODE, channel, duty, (int) ms);
+            ledc_fade_start(SPEED_MODE, channel, wait ? LEDC_FADE_WAIT_DONE : LEDC_FADE_NO_WAIT);
+        }
+
+    private:
+        static const ledc_mode_t SPEED_MODE = LEDC_HIGH_SPEED_MODE;
+        ledc_channel_t channel;
+        ledc_timer_bit_t resolution;
+};
@@ -0,0 +1,206 @@
+//
+// Renderer.h
+// Author: Francesco Mecatti
+// Dirty-region ANSI/VT100 terminal renderer.
+// Text is drawn into a small screen model; flush() compares it with what the terminal already shows and sends only
+// the changed cells, each run of them preceded by one absolute cursor positioning escape, in a single buffered write.
+// The terminal is assumed to be written by this renderer only
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "TimeFormat.h"
+
+typedef enum {PLAIN, HIGHLIGHT} CellStyle;  // HIGHLIGHT: blue background
+
+template <unsigned int ROWS, unsigned int COLS>
+class Renderer {
+    public:
+        static const unsigned int OUT_BUFFER_SIZE = 256;  // A frame larger than this takes more than one write
+        static const unsigned int MAX_GAP = 4;  // Unchanged cells between two changes: resending them is cheaper than a new cursor escape
+        static const size_t MAX_RUN = 2 + 10 + 1 + 10 + 1 + COLS * (6 + 1);  // Cursor escape, then each cell with an attribute change
+
+        Renderer(FILE *out = stdout) : out(out) {
+            memset(text, ' ', sizeof(text));
+            memset(style, PLAIN, sizeof(style));
+            memset(shownText, ' ', sizeof(shownText));
+            memset(shownStyle, PLAIN, sizeof(shownStyle));
+        }
+
+        // Erase display, hide cursor; the screen model starts blank as the terminal
+        void begin(void) {
+            append("\e[0m\e[2J\e[H\e[?25l");
+            memset(shownText, ' ', sizeof(shownText));
+            memset(shownStyle, PLAIN, sizeof(shownStyle));
+            currentStyle = PLAIN;
+        }
+
+        // Leave the terminal as found: attributes off, cursor shown
+        void end(void) {
+            append("\e[0m\e[?25h");
+            currentStyle = PLAIN;
+            flush();
+        }
+
+        // Draw text at (row, col), 0 based; clipped at the right border
+        void put(unsigned int row, unsigned int col, const char *s, CellStyle cellStyle = PLAIN) {
+            if (row >= ROWS)
+                return;
+            for (; *s != '\0' && col < COLS; s++, col++) {
+                text[row][col] = *s;
+                style[row][col] = cellStyle;
+            }
+            rowDirty[row] = true;
+        }
+
+        void clearRow(unsigned int row, unsigned int fromCol = 0) {
+            if (row >= ROWS)
+                return;
+            for (unsigned int col = fromCol; col < COLS; col++) {
+                text[row][col] = ' ';
+                style[row][col] = PLAIN;
+            }
+            rowDirty[row] = true;
+        }
+
+        // Send the changes since the last flush, up to maxBytes: the runs that do not fit stay pending and go with a
+        // later flush, merged with the changes made in between. Returns the number of bytes written
+        size_t flush(size_t maxBytes = SIZE_MAX) {
+            bool cut = false;
+            for (unsigned int row = 0; row < ROWS && !cut; row++) {
+                if (!rowDirty[row])
+                    continue;
+                rowDirty[row] = false;
+                unsigned int col = 0;
+                while (col < COLS) {
+                    if (!isDirty(row, col)) {
+                        col++;
+                        continue;
+                    }
+                    // Run of changed cells, possibly bridging short unchanged gaps
+                    unsigned int end = col + 1, lastDirty = col;
+                    while (end < COLS && end - lastDirty <= MAX_GAP) {
+                        if (isDirty(row, end))
+                            lastDirty = end;
+                        end++;
+                    }
+                    // Cursor escape, attribute changes and cells, built once: sent whole, or left for a later flush
+                    char run[MAX_RUN];
+                    size_t n = cursorTo(row, col, run);
+                    CellStyle runStyle = currentStyle;
+                    for (unsigned int c = col; c <= lastDirty; c++) {
+                        if (style[row][c] != runStyle) {
+                            runStyle = (CellStyle) style[row][c];
+                            n += copy(runStyle == HIGHLIGHT ? "\e[104m" : "\e[0m", run + n);
+                        }
+                        run[n++] = text[row][c];
+                    }
+                    if (maxBytes != SIZE_MAX && frameBytes + outLength + n > maxBytes) {
+                        rowDirty[row] = true;
+                        cut = true;
+                        deferred++;
+                        break;
+                    }
+                    append(run, n);
+                    currentStyle = runStyle;
+                    memcpy(&shownText[row][col], &text[row][col], lastDirty + 1 - col);
+                    memcpy(&shownStyle[row][col], &style[row][col], lastDirty + 1 - col);
+                    col = lastDirty + 1;
+                }
+            }
+            size_t written = frameBytes + outLength;
+            writeOut();
+            fflush(out);
+            frameBytes = 0;
+            frames++;
+            totalBytes += written;
+            return written;
+        }
+
+        void setOutput(FILE *out) {
+            this->out = out;
+        }
+
+        // Next flush redraws every cell
+        void invalidate(void) {
+            memset(shownText, 0, sizeof(shownText));
+            memset(rowDirty, true, sizeof(rowDirty));
+        }
+
+        unsigned long getFrames(void) const {
+            return frames;
+        }
+
+        unsigned long getBytes(void) const {
+            return totalBytes;
+        }
+
+        // Flushes cut short by their byte budget
+        unsigned long getDeferred(void) const {
+            return deferred;
+        }
+
+        // Screen model, as the terminal will show it once every change is flushed
+        char getText(unsigned int row, unsigned int col) const {
+            return text[row][col];
+        }
+
+        CellStyle getStyle(unsigned int row, unsigned int col) const {
+            return (CellStyle) style[row][col];
+        }
+
+    private:
+        FILE *out;
+        char text[ROWS][COLS], shownText[ROWS][COLS];
+        uint8_t style[ROWS][COLS], shownStyle[ROWS][COLS];
+        bool rowDirty[ROWS] = {};  // Rows drawn since the last flush: the others are not compared at all
+        CellStyle currentStyle = PLAIN;  // Graphics attribute of the terminal, kept across frames
+        char outBuffer[OUT_BUFFER_SIZE];
+        size_t outLength = 0, frameBytes = 0;
+        unsigned long frames = 0, totalBytes = 0, deferred = 0;
+
+        bool isDirty(unsigned int row, unsigned int col) const {
+            return text[row][col] != shownText[row][col] || style[row][col] != shownStyle[row][col];
+        }
+
+        // "\e[row;colH", 1 based, into out. Returns its length
+        static size_t cursorTo(unsigned int row, unsigned int col, char *out) {
+            size_t n = copy("\e[", out);
+            n += TimeFormat::formatUnsigned(row + 1, out + n);
+            out[n++] = ';';
+            n += TimeFormat::formatUnsigned(col + 1, out + n);
+            out[n++] = 'H';
+            return n;
+        }
+
+        static size_t copy(const char *s, char *out) {  // Without the '\0'
+            size_t n = strlen(s);
+            memcpy(out, s, n);
+            return n;
+        }
+
+        void append(const char *s) {
+            append(s, strlen(s));
+        }
+
+        void append(const char *s, size_t n) {
+            while (n > 0) {
+                if (outLength == OUT_BUFFER_SIZE)
+                    writeOut();
+                size_t chunk = n < OUT_BUFFER_SIZE - outLength ? n : OUT_BUFFER_SIZE - outLength;
+                memcpy(outBuffer + outLength, s, chunk);
+                outLength += chunk;
+                s += chunk;
+                n -= chunk;
+            }
+        }
+
+        void writeOut(void) {
+            fwrite(outBuffer, 1, outLength, out);
+            frameBytes += outLength;
+            outLength = 0;
+        }
+};
@@ -0,0 +1,244 @@
+//
+// StopwatchBank.h
+// Author: Francesco Mecatti
+// CHANNELS independent stopwatches (lanes) read from one monotonic clock and drawn by one refresh task.
+// State is kept as a structure of arrays, one array per field, so a refresh is a single pass over contiguous memory
+// whatever the number of lanes, and only the rows whose shown time changed are redrawn. Finding them takes a 64-bit
+// subtraction and compare per lane, no division: only the rows redrawn convert their time
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "ClockSource.h"
+#include "Profiler.h"
+#include "Renderer.h"
+#include "TaskPlacement.h"
+#include "TimeFormat.h"
+
+template <size_t CHANNELS>
+class StopwatchBank {
+    static_assert(CHANNELS > 0, "StopwatchBank needs at least one channel");
+
+    public:
+        static const unsigned int US_PER_CS = 10000;
+        static const unsigned int CS_PER_S = 100;
+        static const clock_us_t US_PER_S = (clock_us_t) US_PER_CS * CS_PER_S;
+        static const unsigned int SCREEN_COLS = 40;
+        static const unsigned int REFRESH_STACK_SIZE = 2048;
+
+        StopwatchBank(clock_source_t clockSource = espTimerClock) : clockSource(clockSource) {
+            xStateMutex = xSemaphoreCreateMutex();
+            for (size_t i = 0; i < CHANNELS; i++)
+                shownFrom[i] = NOT_SHOWN;
+        }
+
+        StopwatchBank(const StopwatchBank &) = delete;  // The refresh task holds this
+        StopwatchBank &operator=(const StopwatchBank &) = delete;
+
+        // Erase the screen and start the refresh task: fps frames per second while a lane runs, on request otherwise
+        void begin(unsigned int fps = 1) {
+            if (xRefreshTaskHandle != NULL)
+                return;
+            this->fps = fps != 0 ? fps : 1;
+            screen.begin();
+            screen.flush();
+            xRefreshRequest = xSemaphoreCreateBinary();
+            TaskPlacement::create(RENDER_TASK, &refreshTask, "bankTask", REFRESH_STACK_SIZE, this, 1, &xRefreshTaskHandle);
+        }
+
+        void start(size_t channel, clock_us_t timestamp) {
+            if (channel >= CHANNELS || running[channel])
+                return;
+            xSemaphoreTake(xStateMutex, portMAX_DELAY);
+            startTimestamp[channel] = timestamp;
+            running[channel] = 1;
+            xSemaphoreGive(xStateMutex);
+            requestRefresh();
+        }
+
+        void start(size_t channel) {
+            start(channel, clockSource());
+        }
+
+        void stop(size_t channel, clock_us_t timestamp) {
+            if (channel >= CHANNELS || !running[channel])
+                return;
+            xSemaphoreTake(xStateMutex, portMAX_DELAY);
+            elapsedUs[channel] += timestamp - startTimestamp[channel];
+            running[channel] = 0;
+            xSemaphoreGive(xStateMutex);
+            requestRefresh();
+        }
+
+        void stop(size_t channel) {
+            stop(channel, clockSource());
+        }
+
+        void lap(size_t channel, clock_us_t timestamp) {
+            if (channel >= CHANNELS)
+                return;
+            xSemaphoreTake(xStateMutex, portMAX_DELAY);
+            lastSplit[channel] = elapsedAt(channel, timestamp);
+            lapCount[channel]++;
+            xSemaphoreGive(xStateMutex);
+            requestRefresh();
+        }
+
+        void lap(size_t channel) {
+            lap(channel, clockSource());
+        }
+
+        // Zero the time and the laps; a running lane keeps running from zero
+        void reset(size_t channel) {
+            if (channel >= CHANNELS)
+                return;
+            xSemaphoreTake(xStateMutex, portMAX_DELAY);
+            elapsedUs[channel] = 0;
+            startTimestamp[channel] = clockSource();
+            lastSplit[channel] = 0;
+            lapCount[channel] = 0;
+            xSemaphoreGive(xStateMutex);
+            requestRefresh();
+        }
+
+        clock_us_t elapsedAt(size_t channel, clock_us_t timestamp) const {
+            return elapsedUs[channel] + (running[channel] ? timestamp - startTimestamp[channel] : 0);
+        }
+
+        bool isStopped(size_t channel) const {
+            return !running[channel];
+        }
+
+        uint32_t getLaps(size_t channel) const {
+            return lapCount[channel];
+        }
+
+        size_t getRunning(void) const {
+            size_t n = 0;
+            for (size_t i = 0; i < CHANNELS; i++)
+                n += running[i];
+            return n;
+        }
+
+        // One frame at clock value now: a pass over every lane to find the rows to redraw, then a single console write.
+        // Returns the number of rows redrawn
+        size_t refresh(clock_us_t now) {
+            size_t redrawn = 0;
+            xSemaphoreTake(xStateMutex, portMAX_DELAY);
+            for (size_t i = 0; i < CHANNELS; i++) {  // No calls, no branches on the lane state: the compiler can vectorize it
+                clock_us_t elapsed = elapsedUs[i] + running[i] * (now - startTimestamp[i]);
+                changed[i] = ((uint64_t) (elapsed - shownFrom[i]) >= (uint64_t) US_PER_S) | (lapCount[i] != shownLaps[i]) |
+                             (running[i] != shownRunning[i]);  // The highlight follows the run state
+            }
+            for (size_t i = 0; i < CHANNELS; i++) {
+                if (!changed[i])
+                    continue;
+                uint64_t seconds = TimeFormat::divide((uint64_t) elapsedAt(i, now), US_PER_S);
+                shownFrom[i] = (clock_us_t) seconds * US_PER_S;
+                shownLaps[i] = lapCount[i];
+                shownRunning[i] = running[i];
+                drawRow(i, seconds, running[i] ? HIGHLIGHT : PLAIN);
+                redrawn++;
+            }
+            xSemaphoreGive(xStateMutex);
+            screen.flush();
+            frames++;
+            return redrawn;
+        }
+
+        void setOutput(FILE *out) {
+            screen.setOutput(out);
+        }
+
+        unsigned long getFrames(void) const {
+            return frames;
+        }
+
+        unsigned long getBytes(void) const {
+            return screen.getBytes();
+        }
+
+        const Renderer<CHANNELS, SCREEN_COLS> &getScreen(void) const {
+            return screen;
+        }
+
+    private:
+        static const clock_us_t NOT_SHOWN = -US_PER_S;  // A second no elapsed time falls in
+
+        // One array per field, indexed by channel
+        clock_us_t startTimestamp[CHANNELS] = {};  // Clock value when the lane was last started
+        clock_us_t elapsedUs[CHANNELS] = {};  // Time accumulated before the last start
+        clock_us_t lastSplit[CHANNELS] = {};
+        uint32_t lapCount[CHANNELS] = {};
+        clock_us_t shownFrom[CHANNELS];  // Start of the second the screen shows, to redraw only what changed
+        uint32_t shownLaps[CHANNELS] = {};
+        uint8_t shownRunning[CHANNELS] = {};
+        uint8_t running[CHANNELS] = {};
+        uint8_t changed[CHANNELS] = {};
+
+        clock_source_t clockSource;
+        Renderer<CHANNELS, SCREEN_COLS> screen;
+        unsigned int fps = 1;
+        unsigned long frames = 0;
+        TaskHandle_t xRefreshTaskHandle = NULL;
+        SemaphoreHandle_t xRefreshRequest = NULL;  // Given to redraw before the next frame; requests coalesce
+        SemaphoreHandle_t xStateMutex = NULL;  // Guards the arrays; never held while writing to the console
+
+        void requestRefresh(void) {
+            if (xRefreshRequest != NULL)
+                xSemaphoreGive(xRefreshRequest);
+        }
+
+        // "  3 01:02:03  lap 12  01:01:58.42", running lanes highlighted; clipped at SCREEN_COLS
+        void drawRow(size_t i, uint64_t seconds, CellStyle cellStyle) {
+            char buffer[96], number[11];
+            size_t n = 0, digits = TimeFormat::formatUnsigned((uint32_t) i + 1, number);
+            for (; n + digits < 3; n++)
+                buffer[n] = ' ';
+            memcpy(buffer + n, number, digits);
+            n += digits;
+            buffer[n++] = ' ';
+            n += TimeFormat::formatSeconds(seconds, buffer + n);
+            if (lapCount[i] != 0) {
+                memcpy(buffer + n, "  lap ", 6);
+                n += 6;
+                digits = TimeFormat::formatUnsigned(lapCount[i], buffer + n);
+                n += digits;
+                for (; digits < 3; digits++)
+                    buffer[n++] = ' ';
+                buffer[n++] = ' ';
+                TimeFormat::format(TimeFormat::divide((uint64_t) lastSplit[i], US_PER_CS), buffer + n);
+            }
+            screen.clearRow(i);
+            screen.put(i, 0, buffer, cellStyle);
+        }
+
+        // Only task writing to the console for every lane, on an absolute schedule while any of them runs
+        static void refreshTask(void *pvParameter) {
+            StopwatchBank *bank = (StopwatchBank *) pvParameter;
+            TickType_t framePeriod = pdMS_TO_TICKS(1000 / bank->fps);
+            if (framePeriod == 0)
+                framePeriod = 1;
+            TickType_t xNextFrame = xTaskGetTickCount();
+            while (true) {
+                TickType_t wait = portMAX_DELAY;
+                if (bank->getRunning() != 0) {
+                    int32_t untilFrame = (int32_t) (xNextFrame - xTaskGetTickCount());
+                    wait = untilFrame > 0 ? (TickType_t) untilFrame : 0;
+                }
+                xSemaphoreTake(bank->xRefreshRequest, wait);
+                Profiler::wake();
+                TickType_t now = xTaskGetTickCount();
+                if ((int32_t) (now - xNextFrame) >= 0)
+                    xNextFrame = now - (now - xNextFrame) % framePeriod + framePeriod;  // Missed frames are skipped
+                bank->refresh(bank->clockSource());
+            }
+        }
+};
@@ -0,0 +1,53 @@
+//
+// TaskPlacement.h
+// Author: Francesco Mecatti
+// Core and priority of the example tasks, by role. With SPLIT_CORES the timing critical tasks (input handling:
+// buttonTask, hallTask) run on TIMING_CORE above every other task of the examples, and the output tasks (displayTask,
+// bankTask, consoleTask, telemetryTask) on RENDER_CORE at their own priority, so a frame or a UART write never delays
+// a press. The two sides only share lock-free structures: input events go through an EventQueue, the stopwatch state
+// through the sequence counter of Time.h, text and frames through the Console and Telemetry rings.
+// Without SPLIT_CORES every task is created as xTaskCreate does: no affinity, its own priority
+//
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifndef SPLIT_CORES
+#define SPLIT_CORES     (1)
+#endif
+
+#define TIMING_CORE     (1)  // APP_CPU: ESP-IDF keeps the esp_timer task (and Wi-Fi, when used) on core 0
+#define RENDER_CORE     (0)
+#define TIMING_PRIORITY (5)  // Above the output tasks (0 and 1), below the esp_timer task (22)
+
+typedef enum {TIMING_TASK, RENDER_TASK} TaskRole;
+
+class TaskPlacement {
+    public:
+        // xTaskCreate for a task of the given role; priority is the one it has without the split.
+        // On a single core build (CONFIG_FREERTOS_UNICORE) both roles share core 0, the timing one still on top
+        static BaseType_t create(TaskRole role, TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                 void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask = NULL) {
+            BaseType_t core = tskNO_AFFINITY;
+            if (split) {
+                core = portNUM_PROCESSORS > 1 ? (role == TIMING_TASK ? TIMING_CORE : RENDER_CORE) : 0;
+                if (role == TIMING_TASK)
+                    uxPriority = TIMING_PRIORITY;
+            }
+            return xTaskCreatePinnedToCore(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, core);
+        }
+
+        // Placement of the tasks created from now on, e.g. to compare both in one image
+        static void setSplit(bool split) {
+            TaskPlacement::split = split;
+        }
+
+        static bool isSplit(void) {
+            return split;
+        }
+
+    private:
+        static inline bool split = SPLIT_CORES;
+};
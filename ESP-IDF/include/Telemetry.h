@@ -0,0 +1,131 @@
+//
+// Telemetry.h
+// Author: Francesco Mecatti
+// Binary telemetry writer: stopwatch and input events as CRC-checked COBS frames (see TelemetryCodec.h) instead of ANSI
+// text. emit() encodes the frame into a lock-free queue and returns: no formatting and no console I/O on the caller's
+// side. A writer task moves the queued frames to the console in one write per batch. When the queue is full the frame
+// is dropped and counted, and the stream carries a TELEMETRY_DROPPED frame so the collector knows.
+// One producing task (e.g. buttonTask) and one telemetry stream per firmware image, so everything is static
+//
+
+#pragma once
+
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "ClockSource.h"
+#include "EventQueue.h"
+#include "Profiler.h"
+#include "TaskPlacement.h"
+#include "TelemetryCodec.h"
+
+typedef struct {
+    uint8_t length;
+    uint8_t bytes[TelemetryCodec::MAX_FRAME];
+} TelemetryFrame;
+
+typedef struct {
+    unsigned long frames;  // Written to the console
+    unsigned long dropped;  // Lost because the queue was full
+    unsigned long bytes;
+} TelemetryStats;
+
+class Telemetry {
+    public:
+        static const size_t QUEUE_SIZE = 32;  // Frames; power of 2
+        static const size_t BATCH_SIZE = 8;  // Frames per console write
+        static const unsigned int STACK_SIZE = 2048;
+
+        // Start the writer task; the first frame says hello with the format version
+        static void begin(void) {
+            if (xWriterTaskHandle != NULL)
+                return;
+            xPending = xSemaphoreCreateBinary();
+            xWriteMutex = xSemaphoreCreateMutex();
+            TaskPlacement::create(RENDER_TASK, &writerTask, "telemetryTask", STACK_SIZE, NULL, 1, &xWriterTaskHandle);
+            emit(TELEMETRY_HELLO, espTimerClock(), TELEMETRY_VERSION);
+        }
+
+        // Delete the writer task, once it is not halfway through a write. Frames still queued are discarded
+        static void end(void) {
+            if (xWriterTaskHandle == NULL)
+                return;
+            xSemaphoreTake(xWriteMutex, portMAX_DELAY);
+            vTaskDelete(xWriterTaskHandle);
+            xWriterTaskHandle = NULL;
+            xSemaphoreGive(xWriteMutex);
+            vSemaphoreDelete(xPending);
+            vSemaphoreDelete(xWriteMutex);
+            xPending = xWriteMutex = NULL;
+            TelemetryFrame frame;
+            while (queue.pop(&frame, 1) > 0)
+                ;
+        }
+
+        static bool isEnabled(void) {
+            return xWriterTaskHandle != NULL;
+        }
+
+        // Queue one event; never blocks. False if telemetry is off or the queue is full
+        static bool emit(TelemetryType type, clock_us_t timestamp, uint64_t arg0 = 0, uint64_t arg1 = 0, uint64_t arg2 = 0) {
+            if (xWriterTaskHandle == NULL)
+                return false;
+            TelemetryFrame frame;
+            frame.length = (uint8_t) TelemetryCodec::encode({type, timestamp, {arg0, arg1, arg2}}, frame.bytes);
+            if (!queue.push(frame))
+                return false;
+            xSemaphoreGive(xPending);
+            return true;
+        }
+
+        static bool input(const InputEvent &event) {
+            return emit(TELEMETRY_INPUT, event.timestamp, (uint64_t) event.source << 1 | event.level);
+        }
+
+        static void setOutput(FILE *out) {
+            Telemetry::out = out;
+        }
+
+        static TelemetryStats getStats(void) {
+            return {frames, queue.getOverflows(), bytes};
+        }
+
+    private:
+        static inline EventQueue<TelemetryFrame, QUEUE_SIZE> queue;
+        static inline FILE *out = stdout;
+        static inline TaskHandle_t xWriterTaskHandle = NULL;
+        static inline SemaphoreHandle_t xPending = NULL;  // Given after every frame queued; frames coalesce
+        static inline SemaphoreHandle_t xWriteMutex = NULL;  // Taken by writerTask until the queue is empty; end() waits for it, so no frame goes out half sent
+        static inline unsigned long frames = 0, bytes = 0, reportedDrops = 0;
+
+        static void writerTask(void *pvParameter) {
+            TelemetryFrame batch[BATCH_SIZE];
+            uint8_t buffer[(BATCH_SIZE + 1) * TelemetryCodec::MAX_FRAME];
+            size_t n;
+            while (true) {
+                xSemaphoreTake(xPending, portMAX_DELAY);
+                Profiler::wake();
+                xSemaphoreTake(xWriteMutex, portMAX_DELAY);
+                while ((n = queue.pop(batch, BATCH_SIZE)) > 0) {
+                    size_t length = 0;
+                    unsigned long drops = queue.getOverflows();
+                    if (drops != reportedDrops) {  // Before the frames queued after the loss
+                        length += TelemetryCodec::encode({TELEMETRY_DROPPED, espTimerClock(), {drops, 0}}, buffer);
+                        reportedDrops = drops;
+                        frames++;
+                    }
+                    for (size_t i = 0; i < n; i++) {
+                        for (size_t j = 0; j < batch[i].length; j++)
+                            buffer[length + j] = batch[i].bytes[j];
+                        length += batch[i].length;
+                    }
+                    fwrite(buffer, 1, length, out);
+                    fflush(out);
+                    frames += n;
+                    bytes += length;
+                }
+                xSemaphoreGive(xWriteMutex);
+            }
+        }
+};
@@ -0,0 +1,232 @@
+//
+// TelemetryCodec.h
+// Author: Francesco Mecatti
+// Binary telemetry frame format, shared by the device (Telemetry.h) and the host decoder (host/telemetry_decode.cpp).
+// A frame is COBS(payload, CRC-16) followed by a 0x00 delimiter, so a reader can join the stream at any byte and a
+// corrupted frame costs that frame only. The payload is the event type, its timestamp in microseconds since boot and
+// the arguments of the type, all as unsigned LEB128 varints: a lap takes about 12 bytes on the wire
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ClockSource.h"
+
+#define TELEMETRY_VERSION   (2)  // 2: task profile frames, up to 3 arguments
+
+typedef enum : uint8_t {
+    TELEMETRY_HELLO = 0,  // version; first frame of a stream
+    TELEMETRY_START,
+    TELEMETRY_STOP,  // elapsed us
+    TELEMETRY_LAP,  // lap number, split us
+    TELEMETRY_RESET,
+    TELEMETRY_CLEAR_LAPS,
+    TELEMETRY_INPUT,  // source << 1 | level (InputSource, level 0 = pressed)
+    TELEMETRY_DROPPED,  // frames lost on the device so far, queue full
+    TELEMETRY_PROFILE,  // interval us, tasks; heads a profiler dump (see Profiler.h)
+    TELEMETRY_TASK,  // name (8 chars, first in the low byte), cpu us in the interval, wakeups << 32 | stack free bytes
+    TELEMETRY_LATENCY,  // InputSource, bucket (latency < 2^(bucket+1) us), count since boot
+    TELEMETRY_TYPE_COUNT
+} TelemetryType;
+
+typedef struct {
+    TelemetryType type;
+    clock_us_t timestamp;
+    uint64_t args[3];  // TelemetryCodec::MAX_ARGS
+} TelemetryEvent;
+
+// CRC-16/CCITT-FALSE lookup table, built at compile time
+struct Crc16Table {
+    uint16_t entries[256];
+
+    constexpr Crc16Table() : entries() {
+        for (unsigned int i = 0; i < 256; i++) {
+            uint16_t crc = (uint16_t) (i << 8);
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc & 0x8000) ? (uint16_t) (crc << 1) ^ 0x1021 : (uint16_t) (crc << 1);
+            entries[i] = crc;
+        }
+    }
+
+    constexpr uint16_t operator[](size_t i) const {
+        return entries[i];
+    }
+};
+
+class TelemetryCodec {
+    public:
+        static const size_t MAX_ARGS = 3;
+        static const size_t MAX_VARINT = 10;
+        static const size_t MAX_PAYLOAD = 1 + MAX_VARINT * (1 + MAX_ARGS) + 2;  // Type, varints, CRC
+        static const size_t MAX_FRAME = MAX_PAYLOAD + 2;  // COBS adds one byte per 254, plus the delimiter
+
+        static size_t argCount(TelemetryType type) {
+            static const uint8_t ARGS[TELEMETRY_TYPE_COUNT] = {1, 0, 1, 2, 0, 0, 1, 1, 2, 3, 3};
+            return type < TELEMETRY_TYPE_COUNT ? ARGS[type] : 0;
+        }
+
+        // CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xffff)
+        static uint16_t crc16(const uint8_t *data, size_t length) {
+            uint16_t crc = 0xffff;
+            for (size_t i = 0; i < length; i++)
+                crc = (uint16_t) (crc << 8) ^ CRC_TABLE[(crc >> 8) ^ data[i]];
+            return crc;
+        }
+
+        // Whole frame into frame (at least MAX_FRAME bytes), delimiter included. Returns its length
+        static size_t encode(const TelemetryEvent &event, uint8_t *frame) {
+            uint8_t payload[MAX_PAYLOAD];
+            size_t length = encodePayload(event, payload);
+            uint16_t crc = crc16(payload, length);
+            payload[length++] = (uint8_t) (crc >> 8);
+            payload[length++] = (uint8_t) crc;
+            size_t n = cobsEncode(payload, length, frame);
+            frame[n++] = 0;
+            return n;
+        }
+
+        // One frame, without its delimiter. False if it is malformed or fails the CRC
+        static bool decode(const uint8_t *frame, size_t length, TelemetryEvent &event) {
+            uint8_t payload[MAX_FRAME];
+            if (length == 0 || length > MAX_FRAME)
+                return false;
+            size_t n = cobsDecode(frame, length, payload);
+            if (n < 4 || crc16(payload, n - 2) != (uint16_t) (payload[n - 2] << 8 | payload[n - 1]))
+                return false;
+            return decodePayload(payload, n - 2, event);
+        }
+
+        // Type, timestamp and arguments, without the CRC, into payload (at least MAX_PAYLOAD - 2 bytes). Returns its
+        // length. The frame payload; LapLog.h stores it as is
+        static size_t encodePayload(const TelemetryEvent &event, uint8_t *payload) {
+            size_t length = 0;
+            payload[length++] = event.type;
+            length += putVarint((uint64_t) event.timestamp, payload + length);
+            for (size_t i = 0; i < argCount(event.type); i++)
+                length += putVarint(event.args[i], payload + length);
+            return length;
+        }
+
+        // False if the type is unknown or the varints do not fill length exactly
+        static bool decodePayload(const uint8_t *payload, size_t length, TelemetryEvent &event) {
+            if (length == 0 || payload[0] >= TELEMETRY_TYPE_COUNT)
+                return false;
+            event.type = (TelemetryType) payload[0];
+            size_t at = 1;
+            uint64_t value;
+            if (!getVarint(payload, length, at, value))
+                return false;
+            event.timestamp = (clock_us_t) value;
+            for (size_t i = 0; i < MAX_ARGS; i++) {
+                event.args[i] = 0;
+                if (i < argCount(event.type) && !getVarint(payload, length, at, event.args[i]))
+                    return false;
+            }
+            return at == length;
+        }
+
+        // Unsigned LEB128, least significant group first; out takes up to MAX_VARINT bytes. Returns the bytes written
+        static size_t putVarint(uint64_t value, uint8_t *out) {
+            size_t n = 0;
+            while (value >= 0x80) {
+                out[n++] = (uint8_t) (value | 0x80);
+                value >>= 7;
+            }
+            out[n++] = (uint8_t) value;
+            return n;
+        }
+
+        // Varint at in[at], moving at past it. False if it runs over length or MAX_VARINT bytes
+        static bool getVarint(const uint8_t *in, size_t length, size_t &at, uint64_t &value) {
+            value = 0;
+            for (unsigned int shift = 0; at < length && shift < 7 * MAX_VARINT; shift += 7) {
+                uint8_t byte = in[at++];
+                value |= (uint64_t) (byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                    return true;
+            }
+            return false;
+        }
+
+    private:
+        // Consistent Overhead Byte Stuffing: no 0x00 in the output, so 0x00 can end a frame
+        static size_t cobsEncode(const uint8_t *in, size_t length, uint8_t *out) {
+            size_t codeAt = 0, n = 1;
+            uint8_t code = 1;
+            for (size_t i = 0; i < length; i++) {
+                if (in[i] != 0) {
+                    out[n++] = in[i];
+                    code++;
+                }
+                if (in[i] == 0 || code == 0xff) {
+                    out[codeAt] = code;
+                    codeAt = n++;
+                    code = 1;
+                }
+            }
+            out[codeAt] = code;
+            return n;
+        }
+
+        static size_t cobsDecode(const uint8_t *in, size_t length, uint8_t *out) {
+            size_t n = 0;
+            for (size_t i = 0; i < length; ) {
+                uint8_t code = in[i++];
+                if (code == 0)
+                    return 0;
+                for (uint8_t j = 1; j < code; j++) {
+                    if (i >= length || in[i] == 0)
+                        return 0;
+                    out[n++] = in[i++];
+                }
+                if (code != 0xff && i < length)
+                    out[n++] = 0;
+            }
+            return n;
+        }
+
+        static constexpr Crc16Table CRC_TABLE = Crc16Table();
+};
+
+// Splits a byte stream at the delimiters and decodes the frames. A frame longer than MAX_FRAME is dropped up to the
+// next delimiter, so the decoder resynchronises on its own after noise or a reader joining mid-frame
+class TelemetryDecoder {
+    public:
+        // Calls onEvent(const TelemetryEvent &) for every good frame
+        template <typename Callback>
+        void feed(const uint8_t *data, size_t length, Callback onEvent) {
+            for (size_t i = 0; i < length; i++) {
+                if (data[i] != 0) {
+                    if (fill < sizeof(frame))
+                        frame[fill] = data[i];
+                    fill++;
+                    continue;
+                }
+                if (fill == 0)
+                    continue;  // Delimiter run
+                TelemetryEvent event;
+                if (fill <= sizeof(frame) && TelemetryCodec::decode(frame, fill, event)) {
+                    frames++;
+                    onEvent(event);
+                }
+                else {
+                    badFrames++;
+                }
+                fill = 0;
+            }
+        }
+
+        unsigned long getFrames(void) const {
+            return frames;
+        }
+
+        unsigned long getBadFrames(void) const {  // Failed the CRC, malformed or too long
+            return badFrames;
+        }
+
+    private:
+        uint8_t frame[TelemetryCodec::MAX_FRAME];
+        size_t fill = 0;
+        unsigned long frames = 0, badFrames = 0;
+};
@@ -0,0 +1,384 @@
+//
+// Time.h
+// Author: Francesco Mecatti
+// Stopwatch time keeping shared by Stopwatch.cpp, ButtonInterruptStopwatch.cpp and InputInterruptStopwatch.cpp.
+// Elapsed time is computed on demand from a monotonic microsecond clock source: start/stop only store timestamps.
+// Every time is a signed 64-bit microsecond count, so nothing wraps within a session; days are shown past 24 h.
+// Everything shown on the console is drawn by displayTask, at a configurable frame rate while running and on request
+// otherwise, so a slow console never delays the callers. Laps are kept in a fixed-capacity LapStore.
+// There is one stopwatch per firmware image. The Time object that creates displayTask owns it, with its semaphores:
+// it can be moved but not copied, and destroying it stops the counter and deletes them. Give it static storage.
+// The counter and the laps are changed by one task (the input task) and read by displayTask, possibly on the other core:
+// changes are published through a sequence counter, which never makes the input task wait for a frame
+// With the TELEMETRY output there is no displayTask: every change is sent as a binary frame instead (see Telemetry.h)
+// Once LapLog::begin() has run, every change is also kept in flash (see LapLog.h)
+// With the screen on Console::stream() displayTask never waits for the console either: a frame takes what fits in the
+// Console ring and leaves the rest of the changes to the next one
+// Additional feature: ANSI/VT100 formatting
+//
+
+#pragma once
+
+#include <atomic>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "ClockSource.h"
+#include "Console.h"
+#include "LapLog.h"
+#include "LapStore.h"
+#include "Profiler.h"
+#include "Renderer.h"
+#include "TaskPlacement.h"
+#include "Telemetry.h"
+#include "TimeFormat.h"
+
+typedef uint64_t ctime_t;  // Centiseconds: 32 bits would wrap after 497 days
+
+typedef struct {
+    unsigned long frames;
+    unsigned long dropped;  // Frame deadlines missed because the previous frame took too long
+    clock_us_t renderUsTotal;  // Time spent drawing and writing frames
+    clock_us_t renderUsMax;
+} DisplayStats;
+
+class Time {
+    public:
+        typedef enum {SCREEN, TELEMETRY} Output;
+
+        static const unsigned int US_PER_CS = 10000;
+        static const unsigned int DISPLAY_STACK_SIZE = 2048;
+        static const unsigned int SCREEN_ROWS = 24;
+        static const unsigned int SCREEN_COLS = 40;
+        static const unsigned int LAP_COLUMN = 10;  // Laps are printed below the time, starting from this column
+        static const unsigned int LAP_ROWS = SCREEN_ROWS - 1;  // Lap n is shown on row (n-1) % LAP_ROWS, so a new lap redraws one row only
+        static const size_t LAP_CAPACITY = 64;  // Laps kept in memory; older ones are overwritten
+        static inline clock_source_t clockSource = espTimerClock;
+        static inline clock_us_t startTimestamp = 0;  // Clock value when the counter was last started
+        static inline clock_us_t elapsedUs = 0;  // Time accumulated before the last start
+        static inline bool stopped = true;
+        static inline LapStore<LAP_CAPACITY> laps;
+        static inline Renderer<SCREEN_ROWS, SCREEN_COLS> screen;
+        static inline unsigned int displayFps = 1;
+        static inline bool displayCentiseconds = false;
+        static inline TimeText shownTime;  // Time row as last drawn, moved forward digit by digit
+        static inline uint32_t lapsGeneration = 0;  // Incremented by clearLaps
+        static inline DisplayStats displayStats = {};
+        static inline Output output = SCREEN;
+        static inline TaskHandle_t xDisplayTaskHandle = NULL;
+        static inline SemaphoreHandle_t xDisplayRequest = NULL;  // Given to redraw before the next frame; requests coalesce
+        static inline std::atomic<uint32_t> stateVersion {0};  // Odd while the counter or the laps change: displayTask reads them again
+        static inline std::atomic<bool> profileRequested {false};  // Set by printProfile, cleared by displayTask
+        static inline SemaphoreHandle_t xFrameMutex = NULL;  // Held by displayTask from the state copy to the end of the flush; release() deletes it in between frames only
+
+        // Instance constructor. fps: refresh rate while running; centiseconds: show them too (pair it with e.g. 25 fps).
+        // The first Time (or the first after the owner was destroyed) starts from 00:00:00 and owns displayTask, or the
+        // telemetry writer; a second one only refers to the same stopwatch
+        Time(unsigned int fps = 1, bool centiseconds = false, Output output = SCREEN) {
+            if (xFrameMutex != NULL)
+                return;
+            owner = true;
+            Time::output = output;
+            displayFps = fps != 0 ? fps : 1;
+            displayCentiseconds = centiseconds;
+            shownTime.setCentisecondsShown(centiseconds);
+            startTimestamp = elapsedUs = 0;
+            stopped = true;
+            laps.clear();
+            lapsGeneration++;
+            xFrameMutex = xSemaphoreCreateMutex();
+            if (output == TELEMETRY) {
+                Telemetry::begin();
+                return;
+            }
+            screen.begin();  // Erase display and hide the cursor
+            screen.flush();
+            xDisplayRequest = xSemaphoreCreateBinary();
+            TaskPlacement::create(RENDER_TASK, &displayTask, "displayTask", DISPLAY_STACK_SIZE, NULL, 1, &xDisplayTaskHandle);
+        }
+
+        Time(const Time &) = delete;  // A copy would stop the counter and delete displayTask when it goes out of scope
+        Time &operator=(const Time &) = delete;
+
+        Time(Time &&other) : owner(other.owner) {
+            other.owner = false;
+        }
+
+        Time &operator=(Time &&other) {
+            if (this != &other) {
+                release();
+                owner = other.owner;
+                other.owner = false;
+            }
+            return *this;
+        }
+
+        bool isOwner(void) const {
+            return owner;
+        }
+
+        // Elapsed time, derived from the clock source. A 64-bit division: drawTime does without it
+        static ctime_t getCentiseconds(void) {
+            return centisecondsAt(clockSource());
+        }
+
+        // Elapsed time at a given clock value, e.g. the timestamp of an input event
+        static ctime_t centisecondsAt(clock_us_t timestamp) {
+            return (ctime_t) TimeFormat::divide((uint64_t) elapsedAt(timestamp), US_PER_CS);
+        }
+
+        static clock_us_t elapsedAt(clock_us_t timestamp) {
+            clock_us_t us = elapsedUs;
+            if (!stopped)
+                us += timestamp - startTimestamp;
+            return us;
+        }
+
+        // Ask displayTask to show the current time without waiting for the next frame. Never blocks
+        static void updateTime(void) {
+            if (xDisplayRequest != NULL)
+                xSemaphoreGive(xDisplayRequest);
+        }
+
+        // Ask displayTask to print the task profile after its next frame (see Profiler.h): the console takes one writer
+        // only, displayTask. Never blocks; nothing happens with the TELEMETRY output
+        static void printProfile(void) {
+            profileRequested.store(true, std::memory_order_relaxed);
+            updateTime();
+        }
+
+        // Store the lap taken at timestamp (default: now); displayTask shows it
+        void addLap(clock_us_t timestamp = clockSource()) {
+            beginChange();
+            laps.add(timestamp, elapsedAt(timestamp));
+            Lap lap = laps.last();
+            endChange();
+            publish(TELEMETRY_LAP, timestamp, lap.number, (uint64_t) lap.split);
+            updateTime();
+        }
+
+        // Time on the first row, blue background
+        static void drawTime(void) {
+            drawTime(elapsedAt(clockSource()));
+        }
+
+        static void drawTime(clock_us_t elapsed) {
+            size_t previousLength;
+            size_t first = shownTime.set((uint64_t) elapsed, previousLength);
+            if (first < shownTime.size())
+                screen.put(0, first, shownTime.c_str() + first, HIGHLIGHT);  // Only the digits that changed
+            if (shownTime.size() < previousLength)
+                screen.clearRow(0, shownTime.size());  // Shorter than before: nothing else is on the time row
+        }
+
+        // Most recent laps below the time; when the screen is full the oldest row is overwritten
+        static void drawLap(const Lap &lap) {
+            char buffer[13 + TimeFormat::MAX_LENGTH + 1];  // "(n)" left aligned in 7 columns, a space, [Nd ]hh:mm:ss.cs
+            size_t n = 0;
+            buffer[n++] = '(';
+            n += TimeFormat::formatUnsigned(lap.number, buffer + n);
+            buffer[n++] = ')';
+            while (n < 7)
+                buffer[n++] = ' ';
+            buffer[n++] = ' ';
+            TimeFormat::format(TimeFormat::divide((uint64_t) lap.split, US_PER_CS), buffer + n);
+            screen.put(1 + (lap.number - 1) % LAP_ROWS, LAP_COLUMN, buffer);
+        }
+
+        static void clearLapRows(void) {
+            for (unsigned int row = 1; row <= LAP_ROWS; row++)
+                screen.clearRow(row, LAP_COLUMN);
+        }
+
+        static const LapStore<LAP_CAPACITY> &getLaps(void) {
+            return laps;
+        }
+
+        // Draw one frame: time, laps added since the last frame, then a single write to the console.
+        // The state is copied first, again if it changed meanwhile; drawing works on the copy
+        static void renderFrame(uint32_t &shownGeneration, uint32_t &shownLaps) {
+            xSemaphoreTake(xFrameMutex, portMAX_DELAY);
+            Lap fresh[LAP_ROWS];
+            size_t n;
+            uint32_t generation, count;
+            clock_us_t elapsed;
+            uint32_t version;
+            do {
+                version = readBegin();
+                elapsed = elapsedAt(clockSource());
+                generation = lapsGeneration;
+                count = laps.count();
+                uint32_t oldest = count - laps.size();  // Laps before this one were overwritten in the store
+                uint32_t first = count - (laps.size() < LAP_ROWS ? laps.size() : LAP_ROWS);
+                uint32_t from = generation != shownGeneration ? 0 : shownLaps;
+                n = 0;
+                for (uint32_t i = from > first ? from : first; i < count && n < LAP_ROWS; i++)
+                    fresh[n++] = laps[i - oldest];
+            } while (!readEnd(version));
+            drawTime(elapsed);
+            if (shownGeneration != generation) {
+                clearLapRows();
+                shownGeneration = generation;
+            }
+            for (size_t i = 0; i < n; i++)
+                drawLap(fresh[i]);
+            shownLaps = count;
+            screen.flush(Console::room());  // Through the Console, what does not fit waits for the next frame
+            xSemaphoreGive(xFrameMutex);
+        }
+
+        // Only task writing to the console. While running it draws displayFps frames per second on an absolute schedule,
+        // skipping (and counting) the frames it is too late for; while stopped it sleeps until a request
+        static void displayTask(void *pvParameter) {
+            uint32_t shownGeneration = 0, shownLaps = 0;
+            TickType_t xNextFrame = xTaskGetTickCount();
+            bool running = false;
+            while (true) {
+                TickType_t framePeriod = pdMS_TO_TICKS(1000 / displayFps);
+                if (framePeriod == 0)
+                    framePeriod = 1;
+                TickType_t wait = portMAX_DELAY;
+                if (running) {
+                    int32_t untilFrame = (int32_t) (xNextFrame - xTaskGetTickCount());
+                    wait = untilFrame > 0 ? (TickType_t) untilFrame : 0;
+                }
+                xSemaphoreTake(xDisplayRequest, wait);
+                Profiler::wake();
+
+                TickType_t now = xTaskGetTickCount();
+                if (!stopped && !running)
+                    xNextFrame = now;  // Counter (re)started: frames are scheduled from here
+                running = !stopped;
+                int32_t late = (int32_t) (now - xNextFrame);
+                if (running && late >= 0) {
+                    TickType_t missed = (TickType_t) late / framePeriod;
+                    displayStats.dropped += missed;
+                    xNextFrame += (missed + 1) * framePeriod;
+                }
+
+                clock_us_t begin = clockSource();
+                renderFrame(shownGeneration, shownLaps);
+                clock_us_t renderUs = clockSource() - begin;
+                displayStats.frames++;
+                displayStats.renderUsTotal += renderUs;
+                if (renderUs > displayStats.renderUsMax)
+                    displayStats.renderUsMax = renderUs;
+                if (profileRequested.exchange(false, std::memory_order_relaxed)) {
+                    xSemaphoreTake(xFrameMutex, portMAX_DELAY);  // As a frame: release() waits for the whole dump
+                    Profiler::print<Console>();
+                    xSemaphoreGive(xFrameMutex);
+                }
+            }
+        }
+
+        static DisplayStats getDisplayStats(void) {
+            return displayStats;
+        }
+
+        // Run this method to start counter; counting starts from timestamp (default: now)
+        void start(clock_us_t timestamp = clockSource()) {
+            if (!stopped)
+                return;
+            beginChange();
+            startTimestamp = timestamp;
+            stopped = false;
+            endChange();
+            publish(TELEMETRY_START, timestamp);
+            updateTime();
+        }
+
+        void stop(clock_us_t timestamp = clockSource()) {
+            if (stopped)
+                return;
+            beginChange();
+            elapsedUs += timestamp - startTimestamp;
+            stopped = true;
+            clock_us_t elapsed = elapsedUs;
+            endChange();
+            publish(TELEMETRY_STOP, timestamp, (uint64_t) elapsed);
+            updateTime();
+        }
+
+        static bool isStopped(void) {
+            return stopped;
+        }
+
+        void reset(void) {  // Reset counter and show update time (00:00:00)
+            beginChange();
+            elapsedUs = 0;
+            startTimestamp = clockSource();
+            clock_us_t timestamp = startTimestamp;
+            endChange();
+            publish(TELEMETRY_RESET, timestamp);
+            updateTime();
+        }
+
+        void clearLaps(void) {
+            beginChange();
+            laps.clear();
+            lapsGeneration++;
+            endChange();
+            publish(TELEMETRY_CLEAR_LAPS, clockSource());
+            updateTime();
+        }
+
+        // Destructor
+        ~ Time() {
+            release();
+        }
+
+    private:
+        bool owner = false;
+
+        // Writer side of the sequence counter: the input task only
+        static void beginChange(void) {
+            stateVersion.store(stateVersion.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        static void endChange(void) {
+            stateVersion.store(stateVersion.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // Reader side: a copy taken between readBegin and a true readEnd is consistent
+        static uint32_t readBegin(void) {
+            uint32_t version;
+            while ((version = stateVersion.load(std::memory_order_acquire)) & 1)
+                ;  // A change in progress on the other core: a few stores at most
+            return version;
+        }
+
+        static bool readEnd(uint32_t version) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return stateVersion.load(std::memory_order_relaxed) == version;
+        }
+
+        // Every change goes to the telemetry stream and to the lap log; each ignores it unless started
+        static void publish(TelemetryType type, clock_us_t timestamp, uint64_t arg0 = 0, uint64_t arg1 = 0) {
+            Telemetry::emit(type, timestamp, arg0, arg1);
+            LapLog::append(type, timestamp, arg0, arg1);
+        }
+
+        // Stop the counter and delete displayTask and its semaphores, if this object owns them
+        void release(void) {
+            if (!owner)
+                return;
+            owner = false;
+            stop();
+            if (output == TELEMETRY) {
+                Telemetry::end();
+                vSemaphoreDelete(xFrameMutex);
+                xFrameMutex = NULL;
+                return;
+            }
+            xSemaphoreTake(xFrameMutex, portMAX_DELAY);  // displayTask is not halfway through a frame
+            vTaskDelete(xDisplayTaskHandle);
+            xDisplayTaskHandle = NULL;
+            xSemaphoreGive(xFrameMutex);
+            vSemaphoreDelete(xDisplayRequest);
+            vSemaphoreDelete(xFrameMutex);
+            xDisplayRequest = xFrameMutex = NULL;
+            screen.end();  // All graphics attributes off, cursor shown
+        }
+};
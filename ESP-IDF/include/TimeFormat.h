@@ -0,0 +1,253 @@
+//
+// TimeFormat.h
+// Author: Francesco Mecatti
+// Allocation-free formatting of elapsed times and counters into caller buffers: no printf, no varargs, no locale.
+// Two-digit fields come from a "00".."99" table. Times of a day or more start with a day count: "2d 03:04:05.06".
+// TimeText keeps the last text shown and moves it forward by carrying the elapsed microseconds into cs, ss, mm, hh and
+// days, rewriting only the digits that changed: a refresh costs a 64-bit subtraction and a few 32-bit compares, never
+// the 64-bit divisions of a whole conversion, which a 32-bit core runs in software
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// "00" to "99", built at compile time
+struct DigitPairs {
+    char digits[200];
+
+    constexpr DigitPairs() : digits() {
+        for (unsigned int i = 0; i < 100; i++) {
+            digits[2 * i] = (char) ('0' + i / 10);
+            digits[2 * i + 1] = (char) ('0' + i % 10);
+        }
+    }
+};
+
+class TimeFormat {
+    public:
+        static const uint32_t US_PER_CS = 10000;
+        static const uint32_t CS_PER_S = 100;
+        static const uint32_t CS_PER_MIN = 60 * CS_PER_S;
+        static const uint32_t CS_PER_H = 60 * CS_PER_MIN;
+        static const uint32_t CS_PER_DAY = 24 * CS_PER_H;
+        static const uint32_t S_PER_DAY = 24 * 60 * 60;
+        static const size_t MAX_LENGTH = 23;  // "dddddddddd" "d " "hh:mm:ss.cs"; buffers take one more for '\0'
+
+        // value < 100, exactly two characters
+        static void putPair(char *out, unsigned int value) {
+            out[0] = PAIRS.digits[2 * value];
+            out[1] = PAIRS.digits[2 * value + 1];
+        }
+
+        // value / divisor, with a 32-bit division while value fits in 32 bits
+        static uint64_t divide(uint64_t value, uint32_t divisor) {
+            return value <= UINT32_MAX ? (uint32_t) value / divisor : value / divisor;
+        }
+
+        // Decimal, no padding, '\0' terminated. Returns the length
+        static size_t formatUnsigned(uint32_t value, char *out) {
+            char reversed[10];
+            size_t n = 0;
+            while (value >= 100) {
+                uint32_t rest = value / 100;
+                unsigned int pair = (unsigned int) (value - rest * 100);
+                reversed[n++] = PAIRS.digits[2 * pair + 1];
+                reversed[n++] = PAIRS.digits[2 * pair];
+                value = rest;
+            }
+            reversed[n++] = (char) ('0' + value % 10);
+            if (value >= 10)
+                reversed[n++] = (char) ('0' + value / 10);
+            for (size_t i = 0; i < n; i++)
+                out[i] = reversed[n - 1 - i];
+            out[n] = '\0';
+            return n;
+        }
+
+        // "hh:mm:ss", after "Nd " if days > 0, then ".cs" withCentiseconds; '\0' terminated. Returns the length
+        static size_t formatFields(uint32_t days, unsigned int hours, unsigned int minutes, unsigned int seconds,
+                                   unsigned int centiseconds, char *out, bool withCentiseconds = true) {
+            size_t n = 0;
+            if (days > 0) {
+                n = formatUnsigned(days, out);
+                out[n++] = 'd';
+                out[n++] = ' ';
+            }
+            putPair(out + n, hours);
+            out[n + 2] = ':';
+            putPair(out + n + 3, minutes);
+            out[n + 5] = ':';
+            putPair(out + n + 6, seconds);
+            n += 8;
+            if (withCentiseconds) {
+                out[n] = '.';
+                putPair(out + n + 1, centiseconds);
+                n += 3;
+            }
+            out[n] = '\0';
+            return n;
+        }
+
+        // "[Nd ]hh:mm:ss", or "[Nd ]hh:mm:ss.cs" with centiseconds. Returns the length
+        static size_t format(uint64_t centiseconds, char *out, bool withCentiseconds = true) {
+            uint32_t rest;
+            uint32_t days = splitDays(centiseconds, CS_PER_DAY, rest);
+            unsigned int hours = rest / CS_PER_H;
+            rest -= hours * CS_PER_H;
+            unsigned int minutes = rest / CS_PER_MIN;
+            rest -= minutes * CS_PER_MIN;
+            unsigned int seconds = rest / CS_PER_S;
+            return formatFields(days, hours, minutes, seconds, rest - seconds * CS_PER_S, out, withCentiseconds);
+        }
+
+        static size_t formatSeconds(uint64_t seconds, char *out) {
+            uint32_t rest;
+            uint32_t days = splitDays(seconds, S_PER_DAY, rest);
+            unsigned int hours = rest / 3600;
+            rest -= hours * 3600;
+            unsigned int minutes = rest / 60;
+            return formatFields(days, hours, minutes, rest - minutes * 60, 0, out, false);
+        }
+
+        // Whole days in value, at perDay units a day; rest gets what is left. Days fit 32 bits for any clock_us_t
+        static uint32_t splitDays(uint64_t value, uint32_t perDay, uint32_t &rest) {
+            uint32_t days = (uint32_t) divide(value, perDay);
+            rest = (uint32_t) (value - (uint64_t) days * perDay);
+            return days;
+        }
+
+    private:
+        static constexpr DigitPairs PAIRS = DigitPairs();
+};
+
+// Text of a microsecond counter that mostly moves forward by small steps, e.g. the stopwatch at every frame
+class TimeText {
+    public:
+        static const uint32_t CARRY_LIMIT_US = 60 * TimeFormat::CS_PER_S * TimeFormat::US_PER_CS;  // Larger steps, or going back, convert from scratch
+
+        TimeText(bool withCentiseconds = true) : withCentiseconds(withCentiseconds) {
+            reset();
+        }
+
+        // Next set() writes the whole text
+        void reset(void) {
+            convert(0);
+            valid = false;
+        }
+
+        void setCentisecondsShown(bool withCentiseconds) {
+            this->withCentiseconds = withCentiseconds;
+            reset();
+        }
+
+        // Show us microseconds, truncated to centiseconds; returns the index of the first character that changed
+        // (size() if none). previousLength: length of the text the last set() returned, whose tail past size() is stale
+        // when the text got shorter (a day prefix gone, or one digit less in it)
+        size_t set(uint64_t us, size_t &previousLength) {
+            previousLength = shownLength;
+            size_t first = set(us);
+            shownLength = length;
+            return first;
+        }
+
+        size_t set(uint64_t us) {
+            if (!valid || us < value || us - value >= CARRY_LIMIT_US) {
+                convert(us);
+                valid = true;
+                return 0;
+            }
+            uint32_t newSubUs = subUs + (uint32_t) (us - value);
+            unsigned int newCs = cs, newSeconds = seconds, newMinutes = minutes, newHours = hours;
+            if (newSubUs >= TimeFormat::US_PER_CS) {
+                uint32_t carry = newSubUs / TimeFormat::US_PER_CS;  // 32 bit
+                newSubUs -= carry * TimeFormat::US_PER_CS;
+                newCs += carry;
+            }
+            while (newCs >= TimeFormat::CS_PER_S) {  // At most 60 times, once per frame at the usual rates
+                newCs -= TimeFormat::CS_PER_S;
+                newSeconds++;
+            }
+            while (newSeconds >= 60) {
+                newSeconds -= 60;
+                newMinutes++;
+            }
+            if (newMinutes >= 60) {
+                newMinutes -= 60;
+                newHours++;
+            }
+            value = us;
+            subUs = newSubUs;
+            size_t first = length;
+            if (newHours >= 24) {  // The day prefix changes, and may take one more digit: write it all
+                days++;
+                newHours -= 24;
+                first = 0;
+            }
+            else {
+                size_t at = length - (withCentiseconds ? 11 : 8);  // Where hh starts, after the day prefix
+                if (withCentiseconds && newCs != cs)
+                    first = update(at + CS_AT, newCs);
+                if (newSeconds != seconds)
+                    first = update(at + SS_AT, newSeconds);
+                if (newMinutes != minutes)
+                    first = update(at + MM_AT, newMinutes);
+                if (newHours != hours)
+                    first = update(at, newHours);
+            }
+            cs = newCs;
+            seconds = newSeconds;
+            minutes = newMinutes;
+            hours = newHours;
+            if (first == 0)
+                length = TimeFormat::formatFields(days, hours, minutes, seconds, cs, text, withCentiseconds);
+            return first;
+        }
+
+        const char *c_str(void) const {
+            return text;
+        }
+
+        size_t size(void) const {
+            return length;
+        }
+
+    private:
+        static const size_t MM_AT = 3, SS_AT = 6, CS_AT = 9;  // From the start of hh
+
+        char text[TimeFormat::MAX_LENGTH + 1];
+        size_t length = 0;
+        size_t shownLength = 0;  // As of the last set(us, previousLength)
+        uint64_t value = 0;
+        uint32_t subUs = 0;  // Microseconds into the centisecond shown
+        uint32_t days = 0;
+        unsigned int hours = 0, minutes = 0, seconds = 0, cs = 0;
+        bool withCentiseconds;
+        bool valid = false;
+
+        void convert(uint64_t us) {
+            value = us;
+            uint64_t centiseconds = TimeFormat::divide(us, TimeFormat::US_PER_CS);
+            subUs = (uint32_t) (us - centiseconds * TimeFormat::US_PER_CS);
+            uint32_t rest;
+            days = TimeFormat::splitDays(centiseconds, TimeFormat::CS_PER_DAY, rest);
+            hours = rest / TimeFormat::CS_PER_H;
+            rest -= hours * TimeFormat::CS_PER_H;
+            minutes = rest / TimeFormat::CS_PER_MIN;
+            rest -= minutes * TimeFormat::CS_PER_MIN;
+            seconds = rest / TimeFormat::CS_PER_S;
+            cs = rest - seconds * TimeFormat::CS_PER_S;
+            length = TimeFormat::formatFields(days, hours, minutes, seconds, cs, text, withCentiseconds);
+        }
+
+        // Rewrite the two digits at at; returns the first one that differs
+        size_t update(size_t at, unsigned int field) {
+            char pair[2];
+            TimeFormat::putPair(pair, field);
+            size_t first = pair[0] != text[at] ? at : at + 1;
+            text[at] = pair[0];
+            text[at + 1] = pair[1];
+            return first;
+        }
+};
@@ -0,0 +1,67 @@
+//
+// test_main.cpp
+// Author: Francesco Mecatti
+// On-target unit test of the clock-derived stopwatch (include/Time.h), run with pio test. Time reads FakeClock
+// (include/ClockSource.h), advanced by hand between real vTaskDelay calls: the elapsed time must follow the clock
+// exactly whatever the scheduling, and once stopped nothing may read the clock
+//
+
+#include <unity.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "Time.h"
+
+#define STOPPED_MS  (2500)  // Longer than the display refresh period
+
+// Uneven clock steps, with real delays in between: the count must match the clock, not the wakeups
+static void test_elapsed_follows_clock(void) {
+    static const clock_us_t STEPS[] = {10000, 3000, 250000, 7000, 1000000, 90000};
+    FakeClock::reset();
+    Time::clockSource = FakeClock::now;
+    Time t;
+    ctime_t base = Time::getCentiseconds();
+    t.start();
+    clock_us_t elapsed = 0;
+    for (size_t i = 0; i < sizeof(STEPS) / sizeof(STEPS[0]); i++) {
+        FakeClock::advance(STEPS[i]);
+        elapsed += STEPS[i];
+        vTaskDelay(pdMS_TO_TICKS(30));
+        TEST_ASSERT_EQUAL_UINT32(base + elapsed / Time::US_PER_CS, Time::getCentiseconds());
+    }
+    t.stop();
+    Time::clockSource = espTimerClock;
+}
+
+// Stopped: the value is frozen while the clock runs on, and past the frame showing the stop no task samples the
+// clock; a restart resumes from it
+static void test_stopped_reads_nothing(void) {
+    FakeClock::reset();
+    Time::clockSource = FakeClock::now;
+    Time t;
+    ctime_t base = Time::getCentiseconds();  // Time accumulated by the previous test
+    t.start();
+    FakeClock::advance(1230000);
+    t.stop();
+    ctime_t frozen = Time::getCentiseconds();
+    TEST_ASSERT_EQUAL_UINT32(base + 123, frozen);
+
+    vTaskDelay(pdMS_TO_TICKS(100));  // Room for the display to show the stop
+    unsigned long reads = FakeClock::reads;
+    FakeClock::advance(5000000);
+    vTaskDelay(pdMS_TO_TICKS(STOPPED_MS));
+    TEST_ASSERT_EQUAL_UINT32(reads, FakeClock::reads);
+    TEST_ASSERT_EQUAL_UINT32(frozen, Time::getCentiseconds());
+
+    t.start();
+    FakeClock::advance(770000);
+    TEST_ASSERT_EQUAL_UINT32(base + 200, Time::getCentiseconds());  // The stopped 5 s are not counted
+    t.stop();
+    Time::clockSource = espTimerClock;
+}
+
+extern "C" void app_main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_elapsed_follows_clock);
+    RUN_TEST(test_stopped_reads_nothing);
+    UNITY_END();
+}